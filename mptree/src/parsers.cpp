@@ -46,17 +46,7 @@ bool parse_value(bool & out, const char * value, size_t len)
 
 bool parse_value(double & out, const char * val, size_t len)
 {
-    char buffer[0x40];
-    if(len >= sizeof(buffer))
-        return false;
-    memcpy(buffer, val, len);
-    buffer[len] = 0;
-    char * endptr = 0;
-    double value = strtod(buffer, &endptr);
-    if(*endptr)
-        return false;
-    out = value;
-    return true;
+    return mstd::str2double(val, len, out);
 }
 
 }
@@ -0,0 +1,140 @@
+/*
+** The author disclaims copyright to this source code.  In place of
+** a legal notice, here is a blessing:
+**
+**    May you do good and not evil.
+**    May you find forgiveness for yourself and forgive others.
+**    May you share freely, never taking more than you give.
+*/
+#include <algorithm>
+#include <new>
+
+#include "arena.hpp"
+
+namespace mstd {
+
+namespace {
+
+// Chunk header is padded, so data starts at max_align.
+template<class Chunk>
+size_t header_size()
+{
+    return detail::align_up(sizeof(Chunk), detail::max_align);
+}
+
+}
+
+monotonic_arena::monotonic_arena(size_t chunk, size_t max_chunk)
+    : cursor_(0), end_(0), begin_(0), chunks_(0), buffer_(0), buffer_size_(0),
+      next_chunk_(std::max<size_t>(chunk, 256)), max_chunk_(std::max(max_chunk, next_chunk_)), used_(0)
+{
+}
+
+monotonic_arena::monotonic_arena(void * buffer, size_t size, size_t max_chunk)
+    : cursor_(0), end_(0), begin_(0), chunks_(0), buffer_(static_cast<char*>(buffer)), buffer_size_(size),
+      next_chunk_(std::max<size_t>(size * 2, 256)), max_chunk_(std::max(max_chunk, next_chunk_)), used_(0)
+{
+    start(buffer_, buffer_size_);
+}
+
+monotonic_arena::~monotonic_arena()
+{
+    release();
+}
+
+void monotonic_arena::start(char * begin, size_t size)
+{
+    begin_ = begin;
+    cursor_ = begin;
+    end_ = begin + size;
+}
+
+void * monotonic_arena::allocate_slow(size_t size, size_t align)
+{
+    size_t header = header_size<chunk>();
+    size_t need = header + size + (align > detail::max_align ? align : 0);
+    if(need < size)
+        throw std::bad_alloc();
+
+    chunk * c;
+    if(need > next_chunk_)
+    {
+        // Block larger than regular chunk gets its own chunk, current chunk stays in use.
+        c = static_cast<chunk*>(::operator new(need));
+        c->size = need;
+        c->next = chunks_;
+        chunks_ = c;
+        used_ += size;
+        return reinterpret_cast<char*>(detail::align_up(reinterpret_cast<size_t>(c) + header, align));
+    }
+
+    size_t chunk_size = next_chunk_;
+    c = static_cast<chunk*>(::operator new(chunk_size));
+    c->size = chunk_size;
+    c->next = chunks_;
+    chunks_ = c;
+    next_chunk_ = std::min(next_chunk_ * 2, max_chunk_);
+
+    used_ += cursor_ - begin_;
+    start(reinterpret_cast<char*>(c) + header, chunk_size - header);
+    return allocate(size, align);
+}
+
+void monotonic_arena::reset()
+{
+    chunk * largest = 0;
+    for(chunk * c = chunks_; c; c = c->next)
+        if(!largest || c->size > largest->size)
+            largest = c;
+
+    chunk * c = chunks_;
+    while(c)
+    {
+        chunk * next = c->next;
+        if(c != largest)
+            ::operator delete(c);
+        c = next;
+    }
+
+    used_ = 0;
+    if(largest && largest->size - header_size<chunk>() > buffer_size_)
+    {
+        largest->next = 0;
+        chunks_ = largest;
+        start(reinterpret_cast<char*>(largest) + header_size<chunk>(), largest->size - header_size<chunk>());
+    } else {
+        if(largest)
+            ::operator delete(largest);
+        chunks_ = 0;
+        start(buffer_, buffer_size_);
+    }
+}
+
+void monotonic_arena::release()
+{
+    chunk * c = chunks_;
+    while(c)
+    {
+        chunk * next = c->next;
+        ::operator delete(c);
+        c = next;
+    }
+    chunks_ = 0;
+    used_ = 0;
+    start(buffer_, buffer_size_);
+}
+
+size_t monotonic_arena::used() const
+{
+    return used_ + (cursor_ - begin_);
+}
+
+size_t monotonic_arena::capacity() const
+{
+    size_t result = buffer_size_;
+    for(chunk * c = chunks_; c; c = c->next)
+        result += c->size - header_size<chunk>();
+    return result;
+}
+
+}
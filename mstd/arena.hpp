@@ -0,0 +1,75 @@
+/*
+** The author disclaims copyright to this source code.  In place of
+** a legal notice, here is a blessing:
+**
+**    May you do good and not evil.
+**    May you find forgiveness for yourself and forgive others.
+**    May you share freely, never taking more than you give.
+*/
+#pragma once
+
+#include <boost/noncopyable.hpp>
+
+#include "config.hpp"
+#include "resource_allocator.hpp"
+
+namespace mstd {
+
+// Bump allocator over chunks, chunk size doubles up to max_chunk. Memory is given back all at once by reset,
+// deallocate only returns the most recent allocation, so it is for per-request and per-packet work.
+// Could start from caller buffer, i.e. on stack, that is used until it is exhausted. Not thread safe.
+class MSTD_DECL monotonic_arena : private boost::noncopyable {
+public:
+    explicit monotonic_arena(size_t chunk = 4096, size_t max_chunk = 1 << 20);
+    monotonic_arena(void * buffer, size_t size, size_t max_chunk = 1 << 20);
+    ~monotonic_arena();
+
+    void * allocate(size_t size, size_t align = detail::max_align)
+    {
+        char * result = reinterpret_cast<char*>(detail::align_up(reinterpret_cast<size_t>(cursor_), align));
+        if(result < end_ && size <= static_cast<size_t>(end_ - result))
+        {
+            cursor_ = result + size;
+            return result;
+        }
+        return allocate_slow(size, align);
+    }
+
+    void deallocate(void * ptr, size_t size, size_t = detail::max_align)
+    {
+        if(static_cast<char*>(ptr) + size == cursor_)
+            cursor_ = static_cast<char*>(ptr);
+    }
+
+    // Invalidates all allocated blocks. The largest chunk is kept for reuse, others are freed.
+    void reset();
+
+    // Invalidates all allocated blocks and frees all chunks.
+    void release();
+
+    // Bytes handed out since last reset, including alignment padding.
+    size_t used() const;
+
+    // Bytes of chunks and initial buffer currently owned.
+    size_t capacity() const;
+private:
+    struct chunk {
+        chunk * next;
+        size_t size;
+    };
+
+    void * allocate_slow(size_t size, size_t align);
+    void start(char * begin, size_t size);
+
+    char * cursor_;
+    char * end_;
+    char * begin_;
+    chunk * chunks_;
+    char * buffer_;
+    size_t buffer_size_;
+    size_t next_chunk_;
+    size_t max_chunk_;
+    size_t used_;
+};
+
+}
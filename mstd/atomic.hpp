@@ -146,6 +146,23 @@ public:
         return value_type(atomic_read<sizeof(value_type)>(&this->value_));
     }
 
+    // Reads without full fence, reads that follow it are not moved before it.
+    value_type load_acquire() const
+    {
+        BOOST_STATIC_ASSERT(sizeof(value_type) <= sizeof(void*));
+        value_type result = *static_cast<const volatile value_type*>(&this->value_);
+        detail::acquire_fence();
+        return result;
+    }
+
+    // Writes without full fence, writes that precede it are not moved after it.
+    void store_release(value_type value)
+    {
+        BOOST_STATIC_ASSERT(sizeof(value_type) <= sizeof(void*));
+        detail::release_fence();
+        *static_cast<volatile value_type*>(&this->value_) = value;
+    }
+
     template<class F>
     value_type modify(F f)
     {
@@ -15,7 +15,7 @@
 
 #include "config.hpp"
 
-#include "atomic.hpp"
+#include "seqlock.hpp"
 
 namespace mstd {
 
@@ -26,6 +26,7 @@ protected:
 private:
 };
 
+// Kept for compatibility, it is seqlock with old interface.
 template<class T>
 class atomic_pod : private atomic_pod_base {
 public:
@@ -33,34 +34,19 @@ public:
     BOOST_STATIC_ASSERT((boost::is_pod<T>::value));
 #endif
 
-    explicit atomic_pod()
-        : dirty_flag_(0) {}
+    explicit atomic_pod() {}
 
     T inline get() const
     {
-        while(true)
-        {
-            boost::uint32_t oldFlag = dirty_flag_;
-            T result(value_);
-            if(oldFlag != INVALID_DIRTY_FLAG && oldFlag == dirty_flag_)
-                return result;
-            else
-                yield();
-        }
+        return impl_.load();
     }
 
     void set(const T & t)
     {
-        boost::uint32_t old = dirty_flag_;
-        dirty_flag_ = INVALID_DIRTY_FLAG;
-        value_ = t;
-        dirty_flag_ = old + 2;
+        impl_.store(t);
     }
 private:
-    static const boost::uint32_t INVALID_DIRTY_FLAG = 1;
-
-    atomic<boost::uint32_t> dirty_flag_;
-    T value_;
+    seqlock<T> impl_;
 };
 
 }
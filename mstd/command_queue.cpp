@@ -8,56 +8,256 @@
 */
 #if !defined(_STLP_NO_IOSTREAMS)
 
-#include "reverse_lock.hpp"
+#include <chrono>
+
+#include "pool_allocator.hpp"
+#include "yield_k.hpp"
 
 #include "command_queue.hpp"
 
 namespace mstd {
 
-command_queue::command_queue()
+namespace {
+
+boost::uint64_t now_us()
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Nodes are allocated by producers and freed by consumers, so they come from thread cached pool. Pool is never
+// destroyed, so queues could be destroyed during static destruction in any order.
+thread_cached_pool & node_pool()
 {
-    thread_ = boost::thread(&command_queue::execute, this);
+    static thread_cached_pool * result = new thread_cached_pool;
+    return *result;
+}
+
+}
+
+struct command_queue::node {
+    node * next;
+    unique_command_type command;
+    boost::uint64_t enqueued;
+
+    node(unique_command_type & c, boost::uint64_t time)
+        : next(0), command(std::move(c)), enqueued(time) {}
+
+    static void * operator new(size_t size)
+    {
+        return node_pool().allocate(size);
+    }
+
+    static void operator delete(void * ptr, size_t size)
+    {
+        node_pool().deallocate(ptr, size);
+    }
+};
+
+// Producers push to head_ with cas, consumer takes whole list with exchange and reverses it.
+// Parking is Dekker like: producer pushes and then checks sleeping_, consumer sets sleeping_ and then checks head_,
+// both with full barrier, so at least one of them sees the other and notify is never lost.
+class command_queue::consumer : private boost::noncopyable {
+public:
+    consumer()
+        : head_(0), sleeping_(false), executed_(0), dwell_total_(0), dwell_max_(0), batches_(0) {}
+
+    ~consumer()
+    {
+        size_t count;
+        release(take(count));
+    }
+
+    // Returns true when queue was empty, only such push could find consumer parked.
+    bool push(node * n)
+    {
+        node * old = head_;
+        for(;;)
+        {
+            n->next = old;
+            node * prev = head_.cas(n, old);
+            if(prev == old)
+                return !old;
+            old = prev;
+        }
+    }
+
+    void wake()
+    {
+        if(sleeping_)
+        {
+            boost::lock_guard<boost::mutex> lock(mutex_);
+            cond_.notify_one();
+        }
+    }
+
+    bool empty() const
+    {
+        return !head_;
+    }
+
+    // Returns list in enqueue order.
+    node * take(size_t & count)
+    {
+        node * list = head_.read_write(0);
+        node * result = 0;
+        for(count = 0; list; ++count)
+        {
+            node * next = list->next;
+            list->next = result;
+            result = list;
+            list = next;
+        }
+        return result;
+    }
+
+    void park()
+    {
+        boost::unique_lock<boost::mutex> lock(mutex_);
+        sleeping_.read_write(true);
+        while(!head_)
+            cond_.wait(lock);
+        sleeping_ = false;
+    }
+
+    void update(boost::uint64_t executed, boost::uint64_t dwell_total, boost::uint64_t dwell_max)
+    {
+        executed_ = executed_ + executed;
+        dwell_total_ = dwell_total_ + dwell_total;
+        if(dwell_max > dwell_max_)
+            dwell_max_ = dwell_max;
+        ++batches_;
+    }
+
+    void collect(stats_type & out) const
+    {
+        out.executed += executed_;
+        out.dwell_total_us += dwell_total_;
+        out.dwell_max_us = std::max<boost::uint64_t>(out.dwell_max_us, dwell_max_);
+        out.batches += batches_;
+    }
+
+    void reset_max_dwell()
+    {
+        dwell_max_ = 0;
+    }
+
+    static void release(node * list)
+    {
+        while(list)
+        {
+            node * next = list->next;
+            delete list;
+            list = next;
+        }
+    }
+private:
+    atomic<node*> head_;
+    atomic<bool> sleeping_;
+    boost::mutex mutex_;
+    boost::condition_variable cond_;
+
+    // written only by consumer thread
+    atomic<boost::uint64_t> executed_;
+    atomic<boost::uint64_t> dwell_total_;
+    atomic<boost::uint64_t> dwell_max_;
+    atomic<boost::uint64_t> batches_;
+};
+
+command_queue::command_queue(size_t consumers, size_t spin)
+    : spin_(spin), next_(0), length_(0)
+{
+    consumers = std::max<size_t>(consumers, 1);
+    consumers_.reserve(consumers);
+    for(size_t i = 0; i != consumers; ++i)
+        consumers_.push_back(new consumer);
+    for(size_t i = 0; i != consumers; ++i)
+        threads_.create_thread(std::bind(&command_queue::execute, this, std::ref(*consumers_[i])));
 }
 
 command_queue::~command_queue()
 {
-    thread_.interrupt();
-    thread_.join();
+    threads_.interrupt_all();
+    threads_.join_all();
+    for(std::vector<consumer*>::const_iterator i = consumers_.begin(), end = consumers_.end(); i != end; ++i)
+        delete *i;
+}
+
+void command_queue::enqueue(unique_command_type command)
+{
+    size_t count = consumers_.size();
+    push(*consumers_[count == 1 ? 0 : next_++ % count], command);
+}
+
+void command_queue::enqueue(size_t key, unique_command_type command)
+{
+    push(*consumers_[key % consumers_.size()], command);
 }
 
-void command_queue::enqueue(const command_type & command)
+void command_queue::push(consumer & target, unique_command_type & command)
 {
-    boost::unique_lock<boost::mutex> lock(mutex_);
-    queue_.push_back(command);
-    cond_.notify_one();
+    ++length_;
+    if(target.push(new node(command, now_us())))
+        target.wake();
 }
 
-void command_queue::execute()
+command_queue::stats_type command_queue::stats() const
 {
-    queue_type queue;
+    stats_type result = { length_, 0, 0, 0, 0 };
+    for(std::vector<consumer*>::const_iterator i = consumers_.begin(), end = consumers_.end(); i != end; ++i)
+        (*i)->collect(result);
+    return result;
+}
 
-    boost::unique_lock<boost::mutex> lock(mutex_);
+void command_queue::reset_max_dwell()
+{
+    for(std::vector<consumer*>::const_iterator i = consumers_.begin(), end = consumers_.end(); i != end; ++i)
+        (*i)->reset_max_dwell();
+}
 
+void command_queue::execute(consumer & target)
+{
     while(!boost::this_thread::interruption_requested())
     {
-        try {
-            if(queue_.empty())
-                cond_.wait(lock);
-            else {
-                queue_.swap(queue);
-                reverse_lock<boost::unique_lock<boost::mutex> > rlock(lock);
-                for(queue_type::const_iterator i = queue.begin(), end = queue.end(); i != end; ++i)
-                    try {
-                        (*i)();
-                    } catch(boost::thread_interrupted&) {
-                        return;
-                    } catch(...) {
-                    }
-                queue.clear();
+        size_t count;
+        node * list = target.take(count);
+        if(!list)
+        {
+            for(size_t k = 0; k != spin_ && target.empty(); ++k)
+                yield(k);
+            if(target.empty())
+            {
+                try {
+                    target.park();
+                } catch(boost::thread_interrupted&) {
+                    return;
+                }
+            }
+            continue;
+        }
+
+        length_ -= count;
+        boost::uint64_t taken = now_us();
+        boost::uint64_t executed = 0, dwell_total = 0, dwell_max = 0;
+        while(list)
+        {
+            node * current = list;
+            list = list->next;
+            boost::uint64_t dwell = taken > current->enqueued ? taken - current->enqueued : 0;
+            dwell_total += dwell;
+            dwell_max = std::max(dwell_max, dwell);
+            ++executed;
+            try {
+                current->command();
+            } catch(boost::thread_interrupted&) {
+                delete current;
+                consumer::release(list);
+                target.update(executed, dwell_total, dwell_max);
+                return;
+            } catch(...) {
             }
-        } catch(boost::thread_interrupted&) {
-            return;
+            delete current;
         }
+        target.update(executed, dwell_total, dwell_max);
     }
 }
 
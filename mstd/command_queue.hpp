@@ -8,8 +8,11 @@
 */
 #pragma once
 
+#include <functional>
 #include <vector>
 
+#include <boost/cstdint.hpp>
+#include <boost/noncopyable.hpp>
 #include <boost/scoped_ptr.hpp>
 
 #if defined(_MSC_VER)
@@ -25,38 +28,89 @@
 
 #include <boost/thread/thread.hpp>
 
+#include "atomic.hpp"
 #include "singleton.hpp"
+#include "unique_function.hpp"
 
 namespace mstd {
 
-class MSTD_DECL command_queue {
+// Commands are executed by consumers threads, every consumer has own lock free queue, producers push commands
+// to it with one cas and consumer takes all pending commands at once.
+// Commands enqueued with the same key are executed by the same consumer in enqueue order, commands without key
+// are distributed round robin, so with single consumer all commands are executed in enqueue order.
+// Idle consumer calls yield(k) spin times before it parks on condition variable.
+// Commands are stored as unique_function in nodes from thread_cached_pool, so lambda that captures few pointers
+// is enqueued without heap allocation. std::function and move only callables are accepted as well.
+class MSTD_DECL command_queue : private boost::noncopyable {
 public:
     typedef std::function<void()> command_type;
-
-    command_queue();
+    typedef unique_function<void()> unique_command_type;
+
+    struct stats_type {
+        // enqueued and not yet taken by consumer commands
+        size_t length;
+        boost::uint64_t executed;
+        // time from enqueue until consumer took batch with command
+        boost::uint64_t dwell_total_us;
+        boost::uint64_t dwell_max_us;
+        boost::uint64_t batches;
+    };
+
+    explicit command_queue(size_t consumers = 1, size_t spin = 0);
     ~command_queue();
 
-    void enqueue(const command_type & command);
+    void enqueue(unique_command_type command);
+    void enqueue(size_t key, unique_command_type command);
+
+    size_t consumers() const
+    {
+        return consumers_.size();
+    }
+
+    stats_type stats() const;
+    // Resets dwell time maximum, so it could be exported per interval.
+    void reset_max_dwell();
 private:
-    void execute();
+    class consumer;
+    struct node;
 
-    typedef std::vector<command_type> queue_type;
+    void push(consumer & target, unique_command_type & command);
+    void execute(consumer & target);
 
-    boost::mutex              mutex_;
-    boost::condition_variable cond_;
-    boost::thread             thread_;
-    queue_type                queue_;
+    std::vector<consumer*> consumers_;
+    boost::thread_group    threads_;
+    size_t                 spin_;
+    atomic<size_t>         next_;
+    atomic<size_t>         length_;
+};
+
+// Specialize to configure queue of tag.
+template<class Tag>
+struct command_queue_traits {
+    static size_t consumers() { return 1; }
+    static size_t spin() { return 0; }
 };
 
 template<class Tag>
 class tagged_command_queue : public mstd::singleton<tagged_command_queue<Tag> > {
 public:
-    void enqueue(const command_queue::command_type & command)
+    void enqueue(command_queue::unique_command_type command)
+    {
+        impl_.enqueue(std::move(command));
+    }
+
+    void enqueue(size_t key, command_queue::unique_command_type command)
+    {
+        impl_.enqueue(key, std::move(command));
+    }
+
+    command_queue::stats_type stats() const
     {
-        impl_.enqueue(command);
+        return impl_.stats();
     }
 private:
-    tagged_command_queue() {}
+    tagged_command_queue()
+        : impl_(command_queue_traits<Tag>::consumers(), command_queue_traits<Tag>::spin()) {}
 
     command_queue impl_;
 
@@ -64,16 +118,22 @@ private:
 };
 
 template<class Tag>
-void enqueue(const command_queue::command_type & command)
+void enqueue(command_queue::unique_command_type command)
+{
+    tagged_command_queue<Tag>::instance().enqueue(std::move(command));
+}
+
+template<class Tag>
+void enqueue(size_t key, command_queue::unique_command_type command)
 {
-    tagged_command_queue<Tag>::instance().enqueue(command);
+    tagged_command_queue<Tag>::instance().enqueue(key, std::move(command));
 }
 
 class default_enqueue_tag;
 
-inline void default_enqueue(const command_queue::command_type & command)
+inline void default_enqueue(command_queue::unique_command_type command)
 {
-    enqueue<default_enqueue_tag>(command);
+    enqueue<default_enqueue_tag>(std::move(command));
 }
 
 }
@@ -36,6 +36,16 @@ struct atomic_helper {
 
 inline void memory_fence() { __sync_synchronize(); }
 
+// Loads before acquire_fence are not moved after loads following it, stores before release_fence are not moved
+// after stores following it. x86 keeps such order itself, so only compiler should be stopped.
+#if defined(__i386__) || defined(__x86_64__)
+inline void acquire_fence() { __asm__ __volatile__("" : : : "memory"); }
+inline void release_fence() { __asm__ __volatile__("" : : : "memory"); }
+#else
+inline void acquire_fence() { __sync_synchronize(); }
+inline void release_fence() { __sync_synchronize(); }
+#endif
+
 template<size_t size>
 inline typename size_to_int<size>::type atomic_read(const volatile void * ptr)
 {
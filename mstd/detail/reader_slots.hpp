@@ -0,0 +1,59 @@
+/*
+** The author disclaims copyright to this source code.  In place of
+** a legal notice, here is a blessing:
+**
+**    May you do good and not evil.
+**    May you find forgiveness for yourself and forgive others.
+**    May you share freely, never taking more than you give.
+*/
+#pragma once
+
+#include "../atomic.hpp"
+#include "../threads.hpp"
+
+namespace mstd { namespace detail {
+
+const size_t cache_line_size = 64;
+const size_t reader_slots_bits = 6;
+const size_t reader_slots_count = 1 << reader_slots_bits;
+
+// Reader counters of one group of threads, each group has its own cache line, so readers of different groups
+// do not bounce lines between cores.
+template<size_t Counters>
+struct reader_slot {
+    atomic<size_t> counters[Counters];
+    char padding[cache_line_size - Counters * sizeof(atomic<size_t>)];
+};
+
+template<size_t Counters>
+class reader_slots {
+public:
+    typedef reader_slot<Counters> slot_type;
+
+    reader_slots()
+    {
+        for(size_t i = 0; i != reader_slots_count; ++i)
+            for(size_t j = 0; j != Counters; ++j)
+                slots_[i].counters[j] = 0;
+    }
+
+    // Slot is chosen by thread, not by cpu, so thread that migrated while holding lock releases the same slot,
+    // and no thread local storage is required. With more slots than cores threads rarely share slot.
+    slot_type & current()
+    {
+        boost::uint64_t id = static_cast<boost::uint64_t>(this_thread_id());
+        return slots_[static_cast<size_t>((id * 0x9e3779b97f4a7c15ULL) >> (64 - reader_slots_bits))];
+    }
+
+    bool empty(size_t counter) const
+    {
+        for(size_t i = 0; i != reader_slots_count; ++i)
+            if(slots_[i].counters[counter].load_acquire())
+                return false;
+        return true;
+    }
+private:
+    slot_type slots_[reader_slots_count];
+};
+
+} }
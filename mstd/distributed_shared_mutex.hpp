@@ -0,0 +1,90 @@
+/*
+** The author disclaims copyright to this source code.  In place of
+** a legal notice, here is a blessing:
+**
+**    May you do good and not evil.
+**    May you find forgiveness for yourself and forgive others.
+**    May you share freely, never taking more than you give.
+*/
+#pragma once
+
+#include <boost/noncopyable.hpp>
+
+#include <boost/thread/locks.hpp>
+
+#include "detail/reader_slots.hpp"
+
+namespace mstd {
+
+// Reader biased shared mutex. Reader increments counter in its own cache line and checks writer flag,
+// that is written only by writers, so readers that never conflict do not share written memory.
+// Writer sets the flag, so new readers back off, and waits until counters of all slots are zero.
+// Writers are preferred, continuous stream of readers could not starve them. Sized for rare writers:
+// mutex takes 4KB, and lock() scans all slots.
+class distributed_shared_mutex : private boost::noncopyable {
+public:
+    typedef boost::unique_lock<distributed_shared_mutex> unique_lock;
+    typedef boost::shared_lock<distributed_shared_mutex> shared_lock;
+
+    distributed_shared_mutex()
+        : writer_(0) {}
+
+    void lock()
+    {
+        for(size_t k = 0; writer_.cas(1, 0) != 0; ++k)
+            yield(k);
+        for(size_t k = 0; !readers_.empty(0); ++k)
+            yield(k);
+    }
+
+    bool try_lock()
+    {
+        if(writer_.cas(1, 0) != 0)
+            return false;
+        if(readers_.empty(0))
+            return true;
+        writer_ = 0;
+        return false;
+    }
+
+    void unlock()
+    {
+        writer_ = 0;
+    }
+
+    void lock_shared()
+    {
+        atomic<size_t> & counter = readers_.current().counters[0];
+        for(;;)
+        {
+            // increment is full fence, so writer either sees it or it is seen by us
+            ++counter;
+            if(!writer_.load_acquire())
+                return;
+            --counter;
+            for(size_t k = 0; writer_.load_acquire(); ++k)
+                yield(k);
+        }
+    }
+
+    bool try_lock_shared()
+    {
+        atomic<size_t> & counter = readers_.current().counters[0];
+        ++counter;
+        if(!writer_.load_acquire())
+            return true;
+        --counter;
+        return false;
+    }
+
+    void unlock_shared()
+    {
+        --readers_.current().counters[0];
+    }
+private:
+    detail::reader_slots<1> readers_;
+    char padding_[detail::cache_line_size];
+    atomic<boost::uint32_t> writer_;
+};
+
+}
@@ -0,0 +1,609 @@
+/*
+** The author disclaims copyright to this source code.  In place of
+** a legal notice, here is a blessing:
+**
+**    May you do good and not evil.
+**    May you find forgiveness for yourself and forgive others.
+**    May you share freely, never taking more than you give.
+*/
+#pragma once
+
+#include <string.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <iterator>
+#include <new>
+#include <string>
+#include <utility>
+
+#include <boost/cstdint.hpp>
+#include <boost/functional/hash.hpp>
+#include <boost/range/begin.hpp>
+#include <boost/range/end.hpp>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define MSTD_FLAT_SSE2 1
+#include <emmintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#endif
+
+namespace mstd {
+
+namespace detail {
+
+typedef signed char flat_ctrl;
+
+// Control byte of every slot, full slots keep 7 low bits of hash.
+const flat_ctrl flat_empty = -128;
+const flat_ctrl flat_deleted = -2;
+const size_t flat_group_width = 16;
+
+inline unsigned flat_lowest_bit(unsigned mask)
+{
+#if defined(_MSC_VER)
+    unsigned long result;
+    _BitScanForward(&result, mask);
+    return result;
+#else
+    return __builtin_ctz(mask);
+#endif
+}
+
+// 16 control bytes, every match returns bit mask of matching slots.
+class flat_group {
+public:
+    explicit flat_group(const flat_ctrl * ctrl)
+#if MSTD_FLAT_SSE2
+        : ctrl_(_mm_loadu_si128(static_cast<const __m128i*>(static_cast<const void*>(ctrl))))
+#else
+        : ctrl_(ctrl)
+#endif
+    {
+    }
+
+    unsigned match(flat_ctrl h2) const
+    {
+#if MSTD_FLAT_SSE2
+        return static_cast<unsigned>(_mm_movemask_epi8(_mm_cmpeq_epi8(ctrl_, _mm_set1_epi8(h2))));
+#else
+        unsigned result = 0;
+        for(size_t i = 0; i != flat_group_width; ++i)
+            result |= static_cast<unsigned>(ctrl_[i] == h2) << i;
+        return result;
+#endif
+    }
+
+    unsigned match_empty() const
+    {
+        return match(flat_empty);
+    }
+
+    unsigned match_empty_or_deleted() const
+    {
+#if MSTD_FLAT_SSE2
+        return static_cast<unsigned>(_mm_movemask_epi8(ctrl_));
+#else
+        unsigned result = 0;
+        for(size_t i = 0; i != flat_group_width; ++i)
+            result |= static_cast<unsigned>(ctrl_[i] < 0) << i;
+        return result;
+#endif
+    }
+private:
+#if MSTD_FLAT_SSE2
+    __m128i ctrl_;
+#else
+    const flat_ctrl * ctrl_;
+#endif
+};
+
+// boost::hash of integers is identity, while probing uses both high and low bits.
+inline size_t flat_mix(size_t h)
+{
+#if defined(_WIN64) || defined(__LP64__) || defined(__x86_64__)
+    boost::uint64_t x = h;
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    return static_cast<size_t>(x);
+#else
+    boost::uint32_t x = static_cast<boost::uint32_t>(h);
+    x ^= x >> 16;
+    x *= 0x85ebca6bU;
+    x ^= x >> 13;
+    return x;
+#endif
+}
+
+template<class Value, class Slot, class Ctrl>
+class flat_hash_map_iterator {
+public:
+    typedef std::forward_iterator_tag iterator_category;
+    typedef Value value_type;
+    typedef std::ptrdiff_t difference_type;
+    typedef Value * pointer;
+    typedef Value & reference;
+
+    flat_hash_map_iterator()
+        : ctrl_(0), slot_(0) {}
+
+    flat_hash_map_iterator(Ctrl * ctrl, Slot * slot)
+        : ctrl_(ctrl), slot_(slot)
+    {
+    }
+
+    template<class V2, class S2, class C2>
+    flat_hash_map_iterator(const flat_hash_map_iterator<V2, S2, C2> & rhs)
+        : ctrl_(rhs.ctrl()), slot_(rhs.slot()) {}
+
+    Value & operator*() const
+    {
+        return *slot_;
+    }
+
+    Value * operator->() const
+    {
+        return slot_;
+    }
+
+    flat_hash_map_iterator & operator++()
+    {
+        ++ctrl_;
+        ++slot_;
+        skip();
+        return *this;
+    }
+
+    flat_hash_map_iterator operator++(int)
+    {
+        flat_hash_map_iterator result = *this;
+        ++*this;
+        return result;
+    }
+
+    // Moves to the first full slot, table ends with one full sentinel byte.
+    void skip()
+    {
+        while(*ctrl_ < 0)
+        {
+            ++ctrl_;
+            ++slot_;
+        }
+    }
+
+    Ctrl * ctrl() const
+    {
+        return ctrl_;
+    }
+
+    Slot * slot() const
+    {
+        return slot_;
+    }
+private:
+    Ctrl * ctrl_;
+    Slot * slot_;
+};
+
+template<class V1, class S1, class C1, class V2, class S2, class C2>
+bool operator==(const flat_hash_map_iterator<V1, S1, C1> & lhs, const flat_hash_map_iterator<V2, S2, C2> & rhs)
+{
+    return lhs.slot() == rhs.slot();
+}
+
+template<class V1, class S1, class C1, class V2, class S2, class C2>
+bool operator!=(const flat_hash_map_iterator<V1, S1, C1> & lhs, const flat_hash_map_iterator<V2, S2, C2> & rhs)
+{
+    return lhs.slot() != rhs.slot();
+}
+
+}
+
+template<class Key>
+struct flat_hash {
+    size_t operator()(const Key & key) const
+    {
+        return detail::flat_mix(boost::hash<Key>()(key));
+    }
+};
+
+// Strings are hashed as char ranges, so lookup by const char * or string_ref does not build std::string.
+template<class Ch, class Tr, class A>
+struct flat_hash<std::basic_string<Ch, Tr, A> > {
+    template<class Range>
+    size_t operator()(const Range & range) const
+    {
+        return detail::flat_mix(boost::hash_range(boost::begin(range), boost::end(range)));
+    }
+
+    size_t operator()(const Ch * str) const
+    {
+        return detail::flat_mix(boost::hash_range(str, str + Tr::length(str)));
+    }
+
+    template<size_t N>
+    size_t operator()(const Ch (&str)[N]) const
+    {
+        return operator()(static_cast<const Ch*>(str));
+    }
+};
+
+struct flat_equal {
+    template<class Lhs, class Rhs>
+    bool operator()(const Lhs & lhs, const Rhs & rhs) const
+    {
+        return lhs == rhs;
+    }
+};
+
+// Open addressing hash map with SwissTable like layout: slots are kept in one array, with array of control bytes,
+// where every full slot keeps 7 bits of its hash. Lookup compares 16 control bytes at once and touches slots
+// only for matching bytes. Groups are probed quadratically, load factor is at most 7/8.
+//
+// Interface follows mstd::hash_map<Key, Value>::type: insert(value_type) returns pair<iterator, bool>,
+// find, count and erase accept any key that Hash and Equal accept.
+// Unlike node based maps, insert could move elements, so iterators and pointers to elements are invalidated
+// by insert that grows table.
+template<class Key, class Value, class Hash = flat_hash<Key>, class Equal = flat_equal>
+class flat_hash_map {
+public:
+    typedef Key key_type;
+    typedef Value mapped_type;
+    typedef std::pair<const Key, Value> value_type;
+    typedef Hash hasher;
+    typedef Equal key_equal;
+    typedef detail::flat_hash_map_iterator<value_type, value_type, const detail::flat_ctrl> iterator;
+    typedef detail::flat_hash_map_iterator<const value_type, const value_type, const detail::flat_ctrl> const_iterator;
+
+    explicit flat_hash_map(const Hash & hash = Hash(), const Equal & equal = Equal())
+        : ctrl_(empty_group()), slots_(0), capacity_(0), size_(0), growth_left_(0), hash_(hash), equal_(equal)
+    {
+    }
+
+    flat_hash_map(const flat_hash_map & rhs)
+        : ctrl_(empty_group()), slots_(0), capacity_(0), size_(0), growth_left_(0), hash_(rhs.hash_), equal_(rhs.equal_)
+    {
+        reserve(rhs.size());
+        for(const_iterator i = rhs.begin(), end = rhs.end(); i != end; ++i)
+            insert_unique(hash_(i->first), *i);
+    }
+
+    ~flat_hash_map()
+    {
+        destroy();
+    }
+
+    flat_hash_map & operator=(const flat_hash_map & rhs)
+    {
+        if(this != &rhs)
+        {
+            flat_hash_map temp(rhs);
+            swap(temp);
+        }
+        return *this;
+    }
+
+    void swap(flat_hash_map & rhs)
+    {
+        std::swap(ctrl_, rhs.ctrl_);
+        std::swap(slots_, rhs.slots_);
+        std::swap(capacity_, rhs.capacity_);
+        std::swap(size_, rhs.size_);
+        std::swap(growth_left_, rhs.growth_left_);
+        std::swap(hash_, rhs.hash_);
+        std::swap(equal_, rhs.equal_);
+    }
+
+    size_t size() const
+    {
+        return size_;
+    }
+
+    bool empty() const
+    {
+        return !size_;
+    }
+
+    size_t bucket_count() const
+    {
+        return capacity_;
+    }
+
+    iterator begin()
+    {
+        if(!capacity_)
+            return end();
+        iterator result(ctrl_, slots_);
+        result.skip();
+        return result;
+    }
+
+    iterator end()
+    {
+        return iterator(ctrl_ + capacity_, slots_ + capacity_);
+    }
+
+    const_iterator begin() const
+    {
+        if(!capacity_)
+            return end();
+        const_iterator result(ctrl_, slots_);
+        result.skip();
+        return result;
+    }
+
+    const_iterator end() const
+    {
+        return const_iterator(ctrl_ + capacity_, slots_ + capacity_);
+    }
+
+    template<class K>
+    iterator find(const K & key)
+    {
+        size_t index = find_index(key, hash_(key));
+        return index == npos ? end() : at(index);
+    }
+
+    template<class K>
+    const_iterator find(const K & key) const
+    {
+        size_t index = find_index(key, hash_(key));
+        return index == npos ? end() : const_iterator(ctrl_ + index, slots_ + index);
+    }
+
+    template<class K>
+    size_t count(const K & key) const
+    {
+        return find_index(key, hash_(key)) != npos ? 1 : 0;
+    }
+
+    std::pair<iterator, bool> insert(const value_type & value)
+    {
+        size_t hash = hash_(value.first);
+        size_t index = find_index(value.first, hash);
+        if(index != npos)
+            return std::pair<iterator, bool>(at(index), false);
+        return std::pair<iterator, bool>(at(insert_unique(hash, value)), true);
+    }
+
+    std::pair<iterator, bool> insert(value_type && value)
+    {
+        size_t hash = hash_(value.first);
+        size_t index = find_index(value.first, hash);
+        if(index != npos)
+            return std::pair<iterator, bool>(at(index), false);
+        return std::pair<iterator, bool>(at(insert_unique(hash, std::move(value))), true);
+    }
+
+    template<class... Args>
+    std::pair<iterator, bool> emplace(Args &&... args)
+    {
+        return insert(value_type(std::forward<Args>(args)...));
+    }
+
+    mapped_type & operator[](const key_type & key)
+    {
+        size_t hash = hash_(key);
+        size_t index = find_index(key, hash);
+        if(index == npos)
+            index = insert_unique(hash, value_type(key, mapped_type()));
+        return slots_[index].second;
+    }
+
+    template<class K>
+    size_t erase(const K & key)
+    {
+        size_t index = find_index(key, hash_(key));
+        if(index == npos)
+            return 0;
+        erase_index(index);
+        return 1;
+    }
+
+    iterator erase(iterator i)
+    {
+        size_t index = i.slot() - slots_;
+        erase_index(index);
+        ++i;
+        return i;
+    }
+
+    void clear()
+    {
+        destroy();
+        ctrl_ = empty_group();
+        slots_ = 0;
+        capacity_ = size_ = growth_left_ = 0;
+    }
+
+    void reserve(size_t count)
+    {
+        size_t capacity = capacity_ ? capacity_ : detail::flat_group_width;
+        while(max_load(capacity) < count)
+            capacity *= 2;
+        if(capacity > capacity_)
+            rehash(capacity);
+    }
+private:
+    static const size_t npos = static_cast<size_t>(-1);
+
+    static detail::flat_ctrl * empty_group()
+    {
+        // group of empty slots followed by sentinel, so empty map needs no allocation
+        static detail::flat_ctrl result[detail::flat_group_width + 1] = {
+            detail::flat_empty, detail::flat_empty, detail::flat_empty, detail::flat_empty,
+            detail::flat_empty, detail::flat_empty, detail::flat_empty, detail::flat_empty,
+            detail::flat_empty, detail::flat_empty, detail::flat_empty, detail::flat_empty,
+            detail::flat_empty, detail::flat_empty, detail::flat_empty, detail::flat_empty,
+            0
+        };
+        return result;
+    }
+
+    static size_t max_load(size_t capacity)
+    {
+        return capacity - capacity / 8;
+    }
+
+    static detail::flat_ctrl h2(size_t hash)
+    {
+        return static_cast<detail::flat_ctrl>(hash & 0x7f);
+    }
+
+    size_t groups_mask() const
+    {
+        return capacity_ ? capacity_ / detail::flat_group_width - 1 : 0;
+    }
+
+    iterator at(size_t index)
+    {
+        return iterator(ctrl_ + index, slots_ + index);
+    }
+
+    template<class K>
+    size_t find_index(const K & key, size_t hash) const
+    {
+        size_t mask = groups_mask();
+        size_t group = (hash >> 7) & mask;
+        detail::flat_ctrl tag = h2(hash);
+        for(size_t step = 0;;)
+        {
+            size_t base = group * detail::flat_group_width;
+            detail::flat_group g(ctrl_ + base);
+            for(unsigned match = g.match(tag); match; match &= match - 1)
+            {
+                size_t index = base + detail::flat_lowest_bit(match);
+                if(equal_(slots_[index].first, key))
+                    return index;
+            }
+            if(g.match_empty())
+                return npos;
+            group = (group + ++step) & mask;
+        }
+    }
+
+    size_t find_free(size_t hash) const
+    {
+        size_t mask = groups_mask();
+        size_t group = (hash >> 7) & mask;
+        for(size_t step = 0;;)
+        {
+            size_t base = group * detail::flat_group_width;
+            unsigned match = detail::flat_group(ctrl_ + base).match_empty_or_deleted();
+            if(match)
+                return base + detail::flat_lowest_bit(match);
+            group = (group + ++step) & mask;
+        }
+    }
+
+    // Key should not be present.
+    template<class V>
+    size_t insert_unique(size_t hash, V && value)
+    {
+        size_t index = capacity_ ? find_free(hash) : npos;
+        if(index == npos || (!growth_left_ && ctrl_[index] == detail::flat_empty))
+        {
+            // table full of tombstones is cleaned without growth
+            rehash(size_ * 2 < max_load(capacity_) ? std::max(capacity_, detail::flat_group_width) : std::max(capacity_ * 2, detail::flat_group_width));
+            index = find_free(hash);
+        }
+        new (slots_ + index) value_type(std::forward<V>(value));
+        if(ctrl_[index] == detail::flat_empty)
+            --growth_left_;
+        ctrl_[index] = h2(hash);
+        ++size_;
+        return index;
+    }
+
+    void erase_index(size_t index)
+    {
+        slots_[index].~value_type();
+        --size_;
+        // probing goes by aligned groups, so when group still has empty slot, every probe stops in it anyway
+        size_t base = index & ~(detail::flat_group_width - 1);
+        if(detail::flat_group(ctrl_ + base).match_empty())
+        {
+            ctrl_[index] = detail::flat_empty;
+            ++growth_left_;
+        } else
+            ctrl_[index] = detail::flat_deleted;
+    }
+
+    // Elements are moved only when move cannot throw or they could not be copied, otherwise they are copied.
+    // So when transfer of element throws, new table is destroyed and old table is kept intact, except for
+    // move only elements with throwing move.
+    void rehash(size_t capacity)
+    {
+        detail::flat_ctrl * old_ctrl = ctrl_;
+        value_type * old_slots = slots_;
+        size_t old_capacity = capacity_;
+        size_t old_growth_left = growth_left_;
+
+        detail::flat_ctrl * ctrl = new detail::flat_ctrl[capacity + 1];
+        value_type * slots;
+        try {
+            slots = static_cast<value_type*>(::operator new(capacity * sizeof(value_type)));
+        } catch(...) {
+            delete [] ctrl;
+            throw;
+        }
+        memset(ctrl, detail::flat_empty, capacity);
+        ctrl[capacity] = 0;
+
+        ctrl_ = ctrl;
+        slots_ = slots;
+        capacity_ = capacity;
+        growth_left_ = max_load(capacity) - size_;
+
+        try {
+            for(size_t i = 0; i != old_capacity; ++i)
+                if(old_ctrl[i] >= 0)
+                {
+                    size_t hash = hash_(old_slots[i].first);
+                    size_t index = find_free(hash);
+                    new (slots_ + index) value_type(std::move_if_noexcept(old_slots[i]));
+                    ctrl_[index] = h2(hash);
+                }
+        } catch(...) {
+            destroy();
+            ctrl_ = old_ctrl;
+            slots_ = old_slots;
+            capacity_ = old_capacity;
+            growth_left_ = old_growth_left;
+            throw;
+        }
+
+        if(old_capacity)
+        {
+            for(size_t i = 0; i != old_capacity; ++i)
+                if(old_ctrl[i] >= 0)
+                    old_slots[i].~value_type();
+            delete [] old_ctrl;
+            ::operator delete(old_slots);
+        }
+    }
+
+    void destroy()
+    {
+        if(!capacity_)
+            return;
+        for(size_t i = 0; i != capacity_; ++i)
+            if(ctrl_[i] >= 0)
+                slots_[i].~value_type();
+        delete [] ctrl_;
+        ::operator delete(slots_);
+    }
+
+    detail::flat_ctrl * ctrl_;
+    value_type * slots_;
+    size_t capacity_;
+    size_t size_;
+    size_t growth_left_;
+    Hash hash_;
+    Equal equal_;
+};
+
+}
@@ -12,6 +12,8 @@
 #include <boost/multi_index/hashed_index.hpp>
 #include <boost/multi_index/member.hpp>
 
+#include "flat_hash_map.hpp"
+
 namespace mstd {
 
 template<class Key, class Value>
@@ -25,6 +27,8 @@ struct hash_map {
                 >
             >
         > type;
+    // Same interface without node per element, see flat_hash_map for iterator invalidation rules.
+    typedef flat_hash_map<Key, Value> flat;
 };
 
 template<class Key, class Value>
@@ -6,6 +6,10 @@
 **    May you find forgiveness for yourself and forgive others.
 **    May you share freely, never taking more than you give.
 */
+#include <float.h>
+#include <stdlib.h>
+
+#include <string>
 #include <vector>
 
 #include "itoa.hpp"
@@ -13,23 +17,446 @@
 namespace mstd {
 
 namespace detail {
-const char * initBlocks()
+
+MSTD_DECL const char * const digitPairs =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+}
+
+MSTD_DECL const char * const hex_table = "0123456789abcdef";
+
+namespace {
+
+// Double formatting is Grisu2 by Florian Loitsch: value with its boundaries is scaled by cached power of ten,
+// and digits are generated until they are inside boundaries, so result is read back to the same double.
+
+const boost::uint64_t significandMask = 0x000fffffffffffffULL;
+const boost::uint64_t hiddenBit = 0x0010000000000000ULL;
+const int exponentBias = 0x3ff + 52;
+
+struct diy_fp {
+    boost::uint64_t f;
+    int e;
+
+    diy_fp() {}
+
+    diy_fp(boost::uint64_t ff, int ee)
+        : f(ff), e(ee) {}
+
+    explicit diy_fp(double value)
+    {
+        boost::uint64_t bits;
+        memcpy(&bits, &value, sizeof(bits));
+        int biased = static_cast<int>((bits >> 52) & 0x7ff);
+        f = bits & significandMask;
+        if(biased)
+        {
+            f += hiddenBit;
+            e = biased - exponentBias;
+        } else
+            e = 1 - exponentBias;
+    }
+
+    diy_fp operator-(const diy_fp & rhs) const
+    {
+        return diy_fp(f - rhs.f, e);
+    }
+
+    // Upper half of 128 bit product, rounded.
+    diy_fp operator*(const diy_fp & rhs) const
+    {
+        const boost::uint64_t mask = 0xffffffff;
+        boost::uint64_t a = f >> 32, b = f & mask, c = rhs.f >> 32, d = rhs.f & mask;
+        boost::uint64_t ac = a * c, bc = b * c, ad = a * d, bd = b * d;
+        boost::uint64_t temp = (bd >> 32) + (ad & mask) + (bc & mask) + (1U << 31);
+        return diy_fp(ac + (ad >> 32) + (bc >> 32) + (temp >> 32), e + rhs.e + 64);
+    }
+
+    diy_fp normalize() const
+    {
+        diy_fp result = *this;
+        while(!(result.f & (hiddenBit << 11)))
+        {
+            result.f <<= 1;
+            --result.e;
+        }
+        return result;
+    }
+
+    void boundaries(diy_fp & minus, diy_fp & plus) const
+    {
+        plus = diy_fp((f << 1) + 1, e - 1).normalize();
+        minus = f == hiddenBit ? diy_fp((f << 2) - 1, e - 2) : diy_fp((f << 1) - 1, e - 1);
+        minus.f <<= minus.e - plus.e;
+        minus.e = plus.e;
+    }
+};
+
+const int cachedPowersMin = -348;
+const int cachedPowersStep = 8;
+const size_t cachedPowersCount = 87;
+
+// Little endian 32 bit limbs, only what is needed to compute powers of ten.
+class bignum {
+public:
+    explicit bignum(size_t bit)
+        : limbs_(bit / 32 + 1)
+    {
+        limbs_[bit / 32] = 1U << (bit % 32);
+    }
+
+    void multiply10()
+    {
+        boost::uint64_t carry = 0;
+        for(size_t i = 0; i != limbs_.size(); ++i)
+        {
+            carry += static_cast<boost::uint64_t>(limbs_[i]) * 10;
+            limbs_[i] = static_cast<boost::uint32_t>(carry);
+            carry >>= 32;
+        }
+        if(carry)
+            limbs_.push_back(static_cast<boost::uint32_t>(carry));
+    }
+
+    void divide10()
+    {
+        boost::uint64_t rest = 0;
+        for(size_t i = limbs_.size(); i-- != 0;)
+        {
+            rest = (rest << 32) | limbs_[i];
+            limbs_[i] = static_cast<boost::uint32_t>(rest / 10);
+            rest %= 10;
+        }
+    }
+
+    // Rounded upper 64 bits, exponent is for value * 2^exponent.
+    diy_fp upper() const
+    {
+        size_t length = bits();
+        boost::uint64_t f = 0;
+        for(size_t i = 0; i != 64; ++i)
+            f = (f << 1) | (i < length ? bit(length - 1 - i) : 0);
+        int e = static_cast<int>(length) - 64;
+        if(length > 64 && bit(length - 65) && !++f)
+        {
+            f = 1ULL << 63;
+            ++e;
+        }
+        return diy_fp(f, e);
+    }
+private:
+    size_t bits() const
+    {
+        size_t top = limbs_.size() - 1;
+        while(top && !limbs_[top])
+            --top;
+        size_t result = top * 32;
+        for(boost::uint32_t limb = limbs_[top]; limb; limb >>= 1)
+            ++result;
+        return result;
+    }
+
+    unsigned bit(size_t index) const
+    {
+        return (limbs_[index / 32] >> (index % 32)) & 1;
+    }
+
+    std::vector<boost::uint32_t> limbs_;
+};
+
+// Normalized 10^(cachedPowersMin + i * cachedPowersStep), computed once instead of keeping table of constants.
+const diy_fp * initCachedPowers()
 {
-    static std::vector<char> result(blockLen * blockPow);
-    for(size_t i = 0; i != blockPow; ++i)
+    static diy_fp result[cachedPowersCount];
+    const size_t shift = 1300;
+    bignum negative(shift);
+    for(int k = 1; k <= -cachedPowersMin; ++k)
     {
-        result[i * blockLen] = '0' + i % 10;
-        result[i * blockLen + 1] = '0' + (i /   10) % 10;
-        result[i * blockLen + 2] = '0' + (i /  100) % 10;
-        result[i * blockLen + 3] = '0' + (i / 1000) % 10;
+        negative.divide10();
+        if((cachedPowersMin + k) % cachedPowersStep == 0)
+        {
+            diy_fp value = negative.upper();
+            value.e -= static_cast<int>(shift);
+            result[(-k - cachedPowersMin) / cachedPowersStep] = value;
+        }
     }
-    return &result[0];
+    bignum positive(0);
+    for(int k = 1; k <= cachedPowersMin + static_cast<int>(cachedPowersCount - 1) * cachedPowersStep; ++k)
+    {
+        positive.multiply10();
+        if((k - cachedPowersMin) % cachedPowersStep == 0)
+            result[(k - cachedPowersMin) / cachedPowersStep] = positive.upper();
+    }
+    return result;
 }
 
-MSTD_DECL const char * const digitBlocks = initBlocks();
+const boost::uint64_t pow10[] = {
+    1ULL, 10ULL, 100ULL, 1000ULL, 10000ULL, 100000ULL, 1000000ULL, 10000000ULL, 100000000ULL, 1000000000ULL,
+    10000000000ULL, 100000000000ULL, 1000000000000ULL, 10000000000000ULL, 100000000000000ULL,
+    1000000000000000ULL, 10000000000000000ULL, 100000000000000000ULL, 1000000000000000000ULL,
+    10000000000000000000ULL
+};
 
+// Power with binary exponent that brings e into [-60, -32], k gets negated decimal exponent of it.
+diy_fp cachedPower(int e, int & k)
+{
+    double dk = (-61 - e) * 0.30102999566398114 + 347;
+    int ik = static_cast<int>(dk);
+    if(dk - ik > 0.0)
+        ++ik;
+    size_t index = static_cast<size_t>((ik >> 3) + 1);
+    k = -(cachedPowersMin + static_cast<int>(index) * cachedPowersStep);
+    static const diy_fp * const powers = initCachedPowers();
+    return powers[index];
 }
 
-MSTD_DECL const char * const hex_table = "0123456789abcdef";
+void grisuRound(char * buffer, int length, boost::uint64_t delta, boost::uint64_t rest, boost::uint64_t tenKappa, boost::uint64_t distance)
+{
+    while(rest < distance && delta - rest >= tenKappa && (rest + tenKappa < distance || distance - rest > rest + tenKappa - distance))
+    {
+        --buffer[length - 1];
+        rest += tenKappa;
+    }
+}
+
+void digitGen(const diy_fp & w, const diy_fp & mp, boost::uint64_t delta, char * buffer, int & length, int & k)
+{
+    const diy_fp one(1ULL << -mp.e, mp.e);
+    const diy_fp distance = mp - w;
+    boost::uint32_t p1 = static_cast<boost::uint32_t>(mp.f >> -one.e);
+    boost::uint64_t p2 = mp.f & (one.f - 1);
+    int kappa = static_cast<int>(detail::digits10(p1));
+    length = 0;
+    while(kappa > 0)
+    {
+        boost::uint32_t divisor = static_cast<boost::uint32_t>(pow10[kappa - 1]);
+        boost::uint32_t d = p1 / divisor;
+        p1 %= divisor;
+        if(d || length)
+            buffer[length++] = static_cast<char>('0' + d);
+        --kappa;
+        boost::uint64_t rest = (static_cast<boost::uint64_t>(p1) << -one.e) + p2;
+        if(rest <= delta)
+        {
+            k += kappa;
+            grisuRound(buffer, length, delta, rest, pow10[kappa] << -one.e, distance.f);
+            return;
+        }
+    }
+    for(;;)
+    {
+        p2 *= 10;
+        delta *= 10;
+        char d = static_cast<char>(p2 >> -one.e);
+        if(d || length)
+            buffer[length++] = static_cast<char>('0' + d);
+        p2 &= one.f - 1;
+        --kappa;
+        if(p2 < delta)
+        {
+            k += kappa;
+            int index = -kappa;
+            grisuRound(buffer, length, delta, p2, one.f, distance.f * (index < 20 ? pow10[index] : 0));
+            return;
+        }
+    }
+}
+
+// Value is digits * 10^k.
+void grisu2(double value, char * buffer, int & length, int & k)
+{
+    const diy_fp v(value);
+    diy_fp minus, plus;
+    v.boundaries(minus, plus);
+    const diy_fp c = cachedPower(plus.e, k);
+    const diy_fp w = v.normalize() * c;
+    diy_fp wp = plus * c, wm = minus * c;
+    ++wm.f;
+    --wp.f;
+    digitGen(w, wp, wp.f - wm.f, buffer, length, k);
+}
+
+char * writeExponent(int k, char * out)
+{
+    *out++ = k < 0 ? '-' : '+';
+    return detail::pitoa(static_cast<unsigned>(k < 0 ? -k : k), out);
+}
+
+// Fixed notation for decimal point position in (-6, 21], like JavaScript, exponent otherwise.
+char * prettify(char * buffer, int length, int k)
+{
+    const int point = length + k;
+    if(k >= 0 && point <= 21)
+    {
+        // 1234e7 -> 12340000000
+        memset(buffer + length, '0', point - length);
+        return buffer + point;
+    } else if(point > 0 && point <= 21)
+    {
+        // 1234e-2 -> 12.34
+        memmove(buffer + point + 1, buffer + point, length - point);
+        buffer[point] = '.';
+        return buffer + length + 1;
+    } else if(point > -6 && point <= 0)
+    {
+        // 1234e-6 -> 0.001234
+        const int offset = 2 - point;
+        memmove(buffer + offset, buffer, length);
+        buffer[0] = '0';
+        buffer[1] = '.';
+        memset(buffer + 2, '0', offset - 2);
+        return buffer + length + offset;
+    } else if(length == 1)
+    {
+        // 1e30
+        buffer[1] = 'e';
+        return writeExponent(point - 1, buffer + 2);
+    } else {
+        // 1234e30 -> 1.234e33
+        memmove(buffer + 2, buffer + 1, length - 1);
+        buffer[1] = '.';
+        buffer[length + 1] = 'e';
+        return writeExponent(point - 1, buffer + length + 2);
+    }
+}
+
+const double exactPow10[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+bool strtodWhole(const char * begin, const char * end, double & out)
+{
+    char buffer[0x40];
+    std::string temp;
+    const char * str;
+    size_t len = end - begin;
+    if(len < sizeof(buffer))
+    {
+        memcpy(buffer, begin, len);
+        buffer[len] = 0;
+        str = buffer;
+    } else {
+        temp.assign(begin, end);
+        str = temp.c_str();
+    }
+    char * stop = 0;
+    double value = strtod(str, &stop);
+    if(!len || *stop)
+        return false;
+    out = value;
+    return true;
+}
+
+}
+
+char * dtoa(double value, char * buf)
+{
+    char * p = buf;
+    if(value != value)
+    {
+        memcpy(p, "nan", 4);
+        return buf;
+    }
+    boost::uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    if(bits >> 63)
+    {
+        *p++ = '-';
+        value = -value;
+    }
+    if(value == 0)
+        *p++ = '0';
+    else if(value > DBL_MAX)
+    {
+        memcpy(p, "inf", 3);
+        p += 3;
+    } else {
+        int length, k;
+        grisu2(value, p, length, k);
+        p = prettify(p, length, k);
+    }
+    *p = 0;
+    return buf;
+}
+
+// Numbers with up to 19 significant digits and exponent that keeps both mantissa and power of ten exact
+// are computed with single multiplication or division, that is correctly rounded.
+// Everything else, including "inf", "nan" and hex forms, goes to strtod.
+bool str2double(const char * begin, const char * end, double & out)
+{
+    const char * p = begin;
+    bool negative = false;
+    if(p != end && (*p == '-' || *p == '+'))
+    {
+        negative = *p == '-';
+        ++p;
+    }
+    boost::uint64_t mantissa = 0;
+    int significant = 0, exponent = 0;
+    bool digits = false, exact = true;
+    for(; p != end && static_cast<unsigned>(*p - '0') < 10; ++p)
+    {
+        digits = true;
+        if(significant < 19)
+        {
+            mantissa = mantissa * 10 + (*p - '0');
+            significant += mantissa != 0;
+        } else {
+            ++exponent;
+            exact = exact && *p == '0';
+        }
+    }
+    if(p != end && *p == '.')
+    {
+        for(++p; p != end && static_cast<unsigned>(*p - '0') < 10; ++p)
+        {
+            digits = true;
+            if(significant < 19)
+            {
+                mantissa = mantissa * 10 + (*p - '0');
+                significant += mantissa != 0;
+                --exponent;
+            } else
+                exact = exact && *p == '0';
+        }
+    }
+    if(digits && p != end && (*p == 'e' || *p == 'E'))
+    {
+        ++p;
+        bool negativeExponent = false;
+        if(p != end && (*p == '-' || *p == '+'))
+        {
+            negativeExponent = *p == '-';
+            ++p;
+        }
+        if(p == end || static_cast<unsigned>(*p - '0') >= 10)
+            return false;
+        int value = 0;
+        for(; p != end && static_cast<unsigned>(*p - '0') < 10; ++p)
+            if(value < 100000)
+                value = value * 10 + (*p - '0');
+        exponent += negativeExponent ? -value : value;
+    }
+#if !defined(FLT_EVAL_METHOD) || FLT_EVAL_METHOD == 0
+    if(digits && exact && p == end && mantissa <= (1ULL << 53) && exponent >= -22 && exponent <= 22)
+    {
+        double value = static_cast<double>(mantissa);
+        value = exponent < 0 ? value / exactPow10[-exponent] : value * exactPow10[exponent];
+        out = negative ? -value : value;
+        return true;
+    }
+#endif
+    return strtodWhole(begin, end, out);
+}
 
 }
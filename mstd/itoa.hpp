@@ -19,8 +19,15 @@
 #include <typeinfo>
 #endif
 
+#include <boost/cstdint.hpp>
+
+#include <boost/predef/other/endian.h>
+
 #include <boost/utility/enable_if.hpp>
+#include <boost/type_traits/is_integral.hpp>
+#include <boost/type_traits/is_same.hpp>
 #include <boost/type_traits/is_signed.hpp>
+#include <boost/type_traits/make_unsigned.hpp>
 
 #include "config.hpp"
 
@@ -29,46 +36,97 @@ namespace mstd {
     extern MSTD_DECL const char * const hex_table;
 
     namespace detail {
-        const size_t blockLen = 4;
-        const size_t blockPow = 10000;
+        // "00".."99", so two digits are written per division.
+        extern MSTD_DECL const char * const digitPairs;
+
+        inline size_t digits10(boost::uint32_t i)
+        {
+            if(i < 10000)
+                return i < 100 ? (i < 10 ? 1 : 2) : (i < 1000 ? 3 : 4);
+            if(i < 100000000)
+                return i < 1000000 ? (i < 100000 ? 5 : 6) : (i < 10000000 ? 7 : 8);
+            return i < 1000000000 ? 9 : 10;
+        }
 
-        extern MSTD_DECL const char * const digitBlocks;
+        template<class T>
+        size_t digits10(T i)
+        {
+            if(sizeof(T) > sizeof(boost::uint32_t) && i >= 100000000U)
+            {
+                if(i >= 10000000000000000ULL)
+                    return 16 + digits10(static_cast<boost::uint32_t>(i / 10000000000000000ULL));
+                return 8 + digits10(static_cast<boost::uint32_t>(i / 100000000U));
+            }
+            return digits10(static_cast<boost::uint32_t>(i));
+        }
+
+        template<class Char>
+        void writePair(boost::uint32_t i, Char * p)
+        {
+            const char * src = digitPairs + i * 2;
+            p[0] = src[0];
+            p[1] = src[1];
+        }
+
+        // Writes digits of i backwards, so they end right before p.
+        template<class Char>
+        void writeBackward(boost::uint32_t i, Char * p)
+        {
+            while(i >= 100)
+            {
+                writePair(i % 100, p -= 2);
+                i /= 100;
+            }
+            if(i >= 10)
+                writePair(i, p - 2);
+            else
+                *--p = static_cast<Char>('0' + i);
+        }
 
         template<class T, class Char>
         Char * pitoa(T i, Char * buf)
         {
-            Char * p = buf;
-            while(i) {
-                const char * src = digitBlocks + (i % blockPow) * blockLen;
-                std::copy(src, src + blockLen, p);
-                p += blockLen;
-                i = static_cast<T>(i / blockPow);
-            }
-            if(*(p - 1) == '0')
+            Char * end = buf + digits10(i);
+            Char * p = end;
+            // wide values are cut to 8 digit blocks, so the rest of divisions are 32 bit
+            while(sizeof(T) > sizeof(boost::uint32_t) && i >= 100000000U)
             {
-                --p;
-                if(*(p - 1) == '0')
-                {
-                    --p;
-                    if(*(p - 1) == '0')
-                        --p;
-                }
+                boost::uint32_t block = static_cast<boost::uint32_t>(i % 100000000U);
+                i = static_cast<T>(i / 100000000U);
+                boost::uint32_t high = block / 10000, low = block % 10000;
+                writePair(low % 100, p -= 2);
+                writePair(low / 100, p -= 2);
+                writePair(high % 100, p -= 2);
+                writePair(high / 100, p -= 2);
             }
-            std::reverse(buf, p);
-            return p;
+            writeBackward(static_cast<boost::uint32_t>(i), p);
+            return end;
+        }
+
+#if BOOST_ENDIAN_LITTLE_BYTE
+#define MSTD_ITOA_SWAR 1
+        // Parses 8 digits at once, returns false when some of chars is not digit.
+        inline bool parse8(const char * p, boost::uint64_t & value)
+        {
+            boost::uint64_t chunk;
+            memcpy(&chunk, p, sizeof(chunk));
+            if((chunk & 0xf0f0f0f0f0f0f0f0ULL) != 0x3030303030303030ULL ||
+               ((chunk + 0x0606060606060606ULL) & 0xf0f0f0f0f0f0f0f0ULL) != 0x3030303030303030ULL)
+                return false;
+            chunk -= 0x3030303030303030ULL;
+            chunk = chunk * 10 + (chunk >> 8);
+            value = ((chunk & 0x000000ff000000ffULL) * (100 + (1000000ULL << 32)) +
+                     ((chunk >> 16) & 0x000000ff000000ffULL) * (1 + (10000ULL << 32))) >> 32;
+            return true;
         }
+#endif
     }
 
 template<class T, class Char>
 typename boost::disable_if<boost::is_signed<T>, Char*>::type
 itoa(T i, Char * buf)
 {
-    Char * p = buf;
-    if(i)
-        p = detail::pitoa(i, p);
-    else
-        *p++ = '0';
-
+    Char * p = detail::pitoa(i, buf);
     *p = 0;
     return buf;
 }
@@ -91,49 +149,39 @@ itoa16(T i, Char * buf)
     return buf;
 }
 
-template<class T, class Char>
-typename boost::enable_if_c<sizeof(T) >= sizeof(intptr_t), void>::type
-itoaMinValue(T i, Char * p)
-{
-    p = detail::pitoa(-(i / static_cast<T>(detail::blockPow)), p);
-    p = detail::pitoa(-(i % static_cast<T>(detail::blockPow)), p);
-    *p = 0;
-}
-
-template<class T, class Char>
-typename boost::enable_if_c<sizeof(T) < sizeof(intptr_t), void>::type
-itoaMinValue(T i, Char * buf)
-{
-    return itoaMinValue(static_cast<intptr_t>(i), buf);
-}
-
 template<class T, class Char>
 typename boost::enable_if<boost::is_signed<T>, Char*>::type
 itoa(T i, Char * buf)
 {
+    typedef typename boost::make_unsigned<T>::type unsigned_type;
     Char * p = buf;
-    if(i)
+    unsigned_type value = static_cast<unsigned_type>(i);
+    if(i < 0)
     {
-        if(i < 0)
-        {
-            i = -i;
-            *p = '-';
-            ++p;
-            if(i < 0)
-            {
-                itoaMinValue(i, p);
-                return buf;
-            }
-        }
-        p = detail::pitoa(i, p);
-    } else {
-        *p++ = '0';
+        *p++ = '-';
+        // negated as unsigned, so minimal value needs no special case
+        value = static_cast<unsigned_type>(0 - value);
     }
-
+    p = detail::pitoa(value, p);
     *p = 0;
     return buf;
 }
 
+// Enough for any double written by dtoa, including terminating zero.
+const size_t max_dtoa_length = 0x20;
+
+// Writes shortest representation that is parsed back to the same value, "nan", "inf" and "-inf" for special values.
+// Returns buf, as itoa does.
+MSTD_DECL char * dtoa(double value, char * buf);
+
+// Parses whole [begin, end) as decimal floating point number, returns false if it is not a number.
+MSTD_DECL bool str2double(const char * begin, const char * end, double & out);
+
+inline bool str2double(const char * str, size_t len, double & out)
+{
+    return str2double(str, str + len, out);
+}
+
 #ifndef BOOST_NO_EXCEPTIONS
 class bad_str2int_cast : public std::bad_cast {
 public:
@@ -165,6 +213,31 @@ T str2int10_impl(It inp, It end)
     return result;
 }
 
+// Pointers are parsed by 8 digits at once. Computation goes in unsigned type,
+// so overflow wraps exactly as digit by digit parsing does.
+template<class T, class Check>
+typename boost::enable_if_c<boost::is_integral<T>::value && !boost::is_same<T, bool>::value, T>::type
+str2int10_impl(const char * inp, const char * end)
+{
+    typedef typename boost::make_unsigned<T>::type unsigned_type;
+    unsigned_type result = 0;
+#if MSTD_ITOA_SWAR
+    boost::uint64_t block;
+    for(; end - inp >= 8 && detail::parse8(inp, block); inp += 8)
+        result = static_cast<unsigned_type>(static_cast<boost::uint64_t>(result) * 100000000U + block);
+#endif
+    for(; inp != end; ++inp)
+    {
+        char c = *inp;
+#ifndef BOOST_NO_EXCEPTIONS
+        if(Check::value && (c < '0' || c > '9'))
+            throw bad_str2int_cast();
+#endif
+        result = static_cast<unsigned_type>(result * 10U + static_cast<unsigned_type>(c - '0'));
+    }
+    return static_cast<T>(result);
+}
+
 template<class T, class Check, class It>
 typename boost::enable_if<boost::is_signed<T>, T>::type
 str2int10_i1(It inp, It end)
@@ -0,0 +1,81 @@
+/*
+** The author disclaims copyright to this source code.  In place of
+** a legal notice, here is a blessing:
+**
+**    May you do good and not evil.
+**    May you find forgiveness for yourself and forgive others.
+**    May you share freely, never taking more than you give.
+*/
+#include <boost/config.hpp>
+
+#if BOOST_WINDOWS
+#include <Windows.h>
+#else
+#include <time.h>
+#endif
+
+#include <ostream>
+
+#include "lock_site.hpp"
+
+namespace mstd {
+
+namespace {
+
+// Sites are only added, so list is read without lock. Sites could be created during static initialization.
+atomic<lock_site*> & sites()
+{
+    static atomic<lock_site*> result(0);
+    return result;
+}
+
+}
+
+lock_site::lock_site(const char * name)
+    : name_(name), acquisitions_(0), contended_(0), spins_(0), wait_(0)
+{
+    for(;;)
+    {
+        lock_site * head = sites();
+        next_ = head;
+        if(sites().cas(this, head) == head)
+            break;
+    }
+}
+
+boost::uint64_t lock_site::now_ns()
+{
+#if BOOST_WINDOWS
+    static LARGE_INTEGER frequency;
+    if(!frequency.QuadPart)
+        QueryPerformanceFrequency(&frequency);
+    LARGE_INTEGER counter;
+    QueryPerformanceCounter(&counter);
+    return static_cast<boost::uint64_t>(counter.QuadPart / frequency.QuadPart * 1000000000ULL +
+                                        counter.QuadPart % frequency.QuadPart * 1000000000ULL / frequency.QuadPart);
+#else
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<boost::uint64_t>(ts.tv_sec) * 1000000000ULL + ts.tv_nsec;
+#endif
+}
+
+void lock_site::report(std::ostream & out)
+{
+    for(lock_site * site = sites(); site; site = site->next_)
+        out << site->name() << ": acquisitions " << site->acquisitions() << ", contended " << site->contended()
+            << ", spins " << site->spins() << ", wait " << site->wait_ns() / 1000 << "us" << std::endl;
+}
+
+void lock_site::reset_all()
+{
+    for(lock_site * site = sites(); site; site = site->next_)
+    {
+        site->acquisitions_ = 0;
+        site->contended_ = 0;
+        site->spins_ = 0;
+        site->wait_ = 0;
+    }
+}
+
+}
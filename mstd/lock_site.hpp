@@ -0,0 +1,154 @@
+/*
+** The author disclaims copyright to this source code.  In place of
+** a legal notice, here is a blessing:
+**
+**    May you do good and not evil.
+**    May you find forgiveness for yourself and forgive others.
+**    May you share freely, never taking more than you give.
+*/
+#pragma once
+
+#include <iosfwd>
+
+#include <boost/noncopyable.hpp>
+
+#include "atomic.hpp"
+#include "config.hpp"
+#include "spinlock.hpp"
+
+// Contention profiling is enabled by defining MSTD_LOCK_PROFILING to 1 for whole build,
+// otherwise lock_profile<Mutex>::type is Mutex itself and sites are never updated.
+#ifndef MSTD_LOCK_PROFILING
+#define MSTD_LOCK_PROFILING 0
+#endif
+
+namespace mstd {
+
+// Statistics of place where lock is used. Sites live forever, they are linked into global list when created,
+// so they are usually function local statics.
+class MSTD_DECL lock_site : private boost::noncopyable {
+public:
+    explicit lock_site(const char * name);
+
+    void acquired()
+    {
+        ++acquisitions_;
+    }
+
+    void contended(size_t spins, boost::uint64_t waitNs)
+    {
+        ++acquisitions_;
+        ++contended_;
+        spins_ += spins;
+        wait_ += waitNs;
+    }
+
+    const char * name() const { return name_; }
+    boost::uint64_t acquisitions() const { return acquisitions_; }
+    boost::uint64_t contended() const { return contended_; }
+    boost::uint64_t spins() const { return spins_; }
+    boost::uint64_t wait_ns() const { return wait_; }
+
+    // Monotonic time for measuring of wait.
+    static boost::uint64_t now_ns();
+
+    // One line per site: name, acquisitions, contended acquisitions, spins and total wait.
+    static void report(std::ostream & out);
+    static void reset_all();
+private:
+    const char * name_;
+    atomic<boost::uint64_t> acquisitions_;
+    atomic<boost::uint64_t> contended_;
+    atomic<boost::uint64_t> spins_;
+    atomic<boost::uint64_t> wait_;
+    lock_site * next_;
+};
+
+namespace detail {
+    template<class Mutex>
+    size_t lock_counted(Mutex & mutex)
+    {
+        mutex.lock();
+        return 0;
+    }
+
+    inline size_t lock_counted(spinlock & mutex)
+    {
+        return mutex.lock_counted();
+    }
+
+    inline size_t lock_counted(ticket_spinlock & mutex)
+    {
+        return mutex.lock_counted();
+    }
+}
+
+// Mutex that reports its acquisitions to site, site is assigned by owner after construction,
+// so it could replace Mutex in templates that construct it by default.
+template<class Mutex>
+class profiled_mutex : private boost::noncopyable {
+public:
+    profiled_mutex()
+        : site_(&unknown()) {}
+
+    void site(lock_site & value)
+    {
+        site_ = &value;
+    }
+
+    void lock()
+    {
+        if(mutex_.try_lock())
+        {
+            site_->acquired();
+            return;
+        }
+        boost::uint64_t start = lock_site::now_ns();
+        size_t spins = detail::lock_counted(mutex_);
+        site_->contended(spins, lock_site::now_ns() - start);
+    }
+
+    bool try_lock()
+    {
+        if(!mutex_.try_lock())
+            return false;
+        site_->acquired();
+        return true;
+    }
+
+    void unlock()
+    {
+        mutex_.unlock();
+    }
+private:
+    static lock_site & unknown()
+    {
+        static lock_site result("unknown");
+        return result;
+    }
+
+    Mutex mutex_;
+    lock_site * site_;
+};
+
+template<class Mutex>
+struct lock_profile {
+#if MSTD_LOCK_PROFILING
+    typedef profiled_mutex<Mutex> type;
+#else
+    typedef Mutex type;
+#endif
+};
+
+template<class Mutex>
+void set_lock_site(Mutex &, lock_site &)
+{
+}
+
+template<class Mutex>
+void set_lock_site(profiled_mutex<Mutex> & mutex, lock_site & site)
+{
+    mutex.site(site);
+}
+
+}
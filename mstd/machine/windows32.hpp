@@ -18,6 +18,10 @@ namespace mstd { namespace detail {
 
 inline void memory_fence() { _ReadWriteBarrier(); }
 
+// x86 does not reorder loads with loads and stores with stores, so only compiler should be stopped.
+inline void acquire_fence() { _ReadWriteBarrier(); }
+inline void release_fence() { _ReadWriteBarrier(); }
+
 template<size_t size>
 inline typename size_to_int<size>::type atomic_read(const volatile void * ptr)
 {
@@ -8,12 +8,59 @@
 */
 #pragma once
 
+#include <algorithm>
 #include <vector>
 
+#include <boost/assert.hpp>
+#include <boost/cstdint.hpp>
 #include <boost/optional.hpp>
 
+#if defined(_MSC_VER)
+#include <intrin.h>
+#include <xmmintrin.h>
+#endif
+
 namespace mstd {
 
+namespace detail {
+
+inline unsigned interval_lowest_bit(unsigned mask)
+{
+#if defined(_MSC_VER)
+    unsigned long result;
+    _BitScanForward(&result, mask);
+    return result;
+#else
+    return __builtin_ctz(mask);
+#endif
+}
+
+inline void interval_prefetch(const void * address)
+{
+#if defined(_MSC_VER)
+    _mm_prefetch(static_cast<const char*>(address), _MM_HINT_T0);
+#else
+    __builtin_prefetch(address);
+#endif
+}
+
+template<size_t N>
+struct interval_floor_pow2 {
+    static const size_t value = interval_floor_pow2<N / 2>::value * 2;
+};
+
+template<>
+struct interval_floor_pow2<1> {
+    static const size_t value = 1;
+};
+
+template<>
+struct interval_floor_pow2<0> {
+    static const size_t value = 0;
+};
+
+}
+
 template<class Key, class Mapped>
 struct interval_with_value {
     typedef Key key_type;
@@ -53,6 +100,9 @@ struct interval_compare {
     }
 };
 
+// Sorted intervals searched by upper bound. After build_index upper bounds are also kept in separate key only
+// array in Eytzinger (BFS) order, so every search step touches single key and next 4 levels of tree are
+// prefetched by one cache line, instead of loading whole intervals with values as lower_bound does.
 template<class Key, class Value>
 class plain_interval_map {
 public:
@@ -61,31 +111,35 @@ public:
     typedef interval_with_value<key_type, value_type> interval_type;
     typedef std::vector<interval_type> holder_type;
 
+    // Keys searched together by batched get, so their cache misses overlap.
+    static const size_t batch_size = 8;
+
     plain_interval_map()
+        : index_depth_(0)
     {
     }
 
     template<class It>
     plain_interval_map(It begin, It end)
-        : intervals_(begin, end)
+        : intervals_(begin, end), index_depth_(0)
     {
         std::sort(intervals_.begin(), intervals_.end(), comparator_);
     }
 
     boost::optional<const value_type &> get(const key_type & k) const
     {
-        typename std::vector<interval_type>::const_iterator i = std::lower_bound(intervals_.begin(), intervals_.end(), k, comparator_);
-        if(i == intervals_.end() || i->lower > k)
+        size_t i = find(k);
+        if(i == intervals_.size())
             return boost::optional<const value_type&>();
-        return i->value;
+        return intervals_[i].value;
     }
 
     boost::optional<value_type &> get(const key_type & k)
     {
-        typename std::vector<interval_type>::const_iterator i = std::lower_bound(intervals_.begin(), intervals_.end(), k, comparator_);
-        if(i == intervals_.end() || i->lower > k)
+        size_t i = find(k);
+        if(i == intervals_.size())
             return boost::optional<value_type&>();
-        return i->value;
+        return intervals_[i].value;
     }
 
     const value_type & get(const key_type & k, const value_type & def) const
@@ -94,19 +148,129 @@ public:
         return temp ? *temp : def;
     }
 
+    // Looks up count keys, out[i] is value for keys[i] or null when it is not in any interval.
+    void get(const key_type * keys, size_t count, const value_type ** out) const
+    {
+        if(index_keys_.empty())
+        {
+            for(size_t i = 0; i != count; ++i)
+            {
+                size_t j = find(keys[i]);
+                out[i] = j == intervals_.size() ? 0 : &intervals_[j].value;
+            }
+            return;
+        }
+        size_t pos[batch_size];
+        while(count)
+        {
+            size_t n = count < batch_size ? count : batch_size;
+            for(size_t i = 0; i != n; ++i)
+                pos[i] = 1;
+            for(size_t level = index_depth_; level; --level)
+                for(size_t i = 0; i != n; ++i)
+                    pos[i] = index_step(pos[i], keys[i]);
+            for(size_t i = 0; i != n; ++i)
+            {
+                size_t j = index_finish(pos[i], keys[i]);
+                out[i] = j == intervals_.size() || intervals_[j].lower > keys[i] ? 0 : &intervals_[j].value;
+            }
+            keys += n;
+            out += n;
+            count -= n;
+        }
+    }
+
+    // Builds Eytzinger index, it is dropped by swap and rebuilt when map was indexed.
+    void build_index()
+    {
+        size_t n = intervals_.size();
+        BOOST_ASSERT(n < 0x80000000U);
+        index_keys_.assign(n + 1, key_type());
+        index_order_.assign(n + 1, 0);
+        size_t next = 0;
+        fill_index(1, next);
+        index_depth_ = 0;
+        while((static_cast<size_t>(2) << index_depth_) <= n)
+            ++index_depth_;
+    }
+
+    bool indexed() const
+    {
+        return !index_keys_.empty();
+    }
+
     bool empty() const
     {
         return intervals_.empty();
     }
 
+    size_t size() const
+    {
+        return intervals_.size();
+    }
+
     void swap(std::vector<interval_type> & src)
     {
         intervals_.swap(src);
         std::sort(intervals_.begin(), intervals_.end(), comparator_);
+        if(indexed())
+            build_index();
     }
 private:
+    static const size_t prefetch_stride = detail::interval_floor_pow2<64 / sizeof(key_type)>::value;
+
+    // Index of interval that contains k, or size() when there is no such interval.
+    size_t find(const key_type & k) const
+    {
+        size_t i;
+        if(index_keys_.empty())
+            i = std::lower_bound(intervals_.begin(), intervals_.end(), k, comparator_) - intervals_.begin();
+        else {
+            size_t pos = 1;
+            for(size_t level = index_depth_; level; --level)
+                pos = index_step(pos, k);
+            i = index_finish(pos, k);
+        }
+        if(i == intervals_.size() || intervals_[i].lower > k)
+            return intervals_.size();
+        return i;
+    }
+
+    // Descends one level without branch, first index_depth_ levels are always inside of index.
+    size_t index_step(size_t pos, const key_type & k) const
+    {
+        const key_type * keys = &index_keys_[0];
+        if(prefetch_stride)
+            detail::interval_prefetch(keys + pos * prefetch_stride);
+        return 2 * pos + (keys[pos] < k);
+    }
+
+    // Makes last level step when it is inside of index, then goes up to node where search turned left last time.
+    // It is first key that is not less than k, or 0 when all keys are less.
+    size_t index_finish(size_t pos, const key_type & k) const
+    {
+        if(pos < index_keys_.size())
+            pos = 2 * pos + (index_keys_[pos] < k);
+        pos >>= detail::interval_lowest_bit(~static_cast<unsigned>(pos)) + 1;
+        return pos ? index_order_[pos] : intervals_.size();
+    }
+
+    void fill_index(size_t pos, size_t & next)
+    {
+        if(pos >= index_keys_.size())
+            return;
+        fill_index(2 * pos, next);
+        index_keys_[pos] = intervals_[next].upper;
+        index_order_[pos] = static_cast<boost::uint32_t>(next);
+        ++next;
+        fill_index(2 * pos + 1, next);
+    }
+
     holder_type intervals_;
     interval_compare comparator_;
+    std::vector<key_type> index_keys_;
+    std::vector<boost::uint32_t> index_order_;
+    size_t index_depth_;
 };
 
 }
@@ -0,0 +1,243 @@
+/*
+** The author disclaims copyright to this source code.  In place of
+** a legal notice, here is a blessing:
+**
+**    May you do good and not evil.
+**    May you find forgiveness for yourself and forgive others.
+**    May you share freely, never taking more than you give.
+*/
+#include <algorithm>
+#include <vector>
+
+#include <boost/thread/lock_guard.hpp>
+#include <boost/thread/tss.hpp>
+
+#include "atomic.hpp"
+#include "spinlock.hpp"
+
+#include "pool_allocator.hpp"
+
+namespace mstd {
+
+size_class_pool::size_class_pool(size_t chunk)
+    : arena_(chunk)
+{
+    std::fill(heads_, heads_ + class_count, static_cast<void*>(0));
+}
+
+void size_class_pool::reset()
+{
+    std::fill(heads_, heads_ + class_count, static_cast<void*>(0));
+    arena_.reset();
+}
+
+void * size_class_pool::take(size_t index, size_t count)
+{
+    void * head = 0;
+    for(; count && heads_[index]; --count)
+    {
+        void * block = heads_[index];
+        heads_[index] = detail::free_next(block);
+        detail::free_next(block) = head;
+        head = block;
+    }
+    size_t size = class_size(index);
+    for(; count; --count)
+    {
+        void * block = arena_.allocate(size);
+        detail::free_next(block) = head;
+        head = block;
+    }
+    return head;
+}
+
+namespace detail {
+
+struct pool_state {
+    spinlock mutex;
+    size_class_pool pool;
+    atomic<size_t> refs;
+
+    explicit pool_state(size_t chunk)
+        : pool(chunk), refs(1) {}
+
+    void release()
+    {
+        if(!--refs)
+            delete this;
+    }
+};
+
+}
+
+namespace {
+
+// Blocks moved between thread cache and shared pool at once, about 4KB but from 4 to 64 blocks.
+size_t batch_size(size_t index)
+{
+    return std::max<size_t>(4, std::min<size_t>(64, 4096 / size_class_pool::class_size(index)));
+}
+
+struct pool_cache {
+    detail::pool_state * state;
+    void * heads[size_class_pool::class_count];
+    size_t counts[size_class_pool::class_count];
+
+    explicit pool_cache(detail::pool_state * s)
+        : state(s)
+    {
+        ++state->refs;
+        std::fill(heads, heads + size_class_pool::class_count, static_cast<void*>(0));
+        std::fill(counts, counts + size_class_pool::class_count, 0);
+    }
+
+    ~pool_cache()
+    {
+        {
+            boost::lock_guard<spinlock> lock(state->mutex);
+            for(size_t i = 0; i != size_class_pool::class_count; ++i)
+                if(heads[i])
+                {
+                    void * last = heads[i];
+                    while(detail::free_next(last))
+                        last = detail::free_next(last);
+                    state->pool.give(i, heads[i], last);
+                }
+        }
+        state->release();
+    }
+};
+
+// Caches of current thread indexed by pool id. boost::thread_specific_ptr lookup costs as much as the lock
+// it should save, so it only owns caches and flushes them when thread exits, while lookup goes through
+// native thread local pointer.
+class thread_caches {
+public:
+    ~thread_caches();
+
+    pool_cache & get(size_t id, detail::pool_state * state)
+    {
+        if(id >= caches_.size())
+            caches_.resize(id + 1);
+        pool_cache *& result = caches_[id];
+        if(!result)
+            result = new pool_cache(state);
+        return *result;
+    }
+
+    void drop(size_t id)
+    {
+        if(id < caches_.size())
+        {
+            delete caches_[id];
+            caches_[id] = 0;
+        }
+    }
+private:
+    std::vector<pool_cache*> caches_;
+};
+
+#if BOOST_WINDOWS
+__declspec(thread) thread_caches * current_caches = 0;
+#else
+__thread thread_caches * current_caches = 0;
+#endif
+
+thread_caches::~thread_caches()
+{
+    for(std::vector<pool_cache*>::iterator i = caches_.begin(), end = caches_.end(); i != end; ++i)
+        delete *i;
+    if(current_caches == this)
+        current_caches = 0;
+}
+
+boost::thread_specific_ptr<thread_caches> owned_caches;
+
+thread_caches & local_caches()
+{
+    thread_caches * result = current_caches;
+    if(!result)
+    {
+        owned_caches.reset(result = new thread_caches);
+        current_caches = result;
+    }
+    return *result;
+}
+
+size_t next_pool_id()
+{
+    static atomic<size_t> next(0);
+    return next++;
+}
+
+}
+
+thread_cached_pool::thread_cached_pool(size_t chunk)
+    : state_(new detail::pool_state(chunk)), id_(next_pool_id())
+{
+}
+
+thread_cached_pool::~thread_cached_pool()
+{
+    if(current_caches)
+        current_caches->drop(id_);
+    state_->release();
+}
+
+void * thread_cached_pool::allocate(size_t size, size_t align)
+{
+    if(align > detail::max_align)
+        return detail::aligned_new(size, align);
+    if(size > size_class_pool::max_size)
+        return ::operator new(size);
+
+    pool_cache & cache = local_caches().get(id_, state_);
+    size_t index = size_class_pool::class_of(size);
+    void * result = cache.heads[index];
+    if(!result)
+    {
+        size_t batch = batch_size(index);
+        {
+            boost::lock_guard<spinlock> lock(state_->mutex);
+            result = state_->pool.take(index, batch);
+        }
+        cache.counts[index] = batch;
+    }
+    cache.heads[index] = detail::free_next(result);
+    --cache.counts[index];
+    return result;
+}
+
+void thread_cached_pool::deallocate(void * ptr, size_t size, size_t align)
+{
+    if(align > detail::max_align)
+    {
+        detail::aligned_delete(ptr);
+        return;
+    }
+    if(size > size_class_pool::max_size)
+    {
+        ::operator delete(ptr);
+        return;
+    }
+
+    pool_cache & cache = local_caches().get(id_, state_);
+    size_t index = size_class_pool::class_of(size);
+    detail::free_next(ptr) = cache.heads[index];
+    cache.heads[index] = ptr;
+
+    size_t batch = batch_size(index);
+    if(++cache.counts[index] >= batch * 2)
+    {
+        void * first = cache.heads[index];
+        void * last = first;
+        for(size_t i = 1; i != batch; ++i)
+            last = detail::free_next(last);
+        cache.heads[index] = detail::free_next(last);
+        cache.counts[index] -= batch;
+        boost::lock_guard<spinlock> lock(state_->mutex);
+        state_->pool.give(index, first, last);
+    }
+}
+
+}
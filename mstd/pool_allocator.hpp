@@ -0,0 +1,136 @@
+/*
+** The author disclaims copyright to this source code.  In place of
+** a legal notice, here is a blessing:
+**
+**    May you do good and not evil.
+**    May you find forgiveness for yourself and forgive others.
+**    May you share freely, never taking more than you give.
+*/
+#pragma once
+
+#include <boost/assert.hpp>
+#include <boost/noncopyable.hpp>
+
+#include "arena.hpp"
+#include "config.hpp"
+
+namespace mstd {
+
+namespace detail {
+    inline void *& free_next(void * block)
+    {
+        return *static_cast<void**>(block);
+    }
+
+    // Blocks aligned above max_align bypass size classes, pointer from operator new is kept just before block.
+    inline void * aligned_new(size_t size, size_t align)
+    {
+        BOOST_ASSERT(!(align & (align - 1)));
+        char * raw = static_cast<char*>(::operator new(size + align + sizeof(void*)));
+        void * result = reinterpret_cast<void*>(align_up(reinterpret_cast<size_t>(raw) + sizeof(void*), align));
+        static_cast<void**>(result)[-1] = raw;
+        return result;
+    }
+
+    inline void aligned_delete(void * ptr)
+    {
+        ::operator delete(static_cast<void**>(ptr)[-1]);
+    }
+
+    struct pool_state;
+}
+
+// Free lists of 14 size classes, from 16 to 1024 bytes, as several linked_allocator's that share
+// monotonic_arena instead of taking blocks from operator new one by one. Larger and over-aligned blocks go to
+// operator new. reset gives all class blocks back at once. Not thread safe.
+class MSTD_DECL size_class_pool : private boost::noncopyable {
+public:
+    static const size_t class_count = 14;
+    static const size_t max_size = 1024;
+
+    explicit size_class_pool(size_t chunk = 16384);
+
+    void * allocate(size_t size, size_t align = detail::max_align)
+    {
+        if(align > detail::max_align)
+            return detail::aligned_new(size, align);
+        if(size > max_size)
+            return ::operator new(size);
+        size_t index = class_of(size);
+        void * result = heads_[index];
+        if(result)
+        {
+            heads_[index] = detail::free_next(result);
+            return result;
+        }
+        return arena_.allocate(class_size(index));
+    }
+
+    void deallocate(void * ptr, size_t size, size_t align = detail::max_align)
+    {
+        if(align > detail::max_align)
+        {
+            detail::aligned_delete(ptr);
+            return;
+        }
+        if(size > max_size)
+        {
+            ::operator delete(ptr);
+            return;
+        }
+        size_t index = class_of(size);
+        detail::free_next(ptr) = heads_[index];
+        heads_[index] = ptr;
+    }
+
+    // Invalidates all blocks up to max_size and keeps memory for reuse, larger blocks are not affected.
+    void reset();
+
+    // Unlinks count blocks of class as list, used by thread caches to refill.
+    void * take(size_t index, size_t count);
+
+    // Links list from first to last into class, used by thread caches to flush.
+    void give(size_t index, void * first, void * last)
+    {
+        detail::free_next(last) = heads_[index];
+        heads_[index] = first;
+    }
+
+    static size_t class_of(size_t size)
+    {
+        if(size <= 128)
+            return size ? (size - 1) >> 4 : 0;
+        if(size <= 256)
+            return size <= 192 ? 8 : 9;
+        if(size <= 512)
+            return size <= 384 ? 10 : 11;
+        return size <= 768 ? 12 : 13;
+    }
+
+    static size_t class_size(size_t index)
+    {
+        static const size_t sizes[class_count] = { 16, 32, 48, 64, 80, 96, 112, 128, 192, 256, 384, 512, 768, 1024 };
+        return sizes[index];
+    }
+private:
+    monotonic_arena arena_;
+    void * heads_[class_count];
+};
+
+// Thread safe size_class_pool. Every thread keeps own free lists per pool and exchanges blocks with shared pool
+// in batches under lock, so lock is taken once per tens of allocations. Blocks could be freed by any thread.
+// Thread caches keep shared pool alive, memory is given back when pool is destroyed and all threads that used it
+// exited, so pools are meant to be long living, i.e. one per subsystem.
+class MSTD_DECL thread_cached_pool : private boost::noncopyable {
+public:
+    explicit thread_cached_pool(size_t chunk = 65536);
+    ~thread_cached_pool();
+
+    void * allocate(size_t size, size_t align = detail::max_align);
+    void deallocate(void * ptr, size_t size, size_t align = detail::max_align);
+private:
+    detail::pool_state * state_;
+    size_t id_;
+};
+
+}
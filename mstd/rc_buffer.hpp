@@ -11,12 +11,20 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include <algorithm>
+#include <new>
+
 #include <boost/assert.hpp>
 
 #include "atomic.hpp"
 
 namespace mstd {
 
+class rc_buffer_view;
+
+// Reference counted byte buffer, header with reference counter, size and capacity is stored in the same
+// malloc block as data. Copies share data, append and resize of shared buffer copy it first, so slices and
+// other copies keep seeing old content. Writes through data() are not copied and are seen by all sharers.
 class rc_buffer {
 public:
     rc_buffer()
@@ -25,27 +33,24 @@ public:
     }
 
     explicit rc_buffer(size_t size)
-        : data_(static_cast<char*>(malloc(size + sizeof(counter_t) + sizeof(size_t))))
+        : data_(allocate(size))
     {
         *sizeAddress() = size;
-        *counterAddress() = 1;
     }
 
     rc_buffer(const char * data, size_t size)
-        : data_(static_cast<char*>(malloc(size + sizeof(counter_t) + sizeof(size_t))))
+        : data_(allocate(size))
     {
         memcpy(this->data(), data, size);
         *sizeAddress() = size;
-        *counterAddress() = 1;
     }
 
     rc_buffer(const char * data, const char * end)
-        : data_(static_cast<char*>(malloc((end - data) + sizeof(counter_t) + sizeof(size_t))))
+        : data_(allocate(end - data))
     {
         size_t size = end - data;
         memcpy(this->data(), data, size);
         *sizeAddress() = size;
-        *counterAddress() = 1;
     }
 
     ~rc_buffer()
@@ -62,35 +67,70 @@ public:
 
     void operator=(const rc_buffer & rhs)
     {
+        char * data = rhs.data_;
+        if(data)
+            detail::atomic_helper<sizeof(int)>::add(rhs.counterAddress(), 1);
         reset();
-        data_ = rhs.data_;
-        if(data_)
-            detail::atomic_helper<sizeof(int)>::add(counterAddress(), 1);
+        data_ = data;
     }
 
     inline size_t size() const
     {
-        return *sizeAddress();
+        return data_ ? *sizeAddress() : 0;
     }
 
-    inline void resize(size_t size)
+    inline size_t capacity() const
     {
+        return data_ ? *capacityAddress() : 0;
+    }
+
+    // Whether no other buffer or view shares data.
+    inline bool unique() const
+    {
+        return !data_ || *counterAddress() == 1;
+    }
+
+    // Shrinking keeps capacity, so following appends do not reallocate.
+    void resize(size_t size)
+    {
+        // Empty buffer has no storage to write size to.
+        if(!data_ && !size)
+            return;
+        if(!unique() || size > capacity())
+            detach(std::max(size, capacity()), std::min(size, this->size()));
         *sizeAddress() = size;
     }
 
+    void reserve(size_t capacity)
+    {
+        if(!unique() || capacity > this->capacity())
+            detach(std::max(capacity, this->capacity()), size());
+    }
+
+    // Capacity grows twice, so appending byte by byte is amortized linear.
     void append(const char * buf, size_t len)
     {
-        BOOST_ASSERT(*counterAddress() == 1);
+        // Empty buffer has no storage to write size to.
+        if(!len)
+            return;
         size_t size = this->size();
-        size_t requiredSize = sizeof(counter_t) + sizeof(size_t) + size + len;
-        data_ = static_cast<char*>(realloc(data_, requiredSize));
+        size_t required = size + len;
+        if(!unique() || required > capacity())
+        {
+            // Source could be part of this buffer, that is moved by realloc.
+            bool inside = data_ && buf >= data() && buf < data() + size;
+            size_t offset = inside ? buf - data() : 0;
+            detach(std::max(required, capacity() * 2), size);
+            if(inside)
+                buf = data() + offset;
+        }
         memcpy(data() + size, buf, len);
-        resize(size + len);
+        *sizeAddress() = required;
     }
 
     inline char * data() const
     {
-        return data_ + sizeof(counter_t) + sizeof(size_t);
+        return data_ + header_size;
     }
 
     inline char * begin() const
@@ -107,7 +147,7 @@ public:
     {
         return static_cast<unsigned char*>(static_cast<void*>(data()));
     }
-    
+
     inline unsigned char * ubegin() const
     {
         return udata();
@@ -118,6 +158,9 @@ public:
         return udata() + size();
     }
 
+    // Range of this buffer that shares its reference counter, defined after rc_buffer_view.
+    rc_buffer_view slice(size_t offset, size_t len) const;
+
     void reset()
     {
         if(data_)
@@ -144,17 +187,154 @@ public:
 private:
     typedef unsigned int counter_t;
 
+    struct header {
+        size_t size;
+        size_t capacity;
+        counter_t counter;
+    };
+
+    static const size_t header_size = sizeof(header);
+
+    static char * allocate(size_t capacity)
+    {
+        char * result = static_cast<char*>(malloc(header_size + capacity));
+        if(!result)
+            throw std::bad_alloc();
+        header * h = static_cast<header*>(static_cast<void*>(result));
+        h->capacity = capacity;
+        h->counter = 1;
+        return result;
+    }
+
+    // Makes this buffer unique with at least capacity bytes, keeping first size bytes.
+    void detach(size_t capacity, size_t size)
+    {
+        if(unique() && data_)
+        {
+            char * data = static_cast<char*>(realloc(data_, header_size + capacity));
+            if(!data)
+                throw std::bad_alloc();
+            data_ = data;
+            *capacityAddress() = capacity;
+        } else {
+            char * data = allocate(capacity);
+            if(data_)
+                memcpy(data + header_size, this->data(), size);
+            reset();
+            data_ = data;
+            *sizeAddress() = size;
+        }
+    }
+
     inline size_t * sizeAddress() const
     {
-        return static_cast<size_t*>(static_cast<void*>(data_ + sizeof(counter_t)));
+        return &static_cast<header*>(static_cast<void*>(data_))->size;
+    }
+
+    inline size_t * capacityAddress() const
+    {
+        return &static_cast<header*>(static_cast<void*>(data_))->capacity;
     }
 
     inline volatile counter_t * counterAddress() const
     {
-        return static_cast<volatile unsigned int*>(static_cast<void*>(data_));
+        return &static_cast<volatile header*>(static_cast<void*>(data_))->counter;
     }
 
     char * data_;
 };
 
+// Read only range of rc_buffer, keeps whole buffer alive by its reference counter, so part of response or
+// packet is passed around without copying. Appends to owner do not move data seen by view.
+class rc_buffer_view {
+public:
+    rc_buffer_view()
+        : begin_(0), end_(0)
+    {
+    }
+
+    explicit rc_buffer_view(const rc_buffer & owner)
+        : owner_(owner), begin_(owner ? owner.data() : 0), end_(begin_ + owner.size())
+    {
+    }
+
+    rc_buffer_view(const rc_buffer & owner, size_t offset, size_t len)
+        : owner_(owner), begin_(owner.data() + offset), end_(begin_ + len)
+    {
+        BOOST_ASSERT(offset + len <= owner.size());
+    }
+
+    inline const char * data() const
+    {
+        return begin_;
+    }
+
+    inline const char * begin() const
+    {
+        return begin_;
+    }
+
+    inline const char * end() const
+    {
+        return end_;
+    }
+
+    inline const unsigned char * udata() const
+    {
+        return static_cast<const unsigned char*>(static_cast<const void*>(begin_));
+    }
+
+    inline size_t size() const
+    {
+        return end_ - begin_;
+    }
+
+    inline bool empty() const
+    {
+        return begin_ == end_;
+    }
+
+    rc_buffer_view slice(size_t offset, size_t len) const
+    {
+        BOOST_ASSERT(offset + len <= size());
+        rc_buffer_view result(*this);
+        result.begin_ += offset;
+        result.end_ = result.begin_ + len;
+        return result;
+    }
+
+    // Buffer that owns viewed data.
+    const rc_buffer & owner() const
+    {
+        return owner_;
+    }
+
+    // Copies range to own buffer, so rest of owner could be freed.
+    rc_buffer copy() const
+    {
+        return rc_buffer(begin_, end_);
+    }
+
+    typedef const char * rc_buffer_view::*unspecified_bool_type;
+
+    inline operator unspecified_bool_type() const
+    {
+        return owner_ ? &rc_buffer_view::begin_ : 0;
+    }
+
+    inline bool operator!() const
+    {
+        return !owner_;
+    }
+private:
+    rc_buffer owner_;
+    const char * begin_;
+    const char * end_;
+};
+
+inline rc_buffer_view rc_buffer::slice(size_t offset, size_t len) const
+{
+    return rc_buffer_view(*this, offset, len);
+}
+
 }
@@ -0,0 +1,120 @@
+/*
+** The author disclaims copyright to this source code.  In place of
+** a legal notice, here is a blessing:
+**
+**    May you do good and not evil.
+**    May you find forgiveness for yourself and forgive others.
+**    May you share freely, never taking more than you give.
+*/
+#pragma once
+
+#include <cstddef>
+#include <limits>
+#include <new>
+#include <utility>
+
+#include <boost/type_traits/alignment_of.hpp>
+
+namespace mstd {
+
+namespace detail {
+    // Alignment of memory returned by operator new on platforms we run, memory resources keep it for all blocks.
+    const size_t max_align = 16;
+
+    inline size_t align_up(size_t value, size_t align)
+    {
+        return (value + align - 1) & ~(align - 1);
+    }
+}
+
+// Standard allocator over memory resource, i.e. monotonic_arena, size_class_pool or thread_cached_pool.
+// Resource should have allocate(size, align) and deallocate(ptr, size, align), and should outlive containers.
+// Allocators are equal when they use the same resource.
+template<class T, class Resource>
+class resource_allocator {
+public:
+    typedef T value_type;
+    typedef T * pointer;
+    typedef const T * const_pointer;
+    typedef T & reference;
+    typedef const T & const_reference;
+    typedef size_t size_type;
+    typedef ptrdiff_t difference_type;
+
+    template<class U>
+    struct rebind {
+        typedef resource_allocator<U, Resource> other;
+    };
+
+    explicit resource_allocator(Resource & resource)
+        : resource_(&resource) {}
+
+    template<class U>
+    resource_allocator(const resource_allocator<U, Resource> & rhs)
+        : resource_(&rhs.resource()) {}
+
+    T * allocate(size_t n, const void * = 0)
+    {
+        if(n > max_size())
+            throw std::bad_alloc();
+        return static_cast<T*>(resource_->allocate(n * sizeof(T), boost::alignment_of<T>::value));
+    }
+
+    void deallocate(T * p, size_t n)
+    {
+        resource_->deallocate(p, n * sizeof(T), boost::alignment_of<T>::value);
+    }
+
+    size_t max_size() const
+    {
+        return std::numeric_limits<size_t>::max() / sizeof(T);
+    }
+
+    void construct(T * p, const T & value)
+    {
+        new (p) T(value);
+    }
+
+    template<class U, class... Args>
+    void construct(U * p, Args&&... args)
+    {
+        new (p) U(std::forward<Args>(args)...);
+    }
+
+    template<class U>
+    void destroy(U * p)
+    {
+        p->~U();
+    }
+
+    T * address(T & value) const
+    {
+        return &value;
+    }
+
+    const T * address(const T & value) const
+    {
+        return &value;
+    }
+
+    Resource & resource() const
+    {
+        return *resource_;
+    }
+private:
+    Resource * resource_;
+};
+
+template<class T, class U, class Resource>
+bool operator==(const resource_allocator<T, Resource> & lhs, const resource_allocator<U, Resource> & rhs)
+{
+    return &lhs.resource() == &rhs.resource();
+}
+
+template<class T, class U, class Resource>
+bool operator!=(const resource_allocator<T, Resource> & lhs, const resource_allocator<U, Resource> & rhs)
+{
+    return !(lhs == rhs);
+}
+
+}
@@ -0,0 +1,91 @@
+/*
+** The author disclaims copyright to this source code.  In place of
+** a legal notice, here is a blessing:
+**
+**    May you do good and not evil.
+**    May you find forgiveness for yourself and forgive others.
+**    May you share freely, never taking more than you give.
+*/
+#pragma once
+
+#include <boost/noncopyable.hpp>
+
+#include "atomic.hpp"
+#include "yield_k.hpp"
+
+namespace mstd {
+
+// Value that is read without writing to shared memory. Reader copies value between two reads of sequence and
+// retries if sequence was odd or changed, i.e. writer was active. Writers are serialized by cas on sequence.
+// T is copied while writer could change it, so it should be plain data without pointers to owned memory.
+template<class T>
+class seqlock : private boost::noncopyable {
+public:
+    typedef T value_type;
+
+    seqlock()
+        : sequence_(0), value_() {}
+
+    explicit seqlock(const T & value)
+        : sequence_(0), value_(value) {}
+
+    T load() const
+    {
+        T result;
+        for(size_t k = 0; !try_load(result); ++k)
+            yield(k);
+        return result;
+    }
+
+    // Returns false instead of waiting when writer is active.
+    bool try_load(T & out) const
+    {
+        boost::uint32_t before = sequence_.load_acquire();
+        if(before & 1)
+            return false;
+        T result(value_);
+        detail::acquire_fence();
+        if(sequence_.load_acquire() != before)
+            return false;
+        out = result;
+        return true;
+    }
+
+    void store(const T & value)
+    {
+        boost::uint32_t sequence = lock();
+        value_ = value;
+        sequence_.store_release(sequence + 2);
+    }
+
+    // Calls f with reference to value under write lock, so update could depend on current value.
+    template<class F>
+    void modify(const F & f)
+    {
+        boost::uint32_t sequence = lock();
+        f(value_);
+        sequence_.store_release(sequence + 2);
+    }
+
+    boost::uint32_t sequence() const
+    {
+        return sequence_.load_acquire();
+    }
+private:
+    // cas is full fence, so value is not written before sequence becomes odd.
+    boost::uint32_t lock()
+    {
+        for(size_t k = 0; ; ++k)
+        {
+            boost::uint32_t sequence = sequence_.load_acquire();
+            if(!(sequence & 1) && sequence_.cas(sequence + 1, sequence) == sequence)
+                return sequence;
+            yield(k);
+        }
+    }
+
+    atomic<boost::uint32_t> sequence_;
+    T value_;
+};
+
+}
@@ -0,0 +1,131 @@
+/*
+** The author disclaims copyright to this source code.  In place of
+** a legal notice, here is a blessing:
+**
+**    May you do good and not evil.
+**    May you find forgiveness for yourself and forgive others.
+**    May you share freely, never taking more than you give.
+*/
+#pragma once
+
+#include <vector>
+
+#include <boost/noncopyable.hpp>
+
+#include <boost/thread/locks.hpp>
+#include <boost/thread/mutex.hpp>
+
+#include "detail/reader_slots.hpp"
+
+namespace mstd {
+
+// Pointer to immutable snapshot, that is read without locks and replaced as whole, RCU style.
+// Reader marks itself in per slot counter of current epoch and reads pointer. Replaced snapshot is retired
+// and deleted later, when grace period passed: epoch was flipped after it was retired, and counters of both
+// epochs were seen empty since then, so no reader could still hold it. Readers never wait, writers never
+// wait for readers in reset, retired snapshots are deleted by later reset or reclaim.
+template<class T>
+class snapshot_ptr : private boost::noncopyable {
+public:
+    class reader : private boost::noncopyable {
+    public:
+        explicit reader(const snapshot_ptr & owner)
+        {
+            size_t epoch = owner.epoch_.load_acquire() & 1;
+            counter_ = &owner.readers_.current().counters[epoch];
+            // increment is full fence, so pointer is read after writer could see us
+            ++*counter_;
+            value_ = owner.value_.load_acquire();
+        }
+
+        ~reader()
+        {
+            --*counter_;
+        }
+
+        const T * get() const
+        {
+            return value_;
+        }
+
+        const T & operator*() const
+        {
+            return *value_;
+        }
+
+        const T * operator->() const
+        {
+            return value_;
+        }
+    private:
+        atomic<size_t> * counter_;
+        const T * value_;
+    };
+
+    explicit snapshot_ptr(T * value = 0)
+        : value_(value), epoch_(0) {}
+
+    // There should be no readers at this moment.
+    ~snapshot_ptr()
+    {
+        deleteAll(pending_);
+        deleteAll(flipped_);
+        delete value_.load_acquire();
+    }
+
+    // Publishes value, previous one is deleted when no reader could hold it.
+    void reset(T * value)
+    {
+        boost::lock_guard<boost::mutex> lock(mutex_);
+        pending_.push_back(value_.read_write(value));
+        advance();
+    }
+
+    // Deletes retired snapshots that readers could not hold anymore, returns number of still retired ones.
+    size_t reclaim()
+    {
+        boost::lock_guard<boost::mutex> lock(mutex_);
+        advance();
+        return pending_.size() + flipped_.size();
+    }
+
+    // Waits until all retired snapshots are deleted.
+    void synchronize()
+    {
+        for(size_t k = 0; reclaim(); ++k)
+            yield(k);
+    }
+private:
+    // Snapshots in flipped_ were retired before epoch flip, so they could be held only by readers
+    // of both epochs seen before flip, readers of previous epoch are the only ones left after it.
+    void advance()
+    {
+        size_t current = epoch_.load_acquire() & 1;
+        if(!readers_.empty(current ^ 1))
+            return;
+        deleteAll(flipped_);
+        if(pending_.empty())
+            return;
+        pending_.swap(flipped_);
+        epoch_.store_release(epoch_.load_acquire() + 1);
+        if(readers_.empty(current))
+            deleteAll(flipped_);
+    }
+
+    static void deleteAll(std::vector<T*> & values)
+    {
+        for(typename std::vector<T*>::const_iterator i = values.begin(), end = values.end(); i != end; ++i)
+            delete *i;
+        values.clear();
+    }
+
+    mutable detail::reader_slots<2> readers_;
+    char padding_[detail::cache_line_size];
+    atomic<T*> value_;
+    atomic<boost::uint32_t> epoch_;
+    boost::mutex mutex_;
+    std::vector<T*> pending_;
+    std::vector<T*> flipped_;
+};
+
+}
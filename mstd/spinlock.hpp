@@ -8,10 +8,32 @@
 */
 #pragma once
 
+#include <algorithm>
+
+#include "atomic.hpp"
 #include "yield_k.hpp"
 
 namespace mstd {
 
+namespace detail {
+    // Waiter spins with exponential backoff for spin_rounds rounds, about few microseconds in total,
+    // so short critical sections are waited without syscalls, and then gives CPU away as yield does.
+    const size_t spin_rounds = 10;
+    const size_t max_backoff = 64;
+
+    inline void backoff(size_t k, size_t pauses)
+    {
+        if(k < spin_rounds)
+        {
+            for(size_t i = 0; i != pauses; ++i)
+                cpu_relax();
+        } else
+            yield(k - spin_rounds + 16);
+    }
+}
+
+// Test and test-and-set lock. Waiters read lock word, that stays in their caches while lock is held,
+// and try to take it only after it was seen free, so they do not bounce the line.
 class spinlock {
 public:
     spinlock()
@@ -21,6 +43,8 @@ public:
 public:
     bool try_lock()
     {
+        if(locked())
+            return false;
 #if BOOST_WINDOWS
         long r = _InterlockedExchange(&v_, 1);
         _ReadWriteBarrier();
@@ -33,8 +57,20 @@ public:
 
     void lock()
     {
-        for(size_t k = 0; !try_lock(); ++k)
-            yield(k);
+        lock_counted();
+    }
+
+    // Locks and returns number of failed attempts, used by contention profiling.
+    size_t lock_counted()
+    {
+        size_t pauses = 1;
+        size_t k = 0;
+        for(; !try_lock(); ++k)
+        {
+            detail::backoff(k, pauses);
+            pauses = std::min(pauses * 2, detail::max_backoff);
+        }
+        return k;
     }
 
     void unlock()
@@ -44,6 +80,15 @@ public:
         *const_cast< long volatile* >( &v_ ) = 0;
 #else
         __sync_lock_release( &v_ );
+#endif
+    }
+
+    bool locked() const
+    {
+#if BOOST_WINDOWS
+        return *const_cast< long const volatile* >( &v_ ) != 0;
+#else
+        return *const_cast< int const volatile* >( &v_ ) != 0;
 #endif
     }
 private:
@@ -54,4 +99,52 @@ private:
 #endif
 };
 
+// Ticket lock, lock is granted in order of arrival, so no waiter starves. Waiter backs off in proportion to
+// number of tickets before it. Every waiter reads the same word, and waiter that lost CPU delays all behind it,
+// so it is for short critical sections with fairness requirement and no more threads than cores.
+class ticket_spinlock {
+public:
+    ticket_spinlock()
+        : next_(0), serving_(0)
+    {
+    }
+
+    bool try_lock()
+    {
+        boost::uint32_t serving = serving_.load_acquire();
+        return next_.cas(serving + 1, serving) == serving;
+    }
+
+    void lock()
+    {
+        lock_counted();
+    }
+
+    // Locks and returns number of times waiter saw lock held.
+    size_t lock_counted()
+    {
+        boost::uint32_t ticket = next_++;
+        for(size_t k = 0; ; ++k)
+        {
+            boost::uint32_t serving = serving_.load_acquire();
+            if(serving == ticket)
+                return k;
+            detail::backoff(k, std::min<size_t>(static_cast<boost::uint32_t>(ticket - serving) * 8, detail::max_backoff));
+        }
+    }
+
+    void unlock()
+    {
+        serving_.store_release(serving_.load_acquire() + 1);
+    }
+
+    bool locked() const
+    {
+        return next_.load_acquire() != serving_.load_acquire();
+    }
+private:
+    atomic<boost::uint32_t> next_;
+    atomic<boost::uint32_t> serving_;
+};
+
 }
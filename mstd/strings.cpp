@@ -11,7 +11,12 @@
 #pragma warning(disable:4996)
 #endif
 
+#include <algorithm>
+
 #include <boost/config.hpp>
+#include <boost/cstdint.hpp>
+
+#include <boost/type_traits/make_unsigned.hpp>
 
 #if !defined(MSTD_USE_PBUFFER)
 
@@ -42,6 +47,21 @@
 
 #endif
 
+#if defined(__AVX2__)
+#define MSTD_UTF8_AVX2 1
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define MSTD_UTF8_SSE2 1
+#include <emmintrin.h>
+#if MSTD_UTF8_AVX2
+#include <immintrin.h>
+#endif
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#endif
+
 #include "pointer_cast.hpp"
 #include "utf8.hpp"
 
@@ -130,6 +150,223 @@ std::wstring MSTD_STDCALL widen(const std::string & value)
 
 namespace {
     const size_t maxStackLen = 0xff;
+
+#if MSTD_UTF8_SSE2
+inline unsigned lowestBit(unsigned mask)
+{
+#if defined(_MSC_VER)
+    unsigned long result;
+    _BitScanForward(&result, mask);
+    return result;
+#else
+    return __builtin_ctz(mask);
+#endif
+}
+
+inline unsigned bitCount(unsigned value)
+{
+    value = value - ((value >> 1) & 0x55555555);
+    value = (value & 0x33333333) + ((value >> 2) & 0x33333333);
+    return (((value + (value >> 4)) & 0x0f0f0f0f) * 0x01010101) >> 24;
+}
+
+// Bit mask of 16 wide characters that have bits outside of mask set.
+inline unsigned wideOutside(const wchar_t * input, int mask)
+{
+    const __m128i zero = _mm_setzero_si128();
+    if(sizeof(wchar_t) == 2)
+    {
+        const __m128i outside = _mm_set1_epi16(static_cast<short>(~mask));
+        __m128i lo = _mm_cmpeq_epi16(_mm_and_si128(_mm_loadu_si128(pointer_cast<const __m128i*>(input)), outside), zero);
+        __m128i hi = _mm_cmpeq_epi16(_mm_and_si128(_mm_loadu_si128(pointer_cast<const __m128i*>(input + 8)), outside), zero);
+        return ~static_cast<unsigned>(_mm_movemask_epi8(_mm_packs_epi16(lo, hi))) & 0xffff;
+    } else {
+        const __m128i outside = _mm_set1_epi32(~mask);
+        __m128i a = _mm_cmpeq_epi32(_mm_and_si128(_mm_loadu_si128(pointer_cast<const __m128i*>(input)), outside), zero);
+        __m128i b = _mm_cmpeq_epi32(_mm_and_si128(_mm_loadu_si128(pointer_cast<const __m128i*>(input + 4)), outside), zero);
+        __m128i c = _mm_cmpeq_epi32(_mm_and_si128(_mm_loadu_si128(pointer_cast<const __m128i*>(input + 8)), outside), zero);
+        __m128i d = _mm_cmpeq_epi32(_mm_and_si128(_mm_loadu_si128(pointer_cast<const __m128i*>(input + 12)), outside), zero);
+        __m128i packed = _mm_packs_epi16(_mm_packs_epi32(a, b), _mm_packs_epi32(c, d));
+        return ~static_cast<unsigned>(_mm_movemask_epi8(packed)) & 0xffff;
+    }
+}
+
+// Low bytes of 16 wide characters, valid only for characters below 0x80.
+inline __m128i narrowWide(const wchar_t * input)
+{
+    if(sizeof(wchar_t) == 2)
+        return _mm_packus_epi16(_mm_loadu_si128(pointer_cast<const __m128i*>(input)), _mm_loadu_si128(pointer_cast<const __m128i*>(input + 8)));
+    __m128i lo = _mm_packs_epi32(_mm_loadu_si128(pointer_cast<const __m128i*>(input)), _mm_loadu_si128(pointer_cast<const __m128i*>(input + 4)));
+    __m128i hi = _mm_packs_epi32(_mm_loadu_si128(pointer_cast<const __m128i*>(input + 8)), _mm_loadu_si128(pointer_cast<const __m128i*>(input + 12)));
+    return _mm_packus_epi16(lo, hi);
+}
+
+inline void widenBytes(__m128i chunk, wchar_t * out)
+{
+    const __m128i zero = _mm_setzero_si128();
+    __m128i lo = _mm_unpacklo_epi8(chunk, zero), hi = _mm_unpackhi_epi8(chunk, zero);
+    if(sizeof(wchar_t) == 2)
+    {
+        _mm_storeu_si128(pointer_cast<__m128i*>(out), lo);
+        _mm_storeu_si128(pointer_cast<__m128i*>(out + 8), hi);
+    } else {
+        _mm_storeu_si128(pointer_cast<__m128i*>(out), _mm_unpacklo_epi16(lo, zero));
+        _mm_storeu_si128(pointer_cast<__m128i*>(out + 4), _mm_unpackhi_epi16(lo, zero));
+        _mm_storeu_si128(pointer_cast<__m128i*>(out + 8), _mm_unpacklo_epi16(hi, zero));
+        _mm_storeu_si128(pointer_cast<__m128i*>(out + 12), _mm_unpackhi_epi16(hi, zero));
+    }
+}
+#endif
+
+// Blocks below are stored whole even when only prefix of them is ASCII. Output never gets ahead of input,
+// so while 16 input units are left, 16 output units fit into caller buffer.
+inline size_t widenAscii(const char * begin, const char * end, wchar_t * out)
+{
+    const char * start = begin;
+#if MSTD_UTF8_AVX2
+    for(; end - begin >= 32; begin += 32, out += 32)
+    {
+        __m256i chunk = _mm256_loadu_si256(pointer_cast<const __m256i*>(begin));
+        unsigned mask = static_cast<unsigned>(_mm256_movemask_epi8(chunk));
+        if(sizeof(wchar_t) == 2)
+        {
+            _mm256_storeu_si256(pointer_cast<__m256i*>(out), _mm256_cvtepu8_epi16(_mm_loadu_si128(pointer_cast<const __m128i*>(begin))));
+            _mm256_storeu_si256(pointer_cast<__m256i*>(out + 16), _mm256_cvtepu8_epi16(_mm_loadu_si128(pointer_cast<const __m128i*>(begin + 16))));
+        } else {
+            for(size_t i = 0; i != 4; ++i)
+                _mm256_storeu_si256(pointer_cast<__m256i*>(out + i * 8), _mm256_cvtepu8_epi32(_mm_loadl_epi64(pointer_cast<const __m128i*>(begin + i * 8))));
+        }
+        if(mask)
+            return begin - start + lowestBit(mask);
+    }
+#endif
+#if MSTD_UTF8_SSE2
+    for(; end - begin >= 16; begin += 16, out += 16)
+    {
+        __m128i chunk = _mm_loadu_si128(pointer_cast<const __m128i*>(begin));
+        unsigned mask = static_cast<unsigned>(_mm_movemask_epi8(chunk));
+        widenBytes(chunk, out);
+        if(mask)
+            return begin - start + lowestBit(mask);
+    }
+#endif
+    for(; begin != end && !(*begin & 0x80); ++begin, ++out)
+        *out = static_cast<wchar_t>(*begin);
+    return begin - start;
+}
+
+inline size_t narrowAscii(const wchar_t * begin, const wchar_t * end, char * out)
+{
+    const wchar_t * start = begin;
+#if MSTD_UTF8_SSE2
+    for(; end - begin >= 16; begin += 16, out += 16)
+    {
+        unsigned mask = wideOutside(begin, 0x7f);
+        _mm_storeu_si128(pointer_cast<__m128i*>(out), narrowWide(begin));
+        if(mask)
+            return begin - start + lowestBit(mask);
+    }
+#endif
+    for(; begin != end && !(*begin & ~0x7f); ++begin, ++out)
+        *out = static_cast<char>(*begin);
+    return begin - start;
+}
+
+inline size_t asciiPrefix(const char * begin, const char * end)
+{
+    const char * start = begin;
+#if MSTD_UTF8_SSE2
+    for(; end - begin >= 16; begin += 16)
+    {
+        unsigned mask = static_cast<unsigned>(_mm_movemask_epi8(_mm_loadu_si128(pointer_cast<const __m128i*>(begin))));
+        if(mask)
+            return begin - start + lowestBit(mask);
+    }
+#endif
+    while(begin != end && !(*begin & 0x80))
+        ++begin;
+    return begin - start;
+}
+
+}
+
+wchar_t * deutf8_to(const char * begin, const char * end, wchar_t * out)
+{
+    ptrdiff_t window = 16;
+    for(;;)
+    {
+        size_t ascii = widenAscii(begin, end, out);
+        window = ascii >= 16 ? 16 : std::min<ptrdiff_t>(window * 2, 1024);
+        begin += ascii;
+        out += ascii;
+        if(begin == end)
+            return out;
+        // Text around multibyte characters is decoded here, window grows while SIMD finds no ASCII block,
+        // so non latin text does not go back to SIMD after every character.
+        const char * stop = end - begin > window ? begin + window : end;
+        do {
+            boost::uint32_t word = static_cast<unsigned char>(*begin);
+            if(end - begin >= 3)
+                word |= (static_cast<boost::uint32_t>(static_cast<unsigned char>(begin[1])) << 8) | (static_cast<boost::uint32_t>(static_cast<unsigned char>(begin[2])) << 16);
+            else if(end - begin == 2)
+                word |= static_cast<boost::uint32_t>(static_cast<unsigned char>(begin[1])) << 8;
+            boost::uint32_t value;
+            if(!(word & 0x80))
+            {
+                value = word & 0x7f;
+                ++begin;
+            } else if((word & 0xc0c0f0) == 0x8080e0)
+            {
+                value = ((word & 0x0f) << 12) | ((word & 0x3f00) >> 2) | ((word >> 16) & 0x3f);
+                if(value < 0x800 || (value & 0xf800) == 0xd800)
+                    return 0;
+                begin += 3;
+            } else if((word & 0xc0e0) == 0x80c0)
+            {
+                value = ((word & 0x1f) << 6) | ((word >> 8) & 0x3f);
+                if(value < 0x80)
+                    return 0;
+                begin += 2;
+            } else
+                return 0;
+            *out++ = static_cast<wchar_t>(value);
+        } while(begin < stop);
+    }
+}
+
+char * utf8_to(const wchar_t * begin, const wchar_t * end, char * out)
+{
+    ptrdiff_t window = 16;
+    for(;;)
+    {
+        size_t ascii = narrowAscii(begin, end, out);
+        window = ascii >= 16 ? 16 : std::min<ptrdiff_t>(window * 2, 1024);
+        begin += ascii;
+        out += ascii;
+        if(begin == end)
+            return out;
+        const wchar_t * stop = end - begin > window ? begin + window : end;
+        do {
+            typedef boost::make_unsigned<wchar_t>::type unsigned_wchar;
+            boost::uint32_t c = static_cast<unsigned_wchar>(*begin);
+            if(c < 0x80)
+                *out++ = static_cast<char>(c);
+            else if(c < 0x800)
+            {
+                out[0] = static_cast<char>(0xc0 | (c >> 6));
+                out[1] = static_cast<char>(0x80 | (c & 0x3f));
+                out += 2;
+            } else if(c < 0xd800 || (c >= 0xe000 && c < 0x10000))
+            {
+                out[0] = static_cast<char>(0xe0 | (c >> 12));
+                out[1] = static_cast<char>(0x80 | ((c >> 6) & 0x3f));
+                out[2] = static_cast<char>(0x80 | (c & 0x3f));
+                out += 3;
+            } else
+                return 0;
+            ++begin;
+        } while(begin != stop);
+    }
 }
 
 #if MSTD_USE_PBUFFER 
@@ -154,11 +391,15 @@ std::string MSTD_STDCALL utf8(const wchar_t * src, size_t len)
         std::vector<char> buf(len * max_utf8_length);
 #endif
         char * begin = bufferBegin(buf);
-        char * end = mstd::utf8(src, src + len, begin);
+        char * end = utf8_to(src, src + len, begin);
+        if(!end)
+            end = mstd::utf8(src, src + len, begin);
         return std::string(begin, end);
     } else if(len) {
         char begin[maxStackLen * max_utf8_length];
-        char * end = mstd::utf8(src, src + len, begin);
+        char * end = utf8_to(src, src + len, begin);
+        if(!end)
+            end = mstd::utf8(src, src + len, begin);
         return std::string(begin, end);
     } else
         return std::string();
@@ -324,7 +565,8 @@ private:
 
 size_t deutf8_length(const char * str, size_t len)
 {
-    return deutf8(str, str + len, counter()).value();
+    size_t ascii = asciiPrefix(str, str + len);
+    return ascii + deutf8(str + ascii, str + len, counter()).value();
 }
 
 size_t deutf8_length(const std::string & value)
@@ -334,7 +576,15 @@ size_t deutf8_length(const std::string & value)
 
 size_t utf8_length(const std::wstring & value)
 {
-    return mstd::utf8_length(value.begin(), value.end());
+    const wchar_t * begin = value.c_str();
+    const wchar_t * end = begin + value.length();
+    size_t result = 0;
+#if MSTD_UTF8_SSE2
+    // every character takes one byte, plus one for each of masks it does not fit
+    for(; end - begin >= 16; begin += 16)
+        result += 16 + bitCount(wideOutside(begin, 0x7f)) + bitCount(wideOutside(begin, 0x7ff));
+#endif
+    return result + mstd::utf8_length(begin, end);
 }
 
 bool utf8_length_less(const std::string & value, size_t len)
@@ -355,8 +605,18 @@ std::wstring MSTD_STDCALL deutf8(const std::string & value)
 std::wstring MSTD_STDCALL deutf8(const char * src, size_t len)
 {
     std::wstring result;
-    result.resize(mstd::deutf8_length(src, len));
-    deutf8(src, src + len, result.begin());
+    if(!len)
+        return result;
+    result.resize(len);
+    wchar_t * begin = &result[0];
+    wchar_t * end = deutf8_to(src, src + len, begin);
+    if(end)
+        result.resize(end - begin);
+    else {
+        // invalid input is decoded leniently, as before
+        result.resize(mstd::deutf8_length(src, len));
+        deutf8(src, src + len, result.begin());
+    }
     return std::move(result);
 }
 
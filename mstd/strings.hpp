@@ -45,6 +45,12 @@ MSTD_DECL std::wstring MSTD_STDCALL deutf8(const std::string & value);
 MSTD_DECL std::wstring MSTD_STDCALL deutf8(const char * value);
 MSTD_DECL std::wstring MSTD_STDCALL deutf8(const char * value, size_t len);
 
+// Validating conversions into caller buffers, both return 0 on input they cannot convert.
+// deutf8_to needs room for end - begin characters and accepts UTF-8 of characters up to U+FFFF.
+MSTD_DECL wchar_t * deutf8_to(const char * begin, const char * end, wchar_t * out);
+// utf8_to needs room for (end - begin) * max_utf8_length bytes and rejects surrogates and characters above U+FFFF.
+MSTD_DECL char * utf8_to(const wchar_t * begin, const wchar_t * end, char * out);
+
 MSTD_DECL std::string utf8_to_lower_copy(const std::string & input);
 MSTD_DECL void utf8_to_lower(std::string & str);
 MSTD_DECL bool utf8_iequals(const std::string & lhs, const std::string & rhs);
@@ -29,11 +29,11 @@ public:
             threads_.push_back(boost::shared_ptr<boost::thread>(new boost::thread(std::bind(&impl::execute, this))));
     }
 
-    void enqueue(const std::function<void()> & f)
+    void enqueue(task_type & f)
     {
         {
             boost::lock_guard<boost::mutex> lock(mutex_);
-            queue_.push_back(f);
+            queue_.push_back(std::move(f));
         }
         cond_.notify_one();
     }
@@ -58,7 +58,7 @@ private:
                 cond_.timed_wait(lock, boost::posix_time::milliseconds(100));
                 if(!queue_.empty())
                 {
-                    std::function<void()> f = queue_.front();
+                    task_type f(std::move(queue_.front()));
                     queue_.pop_front();
                     reverse_lock<boost::unique_lock<boost::mutex> > rlock(lock);
                     try {
@@ -78,7 +78,7 @@ private:
     boost::condition_variable cond_;
     boost::mutex mutex_;
     bool finished_;
-    std::deque<std::function<void()> > queue_;
+    std::deque<task_type> queue_;
 };
 
 thread_pool::thread_pool(size_t threads)
@@ -90,7 +90,7 @@ thread_pool::~thread_pool()
 {
 }
 
-void thread_pool::enqueue(const std::function<void()> & f)
+void thread_pool::enqueue(task_type f)
 {
     impl_->enqueue(f);
 }
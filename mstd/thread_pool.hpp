@@ -10,11 +10,15 @@
 
 #include <boost/scoped_ptr.hpp>
 
+#include "unique_function.hpp"
+
 namespace mstd {
 
 class thread_pool {
 public:
-    void enqueue(const std::function<void()> & f);
+    typedef unique_function<void()> task_type;
+
+    void enqueue(task_type f);
 
     thread_pool(size_t threads);
     ~thread_pool();
@@ -8,10 +8,19 @@
 */
 #pragma once
 
+#include <limits>
 #include <vector>
 
+#include <boost/noncopyable.hpp>
+#include <boost/static_assert.hpp>
+
 #include <boost/mpl/if.hpp>
 
+#include <boost/type_traits/is_integral.hpp>
+#include <boost/type_traits/is_pointer.hpp>
+
+#include "atomic.hpp"
+
 namespace mstd {
 
 namespace detail {
@@ -67,7 +76,7 @@ public:
                      const typename boost::enable_if<
                         boost::mpl::and_<boost::is_convertible<I2, Impl>,
                                          boost::mpl::bool_<isconst> >,
-                        int>::type dummy = 0)
+                        int>::type = 0)
         : impl_(rhs.impl()), end_(rhs.end()) {}
 
     tid_map_iterator(Impl impl, Impl end)
@@ -127,6 +136,7 @@ public:
     typedef detail::key_traits<Key> traits;
     typedef typename traits::version_type version_type;
     typedef typename traits::index_type index_type;
+    typedef Key full_type;
 
     tid_map_key(Key src)
         : impl_(src) {}
@@ -255,4 +265,187 @@ private:
     index_type head_;
 };
 
+// tid_map that could be used from many threads without external lock.
+// Nodes live in segments that are allocated once and never move, so lookup only reads node version and value,
+// and checks version again, so value of node erased or reused meanwhile is never returned.
+// Free nodes form lock free list, its head is key of the first free node, so version changed by insert and erase
+// of the same node protects list from ABA.
+// Value should be pointer or integral, so it could be read atomically.
+template<class Key, class Value>
+class concurrent_tid_map : private boost::noncopyable {
+    BOOST_STATIC_ASSERT((boost::is_pointer<Value>::value || boost::is_integral<Value>::value));
+public:
+    typedef Key key_type;
+    typedef Value mapped_type;
+    typedef typename key_type::index_type index_type;
+    typedef typename key_type::version_type version_type;
+    typedef typename key_type::full_type full_type;
+
+    static const size_t segment_bits = 8;
+    static const size_t segment_size = 1 << segment_bits;
+    // the last index marks end of free list
+    static const size_t capacity = std::numeric_limits<index_type>::max();
+    static const size_t max_segments = (capacity + segment_size) / segment_size;
+
+    concurrent_tid_map()
+        : free_(key_type(capacity, 0).full()), used_(0), size_(0)
+    {
+        for(size_t i = 0; i != max_segments; ++i)
+            segments_[i] = 0;
+    }
+
+    ~concurrent_tid_map()
+    {
+        for(size_t i = 0; i != max_segments; ++i)
+            delete segments_[i];
+    }
+
+    bool find(key_type key, mapped_type & out) const
+    {
+        const node * n = get(key.index());
+        if(!n)
+            return false;
+        version_type version = n->version;
+        if(version != key.version() || (version & 1))
+            return false;
+        mapped_type value = n->value;
+        if(n->version != version)
+            return false;
+        out = value;
+        return true;
+    }
+
+    // Returns false when all capacity nodes are used.
+    bool insert(const mapped_type & value, key_type & out)
+    {
+        size_t index = pop();
+        if(index == capacity)
+        {
+            index = used_++;
+            if(index >= capacity)
+            {
+                --used_;
+                return false;
+            }
+        }
+
+        node & n = ensure(index);
+        n.value = value;
+        version_type version = static_cast<version_type>(n.version + 1);
+        n.version = version;
+        ++size_;
+        out = key_type(index, version);
+        return true;
+    }
+
+    bool erase(key_type key)
+    {
+        node * n = get(key.index());
+        if(!n || (key.version() & 1))
+            return false;
+        version_type version = static_cast<version_type>(key.version() + 1);
+        if(n->version.cas(version, key.version()) != key.version())
+            return false;
+        n->value = mapped_type();
+        --size_;
+        push(key.index(), version);
+        return true;
+    }
+
+    size_t size() const
+    {
+        return size_;
+    }
+
+    // Visits nodes allocated at the moment of visit, with their keys.
+    template<class F>
+    void for_each(const F & f) const
+    {
+        size_t used = std::min<size_t>(used_, capacity);
+        for(size_t i = 0; i != used; ++i)
+        {
+            const node * n = get(i);
+            if(!n)
+                continue;
+            version_type version = n->version;
+            if(version & 1)
+                continue;
+            mapped_type value = n->value;
+            if(n->version == version)
+                f(key_type(i, version), value);
+        }
+    }
+private:
+    struct node {
+        atomic<version_type> version;
+        atomic<mapped_type> value;
+        // key of the next free node, valid only while node is free
+        atomic<full_type> next;
+
+        node()
+            : version(1), value(mapped_type()), next(0) {}
+    };
+
+    struct segment {
+        node nodes[segment_size];
+    };
+
+    node * get(size_t index) const
+    {
+        if(index >= capacity)
+            return 0;
+        segment * s = segments_[index >> segment_bits];
+        return s ? &s->nodes[index & (segment_size - 1)] : 0;
+    }
+
+    node & ensure(size_t index)
+    {
+        atomic<segment*> & slot = segments_[index >> segment_bits];
+        segment * s = slot;
+        if(!s)
+        {
+            segment * created = new segment;
+            s = slot.cas(created, 0);
+            if(s)
+                delete created;
+            else
+                s = created;
+        }
+        return s->nodes[index & (segment_size - 1)];
+    }
+
+    size_t pop()
+    {
+        for(;;)
+        {
+            key_type head(free_);
+            if(head.index() == capacity)
+                return capacity;
+            node * n = get(head.index());
+            full_type next = n->next;
+            // version in head changes on every reuse of node, so stale next is never installed
+            if(free_.cas(next, head.full()) == head.full())
+                return head.index();
+        }
+    }
+
+    void push(size_t index, version_type version)
+    {
+        node * n = get(index);
+        key_type key(index, version);
+        for(;;)
+        {
+            full_type head = free_;
+            n->next = head;
+            if(free_.cas(key.full(), head) == head)
+                return;
+        }
+    }
+
+    mutable atomic<segment*> segments_[max_segments];
+    atomic<full_type> free_;
+    atomic<size_t> used_;
+    atomic<size_t> size_;
+};
+
 }
@@ -0,0 +1,278 @@
+/*
+** The author disclaims copyright to this source code.  In place of
+** a legal notice, here is a blessing:
+**
+**    May you do good and not evil.
+**    May you find forgiveness for yourself and forgive others.
+**    May you share freely, never taking more than you give.
+*/
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+#include <boost/throw_exception.hpp>
+
+namespace mstd {
+
+template<class Signature, size_t Size = 4 * sizeof(void*)>
+class unique_function;
+
+namespace detail {
+    template<class R, class... Args>
+    struct unique_function_ops {
+        R (*invoke)(void * storage, Args &&... args);
+        // Move constructs callable at to and destroys it at from.
+        void (*move)(void * from, void * to);
+        void (*destroy)(void * storage);
+    };
+
+    template<class F, bool Inline, class R, class... Args>
+    struct unique_function_impl;
+
+    // Whether F could be stored to unique_function Function, i.e. is callable with Args and result converts to R.
+    template<class F, class Function, class R, class... Args>
+    struct unique_function_callable {
+        template<class G>
+        static auto test(int)
+            -> decltype(static_cast<R>(std::declval<G&>()(std::declval<Args>()...)), std::true_type());
+
+        template<class G>
+        static std::false_type test(...);
+
+        static const bool value = !std::is_same<F, Function>::value && decltype(test<F>(0))::value;
+    };
+
+    // Empty std::function and null function pointer make empty unique_function.
+    template<class F>
+    bool unique_function_null(const F &)
+    {
+        return false;
+    }
+
+    template<class Signature>
+    bool unique_function_null(const std::function<Signature> & f)
+    {
+        return !f;
+    }
+
+    template<class R, class... Args>
+    bool unique_function_null(R (*f)(Args...))
+    {
+        return !f;
+    }
+
+    template<class F, class R, class... Args>
+    struct unique_function_impl<F, true, R, Args...> {
+        static F & get(void * storage)
+        {
+            return *static_cast<F*>(storage);
+        }
+
+        template<class G>
+        static void create(void * storage, G && g)
+        {
+            new (storage) F(std::forward<G>(g));
+        }
+
+        static R invoke(void * storage, Args &&... args)
+        {
+            return static_cast<R>(get(storage)(std::forward<Args>(args)...));
+        }
+
+        static void move(void * from, void * to)
+        {
+            new (to) F(std::move(get(from)));
+            get(from).~F();
+        }
+
+        static void destroy(void * storage)
+        {
+            get(storage).~F();
+        }
+
+        static const unique_function_ops<R, Args...> ops;
+    };
+
+    template<class F, class R, class... Args>
+    const unique_function_ops<R, Args...> unique_function_impl<F, true, R, Args...>::ops = {
+        &unique_function_impl::invoke, &unique_function_impl::move, &unique_function_impl::destroy
+    };
+
+    template<class F, class R, class... Args>
+    struct unique_function_impl<F, false, R, Args...> {
+        static F *& get(void * storage)
+        {
+            return *static_cast<F**>(storage);
+        }
+
+        template<class G>
+        static void create(void * storage, G && g)
+        {
+            get(storage) = new F(std::forward<G>(g));
+        }
+
+        static R invoke(void * storage, Args &&... args)
+        {
+            return static_cast<R>((*get(storage))(std::forward<Args>(args)...));
+        }
+
+        static void move(void * from, void * to)
+        {
+            get(to) = get(from);
+        }
+
+        static void destroy(void * storage)
+        {
+            delete get(storage);
+        }
+
+        static const unique_function_ops<R, Args...> ops;
+    };
+
+    template<class F, class R, class... Args>
+    const unique_function_ops<R, Args...> unique_function_impl<F, false, R, Args...>::ops = {
+        &unique_function_impl::invoke, &unique_function_impl::move, &unique_function_impl::destroy
+    };
+}
+
+// Move only replacement of std::function. Callables up to Size bytes with nothrow move are stored inline,
+// so posting lambda that captures few pointers does not allocate, larger ones are moved to heap.
+// Callable does not have to be copyable, std::function is accepted as callable. Empty std::function and null
+// function pointer give empty unique_function.
+template<class R, class... Args, size_t Size>
+class unique_function<R(Args...), Size> {
+    typedef typename std::aligned_storage<Size>::type storage_type;
+public:
+    typedef R result_type;
+    static const size_t inline_size = Size;
+
+    // Whether callable of type F is stored without allocation.
+    template<class F>
+    struct fits {
+        static const bool value = sizeof(F) <= Size && std::alignment_of<F>::value <= std::alignment_of<storage_type>::value &&
+                                  std::is_nothrow_move_constructible<F>::value;
+    };
+
+    // Whether F is accepted by constructor and assignment, so overloads on unique_function types resolve by signature.
+    template<class F>
+    struct callable : detail::unique_function_callable<F, unique_function, R, Args...> {};
+
+    unique_function()
+        : ops_(0) {}
+
+    unique_function(std::nullptr_t)
+        : ops_(0) {}
+
+    template<class F, class = typename std::enable_if<callable<F>::value>::type>
+    unique_function(F f)
+        : ops_(0)
+    {
+        if(detail::unique_function_null(f))
+            return;
+        typedef detail::unique_function_impl<F, fits<F>::value, R, Args...> impl;
+        impl::create(&storage_, std::move(f));
+        ops_ = &impl::ops;
+    }
+
+    unique_function(unique_function && rhs)
+        : ops_(rhs.ops_)
+    {
+        if(ops_)
+        {
+            ops_->move(&rhs.storage_, &storage_);
+            rhs.ops_ = 0;
+        }
+    }
+
+    ~unique_function()
+    {
+        reset();
+    }
+
+    unique_function & operator=(unique_function && rhs)
+    {
+        if(this != &rhs)
+        {
+            reset();
+            if(rhs.ops_)
+            {
+                rhs.ops_->move(&rhs.storage_, &storage_);
+                ops_ = rhs.ops_;
+                rhs.ops_ = 0;
+            }
+        }
+        return *this;
+    }
+
+    unique_function & operator=(std::nullptr_t)
+    {
+        reset();
+        return *this;
+    }
+
+    template<class F>
+    typename std::enable_if<callable<F>::value, unique_function &>::type operator=(F f)
+    {
+        return *this = unique_function(std::move(f));
+    }
+
+    R operator()(Args... args) const
+    {
+        if(!ops_)
+            boost::throw_exception(std::bad_function_call());
+        return ops_->invoke(const_cast<storage_type*>(&storage_), std::forward<Args>(args)...);
+    }
+
+    explicit operator bool() const
+    {
+        return ops_ != 0;
+    }
+
+    bool empty() const
+    {
+        return !ops_;
+    }
+
+    void swap(unique_function & rhs)
+    {
+        unique_function temp(std::move(rhs));
+        rhs = std::move(*this);
+        *this = std::move(temp);
+    }
+private:
+    void reset()
+    {
+        if(ops_)
+        {
+            ops_->destroy(&storage_);
+            ops_ = 0;
+        }
+    }
+
+    storage_type storage_;
+    const detail::unique_function_ops<R, Args...> * ops_;
+};
+
+template<class Signature, size_t Size>
+void swap(unique_function<Signature, Size> & lhs, unique_function<Signature, Size> & rhs)
+{
+    lhs.swap(rhs);
+}
+
+template<class Signature, size_t Size>
+bool operator==(const unique_function<Signature, Size> & lhs, std::nullptr_t)
+{
+    return lhs.empty();
+}
+
+template<class Signature, size_t Size>
+bool operator!=(const unique_function<Signature, Size> & lhs, std::nullptr_t)
+{
+    return !lhs.empty();
+}
+
+}
@@ -19,6 +19,10 @@ namespace mstd { namespace detail {
 
 inline void memory_fence() { _ReadWriteBarrier(); }
 
+// x86 does not reorder loads with loads and stores with stores, so only compiler should be stopped.
+inline void acquire_fence() { _ReadWriteBarrier(); }
+inline void release_fence() { _ReadWriteBarrier(); }
+
 template<size_t Size>
 struct atomic_helper;
 
@@ -22,6 +22,15 @@ extern "C" void _mm_pause();
 
 namespace mstd {
 
+inline void cpu_relax()
+{
+#if BOOST_WINDOWS
+    _mm_pause();
+#else
+    __asm__ __volatile__( "rep; nop" : : : "memory" );
+#endif
+}
+
 inline void yield(size_t k)
 {
     if( k < 4 ) ;
@@ -18,62 +18,91 @@
 
 namespace nexus {
 
+// Flags and number of pending operations are packed into one word, so prepare and complete are single atomic operations
+// in uncontended case, and finish could not miss operation started concurrently.
 class NEXUS_DECL AsyncOperations : public boost::noncopyable {
 public:
     explicit AsyncOperations(bool active)
-        : asyncOperations_(0), shuttingDown_(active ? 0 : 1) {}
+        : state_(active ? 0 : inactive) {}
 
     bool finish()
     {
-        bool result = !asyncOperations_.cas(finishing * 2, 0);
-        if(result)
-            shutdown();
-        return result;
+        boost::uint32_t state = peek();
+        while(!(state & (countMask | finished)))
+        {
+            boost::uint32_t old = state_.cas(state | inactive | finished, state);
+            if(old == state)
+                return true;
+            state = old;
+        }
+        return false;
     }
     
     int count()
     {
-        return asyncOperations_;
+        return state_ & countMask;
     }
 
     bool shutdown()
     {
-        return !shuttingDown_.cas(1, 0);
+        boost::uint32_t state = peek();
+        while(!(state & inactive))
+        {
+            boost::uint32_t old = state_.cas(state | inactive, state);
+            if(old == state)
+                return true;
+            state = old;
+        }
+        return false;
     }
 
     bool prepare()
     {
-        if(active())
-            return ++asyncOperations_ <= finishing;
-        else
-            return false;
+        boost::uint32_t state = peek();
+        while(!(state & inactive))
+        {
+            boost::uint32_t old = state_.cas(state + 1, state);
+            if(old == state)
+                return true;
+            state = old;
+        }
+        return false;
     }
     
     boost::uint32_t complete()
     {
-        return --asyncOperations_;
+        return --state_ & countMask;
     }
     
     bool active()
     {
-        return !shuttingDown_;
+        return !(state_ & inactive);
     }
     
     bool activate()
     {
-        boost::uint32_t old = shuttingDown_.cas(0, 1);
-        if(old)
+        boost::uint32_t state = peek();
+        while(state & inactive)
         {
-            asyncOperations_ = 0;
-            return true;
-        } else
-            return false;
+            boost::uint32_t old = state_.cas(0, state);
+            if(old == state)
+                return true;
+            state = old;
+        }
+        return false;
     }
 private:
-    mstd::atomic<boost::uint32_t> asyncOperations_;
-    mstd::atomic<boost::uint32_t> shuttingDown_;
+    // plain read without fence, it is only a guess validated by the following cas
+    boost::uint32_t peek()
+    {
+        return state_._direct_reference();
+    }
+
+    mstd::atomic<boost::uint32_t> state_;
 
-    static const boost::uint32_t finishing = 0xffff;
+    static const boost::uint32_t inactive = 0x80000000;
+    static const boost::uint32_t finished = 0x40000000;
+    static const boost::uint32_t countMask = 0x3fffffff;
 };
 
 }
@@ -0,0 +1,204 @@
+/*
+** The author disclaims copyright to this source code.  In place of
+** a legal notice, here is a blessing:
+**
+**    May you do good and not evil.
+**    May you find forgiveness for yourself and forgive others.
+**    May you share freely, never taking more than you give.
+*/
+#pragma once
+
+#ifndef NEXUS_BUILDING
+
+#include <algorithm>
+#include <unordered_map>
+#include <vector>
+
+#include <boost/asio/io_service.hpp>
+#include <boost/intrusive_ptr.hpp>
+#include <boost/noncopyable.hpp>
+
+#include <mstd/atomic.hpp>
+#include <mstd/reference_counter.hpp>
+
+#endif
+
+#include "Buffer.h"
+#include "Clock.h"
+
+namespace nexus {
+
+struct BroadcastStats {
+    size_t recipients;
+    size_t delivered;
+    // send queue of recipient was over the limit
+    size_t skipped;
+    // recipient was already shutting down
+    size_t inactive;
+    // from broadcast call till the last recipient got the buffer queued
+    Microseconds latency;
+};
+
+// Sends the same buffer to many connections.
+// Targets are grouped by io_service they are running on, and each group is split to batches of at most batchSize
+// connections, every batch is one task posted to that io_service. So the buffer is encoded once, there is one post
+// per batch instead of one per connection, and all threads running io_service take part in the fan-out.
+// Ptr is an owning pointer to Connection descendant, it keeps connection alive while the task is pending.
+template<class Ptr>
+class Broadcaster : public boost::noncopyable {
+public:
+    typedef std::function<void(const BroadcastStats &)> Listener;
+
+    explicit Broadcaster(size_t queueLimit = 1 << 20, size_t batchSize = 256)
+        : queueLimit_(queueLimit), batchSize_(std::max<size_t>(batchSize, 1)), totals_(new Totals) {}
+
+    void queueLimit(size_t value)
+    {
+        queueLimit_ = value;
+    }
+
+    void batchSize(size_t value)
+    {
+        batchSize_ = std::max<size_t>(value, 1);
+    }
+
+    template<class Range>
+    void broadcast(const char * data, size_t len, const Range & targets, const Listener & listener = Listener())
+    {
+        broadcast(Buffer(data, len), targets, listener);
+    }
+
+    template<class Range>
+    void broadcast(const Buffer & buffer, const Range & targets, const Listener & listener = Listener())
+    {
+        ++totals_->broadcasts;
+
+        Shards shards;
+        size_t recipients = 0;
+        size_t batches = 0;
+        for(typename Range::const_iterator i = targets.begin(), end = targets.end(); i != end; ++i)
+        {
+            Batches & shard = shards[&(*i)->ioService()];
+            if(shard.empty() || shard.back()->size() == batchSize_)
+            {
+                shard.push_back(std::make_shared<Targets>());
+                ++batches;
+            }
+            shard.back()->push_back(*i);
+            ++recipients;
+        }
+
+        FanoutPtr fanout(new Fanout(totals_, buffer, queueLimit_, recipients, batches, listener));
+        if(!batches)
+            fanout->complete();
+        for(typename Shards::const_iterator i = shards.begin(), end = shards.end(); i != end; ++i)
+            for(typename Batches::const_iterator j = i->second.begin(), jend = i->second.end(); j != jend; ++j)
+                i->first->post(Batch(fanout, *j));
+    }
+
+    size_t broadcasts() const
+    {
+        return totals_->broadcasts;
+    }
+
+    size_t delivered() const
+    {
+        return totals_->delivered;
+    }
+
+    size_t skipped() const
+    {
+        return totals_->skipped;
+    }
+private:
+    typedef std::vector<Ptr> Targets;
+    typedef std::vector<std::shared_ptr<Targets> > Batches;
+    typedef std::unordered_map<boost::asio::io_service*, Batches> Shards;
+
+    // Shared with pending fan-outs, so batches completing after Broadcaster is destroyed do not touch it.
+    struct Totals : mstd::reference_counter<Totals> {
+        mstd::atomic<size_t> broadcasts;
+        mstd::atomic<size_t> delivered;
+        mstd::atomic<size_t> skipped;
+
+        Totals()
+            : broadcasts(0), delivered(0), skipped(0) {}
+    };
+
+    typedef boost::intrusive_ptr<Totals> TotalsPtr;
+
+    class Fanout : public mstd::reference_counter<Fanout> {
+    public:
+        Fanout(const TotalsPtr & totals, const Buffer & buffer, size_t limit, size_t recipients, size_t batches,
+               const Listener & listener)
+            : totals_(totals), buffer_(buffer), limit_(limit), batches_(batches), listener_(listener),
+              start_(Clock::microseconds()), delivered_(0), skipped_(0), inactive_(0)
+        {
+            stats_.recipients = recipients;
+        }
+
+        void deliver(const Ptr & target)
+        {
+            if(!target->active())
+                ++inactive_;
+            else if(target->trySend(buffer_, limit_))
+                ++delivered_;
+            else
+                ++skipped_;
+        }
+
+        void batchDone()
+        {
+            if(!--batches_)
+                complete();
+        }
+
+        void complete()
+        {
+            stats_.delivered = delivered_;
+            stats_.skipped = skipped_;
+            stats_.inactive = inactive_;
+            stats_.latency = Clock::microseconds() - start_;
+
+            totals_->delivered += stats_.delivered;
+            totals_->skipped += stats_.skipped;
+            if(listener_)
+                listener_(stats_);
+        }
+    private:
+        TotalsPtr totals_;
+        Buffer buffer_;
+        size_t limit_;
+        mstd::atomic<size_t> batches_;
+        Listener listener_;
+        Microseconds start_;
+        mstd::atomic<size_t> delivered_;
+        mstd::atomic<size_t> skipped_;
+        mstd::atomic<size_t> inactive_;
+        BroadcastStats stats_;
+    };
+
+    typedef boost::intrusive_ptr<Fanout> FanoutPtr;
+
+    class Batch {
+    public:
+        Batch(const FanoutPtr & fanout, const std::shared_ptr<Targets> & targets)
+            : fanout_(fanout), targets_(targets) {}
+
+        void operator()() const
+        {
+            for(typename Targets::const_iterator i = targets_->begin(), end = targets_->end(); i != end; ++i)
+                fanout_->deliver(*i);
+            fanout_->batchDone();
+        }
+    private:
+        FanoutPtr fanout_;
+        std::shared_ptr<Targets> targets_;
+    };
+
+    size_t queueLimit_;
+    size_t batchSize_;
+    TotalsPtr totals_;
+};
+
+}
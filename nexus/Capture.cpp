@@ -0,0 +1,383 @@
+/*
+** The author disclaims copyright to this source code.  In place of
+** a legal notice, here is a blessing:
+**
+**    May you do good and not evil.
+**    May you find forgiveness for yourself and forgive others.
+**    May you share freely, never taking more than you give.
+*/
+#include "pch.h"
+
+#include <fstream>
+
+#include "Capture.h"
+
+MLOG_DECLARE_LOGGER(nexus_capture);
+
+namespace nexus {
+
+mstd::atomic<bool> PacketCapture::active_(false);
+mstd::atomic<bool> PacketCapture::all_(false);
+
+namespace {
+
+const boost::uint32_t pcapMagic = 0xa1b2c3d4;
+const boost::uint32_t linkTypeUser0 = 147;
+const size_t pseudoHeader = 16;
+
+// Written only by owner thread. Slot sequence is odd while it is written and index * 2 + 2 after that,
+// so reader could detect slot overwritten while it was copied.
+class CaptureRing : public boost::noncopyable {
+public:
+    explicit CaptureRing(boost::uint32_t id)
+        : id_(id), next_(0), head_(0), slots_(PacketCapture::ringSlots), alive_(true)
+    {
+        for(std::vector<Slot>::iterator i = slots_.begin(), end = slots_.end(); i != end; ++i)
+            i->seq = 0;
+    }
+
+    void record(boost::uint64_t connection, CaptureDirection direction, boost::uint16_t code, const char * data, size_t len)
+    {
+        boost::uint64_t index = next_++;
+        Slot & slot = slots_[index & (PacketCapture::ringSlots - 1)];
+        slot.seq.read_write(index * 2 + 1);
+
+        CapturedPacket & packet = slot.packet;
+        packet.time = Clock::microseconds();
+        packet.connection = connection;
+        packet.thread = id_;
+        packet.length = static_cast<boost::uint32_t>(len);
+        packet.code = code;
+        packet.direction = static_cast<boost::uint8_t>(direction);
+        packet.captured = static_cast<boost::uint8_t>(std::min(len, PacketCapture::snapLength));
+        memcpy(packet.data, data, packet.captured);
+
+        slot.seq = index * 2 + 2;
+        head_ = index + 1;
+    }
+
+    void collect(std::vector<CapturedPacket> & out)
+    {
+        boost::uint64_t head = head_;
+        boost::uint64_t index = head > PacketCapture::ringSlots ? head - PacketCapture::ringSlots : 0;
+        for(; index != head; ++index)
+        {
+            Slot & slot = slots_[index & (PacketCapture::ringSlots - 1)];
+            boost::uint64_t seq = index * 2 + 2;
+            if(slot.seq != seq)
+                continue;
+            out.push_back(slot.packet);
+            // full barrier, so copy is not moved after the check
+            if(slot.seq.cas(seq, seq) != seq)
+                out.pop_back();
+        }
+    }
+
+    void finished()
+    {
+        alive_ = false;
+    }
+
+    bool alive() const
+    {
+        return alive_;
+    }
+private:
+    struct Slot {
+        mstd::atomic<boost::uint64_t> seq;
+        CapturedPacket packet;
+    };
+
+    boost::uint32_t id_;
+    boost::uint64_t next_;
+    mstd::atomic<boost::uint64_t> head_;
+    std::vector<Slot> slots_;
+    mstd::atomic<bool> alive_;
+};
+
+typedef boost::shared_ptr<CaptureRing> CaptureRingPtr;
+
+// Owned by thread, marks its ring finished on thread exit, so clear could release it.
+class ThreadRing {
+public:
+    explicit ThreadRing(const CaptureRingPtr & ring)
+        : ring_(ring) {}
+
+    ~ThreadRing()
+    {
+        ring_->finished();
+    }
+
+    CaptureRing & ring()
+    {
+        return *ring_;
+    }
+private:
+    CaptureRingPtr ring_;
+};
+
+class Rings {
+public:
+    Rings()
+        : nextId_(0), cleared_(0), filtered_(false)
+    {
+        for(size_t i = 0; i != sizeof(codes_) / sizeof(codes_[0]); ++i)
+            codes_[i] = 0;
+    }
+
+    CaptureRing & threadRing()
+    {
+        ThreadRing * result = thread_.get();
+        if(!result)
+        {
+            CaptureRingPtr ring;
+            {
+                boost::lock_guard<boost::mutex> lock(mutex_);
+                ring.reset(new CaptureRing(nextId_++));
+                rings_.push_back(ring);
+            }
+            thread_.reset(result = new ThreadRing(ring));
+        }
+        return result->ring();
+    }
+
+    std::vector<CaptureRingPtr> rings()
+    {
+        boost::lock_guard<boost::mutex> lock(mutex_);
+        return rings_;
+    }
+
+    void clear()
+    {
+        std::vector<CaptureRingPtr> temp;
+        {
+            boost::lock_guard<boost::mutex> lock(mutex_);
+            for(std::vector<CaptureRingPtr>::const_iterator i = rings_.begin(), end = rings_.end(); i != end; ++i)
+                if((*i)->alive())
+                    temp.push_back(*i);
+            temp.swap(rings_);
+        }
+        // rings of alive threads are still referenced, so old records are dropped by collect
+        cleared_ = Clock::microseconds();
+    }
+
+    Microseconds cleared() const
+    {
+        return cleared_;
+    }
+
+    bool accepts(boost::uint16_t code) const
+    {
+        if(!filtered_)
+            return true;
+        return code != PacketCapture::noCode && (codes_[code >> 5] & (1U << (code & 0x1f)));
+    }
+
+    void filter(PacketCode code, bool value)
+    {
+        boost::lock_guard<boost::mutex> lock(mutex_);
+        if(value)
+            codes_[code >> 5] |= 1U << (code & 0x1f);
+        else
+            codes_[code >> 5] &= ~(1U << (code & 0x1f));
+        updateFiltered();
+    }
+
+    void clearFilter()
+    {
+        boost::lock_guard<boost::mutex> lock(mutex_);
+        for(size_t i = 0; i != sizeof(codes_) / sizeof(codes_[0]); ++i)
+            codes_[i] = 0;
+        updateFiltered();
+    }
+
+    bool filtered() const
+    {
+        return filtered_;
+    }
+private:
+    void updateFiltered()
+    {
+        bool result = false;
+        for(size_t i = 0; i != sizeof(codes_) / sizeof(codes_[0]); ++i)
+            result = result || codes_[i];
+        filtered_ = result;
+    }
+
+    boost::mutex mutex_;
+    boost::uint32_t nextId_;
+    std::vector<CaptureRingPtr> rings_;
+    boost::thread_specific_ptr<ThreadRing> thread_;
+    mstd::atomic<Microseconds> cleared_;
+    volatile boost::uint32_t codes_[8];
+    volatile bool filtered_;
+};
+
+Rings & rings()
+{
+    static Rings result;
+    return result;
+}
+
+bool timeLess(const CapturedPacket & lhs, const CapturedPacket & rhs)
+{
+    return lhs.time < rhs.time;
+}
+
+template<class T>
+void writeRaw(std::ostream & out, T value)
+{
+    out.write(static_cast<const char*>(static_cast<const void*>(&value)), sizeof(value));
+}
+
+const char * directionName(boost::uint8_t direction)
+{
+    return direction == cdIn ? "in" : "out";
+}
+
+}
+
+void PacketCapture::enable(bool value)
+{
+    if(value)
+        rings();
+    active_ = value;
+}
+
+void PacketCapture::captureAll(bool value)
+{
+    all_ = value;
+}
+
+void PacketCapture::filterCode(PacketCode code, bool value)
+{
+    rings().filter(code, value);
+}
+
+void PacketCapture::clearFilter()
+{
+    rings().clearFilter();
+}
+
+bool PacketCapture::filtered()
+{
+    return rings().filtered();
+}
+
+void PacketCapture::record(boost::uint64_t connection, CaptureDirection direction, boost::uint16_t code, const char * data, size_t len)
+{
+    Rings & all = rings();
+    if(all.accepts(code))
+        all.threadRing().record(connection, direction, code, data, len);
+}
+
+std::vector<CapturedPacket> PacketCapture::collect(size_t limit)
+{
+    Rings & all = rings();
+    std::vector<CaptureRingPtr> temp = all.rings();
+    std::vector<CapturedPacket> result;
+    for(std::vector<CaptureRingPtr>::const_iterator i = temp.begin(), end = temp.end(); i != end; ++i)
+        (*i)->collect(result);
+
+    Microseconds cleared = all.cleared();
+    if(cleared)
+        result.erase(std::remove_if(result.begin(), result.end(), [cleared](const CapturedPacket & packet) { return packet.time < cleared; }), result.end());
+
+    std::stable_sort(result.begin(), result.end(), &timeLess);
+    if(limit && result.size() > limit)
+        result.erase(result.begin(), result.end() - limit);
+    return result;
+}
+
+void PacketCapture::clear()
+{
+    rings().clear();
+}
+
+void PacketCapture::writePcap(std::ostream & out, const std::vector<CapturedPacket> & packets)
+{
+    writeRaw(out, pcapMagic);
+    writeRaw(out, static_cast<boost::uint16_t>(2));
+    writeRaw(out, static_cast<boost::uint16_t>(4));
+    writeRaw(out, static_cast<boost::int32_t>(0));
+    writeRaw(out, static_cast<boost::uint32_t>(0));
+    writeRaw(out, static_cast<boost::uint32_t>(pseudoHeader + snapLength));
+    writeRaw(out, linkTypeUser0);
+
+    for(std::vector<CapturedPacket>::const_iterator i = packets.begin(), end = packets.end(); i != end; ++i)
+    {
+        writeRaw(out, static_cast<boost::uint32_t>(i->time / 1000000));
+        writeRaw(out, static_cast<boost::uint32_t>(i->time % 1000000));
+        writeRaw(out, static_cast<boost::uint32_t>(pseudoHeader + i->captured));
+        writeRaw(out, static_cast<boost::uint32_t>(pseudoHeader + i->length));
+
+        writeRaw(out, mstd::hton(i->connection));
+        writeRaw(out, mstd::hton(i->thread));
+        writeRaw(out, i->direction);
+        writeRaw(out, static_cast<boost::uint8_t>(0));
+        writeRaw(out, mstd::hton(i->code));
+        out.write(i->data, i->captured);
+    }
+}
+
+void PacketCapture::print(std::ostream & out, const std::vector<CapturedPacket> & packets)
+{
+    for(std::vector<CapturedPacket>::const_iterator i = packets.begin(), end = packets.end(); i != end; ++i)
+    {
+        out << Clock::posix(i->time / 1000) << " conn = " << std::hex << i->connection << std::dec << ", thread = " << i->thread
+            << ", " << directionName(i->direction);
+        if(i->code != noCode)
+            out << ", code = " << i->code;
+        out << ", len = " << i->length << ": " << mlog::dump(i->data, i->captured) << std::endl;
+    }
+}
+
+bool PacketCapture::command(std::ostream & out, const std::vector<std::string> & args)
+{
+    if(args.empty() || args[0] != "capture")
+        return false;
+
+    std::string action = args.size() > 1 ? args[1] : std::string();
+    if(action == "on")
+    {
+        if(args.size() > 2 && args[2] == "all")
+            captureAll(true);
+        enable(true);
+    } else if(action == "off")
+        enable(false);
+    else if(action == "all" && args.size() > 2)
+        captureAll(args[2] == "on");
+    else if(action == "codes")
+    {
+        clearFilter();
+        for(size_t i = 2; i < args.size(); ++i)
+            filterCode(static_cast<PacketCode>(mstd::str2int10<int>(args[i])), true);
+    } else if(action == "show")
+        print(out, collect(args.size() > 2 ? mstd::str2int10<size_t>(args[2]) : 20));
+    else if(action == "dump" && args.size() > 2)
+    {
+        std::vector<CapturedPacket> packets = collect();
+        std::ofstream file(args[2].c_str(), std::ios::binary);
+        if(!file)
+        {
+            out << "Failed to open " << args[2] << std::endl;
+            return true;
+        }
+        writePcap(file, packets);
+        out << packets.size() << " packets written to " << args[2] << std::endl;
+        MLOG_NOTICE("capture dump: " << args[2] << ", packets = " << packets.size());
+        return true;
+    } else if(action == "clear")
+        clear();
+    else if(!action.empty())
+    {
+        out << "usage: capture on [all] | off | all on|off | codes [code...] | show [count] | dump path | clear" << std::endl;
+        return true;
+    }
+
+    out << "capture " << (active_ ? "on" : "off") << ", all = " << (all_ ? "on" : "off") << ", filtered = " << (filtered() ? "yes" : "no")
+        << ", threads = " << rings().rings().size() << std::endl;
+    return true;
+}
+
+}
@@ -0,0 +1,102 @@
+/*
+** The author disclaims copyright to this source code.  In place of
+** a legal notice, here is a blessing:
+**
+**    May you do good and not evil.
+**    May you find forgiveness for yourself and forgive others.
+**    May you share freely, never taking more than you give.
+*/
+#pragma once
+
+#ifndef NEXUS_BUILDING
+
+#include <iosfwd>
+#include <string>
+#include <vector>
+
+#include <boost/cstdint.hpp>
+
+#include <mstd/atomic.hpp>
+
+#endif
+
+#include "Config.h"
+
+#include "Clock.h"
+#include "Packet.h"
+
+namespace nexus {
+
+enum CaptureDirection {
+    cdIn,
+    cdOut,
+};
+
+struct NEXUS_DECL CapturedPacket {
+    static const size_t snapLength = 0x40;
+
+    Microseconds time;
+    boost::uint64_t connection;
+    boost::uint32_t thread;
+    boost::uint32_t length;
+    boost::uint16_t code;
+    boost::uint8_t direction;
+    boost::uint8_t captured;
+    char data[snapLength];
+};
+
+// Binary capture of packets for production debugging.
+// Every thread records into its own ring of fixed slots, so recording takes no locks and old records are overwritten.
+// Slot keeps time, connection, direction, packet code, original length and first snapLength bytes of payload.
+// Rings are read concurrently with writers, slots overwritten during read are skipped.
+//
+// Nothing is recorded until enable(true), callers check active() first, that is single read of a flag.
+// Connections are recorded when captureAll(true) or when ConnectionBase::capture(true) was called for them.
+// When code filter is not empty, only packets with listed codes are recorded, raw reads and writes are skipped.
+class NEXUS_DECL PacketCapture {
+public:
+    static const size_t snapLength = CapturedPacket::snapLength;
+    static const size_t ringSlots = 0x1000;
+    // Code of raw reads and writes, whose packet boundaries are not known.
+    static const boost::uint16_t noCode = 0x100;
+
+    static inline bool active()
+    {
+        return active_;
+    }
+
+    static inline bool all()
+    {
+        return active_ && all_;
+    }
+
+    static void enable(bool value);
+    static void captureAll(bool value);
+
+    static void filterCode(PacketCode code, bool value);
+    static void clearFilter();
+    static bool filtered();
+
+    // Should be called only when active().
+    static void record(boost::uint64_t connection, CaptureDirection direction, boost::uint16_t code, const char * data, size_t len);
+
+    // Records of all threads ordered by time, at most limit last ones when limit is not 0.
+    static std::vector<CapturedPacket> collect(size_t limit = 0);
+    // Drops records, rings of finished threads are released.
+    static void clear();
+
+    // pcap file with LINKTYPE_USER0 frames. Every frame starts with 16 bytes pseudo header in network byte order:
+    // connection (8), thread (4), direction (1), reserved (1), code (2), followed by captured payload.
+    static void writePcap(std::ostream & out, const std::vector<CapturedPacket> & packets);
+    static void print(std::ostream & out, const std::vector<CapturedPacket> & packets);
+
+    // Handles "capture" command, returns false for other commands.
+    // Shell connections try it before their ShellConnectionListener, so every shell accepts it.
+    //   capture on [all] | off | all on|off | codes [code...] | show [count] | dump path | clear
+    static bool command(std::ostream & out, const std::vector<std::string> & args);
+private:
+    static mstd::atomic<bool> active_;
+    static mstd::atomic<bool> all_;
+};
+
+}
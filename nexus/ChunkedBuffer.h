@@ -47,6 +47,7 @@ public:
             BOOST_ASSERT(next);
             chunkSetNext(rchunk_, 0);
             chunkSetNext(tail_, rchunk_);
+            tail_ = rchunk_;
             rchunk_ = next;
             rpos_ = chunkBegin(rchunk_);
         }
@@ -65,17 +66,19 @@ public:
         const char * end = data + len;
         while(data != end)
         {
-            char * chunkEnd = this->chunkEnd(wchunk_);
-            if(wpos_ == chunkEnd)
+            if(wpos_ == chunkEnd(wchunk_))
             {
                 char * next = chunkNext(wchunk_);
                 if(!next)
+                {
                     next = chunkSetNext(wchunk_, allocChunk());
+                    chunkSetNext(next, 0);
+                    tail_ = next;
+                }
                 wchunk_ = next;
-                chunkSetNext(next, 0);
                 wpos_ = chunkBegin(next);
             }
-            size_t size = std::min(end - data, chunkEnd - wpos_);
+            size_t size = std::min<size_t>(end - data, chunkEnd(wchunk_) - wpos_);
             memcpy(wpos_, data, size);
             data += size;
             wpos_ += size;
@@ -0,0 +1,490 @@
+/*
+** The author disclaims copyright to this source code.  In place of
+** a legal notice, here is a blessing:
+**
+**    May you do good and not evil.
+**    May you find forgiveness for yourself and forgive others.
+**    May you share freely, never taking more than you give.
+*/
+#pragma once
+
+#ifndef NEXUS_BUILDING
+
+#include <limits>
+#include <random>
+#include <unordered_map>
+#include <vector>
+
+#include <boost/asio/deadline_timer.hpp>
+#include <boost/asio/io_service.hpp>
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/intrusive_ptr.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/shared_ptr.hpp>
+
+#include <boost/thread/mutex.hpp>
+
+#include <mstd/reference_counter.hpp>
+
+#endif
+
+#include "Buffer.h"
+#include "Clock.h"
+#include "Utils.h"
+
+namespace nexus {
+
+struct EndpointHealth {
+    boost::asio::ip::tcp::endpoint endpoint;
+    size_t desired;
+    size_t connected;
+    size_t connecting;
+    // failed connects since the last successful one
+    size_t failures;
+    size_t reconnects;
+    boost::system::error_code lastError;
+    // duration of the last successful connect
+    Microseconds connectLatency;
+    // smoothed value of samples passed to ClientPool::recordLatency
+    Microseconds latency;
+
+    bool healthy() const
+    {
+        return connected != 0;
+    }
+};
+
+// Keeps connectionsPerEndpoint outbound connections to every added endpoint.
+// Connections are established asynchronously, failed connects and closed connections are retried with exponential backoff.
+// pick() returns the active connection with the shortest send queue, so requests are spread over the pooled connections.
+//
+// Ptr is an owning pointer to Connection descendant. Factory gets connected socket and should create and start
+// connection on it, the connection should call closed from its finish(), after that the slot is reconnected.
+// Connection should also have public close(), it is called when endpoint is removed or pool is stopped.
+// Pool drops its pointer right after that, so connection should keep itself alive till finish().
+template<class Ptr>
+class ClientPool : public boost::noncopyable {
+public:
+    typedef boost::asio::ip::tcp::endpoint Endpoint;
+    typedef std::function<void()> Closed;
+    typedef std::function<Ptr(boost::asio::ip::tcp::socket & socket, const Endpoint & endpoint, const Closed & closed)> Factory;
+
+    ClientPool(boost::asio::io_service & ios, const Factory & factory, size_t connectionsPerEndpoint = 2)
+        : impl_(new Impl(ios, factory, connectionsPerEndpoint)) {}
+
+    ~ClientPool()
+    {
+        impl_->stop();
+    }
+
+    void backoff(Milliseconds initial, Milliseconds max)
+    {
+        impl_->backoff(initial, max);
+    }
+
+    void connectTimeout(Milliseconds value)
+    {
+        impl_->connectTimeout(value);
+    }
+
+    void add(const Endpoint & endpoint)
+    {
+        impl_->add(endpoint);
+    }
+
+    void remove(const Endpoint & endpoint)
+    {
+        impl_->remove(endpoint);
+    }
+
+    void stop()
+    {
+        impl_->stop();
+    }
+
+    // Returns empty pointer when endpoint has no active connections.
+    Ptr pick(const Endpoint & endpoint)
+    {
+        return impl_->pick(endpoint);
+    }
+
+    bool send(const Endpoint & endpoint, const Buffer & buffer)
+    {
+        Ptr conn = pick(endpoint);
+        if(!conn)
+            return false;
+        conn->send(buffer);
+        return true;
+    }
+
+    void recordLatency(const Endpoint & endpoint, Microseconds value)
+    {
+        impl_->recordLatency(endpoint, value);
+    }
+
+    bool health(const Endpoint & endpoint, EndpointHealth & out)
+    {
+        return impl_->health(endpoint, out);
+    }
+
+    std::vector<EndpointHealth> health()
+    {
+        return impl_->health();
+    }
+private:
+    class Impl;
+    typedef boost::intrusive_ptr<Impl> ImplPtr;
+
+    enum SlotState {
+        ssIdle,
+        ssConnecting,
+        ssConnected,
+        ssWaiting,
+    };
+
+    struct Entry;
+    typedef boost::shared_ptr<Entry> EntryPtr;
+
+    struct Slot {
+        EntryPtr entry;
+        SlotState state;
+        size_t generation;
+        boost::scoped_ptr<boost::asio::ip::tcp::socket> socket;
+        boost::asio::deadline_timer timer;
+        Ptr connection;
+        Microseconds connectStarted;
+
+        Slot(boost::asio::io_service & ios, const EntryPtr & e)
+            : entry(e), state(ssIdle), generation(0), timer(ios), connectStarted(0) {}
+    };
+
+    typedef boost::shared_ptr<Slot> SlotPtr;
+
+    struct Entry {
+        EndpointHealth health;
+        bool removed;
+        std::vector<SlotPtr> slots;
+    };
+
+    typedef std::unordered_map<Endpoint, EntryPtr, EndpointHasher> Entries;
+
+    class Impl : public mstd::reference_counter<Impl> {
+    public:
+        Impl(boost::asio::io_service & ios, const Factory & factory, size_t connectionsPerEndpoint)
+            : ios_(ios), factory_(factory), connectionsPerEndpoint_(std::max<size_t>(connectionsPerEndpoint, 1)),
+              initialBackoff_(100), maxBackoff_(30000), connectTimeout_(5000), stopped_(false), random_(static_cast<unsigned>(Clock::microseconds()))
+        {
+        }
+
+        void backoff(Milliseconds initial, Milliseconds max)
+        {
+            boost::lock_guard<boost::mutex> lock(mutex_);
+            initialBackoff_ = std::max<Milliseconds>(initial, 1);
+            maxBackoff_ = std::max(max, initialBackoff_);
+        }
+
+        void connectTimeout(Milliseconds value)
+        {
+            boost::lock_guard<boost::mutex> lock(mutex_);
+            connectTimeout_ = value;
+        }
+
+        void add(const Endpoint & endpoint)
+        {
+            boost::lock_guard<boost::mutex> lock(mutex_);
+            if(stopped_ || entries_.count(endpoint))
+                return;
+            EntryPtr entry(new Entry);
+            entry->removed = false;
+            EndpointHealth & health = entry->health;
+            health.endpoint = endpoint;
+            health.desired = connectionsPerEndpoint_;
+            health.connected = health.connecting = health.failures = health.reconnects = 0;
+            health.connectLatency = health.latency = 0;
+            for(size_t i = 0; i != connectionsPerEndpoint_; ++i)
+            {
+                entry->slots.push_back(SlotPtr(new Slot(ios_, entry)));
+                startConnect(entry->slots.back());
+            }
+            entries_[endpoint] = entry;
+        }
+
+        void remove(const Endpoint & endpoint)
+        {
+            std::vector<Ptr> dropped;
+            {
+                boost::lock_guard<boost::mutex> lock(mutex_);
+                typename Entries::iterator i = entries_.find(endpoint);
+                if(i == entries_.end())
+                    return;
+                release(*i->second, dropped);
+                entries_.erase(i);
+            }
+            shutdown(dropped);
+        }
+
+        void stop()
+        {
+            std::vector<Ptr> dropped;
+            {
+                boost::lock_guard<boost::mutex> lock(mutex_);
+                stopped_ = true;
+                for(typename Entries::iterator i = entries_.begin(), end = entries_.end(); i != end; ++i)
+                    release(*i->second, dropped);
+                entries_.clear();
+            }
+            shutdown(dropped);
+        }
+
+        Ptr pick(const Endpoint & endpoint)
+        {
+            // connections are queried outside of pool lock, they take their own mutex in sendQueueSize
+            Ptr candidates[0x10];
+            std::vector<Ptr> more;
+            size_t count = 0;
+            {
+                boost::lock_guard<boost::mutex> lock(mutex_);
+                typename Entries::iterator i = entries_.find(endpoint);
+                if(i == entries_.end())
+                    return Ptr();
+                const std::vector<SlotPtr> & slots = i->second->slots;
+                for(typename std::vector<SlotPtr>::const_iterator j = slots.begin(), end = slots.end(); j != end; ++j)
+                    if((*j)->state == ssConnected)
+                    {
+                        if(count != sizeof(candidates) / sizeof(candidates[0]))
+                            candidates[count++] = (*j)->connection;
+                        else
+                            more.push_back((*j)->connection);
+                    }
+            }
+
+            Ptr best;
+            size_t bestSize = std::numeric_limits<size_t>::max();
+            for(size_t i = 0, total = count + more.size(); i != total; ++i)
+            {
+                const Ptr & conn = i < count ? candidates[i] : more[i - count];
+                if(!conn->active())
+                    continue;
+                size_t size = conn->sendQueueSize();
+                if(size < bestSize)
+                {
+                    best = conn;
+                    bestSize = size;
+                    if(!size)
+                        break;
+                }
+            }
+            return best;
+        }
+
+        void recordLatency(const Endpoint & endpoint, Microseconds value)
+        {
+            boost::lock_guard<boost::mutex> lock(mutex_);
+            typename Entries::iterator i = entries_.find(endpoint);
+            if(i != entries_.end())
+            {
+                Microseconds & latency = i->second->health.latency;
+                // exponential moving average with 1/8 weight of new sample
+                latency = latency ? latency + (value - latency) / 8 : value;
+            }
+        }
+
+        bool health(const Endpoint & endpoint, EndpointHealth & out)
+        {
+            boost::lock_guard<boost::mutex> lock(mutex_);
+            typename Entries::iterator i = entries_.find(endpoint);
+            if(i == entries_.end())
+                return false;
+            out = i->second->health;
+            return true;
+        }
+
+        std::vector<EndpointHealth> health()
+        {
+            std::vector<EndpointHealth> result;
+            boost::lock_guard<boost::mutex> lock(mutex_);
+            result.reserve(entries_.size());
+            for(typename Entries::iterator i = entries_.begin(), end = entries_.end(); i != end; ++i)
+                result.push_back(i->second->health);
+            return result;
+        }
+    private:
+        // Called under lock.
+        void startConnect(const SlotPtr & slot)
+        {
+            Entry & entry = *slot->entry;
+            slot->state = ssConnecting;
+            ++entry.health.connecting;
+            slot->socket.reset(new boost::asio::ip::tcp::socket(ios_));
+            slot->connectStarted = Clock::microseconds();
+            size_t generation = ++slot->generation;
+            ImplPtr self(this);
+            slot->socket->async_connect(entry.health.endpoint, std::bind(&Impl::handleConnect, this, std::placeholders::_1, slot, generation, self));
+            if(connectTimeout_)
+            {
+                slot->timer.expires_from_now(boost::posix_time::milliseconds(connectTimeout_));
+                slot->timer.async_wait(std::bind(&Impl::handleConnectTimeout, this, std::placeholders::_1, slot, generation, self));
+            }
+        }
+
+        void handleConnectTimeout(const boost::system::error_code & ec, const SlotPtr & slot, size_t generation, const ImplPtr & self)
+        {
+            if(ec)
+                return;
+            boost::lock_guard<boost::mutex> lock(mutex_);
+            if(slot->generation == generation && slot->state == ssConnecting && slot->socket)
+            {
+                boost::system::error_code temp;
+                slot->socket->close(temp);
+            }
+        }
+
+        void handleConnect(const boost::system::error_code & ec, const SlotPtr & slot, size_t generation, const ImplPtr & self)
+        {
+            boost::unique_lock<boost::mutex> lock(mutex_);
+            if(slot->generation != generation || slot->state != ssConnecting)
+                return;
+            Entry & entry = *slot->entry;
+            --entry.health.connecting;
+            boost::system::error_code temp;
+            slot->timer.cancel(temp);
+            if(entry.removed || stopped_)
+            {
+                slot->state = ssIdle;
+                slot->socket.reset();
+                return;
+            }
+
+            if(ec)
+            {
+                ++entry.health.failures;
+                entry.health.lastError = ec;
+                slot->socket.reset();
+                scheduleConnect(slot, entry.health.failures);
+                return;
+            }
+
+            entry.health.failures = 0;
+            entry.health.connectLatency = Clock::microseconds() - slot->connectStarted;
+            ++entry.health.connected;
+            slot->state = ssConnected;
+            ++slot->generation;
+            boost::scoped_ptr<boost::asio::ip::tcp::socket> socket;
+            socket.swap(slot->socket);
+            Closed closed(std::bind(&Impl::handleClosed, ImplPtr(this), slot, slot->generation));
+            lock.unlock();
+
+            Ptr conn = factory_(*socket, entry.health.endpoint, closed);
+
+            lock.lock();
+            if(slot->state == ssConnected && slot->generation == generation + 1)
+            {
+                if(conn)
+                    slot->connection = conn;
+                else
+                    markClosed(slot);
+            } else if(conn && (entry.removed || stopped_)) {
+                // endpoint was removed while connection was created
+                lock.unlock();
+                conn->close();
+            }
+        }
+
+        void handleClosed(const SlotPtr & slot, size_t generation)
+        {
+            Ptr conn;
+            {
+                boost::lock_guard<boost::mutex> lock(mutex_);
+                if(slot->generation != generation || slot->state != ssConnected)
+                    return;
+                conn.swap(slot->connection);
+                markClosed(slot);
+            }
+        }
+
+        // Called under lock.
+        void markClosed(const SlotPtr & slot)
+        {
+            Entry & entry = *slot->entry;
+            --entry.health.connected;
+            ++slot->generation;
+            slot->state = ssIdle;
+            if(!entry.removed && !stopped_)
+            {
+                ++entry.health.reconnects;
+                scheduleConnect(slot, 0);
+            }
+        }
+
+        // Called under lock.
+        void scheduleConnect(const SlotPtr & slot, size_t failures)
+        {
+            // closed connection is reconnected after initial delay, every failed attempt doubles it
+            Milliseconds delay = initialBackoff_;
+            for(size_t i = 1; i < failures && delay < maxBackoff_; ++i)
+                delay *= 2;
+            delay = std::min(delay, maxBackoff_);
+            // jitter keeps slots of the same endpoint from reconnecting at once
+            delay = delay / 2 + static_cast<Milliseconds>(random_() % static_cast<unsigned>(delay / 2 + 1));
+
+            slot->state = ssWaiting;
+            size_t generation = ++slot->generation;
+            slot->timer.expires_from_now(boost::posix_time::milliseconds(delay));
+            slot->timer.async_wait(std::bind(&Impl::handleBackoff, this, std::placeholders::_1, slot, generation, ImplPtr(this)));
+        }
+
+        void handleBackoff(const boost::system::error_code & ec, const SlotPtr & slot, size_t generation, const ImplPtr & self)
+        {
+            boost::lock_guard<boost::mutex> lock(mutex_);
+            if(ec || slot->generation != generation || slot->state != ssWaiting || slot->entry->removed || stopped_)
+                return;
+            startConnect(slot);
+        }
+
+        // Called under lock, connections are collected to be shut down after unlock.
+        void release(Entry & entry, std::vector<Ptr> & dropped)
+        {
+            entry.removed = true;
+            // pending handlers keep slots alive, slots keep entry alive
+            std::vector<SlotPtr> slots;
+            slots.swap(entry.slots);
+            for(typename std::vector<SlotPtr>::iterator i = slots.begin(), end = slots.end(); i != end; ++i)
+            {
+                Slot & slot = **i;
+                ++slot.generation;
+                boost::system::error_code ec;
+                slot.timer.cancel(ec);
+                if(slot.socket)
+                    slot.socket->close(ec);
+                if(slot.connection)
+                {
+                    dropped.push_back(slot.connection);
+                    slot.connection = Ptr();
+                }
+                slot.state = ssIdle;
+            }
+        }
+
+        void shutdown(const std::vector<Ptr> & dropped)
+        {
+            for(typename std::vector<Ptr>::const_iterator i = dropped.begin(), end = dropped.end(); i != end; ++i)
+                (*i)->close();
+        }
+
+        boost::asio::io_service & ios_;
+        Factory factory_;
+        size_t connectionsPerEndpoint_;
+        Milliseconds initialBackoff_;
+        Milliseconds maxBackoff_;
+        Milliseconds connectTimeout_;
+        bool stopped_;
+        std::minstd_rand random_;
+        boost::mutex mutex_;
+        Entries entries_;
+    };
+
+    ImplPtr impl_;
+};
+
+}
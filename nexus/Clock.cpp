@@ -8,6 +8,18 @@
 */
 #include "pch.h"
 
+#if defined(__i386__) || defined(__x86_64__)
+#include <x86intrin.h>
+#define NEXUS_CLOCK_TSC 1
+#elif defined(_M_IX86) || defined(_M_X64)
+#include <intrin.h>
+#define NEXUS_CLOCK_TSC 1
+#endif
+
+#if !BOOST_WINDOWS
+#include <time.h>
+#endif
+
 #include "Clock.h"
 
 MLOG_DECLARE_LOGGER(clock);
@@ -80,6 +92,105 @@ private:
 
 Ticker ticker;
 
+Microseconds epochMicroseconds()
+{
+    return (boost::posix_time::microsec_clock::universal_time() - Clock::timeStart()).total_microseconds();
+}
+
+#if !BOOST_WINDOWS
+Microseconds clockMicroseconds(clockid_t id)
+{
+    struct timespec ts;
+    clock_gettime(id, &ts);
+    return static_cast<Microseconds>(ts.tv_sec) * 1000000 + ts.tv_nsec / 1000;
+}
+
+#if defined(CLOCK_MONOTONIC_COARSE)
+const clockid_t coarseClockId = CLOCK_MONOTONIC_COARSE;
+#else
+const clockid_t coarseClockId = CLOCK_MONOTONIC;
+#endif
+#endif
+
+Microseconds monotonicMicroseconds()
+{
+#if !BOOST_WINDOWS
+    return clockMicroseconds(CLOCK_MONOTONIC);
+#else
+    return epochMicroseconds();
+#endif
+}
+
+class CoarseClock {
+public:
+    CoarseClock()
+    {
+#if !BOOST_WINDOWS
+        offset_ = epochMicroseconds() / 1000 - clockMicroseconds(coarseClockId) / 1000;
+#else
+        offset_ = epochMicroseconds() / 1000 - static_cast<Milliseconds>(GetTickCount64());
+#endif
+    }
+
+    Milliseconds now() const
+    {
+#if !BOOST_WINDOWS
+        return clockMicroseconds(coarseClockId) / 1000 + offset_;
+#else
+        return static_cast<Milliseconds>(GetTickCount64()) + offset_;
+#endif
+    }
+private:
+    Milliseconds offset_;
+};
+
+// Ticks are converted using frequency measured once, so it assumes invariant tsc, as all modern x86 cpus have.
+class TscClock {
+public:
+    TscClock()
+        : baseTicks_(0), usPerTick_(0)
+    {
+        base_ = epochMicroseconds();
+        baseMonotonic_ = monotonicMicroseconds();
+#if NEXUS_CLOCK_TSC
+        baseTicks_ = __rdtsc();
+        boost::this_thread::sleep(boost::posix_time::milliseconds(10));
+        Microseconds elapsed = monotonicMicroseconds() - baseMonotonic_;
+        boost::uint64_t ticks = __rdtsc() - baseTicks_;
+        if(ticks)
+            usPerTick_ = static_cast<double>(elapsed) / ticks;
+        else
+            MLOG_WARNING("tsc does not tick, falling back to monotonic clock");
+#endif
+    }
+
+    Microseconds now() const
+    {
+#if NEXUS_CLOCK_TSC
+        if(usPerTick_)
+            return base_ + static_cast<Microseconds>((__rdtsc() - baseTicks_) * usPerTick_);
+#endif
+        return base_ + monotonicMicroseconds() - baseMonotonic_;
+    }
+private:
+    Microseconds base_;
+    Microseconds baseMonotonic_;
+    boost::uint64_t baseTicks_;
+    double usPerTick_;
+};
+
+const CoarseClock & coarseClock()
+{
+    static const CoarseClock result;
+    return result;
+}
+
+const TscClock & tscClock()
+{
+    static const TscClock result;
+    return result;
+}
+
 }
 
 Milliseconds Clock::milliseconds()
@@ -87,6 +198,16 @@ Milliseconds Clock::milliseconds()
     return out;
 }
 
+Milliseconds Clock::coarseMilliseconds()
+{
+    return coarseClock().now();
+}
+
+Microseconds Clock::microseconds()
+{
+    return tscClock().now();
+}
+
 const boost::posix_time::ptime & Clock::timeStart()
 {
     static const boost::posix_time::ptime result(boost::gregorian::date(1970, boost::date_time::Jan, 1));
@@ -95,6 +216,8 @@ const boost::posix_time::ptime & Clock::timeStart()
 
 void Clock::start()
 {
+    coarseClock();
+    tscClock();
     ticker.start();
 }
 
@@ -23,10 +23,18 @@ namespace nexus {
 
 typedef int32_t Seconds;
 typedef int64_t Milliseconds;
+typedef int64_t Microseconds;
 
+// All clocks share the same origin, posix epoch, so their values could be mixed.
 class Clock {
 public:
+    // Value cached by the ticker thread, so it is just an atomic read. Has step() resolution and requires start().
     static Milliseconds milliseconds();
+    // Kernel coarse clock (CLOCK_MONOTONIC_COARSE on linux), does not require the ticker and never goes backwards.
+    static Milliseconds coarseMilliseconds();
+    // rdtsc based clock calibrated against the monotonic clock, falls back to clock_gettime when tsc is not available.
+    static Microseconds microseconds();
+    static inline Milliseconds preciseMilliseconds() { return microseconds() / 1000; }
     static boost::posix_time::ptime posix(Milliseconds time) { return timeStart() + boost::posix_time::milliseconds(time); }
     static Milliseconds toMilliseconds(const boost::posix_time::ptime & time) { return (time - timeStart()).total_milliseconds(); }
 
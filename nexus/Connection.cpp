@@ -17,10 +17,33 @@ namespace nexus {
 mstd::atomic<size_t> activeConnections_;
 mstd::atomic<size_t> allocatedConnections_;
 
+namespace {
+
+const size_t defaultShrinkReads = 16;
+
+mstd::lock_site & connectionLockSite()
+{
+    static mstd::lock_site result("nexus::ConnectionLock");
+    return result;
+}
+
+}
+
+struct ConnectionBase::ScratchLock::Scratch {
+    std::vector<char> data;
+    bool busy;
+
+    Scratch()
+        : data(scratchSize), busy(false) {}
+};
+
 ConnectionBase::ConnectionBase(bool active, size_t readingBuffer, size_t threshold)
     : asyncOperations_(active), rbuffer_(readingBuffer), rpos_(0), threshold_(threshold),
+      initialBuffer_(readingBuffer), shrinkReads_(defaultShrinkReads), smallReads_(0), peakUsed_(0), scratch_(false), scratchRead_(false),
+      capture_(false), capturePackets_(false),
       reads_(0), writes_(0), reading_(true), stopReason_(srNone), lastRead_(Clock::milliseconds()), lastWrite_(lastRead_)
 {
+    mstd::set_lock_site(mutex_, connectionLockSite());
     ++allocatedConnections_;
     ++activeConnections_;
 }
@@ -102,6 +125,128 @@ void ConnectionBase::commitWrite(size_t len, ConnectionLock &)
     pending_.erase(len);
 }
 
+void ConnectionBase::shrinkAfter(size_t reads)
+{
+    shrinkReads_ = reads;
+    smallReads_ = 0;
+    peakUsed_ = 0;
+}
+
+void ConnectionBase::readThroughScratch(bool value)
+{
+    scratch_ = value;
+}
+
+void ConnectionBase::capture(bool value)
+{
+    capture_ = value;
+}
+
+void ConnectionBase::capturePackets(bool value)
+{
+    capturePackets_ = value;
+}
+
+size_t ConnectionBase::readSpace()
+{
+    size_t bsize = rbuffer_.size();
+    if(!bsize)
+    {
+        // released by keepPartial
+        rbuffer_.resize(std::max<size_t>(initialBuffer_, 1));
+        bsize = rbuffer_.size();
+    }
+    if(threshold_ && (bsize - rpos_) * threshold_ < bsize)
+    { 
+        bsize *= 2;
+        while((bsize - rpos_) * threshold_ < bsize)
+            bsize *= 2;
+        rbuffer_.resize(bsize);
+        rbuffer_.resize(bsize = rbuffer_.capacity());
+    }
+
+    return bsize - rpos_;
+}
+
+void ConnectionBase::adaptBuffer(size_t used)
+{
+    size_t size = rbuffer_.size();
+    if(!shrinkReads_ || size <= initialBuffer_)
+        return;
+
+    if(used * 4 > size)
+    {
+        smallReads_ = 0;
+        peakUsed_ = 0;
+        return;
+    }
+
+    peakUsed_ = std::max(peakUsed_, used);
+    if(++smallReads_ < shrinkReads_)
+        return;
+
+    size_t peak = peakUsed_;
+    smallReads_ = 0;
+    peakUsed_ = 0;
+
+    size_t target = std::max<size_t>(initialBuffer_, 1);
+    while(target < peak * 2)
+        target *= 2;
+    if(target >= size)
+        return;
+
+    MLOG_FMESSAGE(Debug, "shrink reading buffer: " << size << " => " << target << ", peak = " << peak);
+
+    std::vector<char> temp(target);
+    if(rpos_)
+        memcpy(&temp[0], &rbuffer_[0], rpos_);
+    temp.swap(rbuffer_);
+}
+
+void ConnectionBase::keepPartial(const char * data, size_t len)
+{
+    if(len)
+    {
+        if(rbuffer_.size() <= len)
+        {
+            std::vector<char> temp(std::max(initialBuffer_, len * 2));
+            temp.swap(rbuffer_);
+        }
+        memcpy(&rbuffer_[0], data, len);
+    } else if(!rbuffer_.empty())
+        std::vector<char>().swap(rbuffer_);
+    rpos_ = len;
+}
+
+ConnectionBase::ScratchLock::Scratch * ConnectionBase::ScratchLock::threadScratch()
+{
+    static boost::thread_specific_ptr<Scratch> scratches;
+    Scratch * result = scratches.get();
+    if(!result)
+        scratches.reset(result = new Scratch);
+    return result;
+}
+
+ConnectionBase::ScratchLock::ScratchLock()
+    : scratch_(threadScratch())
+{
+    if(scratch_->busy)
+        scratch_ = 0;
+    else
+        scratch_->busy = true;
+}
+
+ConnectionBase::ScratchLock::~ScratchLock()
+{
+    if(scratch_)
+        scratch_->busy = false;
+}
+
+char * ConnectionBase::ScratchLock::data() const
+{
+    return scratch_ ? &scratch_->data[0] : 0;
+}
+
 mlog::Logger & ConnectionBase::getLogger()
 {
     return logger;
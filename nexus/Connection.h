@@ -12,13 +12,18 @@
 
 #include <vector>
 
+#include <boost/static_assert.hpp>
+
 #include <boost/asio/ip/tcp.hpp>
 
 #include <boost/thread/mutex.hpp>
 
+#include <boost/type_traits/integral_constant.hpp>
+
 #include <boost/system/error_code.hpp>
 
 #include <mstd/atomic.hpp>
+#include <mstd/lock_site.hpp>
 #include <mstd/threads.hpp>
 
 #include <mlog/Logging.h>
@@ -30,6 +35,7 @@
 #include "AsyncGuard.h"
 #include "AsyncOperations.h"
 #include "Buffers.h"
+#include "Capture.h"
 #include "Clock.h"
 #include "Handler.h"
 #include "PacketReader.h"
@@ -41,6 +47,9 @@ class Connection;
 
 class ConnectionLock;
 
+// Sections under ConnectionLock are short, but could start write syscall, so waiter spins only for a while.
+typedef mstd::lock_profile<mstd::spinlock>::type ConnectionMutex;
+
 typedef int StopReason;
 const int srNone = 0;
 const int srRead = 1;
@@ -61,6 +70,14 @@ public:
 
     void stopReading(StopReason reason, const boost::system::error_code & ec = boost::system::error_code());
 
+    // Records traffic of this connection to PacketCapture while it is enabled.
+    void capture(bool value);
+
+    bool capturing() const
+    {
+        return PacketCapture::active() && (capture_ || PacketCapture::all());
+    }
+
     int failedOperation() const
     {
         return stopReason_;
@@ -78,6 +95,11 @@ public:
         return lastRead_;
     }
 
+    size_t readBufferSize() const
+    {
+        return rbuffer_.capacity();
+    }
+
     Milliseconds lastWrite() const
     {
         return lastWrite_;
@@ -95,21 +117,81 @@ public:
 
     static size_t activeConnections();
     static size_t allocatedConnections();
+    // Size of per thread buffer used by readThroughScratch.
+    static const size_t scratchSize = 0x10000;
 protected:
     bool activate();
     bool prepare();
     bool reading();
     void stopReason(StopReason reason, const boost::system::error_code & ec);
+
+    // Reading buffer grown by threshold is shrunk back when no read used more than quarter of it during
+    // last reads reads, 0 disables shrinking. Default is 16.
+    void shrinkAfter(size_t reads);
+
+    // When there is no partial packet, connection waits for stream to become readable and reads into
+    // buffer shared by all connections of the thread, only tail of partial packet is copied to own buffer,
+    // that is released otherwise. Stream should have SupportsScratchReads, start switches it to non blocking mode.
+    // Should be set before start.
+    void readThroughScratch(bool value);
+
+    // Derived class parses packets and records them with capturePacket, so raw reads and writes are not recorded.
+    void capturePackets(bool value);
+
+    void capturePacket(CaptureDirection direction, PacketCode code, const char * data, size_t len)
+    {
+        if(capturing())
+            PacketCapture::record(captureId(), direction, code, data, len);
+    }
+
+    void captureRaw(CaptureDirection direction, const char * data, size_t len)
+    {
+        if(capturing() && !capturePackets_)
+            PacketCapture::record(captureId(), direction, PacketCapture::noCode, data, len);
+    }
 private:
+    class NEXUS_DECL ScratchLock : public boost::noncopyable {
+    public:
+        ScratchLock();
+        ~ScratchLock();
+
+        // 0 when scratch of this thread is already used by outer read handler
+        char * data() const;
+    private:
+        struct Scratch;
+
+        static Scratch * threadScratch();
+
+        Scratch * scratch_;
+    };
+
     static mlog::Logger & getLogger();
+
+    boost::uint64_t captureId() const
+    {
+        return reinterpret_cast<uintptr_t>(this);
+    }
+
     void commitWrite(size_t len, ConnectionLock & lock);
 
+    size_t readSpace();
+    void adaptBuffer(size_t used);
+    void keepPartial(const char * data, size_t len);
+
     AsyncOperations asyncOperations_;
-    boost::mutex mutex_;
+    ConnectionMutex mutex_;
     Buffers pending_;
     std::vector<char> rbuffer_;
     size_t rpos_;
     size_t threshold_;
+    size_t initialBuffer_;
+    size_t shrinkReads_;
+    size_t smallReads_;
+    size_t peakUsed_;
+    bool scratch_;
+    bool scratchRead_;
+    volatile bool capture_;
+    bool capturePackets_;
     mstd::atomic<size_t> reads_;
     mstd::atomic<size_t> writes_;
     mstd::atomic<bool> reading_;
@@ -139,7 +221,7 @@ public:
         m_.unlock();
     }
 private:
-    boost::mutex & m_;
+    ConnectionMutex & m_;
 };
 
 class NEXUS_DECL NoGuard {
@@ -203,6 +285,14 @@ private:
     size_t pos_;
 };
 
+// Stream supports null_buffers reads, non_blocking mode and synchronous read_some, so Connection could read it
+// through scratch buffer. Scratch code is not instantiated for other streams, i.e. ShmStream and TlsStream.
+template<class Stream>
+struct SupportsScratchReads : boost::false_type {};
+
+template<>
+struct SupportsScratchReads<boost::asio::ip::tcp::socket> : boost::true_type {};
+
 struct NEXUS_DECL NoAsyncData {
     static NoAsyncData null() { return NoAsyncData(); }
 };
@@ -230,6 +320,8 @@ public:
     {
         if(asyncOperations_.active())
         {
+            captureRaw(cdOut, buffer.data(), buffer.size());
+
             ConnectionLock lock(this);
 
             bool wasEmpty = pending_.empty();
@@ -242,10 +334,40 @@ public:
         }
     }
     
+    // Queues buffer only when no more than limit bytes are waiting to be sent, returns false when buffer was not queued.
+    bool trySend(const Buffer & buffer, size_t limit)
+    {
+        if(asyncOperations_.active())
+        {
+            ConnectionLock lock(this);
+
+            if(pending_.total() > limit)
+                return false;
+
+            captureRaw(cdOut, buffer.data(), buffer.size());
+
+            bool wasEmpty = pending_.empty();
+            commitLazy(lock);
+
+            pending_.push_back(buffer);
+
+            if(wasEmpty)
+                asyncWrite(lock);
+            return true;
+        }
+        return false;
+    }
+
     void send(const std::vector<Buffer> & buffers)
     {
         if(asyncOperations_.active())
         {
+            if(PacketCapture::active())
+            {
+                for(std::vector<Buffer>::const_iterator i = buffers.begin(), end = buffers.end(); i != end; ++i)
+                    captureRaw(cdOut, i->data(), i->size());
+            }
+
             ConnectionLock lock(this);
 
             bool wasEmpty = pending_.empty();
@@ -262,6 +384,8 @@ public:
     {
         if(asyncOperations_.active())
         {
+            captureRaw(cdOut, data, len);
+
             ConnectionLock lock(this);
 
             if(pending_.empty())
@@ -295,6 +419,11 @@ public:
         if(asyncOperations_.prepare())
             derived().stream().get_io_service().post(Send<C>(this, c));
     }
+
+    boost::asio::io_service & ioService()
+    {
+        return derived().stream().get_io_service();
+    }
 private:
     class AsyncHelper;
 protected:
@@ -311,8 +440,17 @@ protected:
 
     void start()
     {
+        if(scratch_)
+            startScratch(scratchReads(derived().stream()));
         asyncRead();
     }
+
+    // Hides ConnectionBase::readThroughScratch, so it does not compile for stream without SupportsScratchReads.
+    void readThroughScratch(bool value)
+    {
+        requireScratchReads(derived().stream());
+        ConnectionBase::readThroughScratch(value);
+    }
     
     Guard & guard()
     {
@@ -321,6 +459,8 @@ protected:
     
     std::pair<const char *, const char *> readyData()
     {
+        if(rbuffer_.empty())
+            return std::pair<const char *, const char *>(0, 0);
         return std::make_pair(&rbuffer_[0], &rbuffer_[0] + rpos_);
     }
     
@@ -357,31 +497,108 @@ private:
         return *static_cast<Derived*>(this);
     }
 
+    template<class Stream>
+    static SupportsScratchReads<Stream> scratchReads(Stream &)
+    {
+        return SupportsScratchReads<Stream>();
+    }
+
+    template<class Stream>
+    static void requireScratchReads(Stream &)
+    {
+        BOOST_STATIC_ASSERT_MSG(SupportsScratchReads<Stream>::value, "stream does not support reads through scratch");
+    }
+
+    void startScratch(boost::true_type)
+    {
+        // readiness could be spurious, so read_some after it should not block io thread
+        boost::system::error_code ec;
+        derived().stream().non_blocking(true, ec);
+        if(ec)
+        {
+            MLOG_FMESSAGE(Notice, "non_blocking failed, scratch reads disabled: " << ec << ", " << ec.message());
+            scratch_ = false;
+        }
+    }
+
+    void startScratch(boost::false_type)
+    {
+        scratch_ = false;
+    }
+
     void asyncRead()
+    {
+        if(scratch_ && !rpos_)
+            readReady(scratchReads(derived().stream()));
+        else
+            readBuffer();
+    }
+
+    void readBuffer()
     {
         if(reading() && asyncOperations_.prepare())
         {
             ++reads_;
 
-            size_t bsize = rbuffer_.size();
-            if(threshold_ && (bsize - rpos_) * threshold_ < bsize)
-            { 
-                bsize *= 2;
-                while((bsize - rpos_) * threshold_ < bsize)
-                    bsize *= 2;
-                rbuffer_.resize(bsize);
-                rbuffer_.resize(bsize = rbuffer_.capacity());
-            }
-
-            size_t size = bsize - rpos_;
+            size_t size = readSpace();
 
             ConnectionLock lock(this);
 
+            scratchRead_ = false;
             derived().stream().async_read_some(boost::asio::buffer(&rbuffer_[rpos_], size),
                                                guard_.wrap(bindRead(baseAsyncData<AsyncData>())));
         }
     }
 
+    void readReady(boost::true_type)
+    {
+        if(reading() && asyncOperations_.prepare())
+        {
+            ++reads_;
+
+            ConnectionLock lock(this);
+
+            scratchRead_ = true;
+            derived().stream().async_read_some(boost::asio::null_buffers(),
+                                               guard_.wrap(bindRead(baseAsyncData<AsyncData>())));
+        }
+    }
+
+    void readReady(boost::false_type)
+    {
+        readBuffer();
+    }
+
+    // Returns false when scratch is busy and nothing was read.
+    bool readScratch(boost::system::error_code & ec, boost::true_type)
+    {
+        ScratchLock scratch;
+        if(!scratch.data())
+            return false;
+
+        size_t len = derived().stream().read_some(boost::asio::buffer(scratch.data(), scratchSize), ec);
+        if(ec == boost::asio::error::would_block || ec == boost::asio::error::try_again)
+        {
+            // spurious readiness, asyncRead waits for it again
+            ec = boost::system::error_code();
+        } else if(!ec)
+        {
+            updateLastRead();
+            captureRaw(cdIn, scratch.data(), len);
+
+            PacketReader reader(scratch.data(), len);
+            derived().processPackets(reader);
+            keepPartial(reader.raw(), reader.left());
+        }
+        return true;
+    }
+
+    bool readScratch(boost::system::error_code &, boost::false_type)
+    {
+        BOOST_ASSERT(false);
+        return false;
+    }
+
     void commitLazy(ConnectionLock &)
     {
         if(!lazy_.empty())
@@ -435,18 +652,32 @@ private:
 
         AsyncGuard guard(this, data);
 
-        if(!ec)
+        if(!ec && scratchRead_)
         {
+            if(!readScratch(ec, scratchReads(derived().stream())))
+            {
+                // stream is readable, so read into own buffer completes at once
+                readBuffer();
+                return;
+            }
+        } else if(!ec)
+        {
+            captureRaw(cdIn, &rbuffer_[rpos_], len);
             rpos_ += len;
             updateLastRead();
 
+            size_t used = rpos_;
             PacketReader reader(rbuffer_, rpos_);
             derived().processPackets(reader);
             memmove(&rbuffer_[0], reader.raw(), reader.left());
             rpos_ = reader.left();
 
+            adaptBuffer(used);
+        }
+
+        if(!ec)
             asyncRead();
-        } else {
+        else {
             MLOG_FMESSAGE(Notice, "handleRead(" << ec << ", " << ec.message() << ")");
 
             guard.failed();
@@ -20,6 +20,7 @@ namespace nexus {
 PipeNode::PipeNode()
     : Connection(false, 1 << 8, 2), timer_(ioService_)
 {
+    capturePackets(true);
 }
 
 PipeNode::~PipeNode()
@@ -143,6 +144,7 @@ void PipeNode::processPackets(PacketReader & reader)
     while(reader.left() >= 3)
     {
         reader.mark();
+        const char * packet = reader.raw();
         PacketCode code = reader.read<PacketCode>();
         boost::uint32_t len = reader.read<boost::uint16_t>();
         if(len > 0x7fff)
@@ -155,6 +157,7 @@ void PipeNode::processPackets(PacketReader & reader)
             reader.revert();
             break;
         }
+        capturePacket(cdIn, code, packet, reader.raw() - packet + len);
         listener_(code, reader.subreader(0, len));
         reader.skip(len);
     }
@@ -38,7 +38,7 @@ public:
 
     void send(nexus::PacketCode code)
     {
-        send(nexus::packCSD(code));
+        sendPacket(code, nexus::packCSD(code));
     }
 
 #define NEXUS_PIPE_NODE_SEND_DEF(z, n, data) \
@@ -46,7 +46,7 @@ public:
     void send(nexus::PacketCode code, BOOST_PP_ENUM_BINARY_PARAMS(n, const T, & x)) \
     { \
         size_t len = nexus::tupleSize(BOOST_PP_ENUM_PARAMS(n, x)); \
-        send(nexus::packCSD(code, len, BOOST_PP_ENUM_PARAMS(n, x))); \
+        sendPacket(code, nexus::packCSD(code, len, BOOST_PP_ENUM_PARAMS(n, x))); \
     } \
     /**/
 
@@ -60,6 +60,12 @@ public:
     
     bool connected();    
 private:
+    void sendPacket(nexus::PacketCode code, const nexus::Buffer & buffer)
+    {
+        capturePacket(cdOut, code, buffer.data(), buffer.size());
+        send(buffer);
+    }
+
     void finish();
     void shutdown();
     boost::asio::windows::stream_handle & stream();
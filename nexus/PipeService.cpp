@@ -8,8 +8,15 @@
 */
 #include "pch.h"
 
-#ifdef BOOST_WINDOWS
+#if defined(BOOST_WINDOWS) || defined(__linux__)
 
+#if !defined(BOOST_WINDOWS)
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/un.h>
+#endif
+
+#include "Capture.h"
 #include "ChunkedBuffer.h"
 #include "PacketReader.h"
 #include "PipeService.h"
@@ -20,6 +27,43 @@ namespace nexus {
 
 namespace {
 
+// Calls listener for every complete packet, returns number of consumed bytes.
+size_t parsePackets(const PipeService::Listener & listener, uint32_t id, const char * data, size_t size)
+{
+    PacketReader reader(data, size);
+    while(reader.left() >= 2)
+    {
+        reader.mark();
+        const char * packet = reader.raw();
+        PacketCode code = reader.read<PacketCode>();
+        uint32_t len = reader.read<uint8_t>();
+        if(len & 0x80)
+        {
+            if(reader.left() >= 1)
+            {
+                len = (len & 0x7f) | (reader.read<uint8_t>() << 7);
+                if(len & 0x4000)
+                {
+                    if(reader.left() >= 2)
+                        len = (len & 0x3fff) | (reader.read<uint16_t>() << 14);
+                }
+            }
+        }
+        if(len > reader.left())
+        {
+            reader.revert();
+            break;
+        }
+        if(PacketCapture::all())
+            PacketCapture::record(id, cdIn, code, packet, reader.raw() - packet + len);
+        listener(id, code, reader.raw(), len);
+        reader.skip(len);
+    }
+    return size - reader.left();
+}
+
+#if defined(BOOST_WINDOWS)
+
 class IoOperation : private OVERLAPPED {
 public:
     virtual void complete(DWORD bytesTransferred, int err) = 0;
@@ -36,8 +80,8 @@ public:
 template<class F>
 class ActionOperation : public IoOperation {
 public:
-    explicit ActionOperation(const F & f)
-        : f_(f)
+    explicit ActionOperation(F f)
+        : f_(std::move(f))
     {
     }
 
@@ -50,9 +94,9 @@ private:
 };
 
 template<class F>
-IoOperation * actionOperation(const F & f)
+IoOperation * actionOperation(F f)
 {
-    return new ActionOperation<F>(f);
+    return new ActionOperation<F>(std::move(f));
 }
 
 class PipeConnection;
@@ -219,34 +263,9 @@ private:
     {
         MLOG_DEBUG("processPackets(" << mlog::dump(&recvBuffer_[0], recvPos_) << ")");
 
-        PacketReader reader(&recvBuffer_[0], recvPos_);
-        while(reader.left() >= 2)
-        {
-            reader.mark();
-            PacketCode code = reader.read<PacketCode>();
-            uint32_t len = reader.read<uint8_t>();
-            if(len & 0x80)
-            {
-                if(reader.left() >= 1)
-                {
-                    len = (len & 0x7f) | (reader.read<uint8_t>() << 7);
-                    if(len & 0x4000)
-                    {
-                        if(reader.left() >= 2)
-                            len = (len & 0x3fff) | (reader.read<uint16_t>() << 14);
-                    }
-                }
-            }
-            if(len > reader.left())
-            {
-                reader.revert();
-                break;
-            }
-            listener_(id_, code, reader.raw(), len);
-            reader.skip(len);
-        }
-        memmove(&recvBuffer_[0], reader.raw(), reader.left());
-        recvPos_ = reader.left();
+        size_t consumed = parsePackets(listener_, id_, &recvBuffer_[0], recvPos_);
+        recvPos_ -= consumed;
+        memmove(&recvBuffer_[0], &recvBuffer_[consumed], recvPos_);
     }
 
     void checkFinished()
@@ -330,6 +349,8 @@ void SendOperation::complete(DWORD bytesTransferred, int err)
     connection_.sendDone(bytesTransferred, err);
 }
 
+#endif
+
 struct TimerOperation {
     boost::posix_time::ptime time;
 
@@ -413,6 +434,8 @@ mstd::rc_buffer pack(PacketCode code, const char * begin, size_t len)
 
 }
 
+#if defined(BOOST_WINDOWS)
+
 class PipeService::Impl : public PipeConnectionContext {
 public:
     Impl()
@@ -473,7 +496,10 @@ public:
     {
         MLOG_DEBUG("send(" << id << ", " << static_cast<int>(code) << ", " << mlog::dump(begin, len) << ")");
 
-        post(std::bind(&Impl::doSend, this, id, pack(code, begin, len)));
+        mstd::rc_buffer packet = pack(code, begin, len);
+        if(PacketCapture::all())
+            PacketCapture::record(id, cdOut, code, packet.data(), packet.size());
+        post(std::bind(&Impl::doSend, this, id, packet));
     }
 
     void disconnect(int id)
@@ -484,9 +510,9 @@ public:
     }
 
     template<class F>
-    void post(const F & f)
+    void post(F f)
     {
-        IoOperation * iop = actionOperation(f);
+        IoOperation * iop = actionOperation(std::move(f));
         PostQueuedCompletionStatus(iocp_, 0, 1, iop->prepare());
     }
 private:
@@ -626,6 +652,531 @@ private:
     Listener listener_;
 };
 
+#else
+
+namespace {
+
+class PollHandler {
+public:
+    virtual void ready(uint32_t events) = 0;
+protected:
+    virtual ~PollHandler() {}
+};
+
+class PipeConnection;
+
+class PipeConnectionContext {
+public:
+    virtual int epoll() = 0;
+    virtual uint32_t registerConnection(PipeConnection * connection) = 0;
+    virtual void releaseConnection(PipeConnection * connection) = 0;
+};
+
+// Pipe names are mapped to the abstract unix socket namespace, so nothing is left in file system after process exit.
+bool makeAddress(const std::wstring & name, sockaddr_un & addr, socklen_t & len)
+{
+    std::string path = mstd::utf8(name);
+    if(path.empty() || path.size() + 1 > sizeof(addr.sun_path))
+        return false;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    memcpy(addr.sun_path + 1, path.c_str(), path.size());
+    len = static_cast<socklen_t>(offsetof(sockaddr_un, sun_path) + 1 + path.size());
+    return true;
+}
+
+class PipeConnection : public PollHandler, boost::noncopyable {
+public:
+    PipeConnection(PipeConnectionContext & context, const PipeService::Listener & listener, int fd)
+        : context_(context), listener_(listener), id_(0), fd_(fd), events_(0), recvPos_(0)
+    {
+    }
+
+    ~PipeConnection()
+    {
+        reset();
+    }
+
+    uint32_t id() const
+    {
+        return id_;
+    }
+
+    void start()
+    {
+        id_ = context_.registerConnection(this);
+        int err = watch(EPOLLIN);
+        if(!err)
+            listener_(id_, -pcConnected, 0, 0);
+        else {
+            MLOG_ERROR("register failed: " << err);
+            reset();
+            listener_(-err, -pcFailed, 0, 0);
+            context_.releaseConnection(this);
+        }
+    }
+
+    void send(const char * data, size_t len)
+    {
+        if(fd_ == -1)
+            return;
+        bool wasEmpty = sendBuffer_.empty();
+        sendBuffer_.append(data, len);
+        if(wasEmpty && len)
+            startSend();
+    }
+
+    void disconnect()
+    {
+        if(fd_ != -1)
+            finish();
+    }
+
+    void ready(uint32_t events)
+    {
+        if(fd_ != -1 && (events & (EPOLLIN | EPOLLHUP | EPOLLERR)))
+            receive();
+        if(fd_ != -1 && (events & EPOLLOUT))
+            startSend();
+    }
+private:
+    void reset()
+    {
+        if(fd_ != -1)
+        {
+            close(fd_);
+            fd_ = -1;
+        }
+    }
+
+    void finish()
+    {
+        MLOG_NOTICE("pipe finished: " << id_);
+        reset();
+        listener_(id_, -pcDisconnected, 0, 0);
+        context_.releaseConnection(this);
+    }
+
+    int watch(uint32_t events)
+    {
+        if(events == events_)
+            return 0;
+        epoll_event event;
+        event.events = events;
+        event.data.ptr = static_cast<PollHandler*>(this);
+        if(epoll_ctl(context_.epoll(), events_ ? EPOLL_CTL_MOD : EPOLL_CTL_ADD, fd_, &event) == -1)
+            return errno;
+        events_ = events;
+        return 0;
+    }
+
+    void receive()
+    {
+        while(true)
+        {
+            if(recvBuffer_.size() - recvPos_ < 0x100)
+            {
+                recvBuffer_.resize(recvBuffer_.size() + 0x100);
+                recvBuffer_.resize(recvBuffer_.capacity());
+            }
+            ssize_t len = read(fd_, &recvBuffer_[recvPos_], recvBuffer_.size() - recvPos_);
+            if(len > 0)
+            {
+                recvPos_ += len;
+                processPackets();
+                // listener could disconnect us
+                if(fd_ == -1)
+                    return;
+            } else if(len == 0) {
+                finish();
+                return;
+            } else {
+                int err = errno;
+                if(err == EINTR)
+                    continue;
+                if(err != EAGAIN && err != EWOULDBLOCK)
+                {
+                    MLOG_ERROR("recv failed: " << err);
+                    finish();
+                }
+                return;
+            }
+        }
+    }
+
+    void processPackets()
+    {
+        MLOG_DEBUG("processPackets(" << mlog::dump(&recvBuffer_[0], recvPos_) << ")");
+
+        size_t consumed = parsePackets(listener_, id_, &recvBuffer_[0], recvPos_);
+        recvPos_ -= consumed;
+        memmove(&recvBuffer_[0], &recvBuffer_[consumed], recvPos_);
+    }
+
+    void startSend()
+    {
+        while(!sendBuffer_.empty())
+        {
+            auto p = sendBuffer_.readyChunk();
+            ssize_t len = ::send(fd_, p.first, p.second, MSG_NOSIGNAL);
+            if(len >= 0)
+                sendBuffer_.consume(len);
+            else {
+                int err = errno;
+                if(err == EINTR)
+                    continue;
+                if(err == EAGAIN || err == EWOULDBLOCK)
+                    break;
+                MLOG_ERROR("send failed: " << err);
+                finish();
+                return;
+            }
+        }
+        int err = watch(sendBuffer_.empty() ? EPOLLIN : EPOLLIN | EPOLLOUT);
+        if(err)
+        {
+            MLOG_ERROR("modify failed: " << err);
+            finish();
+        }
+    }
+
+    PipeConnectionContext & context_;
+    PipeService::Listener listener_;
+    uint32_t id_;
+    int fd_;
+    uint32_t events_;
+
+    std::vector<char> recvBuffer_;
+    size_t recvPos_;
+
+    ChunkedBuffer sendBuffer_;
+};
+
+class PipeAcceptor : public PollHandler, boost::noncopyable {
+public:
+    PipeAcceptor(PipeConnectionContext & context, const PipeService::Listener & listener, int fd)
+        : context_(context), listener_(listener), fd_(fd)
+    {
+    }
+
+    ~PipeAcceptor()
+    {
+        close(fd_);
+    }
+
+    void ready(uint32_t)
+    {
+        while(true)
+        {
+            int fd = accept4(fd_, 0, 0, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if(fd == -1)
+            {
+                int err = errno;
+                if(err == EINTR || err == ECONNABORTED)
+                    continue;
+                if(err != EAGAIN && err != EWOULDBLOCK)
+                    MLOG_ERROR("accept failed: " << err);
+                break;
+            }
+            PipeConnection * connection = new PipeConnection(context_, listener_, fd);
+            connection->start();
+        }
+    }
+private:
+    PipeConnectionContext & context_;
+    PipeService::Listener listener_;
+    int fd_;
+};
+
+}
+
+// All pipes of service are multiplexed by single thread waiting on epoll.
+// Posted actions are queued under mutex and wake the thread through eventfd.
+class PipeService::Impl : public PipeConnectionContext, public PollHandler {
+public:
+    Impl()
+        : epoll_(epoll_create1(EPOLL_CLOEXEC)), wake_(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)), stopped_(false)
+    {
+        connections_.erase(connections_.insert(0));
+
+        if(epoll_ == -1 || wake_ == -1)
+            MLOG_ERROR("create failed: " << errno);
+        else {
+            epoll_event event;
+            event.events = EPOLLIN;
+            event.data.ptr = static_cast<PollHandler*>(this);
+            if(epoll_ctl(epoll_, EPOLL_CTL_ADD, wake_, &event) == -1)
+                MLOG_ERROR("register wake failed: " << errno);
+        }
+    }
+
+    ~Impl()
+    {
+        if(thread_ != boost::thread())
+        {
+            post(std::bind(&Impl::doStop, this));
+            thread_.join();
+        }
+
+        for(auto i = connections_.begin(), end = connections_.end(); i != end; ++i)
+            delete *i;
+        deleteReleased();
+        while(!timers_.empty())
+        {
+            delete timers_.top();
+            timers_.pop();
+        }
+
+        if(wake_ != -1)
+            close(wake_);
+        if(epoll_ != -1)
+            close(epoll_);
+    }
+
+    void listen(const Listener & listener, const std::wstring & name)
+    {
+        start();
+
+        post(std::bind(&Impl::doListen, this, listener, name));
+    }
+
+    void connect(const Listener & listener, const std::wstring & name, int retries)
+    {
+        start();
+
+        post(std::bind(&Impl::doConnect, this, listener, name, retries));
+    }
+
+    int epoll()
+    {
+        return epoll_;
+    }
+
+    uint32_t registerConnection(PipeConnection * conn)
+    {
+        return connections_.insert(conn).full();
+    }
+
+    void releaseConnection(PipeConnection * conn)
+    {
+        connections_.erase(conn->id());
+        // epoll could still report events for this connection in current batch
+        released_.push_back(conn);
+    }
+
+    void send(int id, PacketCode code, const char * begin, size_t len)
+    {
+        MLOG_DEBUG("send(" << id << ", " << static_cast<int>(code) << ", " << mlog::dump(begin, len) << ")");
+
+        mstd::rc_buffer packet = pack(code, begin, len);
+        if(PacketCapture::all())
+            PacketCapture::record(id, cdOut, code, packet.data(), packet.size());
+        post(std::bind(&Impl::doSend, this, id, packet));
+    }
+
+    void disconnect(int id)
+    {
+        post(std::bind(&Impl::doDisconnect, this, id));
+    }
+
+    void post(mstd::unique_function<void()> f)
+    {
+        bool wasEmpty;
+        {
+            boost::lock_guard<boost::mutex> lock(mutex_);
+            wasEmpty = queue_.empty();
+            queue_.push_back(std::move(f));
+        }
+        if(wasEmpty)
+        {
+            uint64_t value = 1;
+            if(write(wake_, &value, sizeof(value)) == -1 && errno != EAGAIN)
+                MLOG_ERROR("wake failed: " << errno);
+        }
+    }
+
+    void ready(uint32_t)
+    {
+        uint64_t value;
+        while(read(wake_, &value, sizeof(value)) == -1 && errno == EINTR)
+            ;
+
+        std::vector<mstd::unique_function<void()>> actions;
+        {
+            boost::lock_guard<boost::mutex> lock(mutex_);
+            actions.swap(queue_);
+        }
+        for(auto i = actions.begin(), end = actions.end(); i != end; ++i)
+            (*i)();
+    }
+private:
+    void start()
+    {
+        if(thread_ == boost::thread())
+            thread_ = boost::thread(std::bind(&Impl::run, this));
+    }
+
+    void doStop()
+    {
+        stopped_ = true;
+    }
+
+    void deleteReleased()
+    {
+        for(auto i = released_.begin(), end = released_.end(); i != end; ++i)
+            delete *i;
+        released_.clear();
+    }
+
+    void doSend(int id, const mstd::rc_buffer & buffer)
+    {
+        MLOG_DEBUG("doSend(" << id << ", " << mlog::dump(buffer.data(), buffer.size()) << ")");
+
+        if(id)
+        {
+            auto i = connections_.find(id);
+            if(i != connections_.end())
+                (*i)->send(buffer.data(), buffer.size());
+        } else
+            for(auto i = connections_.begin(), end = connections_.end(); i != end; ++i)
+                (*i)->send(buffer.data(), buffer.size());
+    }
+
+    void doDisconnect(int id)
+    {
+        auto i = connections_.find(id);
+        if(i != connections_.end())
+            (*i)->disconnect();
+    }
+
+    void doListen(const Listener & listener, const std::wstring & name)
+    {
+        MLOG_DEBUG("doListen(" + mstd::utf8(name) + ")");
+
+        sockaddr_un addr;
+        socklen_t len;
+        if(!makeAddress(name, addr, len))
+        {
+            MLOG_ERROR("invalid pipe name: " << mstd::utf8(name));
+            listener(-ENAMETOOLONG, -pcFailed, 0, 0);
+            return;
+        }
+
+        int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        int err = fd == -1 ? errno : 0;
+        if(!err && (bind(fd, mstd::pointer_cast<sockaddr*>(&addr), len) == -1 || ::listen(fd, SOMAXCONN) == -1))
+            err = errno;
+        if(!err)
+        {
+            acceptors_.push_back(new PipeAcceptor(*this, listener, fd));
+            epoll_event event;
+            event.events = EPOLLIN;
+            event.data.ptr = static_cast<PollHandler*>(&acceptors_.back());
+            if(epoll_ctl(epoll_, EPOLL_CTL_ADD, fd, &event) == -1)
+            {
+                err = errno;
+                acceptors_.pop_back();
+                fd = -1;
+            }
+        }
+
+        if(err)
+        {
+            // name is probably held by another instance, so wait until it is released like the windows version does
+            MLOG_ERROR("create pipe failed: " << err);
+            if(fd != -1)
+                close(fd);
+            timers_.push(timerOperation(boost::posix_time::milliseconds(250), std::bind(&Impl::doListen, this, listener, name)));
+        }
+    }
+
+    void doConnect(const Listener & listener, const std::wstring & name, int retries)
+    {
+        MLOG_DEBUG("doConnect(" << mstd::utf8(name) << ", " << retries << ")");
+
+        sockaddr_un addr;
+        socklen_t len;
+        if(!makeAddress(name, addr, len))
+        {
+            MLOG_ERROR("invalid pipe name: " << mstd::utf8(name));
+            listener(-ENAMETOOLONG, -pcFailed, 0, 0);
+            return;
+        }
+
+        int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        int err = fd == -1 ? errno : 0;
+        if(!err && ::connect(fd, mstd::pointer_cast<sockaddr*>(&addr), len) == -1)
+            err = errno;
+
+        if(!err)
+        {
+            PipeConnection * connection = new PipeConnection(*this, listener, fd);
+            connection->start();
+        } else {
+            MLOG_WARNING("connect failed: " << err);
+            if(fd != -1)
+                close(fd);
+            if(retries)
+            {
+                if(retries > 0)
+                    --retries;
+                timers_.push(timerOperation(boost::posix_time::milliseconds(250), std::bind(&Impl::doConnect, this, listener, name, retries)));
+            } else {
+                listener(-err, -pcFailed, 0, 0);
+            }
+        }
+    }
+
+    void run()
+    {
+        MLOG_NOTICE("run()");
+
+        const int maxEvents = 0x40;
+        epoll_event events[maxEvents];
+        while(!stopped_)
+        {
+            boost::posix_time::ptime now = boost::posix_time::microsec_clock::universal_time();
+            int wait;
+            {
+                TimerOperation * op;
+                while(!timers_.empty() && (op = timers_.top())->time <= now)
+                {
+                    timers_.pop();
+                    op->run();
+                    delete op;
+                }
+                wait = timers_.empty() ? -1 : static_cast<int>((op->time - now).total_milliseconds()) + 1;
+            }
+            int count = epoll_wait(epoll_, events, maxEvents, wait);
+            if(count == -1)
+            {
+                if(errno == EINTR)
+                    continue;
+                MLOG_ERROR("wait failed: " << errno);
+                break;
+            }
+            for(int i = 0; i != count; ++i)
+                static_cast<PollHandler*>(events[i].data.ptr)->ready(events[i].events);
+            deleteReleased();
+        }
+
+        MLOG_NOTICE("run, done");
+    }
+
+    boost::thread thread_;
+    int epoll_;
+    int wake_;
+    bool stopped_;
+    boost::mutex mutex_;
+    std::vector<mstd::unique_function<void()>> queue_;
+    std::priority_queue<TimerOperation*, std::vector<TimerOperation*>, CompareTime> timers_;
+    mstd::tid_map<mstd::tid_map_key<uint32_t>, PipeConnection*> connections_;
+    std::vector<PipeConnection*> released_;
+    boost::ptr_vector<PipeAcceptor> acceptors_;
+};
+
+#endif
+
 PipeService::PipeService()
     : impl_(new Impl())
 {
@@ -650,9 +1201,9 @@ void PipeService::send(int id, PacketCode code, const char * begin, size_t len)
     impl_->send(id, code, begin, len);
 }
 
-void PipeService::post(const std::function<void()> & action)
+void PipeService::post(mstd::unique_function<void()> action)
 {
-    impl_->post(action);
+    impl_->post(std::move(action));
 }
 
 void PipeService::disconnect(int id)
@@ -10,6 +10,8 @@
 
 #ifndef NEXUS_BUILDING
 #include <boost/scoped_ptr.hpp>
+
+#include <mstd/unique_function.hpp>
 #endif
 
 #include "Packet.h"
@@ -35,7 +37,7 @@ public:
 
     void disconnect(int id);
 
-    void post(const std::function<void()> & action);
+    void post(mstd::unique_function<void()> action);
 private:
     class Impl;
     boost::scoped_ptr<Impl> impl_;
@@ -14,71 +14,127 @@ MLOG_DECLARE_LOGGER(rest);
 
 namespace nexus {
 
+namespace {
+
+// 1 for unreserved characters of RFC 3986, that are passed to url as is
+const unsigned char plainChars[0x100] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 0,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0,
+    0, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 1,
+    0, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 1, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+};
+
+const char * const upperHex = "0123456789ABCDEF";
+
+}
+
 RESTRequest::RESTRequest(const std::string & base)
     : url_(base)
 {
 }
 
-void RESTRequest::addParam(const std::string & param, const std::string & value)
+void RESTRequest::reset(const std::string & base)
 {
-    str_ += param;
-    str_ += '=';
-    str_ += value;
-    url_ += param;
-    url_ += '=';
-    url_ += value;
-    url_ += '&';
+    url_.assign(base);
+    str_.clear();
 }
 
-void RESTRequest::addParam(const std::string & param, const char * value)
+size_t RESTRequest::escapedLength(const char * input, size_t len)
 {
-    str_ += param;
-    str_ += '=';
-    str_ += value;
-    url_ += param;
-    url_ += '=';
-    url_ += value;
-    url_ += '&';
+    const unsigned char * p = mstd::pointer_cast<const unsigned char*>(input);
+    const unsigned char * end = p + len;
+    size_t plain = 0;
+    // independent lookups, so they are not serialized by the sum
+    for(; end - p >= 4; p += 4)
+        plain += plainChars[p[0]] + plainChars[p[1]] + plainChars[p[2]] + plainChars[p[3]];
+    for(; p != end; ++p)
+        plain += plainChars[*p];
+    return len + (len - plain) * 2;
 }
 
-void RESTRequest::addParam(const char * param, const std::string & value)
+namespace {
+
+inline char * escapeChar(unsigned char c, char * out)
 {
-    str_ += param;
-    str_ += '=';
-    str_ += value;
-    url_ += param;
-    url_ += '=';
-    url_ += value;
-    url_ += '&';
+    if(plainChars[c])
+        *out++ = c;
+    else {
+        out[0] = '%';
+        out[1] = upperHex[c >> 4];
+        out[2] = upperHex[c & 0xf];
+        out += 3;
+    }
+    return out;
+}
+
 }
 
-void RESTRequest::addParam(const char * param, const char * value)
+char * RESTRequest::escape(const char * input, size_t len, char * out)
 {
-    str_ += param;
-    str_ += '=';
-    str_ += value;
-    url_ += param;
-    url_ += '=';
-    url_ += value;
-    url_ += '&';
+    const unsigned char * p = mstd::pointer_cast<const unsigned char*>(input);
+    const unsigned char * end = p + len;
+    // most of values are plain, so check 8 chars at once and copy them without branching per char
+    while(end - p >= 8)
+    {
+        if(plainChars[p[0]] & plainChars[p[1]] & plainChars[p[2]] & plainChars[p[3]] &
+           plainChars[p[4]] & plainChars[p[5]] & plainChars[p[6]] & plainChars[p[7]])
+        {
+            memcpy(out, p, 8);
+            out += 8;
+            p += 8;
+        } else
+            for(const unsigned char * stop = p + 8; p != stop; ++p)
+                out = escapeChar(*p, out);
+    }
+    for(; p != end; ++p)
+        out = escapeChar(*p, out);
+    return out;
 }
 
-const std::string & RESTRequest::url(const std::string & apiSecret)
+void RESTRequest::addParam(const char * param, size_t paramLen, const char * value, size_t valueLen)
 {
-    str_ += apiSecret;
-    std::string sig = mcrypt::visualize(mcrypt::md5String(str_));
-    url_ += "sig=";
-    url_ += sig;
+    str_.append(param, paramLen);
+    str_ += '=';
+    str_.append(value, valueLen);
 
-    return url_;
+    size_t pos = url_.length();
+    url_.resize(pos + escapedLength(param, paramLen) + escapedLength(value, valueLen) + 2);
+    char * out = escape(param, paramLen, &url_[pos]);
+    *out++ = '=';
+    out = escape(value, valueLen, out);
+    *out = '&';
 }
 
-const std::string & RESTRequest::url(const char * apiSecret)
+const std::string & RESTRequest::url(const char * secret, size_t len)
 {
-    str_ += apiSecret;
-    std::string sig = mcrypt::visualize(mcrypt::md5String(str_));
-    url_ += "sig=";
-    url_ += sig;
+    mcrypt::MD5 md5;
+    md5.feed(str_);
+    md5.feed(secret, len);
+    mcrypt::MD5Digest digest;
+    md5.digest(digest);
+
+    size_t pos = url_.length();
+    url_.resize(pos + 4 + digest.size() * 2);
+    char * out = &url_[pos];
+    memcpy(out, "sig=", 4);
+    out += 4;
+    for(mcrypt::MD5Digest::const_iterator i = digest.begin(), end = digest.end(); i != end; ++i)
+    {
+        *out++ = mstd::hex_table[*i >> 4];
+        *out++ = mstd::hex_table[*i & 0xf];
+    }
 
     return url_;
 }
@@ -16,20 +16,31 @@
 
 namespace nexus {
 
+// Builds signed url: base + "param=value&..." + "sig=" + md5 of "param=value..." followed by secret.
+// Parameters are percent-escaped straight into the url, reset() keeps allocated storage for the next request.
 class RESTRequest {
 public:
-    RESTRequest(const std::string & base);
+    RESTRequest() {}
+    explicit RESTRequest(const std::string & base);
+
+    void reset(const std::string & base);
 
     void addString(const std::string & value) { str_ += value; }
     void setString(const std::string & value) { str_ = value; }
-    void addParam(const std::string & param, const std::string & value);
-    void addParam(const std::string & param, const char * value);
-    void addParam(const char * param, const std::string & value);
-    void addParam(const char * param, const char * value);
-    const std::string & url(const std::string & apiSecret);
-    const std::string & url(const char * secret);
+    void addParam(const std::string & param, const std::string & value) { addParam(param.c_str(), param.length(), value.c_str(), value.length()); }
+    void addParam(const std::string & param, const char * value) { addParam(param.c_str(), param.length(), value, strlen(value)); }
+    void addParam(const char * param, const std::string & value) { addParam(param, strlen(param), value.c_str(), value.length()); }
+    void addParam(const char * param, const char * value) { addParam(param, strlen(param), value, strlen(value)); }
+    void addParam(const char * param, size_t paramLen, const char * value, size_t valueLen);
+    const std::string & url(const std::string & apiSecret) { return url(apiSecret.c_str(), apiSecret.length()); }
+    const std::string & url(const char * secret) { return url(secret, strlen(secret)); }
+    const std::string & url(const char * secret, size_t len);
 
     const std::string & url() { return url_; }
+
+    static size_t escapedLength(const char * input, size_t len);
+    // out should have room for escapedLength(input, len) chars, returns end of written data
+    static char * escape(const char * input, size_t len, char * out);
 private:
     std::string url_;
     std::string str_;
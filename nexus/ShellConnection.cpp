@@ -8,6 +8,7 @@
 */
 #include "pch.h"
 
+#include "Capture.h"
 #include "Handler.h"
 #include "ShellConnection.h"
 
@@ -135,7 +136,8 @@ private:
             std::ostringstream out;
 
             try {
-                listener_(out, args);
+                if(!PacketCapture::command(out, args))
+                    listener_(out, args);
             } catch(boost::exception & exc) {
                 out << "Failed: " << mstd::out_exception(exc) << std::endl;
             } catch(std::exception & exc) {
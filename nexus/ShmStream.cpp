@@ -0,0 +1,646 @@
+/*
+** The author disclaims copyright to this source code.  In place of
+** a legal notice, here is a blessing:
+**
+**    May you do good and not evil.
+**    May you find forgiveness for yourself and forgive others.
+**    May you share freely, never taking more than you give.
+*/
+#include "pch.h"
+
+#if defined(__linux__)
+
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <boost/enable_shared_from_this.hpp>
+#include <boost/lexical_cast.hpp>
+
+#include <boost/asio/posix/stream_descriptor.hpp>
+
+#include "ShmStream.h"
+
+MLOG_DECLARE_LOGGER(nexus_shm);
+
+namespace nexus {
+
+namespace {
+
+const boost::uint32_t shmMagic = 0x4e53484d;
+const size_t cacheLine = 64;
+
+// Lives in shared memory, so only plain fields accessed with atomic builtins.
+struct RingHeader {
+    boost::uint32_t magic;
+    boost::uint32_t closed;
+    boost::uint64_t capacity;
+    char pad0[cacheLine - 16];
+    // written by producer
+    boost::uint64_t head;
+    boost::uint32_t readerWaiting;
+    char pad1[cacheLine - 12];
+    // written by consumer
+    boost::uint64_t tail;
+    boost::uint32_t writerWaiting;
+    char pad2[cacheLine - 12];
+};
+
+template<class T>
+inline T load(const T & value)
+{
+    return __atomic_load_n(&value, __ATOMIC_ACQUIRE);
+}
+
+template<class T>
+inline void store(T & value, T newValue)
+{
+    __atomic_store_n(&value, newValue, __ATOMIC_RELEASE);
+}
+
+inline void fence()
+{
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+// Header is writable by peer, so capacity validated at handshake is kept in Ring and positions read from header
+// are checked against it before every copy.
+class Ring {
+public:
+    Ring()
+        : header_(0), data_(0), capacity_(0), mask_(0) {}
+
+    void attach(char * base, boost::uint64_t capacity)
+    {
+        header_ = mstd::pointer_cast<RingHeader*>(base);
+        data_ = base + sizeof(RingHeader);
+        capacity_ = capacity;
+        mask_ = capacity - 1;
+    }
+
+    static void init(char * base, size_t capacity)
+    {
+        RingHeader * header = new (base) RingHeader();
+        header->magic = shmMagic;
+        header->capacity = capacity;
+    }
+
+    static size_t segmentSize(size_t capacity)
+    {
+        return sizeof(RingHeader) + capacity;
+    }
+
+    RingHeader & header()
+    {
+        return *header_;
+    }
+
+    size_t write(const ShmBuffers & buffers, boost::system::error_code & ec)
+    {
+        boost::uint64_t head = header_->head;
+        boost::uint64_t used = head - load(header_->tail);
+        if(used > capacity_)
+        {
+            MLOG_NOTICE("ring corrupted, used: " << used << ", capacity: " << capacity_);
+            ec = boost::asio::error::invalid_argument;
+            return 0;
+        }
+        boost::uint64_t space = capacity_ - used;
+        size_t result = 0;
+        for(size_t i = 0; i != buffers.size && space; ++i)
+        {
+            size_t len = std::min<boost::uint64_t>(buffers.items[i].second, space);
+            copyIn(head, buffers.items[i].first, len);
+            head += len;
+            space -= len;
+            result += len;
+        }
+        if(result)
+            store(header_->head, head);
+        return result;
+    }
+
+    size_t read(const ShmBuffers & buffers, boost::system::error_code & ec)
+    {
+        boost::uint64_t tail = header_->tail;
+        boost::uint64_t ready = load(header_->head) - tail;
+        if(ready > capacity_)
+        {
+            MLOG_NOTICE("ring corrupted, ready: " << ready << ", capacity: " << capacity_);
+            ec = boost::asio::error::invalid_argument;
+            return 0;
+        }
+        size_t result = 0;
+        for(size_t i = 0; i != buffers.size && ready; ++i)
+        {
+            size_t len = std::min<boost::uint64_t>(buffers.items[i].second, ready);
+            copyOut(tail, buffers.items[i].first, len);
+            tail += len;
+            ready -= len;
+            result += len;
+        }
+        if(result)
+            store(header_->tail, tail);
+        return result;
+    }
+private:
+    void copyIn(boost::uint64_t pos, const char * src, size_t len)
+    {
+        size_t offset = pos & mask_;
+        size_t first = std::min<size_t>(len, mask_ + 1 - offset);
+        memcpy(data_ + offset, src, first);
+        memcpy(data_, src + first, len - first);
+    }
+
+    void copyOut(boost::uint64_t pos, char * dest, size_t len)
+    {
+        size_t offset = pos & mask_;
+        size_t first = std::min<size_t>(len, mask_ + 1 - offset);
+        memcpy(dest, data_ + offset, first);
+        memcpy(dest + first, data_, len - first);
+    }
+
+    RingHeader * header_;
+    char * data_;
+    boost::uint64_t capacity_;
+    boost::uint64_t mask_;
+};
+
+int createSegment(size_t size)
+{
+#if defined(SYS_memfd_create)
+    int fd = static_cast<int>(syscall(SYS_memfd_create, "nexus_shm", 0));
+#else
+    int fd = -1;
+#endif
+    if(fd < 0)
+    {
+        std::string name = "/nexus_shm_" + boost::lexical_cast<std::string>(getpid()) + "_" + boost::lexical_cast<std::string>(reinterpret_cast<uintptr_t>(&size));
+        fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+        if(fd >= 0)
+            shm_unlink(name.c_str());
+    }
+    if(fd >= 0 && ftruncate(fd, size) != 0)
+    {
+        ::close(fd);
+        fd = -1;
+    }
+    return fd;
+}
+
+boost::system::error_code lastError()
+{
+    return boost::system::error_code(errno, boost::system::system_category());
+}
+
+}
+
+class ShmStream::Impl : public boost::enable_shared_from_this<Impl> {
+public:
+    explicit Impl(boost::asio::io_service & ios)
+        : ios_(ios), socket_(ios), wake_(ios), segment_(0), segmentSize_(0), peerWake_(-1),
+          reading_(false), writing_(false), waiting_(false), closed_(false), peerClosed_(false)
+    {
+    }
+
+    ~Impl()
+    {
+        if(segment_)
+            munmap(segment_, segmentSize_);
+        if(peerWake_ >= 0)
+            ::close(peerWake_);
+    }
+
+    void connect(boost::asio::local::stream_protocol::socket & socket, size_t ringSize, boost::system::error_code & ec)
+    {
+        size_t capacity = 1;
+        while(capacity < ringSize)
+            capacity <<= 1;
+
+        segmentSize_ = 2 * Ring::segmentSize(capacity);
+        int fds[3] = { createSegment(segmentSize_), eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC), eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC) };
+        if(fds[0] < 0 || fds[1] < 0 || fds[2] < 0)
+            ec = lastError();
+        else if(!map(fds[0], ec))
+        {
+            Ring::init(segment_, capacity);
+            Ring::init(segment_ + Ring::segmentSize(capacity), capacity);
+            sendFds(socket, fds, ec);
+        }
+
+        if(!ec)
+            attach(socket, 0, capacity, fds[1], fds[2]);
+        else
+        {
+            MLOG_ERROR("connect failed: " << ec << ", " << ec.message());
+            for(size_t i = 1; i != 3; ++i)
+                if(fds[i] >= 0)
+                    ::close(fds[i]);
+        }
+        if(fds[0] >= 0)
+            ::close(fds[0]);
+    }
+
+    void accept(boost::asio::local::stream_protocol::socket & socket, boost::system::error_code & ec)
+    {
+        int fds[3] = { -1, -1, -1 };
+        boost::uint64_t capacity = 0;
+        receiveFds(socket, fds, ec);
+        if(!ec)
+        {
+            struct stat st;
+            if(fstat(fds[0], &st) != 0)
+                ec = lastError();
+            else {
+                segmentSize_ = st.st_size;
+                if(!map(fds[0], ec) && !validate(capacity))
+                    ec = boost::asio::error::invalid_argument;
+            }
+        }
+
+        if(!ec)
+            attach(socket, 1, capacity, fds[2], fds[1]);
+        else {
+            MLOG_ERROR("accept failed: " << ec << ", " << ec.message());
+            for(size_t i = 1; i != 3; ++i)
+                if(fds[i] >= 0)
+                    ::close(fds[i]);
+        }
+        if(fds[0] >= 0)
+            ::close(fds[0]);
+    }
+
+    void asyncRead(const ShmBuffers & buffers, const Handler & handler)
+    {
+        boost::lock_guard<boost::mutex> lock(mutex_);
+        BOOST_ASSERT(!reading_);
+        readBuffers_ = buffers;
+        readHandler_ = handler;
+        reading_ = true;
+        processRead(lock);
+    }
+
+    void asyncWrite(const ShmBuffers & buffers, const Handler & handler)
+    {
+        boost::lock_guard<boost::mutex> lock(mutex_);
+        BOOST_ASSERT(!writing_);
+        writeBuffers_ = buffers;
+        writeHandler_ = handler;
+        writing_ = true;
+        processWrite(lock);
+    }
+
+    bool isOpen()
+    {
+        boost::lock_guard<boost::mutex> lock(mutex_);
+        return segment_ && !closed_;
+    }
+
+    void close()
+    {
+        boost::lock_guard<boost::mutex> lock(mutex_);
+        if(closed_)
+            return;
+        closed_ = true;
+
+        if(segment_)
+        {
+            store(tx_.header().closed, 1u);
+            signalPeer();
+        }
+
+        boost::system::error_code ec;
+        wake_.close(ec);
+        socket_.close(ec);
+
+        if(reading_)
+            complete(reading_, readHandler_, boost::asio::error::operation_aborted, 0);
+        if(writing_)
+            complete(writing_, writeHandler_, boost::asio::error::operation_aborted, 0);
+    }
+private:
+    bool map(int fd, boost::system::error_code & ec)
+    {
+        void * result = mmap(0, segmentSize_, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if(result == MAP_FAILED)
+        {
+            ec = lastError();
+            return true;
+        }
+        segment_ = static_cast<char*>(result);
+        return false;
+    }
+
+    // Capacity is read once, so value checked here is the one rings use.
+    bool validate(boost::uint64_t & capacity)
+    {
+        if(segmentSize_ < 2 * sizeof(RingHeader))
+            return false;
+        RingHeader * first = mstd::pointer_cast<RingHeader*>(segment_);
+        capacity = load(first->capacity);
+        if(first->magic != shmMagic || !capacity || (capacity & (capacity - 1)) || 2 * Ring::segmentSize(capacity) != segmentSize_)
+            return false;
+        RingHeader * second = mstd::pointer_cast<RingHeader*>(segment_ + Ring::segmentSize(capacity));
+        return second->magic == shmMagic && second->capacity == capacity;
+    }
+
+    void sendFds(boost::asio::local::stream_protocol::socket & socket, int * fds, boost::system::error_code & ec)
+    {
+        char data = 0;
+        struct iovec iov = { &data, 1 };
+        char control[CMSG_SPACE(3 * sizeof(int))];
+        memset(control, 0, sizeof(control));
+
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+
+        struct cmsghdr * cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(3 * sizeof(int));
+        memcpy(CMSG_DATA(cmsg), fds, 3 * sizeof(int));
+
+        if(sendmsg(socket.native_handle(), &msg, MSG_NOSIGNAL) != 1)
+            ec = lastError();
+    }
+
+    void receiveFds(boost::asio::local::stream_protocol::socket & socket, int * fds, boost::system::error_code & ec)
+    {
+        char data = 0;
+        struct iovec iov = { &data, 1 };
+        char control[CMSG_SPACE(3 * sizeof(int))];
+
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+
+        // handshake is the first message on the socket, so wait for it even when socket is non blocking
+        ssize_t received;
+        while((received = recvmsg(socket.native_handle(), &msg, MSG_CMSG_CLOEXEC)) < 0 && (errno == EAGAIN || errno == EINTR))
+        {
+            struct pollfd pfd = { socket.native_handle(), POLLIN, 0 };
+            ::poll(&pfd, 1, -1);
+        }
+        if(received != 1)
+        {
+            ec = received < 0 ? lastError() : boost::asio::error::eof;
+            return;
+        }
+
+        struct cmsghdr * cmsg = CMSG_FIRSTHDR(&msg);
+        if(!cmsg || cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS || cmsg->cmsg_len != CMSG_LEN(3 * sizeof(int)))
+        {
+            ec = boost::asio::error::invalid_argument;
+            return;
+        }
+        memcpy(fds, CMSG_DATA(cmsg), 3 * sizeof(int));
+    }
+
+    void attach(boost::asio::local::stream_protocol::socket & socket, size_t side, boost::uint64_t capacity, int wake, int peerWake)
+    {
+        Ring first, second;
+        first.attach(segment_, capacity);
+        second.attach(segment_ + Ring::segmentSize(capacity), capacity);
+        tx_ = side ? second : first;
+        rx_ = side ? first : second;
+
+        wake_.assign(wake);
+        peerWake_ = peerWake;
+        socket_ = boost::move(socket);
+        socket_.async_read_some(boost::asio::buffer(&socketByte_, 1), std::bind(&Impl::handleSocket, shared_from_this(), std::placeholders::_1));
+    }
+
+    void processRead(boost::lock_guard<boost::mutex> &)
+    {
+        if(!reading_)
+            return;
+
+        if(closed_)
+        {
+            complete(reading_, readHandler_, boost::asio::error::operation_aborted, 0);
+            return;
+        }
+        if(failed())
+            return;
+
+        size_t len = rx_.read(readBuffers_, error_);
+        if(!len)
+        {
+            // data published before closed flag is visible after reading it, so check ring once more
+            bool peerGone = load(rx_.header().closed) || peerClosed_;
+            len = rx_.read(readBuffers_, error_);
+            if(failed())
+                return;
+            if(!len && peerGone)
+            {
+                complete(reading_, readHandler_, boost::asio::error::eof, 0);
+                return;
+            }
+            if(!len)
+            {
+                // writer checks the flag after publishing data, so check ring again after raising it
+                store(rx_.header().readerWaiting, 1u);
+                fence();
+                len = rx_.read(readBuffers_, error_);
+                if(failed())
+                    return;
+                if(!len)
+                {
+                    startWait();
+                    return;
+                }
+                store(rx_.header().readerWaiting, 0u);
+            }
+        }
+
+        fence();
+        if(load(rx_.header().writerWaiting))
+        {
+            store(rx_.header().writerWaiting, 0u);
+            signalPeer();
+        }
+        complete(reading_, readHandler_, boost::system::error_code(), len);
+    }
+
+    void processWrite(boost::lock_guard<boost::mutex> &)
+    {
+        if(!writing_)
+            return;
+
+        if(closed_)
+        {
+            complete(writing_, writeHandler_, boost::asio::error::operation_aborted, 0);
+            return;
+        }
+        if(failed())
+            return;
+        if(load(rx_.header().closed) || peerClosed_)
+        {
+            complete(writing_, writeHandler_, boost::asio::error::broken_pipe, 0);
+            return;
+        }
+
+        size_t len = tx_.write(writeBuffers_, error_);
+        if(failed())
+            return;
+        if(!len)
+        {
+            store(tx_.header().writerWaiting, 1u);
+            fence();
+            len = tx_.write(writeBuffers_, error_);
+            if(failed())
+                return;
+            if(!len)
+            {
+                startWait();
+                return;
+            }
+            store(tx_.header().writerWaiting, 0u);
+        }
+
+        fence();
+        if(load(tx_.header().readerWaiting))
+        {
+            store(tx_.header().readerWaiting, 0u);
+            signalPeer();
+        }
+        complete(writing_, writeHandler_, boost::system::error_code(), len);
+    }
+
+    // Stream failed when eventfd is broken or peer corrupted ring, pending and following operations get the error.
+    bool failed()
+    {
+        if(!error_)
+            return false;
+        if(reading_)
+            complete(reading_, readHandler_, error_, 0);
+        if(writing_)
+            complete(writing_, writeHandler_, error_, 0);
+        return true;
+    }
+
+    void complete(bool & active, Handler & handler, const boost::system::error_code & ec, size_t len)
+    {
+        Handler temp;
+        temp.swap(handler);
+        active = false;
+        ios_.post(std::bind(temp, ec, len));
+    }
+
+    void signalPeer()
+    {
+        boost::uint64_t one = 1;
+        if(::write(peerWake_, &one, sizeof(one)) < 0 && errno != EAGAIN)
+            MLOG_NOTICE("signal peer failed: " << errno);
+    }
+
+    void startWait()
+    {
+        if(!waiting_)
+        {
+            waiting_ = true;
+            wake_.async_read_some(boost::asio::buffer(&wakeCounter_, sizeof(wakeCounter_)), std::bind(&Impl::handleWake, shared_from_this(), std::placeholders::_1));
+        }
+    }
+
+    void handleWake(const boost::system::error_code & ec)
+    {
+        boost::lock_guard<boost::mutex> lock(mutex_);
+        waiting_ = false;
+        if(ec && ec != boost::asio::error::operation_aborted)
+        {
+            // eventfd is broken, so pending and following operations fail instead of waiting on it again
+            MLOG_NOTICE("wait failed: " << ec << ", " << ec.message());
+            error_ = ec;
+        }
+        processRead(lock);
+        processWrite(lock);
+    }
+
+    void handleSocket(const boost::system::error_code & ec)
+    {
+        MLOG_DEBUG("peer socket closed: " << ec << ", " << ec.message());
+
+        boost::lock_guard<boost::mutex> lock(mutex_);
+        peerClosed_ = true;
+        processRead(lock);
+        processWrite(lock);
+    }
+
+    boost::asio::io_service & ios_;
+    boost::mutex mutex_;
+    boost::asio::local::stream_protocol::socket socket_;
+    boost::asio::posix::stream_descriptor wake_;
+    char * segment_;
+    size_t segmentSize_;
+    int peerWake_;
+    Ring tx_;
+    Ring rx_;
+    ShmBuffers readBuffers_;
+    ShmBuffers writeBuffers_;
+    Handler readHandler_;
+    Handler writeHandler_;
+    bool reading_;
+    bool writing_;
+    bool waiting_;
+    bool closed_;
+    bool peerClosed_;
+    boost::system::error_code error_;
+    boost::uint64_t wakeCounter_;
+    char socketByte_;
+};
+
+ShmStream::ShmStream(boost::asio::io_service & ios)
+    : ios_(ios), impl_(new Impl(ios))
+{
+}
+
+ShmStream::~ShmStream()
+{
+    impl_->close();
+}
+
+void ShmStream::connect(boost::asio::local::stream_protocol::socket & socket, size_t ringSize, boost::system::error_code & ec)
+{
+    impl_->connect(socket, ringSize, ec);
+}
+
+void ShmStream::accept(boost::asio::local::stream_protocol::socket & socket, boost::system::error_code & ec)
+{
+    impl_->accept(socket, ec);
+}
+
+void ShmStream::asyncRead(const ShmBuffers & buffers, const Handler & handler)
+{
+    impl_->asyncRead(buffers, handler);
+}
+
+void ShmStream::asyncWrite(const ShmBuffers & buffers, const Handler & handler)
+{
+    impl_->asyncWrite(buffers, handler);
+}
+
+bool ShmStream::is_open() const
+{
+    return impl_->isOpen();
+}
+
+void ShmStream::close()
+{
+    impl_->close();
+}
+
+}
+
+#endif
@@ -0,0 +1,113 @@
+/*
+** The author disclaims copyright to this source code.  In place of
+** a legal notice, here is a blessing:
+**
+**    May you do good and not evil.
+**    May you find forgiveness for yourself and forgive others.
+**    May you share freely, never taking more than you give.
+*/
+#pragma once
+
+#if defined(__linux__)
+
+#ifndef NEXUS_BUILDING
+
+#include <boost/array.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+
+#include <boost/asio/buffer.hpp>
+#include <boost/asio/io_service.hpp>
+#include <boost/asio/local/stream_protocol.hpp>
+
+#include <boost/system/error_code.hpp>
+
+#endif
+
+#include "Config.h"
+
+namespace nexus {
+
+// Gather list passed to shared memory rings, write_some semantics allow to use only first buffers of sequence.
+struct ShmBuffers {
+    static const size_t maxBuffers = 8;
+
+    boost::array<std::pair<char*, size_t>, maxBuffers> items;
+    size_t size;
+
+    template<class Buffers>
+    void assignMutable(const Buffers & buffers)
+    {
+        size = 0;
+        for(typename Buffers::const_iterator i = buffers.begin(), end = buffers.end(); i != end && size != maxBuffers; ++i)
+        {
+            boost::asio::mutable_buffer buffer(*i);
+            items[size++] = std::make_pair(boost::asio::buffer_cast<char*>(buffer), boost::asio::buffer_size(buffer));
+        }
+    }
+
+    template<class Buffers>
+    void assignConst(const Buffers & buffers)
+    {
+        size = 0;
+        for(typename Buffers::const_iterator i = buffers.begin(), end = buffers.end(); i != end && size != maxBuffers; ++i)
+        {
+            boost::asio::const_buffer buffer(*i);
+            items[size++] = std::make_pair(const_cast<char*>(boost::asio::buffer_cast<const char*>(buffer)), boost::asio::buffer_size(buffer));
+        }
+    }
+};
+
+// Stream over two single producer/single consumer rings in memfd segment shared by two processes on the same host.
+// Implements async_read_some/async_write_some, so it could be used as stream() of Connection<Derived>.
+//
+// Handshake runs over already connected unix socket: connect() creates the segment and eventfds and passes them
+// with SCM_RIGHTS, accept() receives them. After that the socket is only used to detect peer death.
+// Eventfd of the side is signalled only when that side is waiting for data or free space, so while both sides are busy
+// packets are exchanged without syscalls.
+class NEXUS_DECL ShmStream : public boost::noncopyable {
+public:
+    typedef std::function<void(const boost::system::error_code &, size_t)> Handler;
+
+    explicit ShmStream(boost::asio::io_service & ios);
+    ~ShmStream();
+
+    void connect(boost::asio::local::stream_protocol::socket & socket, size_t ringSize, boost::system::error_code & ec);
+    void accept(boost::asio::local::stream_protocol::socket & socket, boost::system::error_code & ec);
+
+    boost::asio::io_service & get_io_service()
+    {
+        return ios_;
+    }
+
+    template<class MutableBufferSequence, class ReadHandler>
+    void async_read_some(const MutableBufferSequence & buffers, const ReadHandler & handler)
+    {
+        ShmBuffers temp;
+        temp.assignMutable(buffers);
+        asyncRead(temp, handler);
+    }
+
+    template<class ConstBufferSequence, class WriteHandler>
+    void async_write_some(const ConstBufferSequence & buffers, const WriteHandler & handler)
+    {
+        ShmBuffers temp;
+        temp.assignConst(buffers);
+        asyncWrite(temp, handler);
+    }
+
+    bool is_open() const;
+    void close();
+private:
+    void asyncRead(const ShmBuffers & buffers, const Handler & handler);
+    void asyncWrite(const ShmBuffers & buffers, const Handler & handler);
+
+    class Impl;
+
+    boost::asio::io_service & ios_;
+    boost::shared_ptr<Impl> impl_;
+};
+
+}
+
+#endif
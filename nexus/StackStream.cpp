@@ -82,4 +82,136 @@ void StackStream::checkOverflow(size_t required)
         BOOST_THROW_EXCEPTION(StackStreamException() << mstd::error_message("stack buffer overflow") << ErrorPosition(pos_ - begin_) << ErrorSize(end_ - begin_) << ErrorRequired(required));
 }
 
+GrowingStackStream::GrowingStackStream(char * begin, size_t size, size_t blockSize)
+    : stack_(begin), stackEnd_(begin + size), stackUsed_(0), begin_(begin), pos_(begin), end_(stackEnd_),
+      blockSize_(blockSize), blocksTotal_(0) {}
+
+void GrowingStackStream::revert()
+{
+    blocks_.clear();
+    current_ = Buffer();
+    blocksTotal_ = 0;
+    stackUsed_ = 0;
+    begin_ = pos_ = stack_;
+    end_ = stackEnd_;
+}
+
+void GrowingStackStream::grow(size_t required)
+{
+    if(current_)
+    {
+        size_t used = pos_ - begin_;
+        if(used)
+        {
+            current_.resize(used);
+            blocks_.push_back(current_);
+            blocksTotal_ += used;
+        }
+    } else
+        stackUsed_ = pos_ - stack_;
+
+    current_ = Buffer(std::max(blockSize_, required));
+    begin_ = pos_ = current_.data();
+    end_ = begin_ + current_.capacity();
+}
+
+void GrowingStackStream::write(const char * data, size_t n)
+{
+    while(static_cast<size_t>(end_ - pos_) < n)
+    {
+        size_t left = end_ - pos_;
+        memcpy(pos_, data, left);
+        pos_ += left;
+        data += left;
+        n -= left;
+        grow(n);
+    }
+    memcpy(pos_, data, n);
+    pos_ += n;
+}
+
+void GrowingStackStream::put(const char * str)
+{
+    write(str, strlen(str));
+}
+
+void GrowingStackStream::put(const std::string & str)
+{
+    write(str.c_str(), str.length());
+}
+
+void GrowingStackStream::put(char ch)
+{
+    reserve(1);
+    *pos_ = ch;
+    ++pos_;
+}
+
+void GrowingStackStream::writeShortString(const std::string & str)
+{
+    size_t n = std::min<size_t>(str.length(), 0xff);
+    put(static_cast<char>(n));
+    write(str.c_str(), n);
+}
+
+void GrowingStackStream::writeCString(const std::string & str)
+{
+    write(str.c_str(), str.length() + 1);
+}
+
+void GrowingStackStream::writeUTF8CString(const std::wstring & str)
+{
+    reserve(mstd::utf8_length(str) + 1);
+    pos_ = mstd::utf8(str.c_str(), str.c_str() + str.length(), pos_);
+    *pos_ = 0;
+    ++pos_;
+}
+
+size_t GrowingStackStream::size() const
+{
+    return stackSize() + blocksTotal_ + (current_ ? pos_ - begin_ : 0);
+}
+
+Buffer GrowingStackStream::buffer() const
+{
+    if(!current_)
+        return Buffer(stack_, pos_);
+
+    if(!stackUsed_ && blocks_.empty())
+    {
+        Buffer result = current_;
+        result.resize(pos_ - begin_);
+        return result;
+    }
+
+    Buffer result(size());
+    char * out = result.data();
+    memcpy(out, stack_, stackUsed_);
+    out += stackUsed_;
+    for(std::vector<Buffer>::const_iterator i = blocks_.begin(), end = blocks_.end(); i != end; ++i)
+    {
+        memcpy(out, i->data(), i->size());
+        out += i->size();
+    }
+    memcpy(out, begin_, pos_ - begin_);
+    return result;
+}
+
+std::vector<Buffer> GrowingStackStream::buffers() const
+{
+    std::vector<Buffer> result;
+    result.reserve(blocks_.size() + 2);
+    size_t stack = stackSize();
+    if(stack)
+        result.push_back(Buffer(stack_, stack));
+    result.insert(result.end(), blocks_.begin(), blocks_.end());
+    if(current_ && pos_ != begin_)
+    {
+        Buffer last = current_;
+        last.resize(pos_ - begin_);
+        result.push_back(last);
+    }
+    return result;
+}
+
 }
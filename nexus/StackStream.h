@@ -10,6 +10,12 @@
 
 #ifndef NEXUS_BUILDING
 
+#include <vector>
+
+#include <boost/noncopyable.hpp>
+
+#include <boost/asio/buffer.hpp>
+
 #include <boost/type_traits/is_integral.hpp>
 
 #include <mstd/exception.hpp>
@@ -115,4 +121,118 @@ private:
 
 #define NEXUS_STACK_STREAM(name, size) nexus::StackStream name(static_cast<char*>(alloca(size)), (size));
 
+// Same interface as StackStream, but instead of throwing on overflow it continues in pooled blocks.
+// Data is kept as a chain of segments: the stack region first, then the blocks in order.
+class NEXUS_DECL GrowingStackStream : public boost::noncopyable {
+public:
+    explicit GrowingStackStream(char * begin, size_t size, size_t blockSize = 0x1000);
+
+    void revert();
+
+    template<class T>
+    typename boost::enable_if<boost::is_integral<T>, void>::type
+    write(T t)
+    {
+        reserve(sizeof(T));
+        *mstd::pointer_cast<T*>(pos_) = t;
+        pos_ += sizeof(T);
+    }
+
+    void write(const std::vector<char> & buf)
+    {
+        write(&buf[0], buf.size());
+    }
+
+    void write(const std::vector<unsigned char> & buf)
+    {
+        write(mstd::pointer_cast<const char*>(&buf[0]), buf.size());
+    }
+
+    template<size_t N>
+    void write(const boost::array<char, N> & buf)
+    {
+        write(&buf[0], buf.size());
+    }
+
+    template<size_t N>
+    void write(const boost::array<unsigned char, N> & buf)
+    {
+        write(mstd::pointer_cast<const char*>(&buf[0]), buf.size());
+    }
+
+    void writeShortString(const std::string & str);
+    void writeCString(const std::string & str);
+    void writeUTF8CString(const std::wstring & str);
+    void write(const char * str, size_t len);
+
+    void put(const char * str);
+    void put(const std::string & str);
+    void put(char ch);
+
+    template<class T>
+    typename boost::enable_if<boost::is_integral<T>, void>::type
+    put(T t)
+    {
+        reserve(0x20);
+        pos_ += strlen(mstd::itoa(t, pos_));
+    }
+
+    template<size_t sz>
+    void put(const boost::array<char, sz> & src)
+    {
+        write(src.data(), sz);
+    }
+
+    size_t size() const;
+
+    bool spilled() const
+    {
+        return current_;
+    }
+
+    // Copies segments into single buffer, unless all data already lives in one pooled block.
+    Buffer buffer() const;
+    // Only the stack segment is copied, pooled blocks are shared.
+    std::vector<Buffer> buffers() const;
+
+    // Appends asio buffers referencing the segments, they are valid while the stream is alive and not modified.
+    template<class Container>
+    void gather(Container & out) const
+    {
+        size_t stack = stackSize();
+        if(stack)
+            out.push_back(boost::asio::const_buffer(stack_, stack));
+        for(std::vector<Buffer>::const_iterator i = blocks_.begin(), end = blocks_.end(); i != end; ++i)
+            out.push_back(i->make(0));
+        if(current_ && pos_ != begin_)
+            out.push_back(boost::asio::const_buffer(begin_, pos_ - begin_));
+    }
+private:
+    void reserve(size_t required)
+    {
+        if(static_cast<size_t>(end_ - pos_) < required)
+            grow(required);
+    }
+
+    size_t stackSize() const
+    {
+        return current_ ? stackUsed_ : pos_ - stack_;
+    }
+
+    void grow(size_t required);
+
+    char * stack_;
+    char * stackEnd_;
+    size_t stackUsed_;
+    char * begin_;
+    char * pos_;
+    char * end_;
+    size_t blockSize_;
+    size_t blocksTotal_;
+    Buffer current_;
+    std::vector<Buffer> blocks_;
+};
+
+#define NEXUS_GROWING_STACK_STREAM(name, size) nexus::GrowingStackStream name(static_cast<char*>(alloca(size)), (size));
+
 }
@@ -11,7 +11,7 @@
 #ifndef NEXUS_BUILDING
 #include <boost/asio/io_service.hpp>
 
-#include <mstd/spinlock.hpp>
+#include <mstd/lock_site.hpp>
 #endif
 
 namespace nexus {
@@ -26,6 +26,7 @@ public:
         : boost::asio::detail::operation(&Strand::doComplete),
           ios_(boost::asio::use_service<boost::asio::detail::io_service_impl>(ios)), locked_(false)
     {
+        mstd::set_lock_site(mutex_, lockSite());
     }
 
     template<class Handler>
@@ -188,8 +189,14 @@ private:
         Strand & strand_;
     };
 
+    static mstd::lock_site & lockSite()
+    {
+        static mstd::lock_site result("nexus::Strand");
+        return result;
+    }
+
     boost::asio::detail::io_service_impl & ios_;
-    Mutex mutex_;
+    typename mstd::lock_profile<Mutex>::type mutex_;
     bool locked_;
     boost::asio::detail::op_queue<boost::asio::detail::operation> waiting_queue_;
     boost::asio::detail::op_queue<boost::asio::detail::operation> ready_queue_;
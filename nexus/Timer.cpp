@@ -17,9 +17,13 @@ namespace {
 class Manager {
     MSTD_SINGLETON_INLINE_DEFINITION(Manager);
 public:
-    void schedule(const mstd::command_queue::command_type & command, const boost::posix_time::time_duration & delay)
+    void schedule(mstd::command_queue::unique_command_type & command, const boost::posix_time::time_duration & delay)
     {
-        service_.post(std::bind(&Manager::doSchedule, this, QueueItem(command, boost::posix_time::microsec_clock::universal_time() + delay)));
+        {
+            boost::lock_guard<boost::mutex> lock(mutex_);
+            queue_.insert(Queue::value_type(boost::posix_time::microsec_clock::universal_time() + delay, std::move(command)));
+        }
+        service_.post(std::bind(&Manager::processQueue, this));
     }
     
     ~Manager()
@@ -34,25 +38,18 @@ private:
         thread_ = boost::thread([this]() { service_.run(); });
     }
 
-    typedef std::pair<mstd::command_queue::command_type, boost::posix_time::ptime> QueueItem;
-
-    void doSchedule(const QueueItem & item)
-    {
-        queue_.push(item);
-        processQueue();
-    }
-    
     void processQueue()
     {
         boost::posix_time::ptime now = boost::posix_time::microsec_clock::universal_time();
-        while(!queue_.empty() && queue_.top().second <= now)
+        boost::lock_guard<boost::mutex> lock(mutex_);
+        while(!queue_.empty() && queue_.begin()->first <= now)
         {
-            mstd::default_enqueue(queue_.top().first);
-            queue_.pop();
+            mstd::default_enqueue(std::move(queue_.begin()->second));
+            queue_.erase(queue_.begin());
         }
         if(!queue_.empty())
         {
-            timer_.expires_at(queue_.top().second);
+            timer_.expires_at(queue_.begin()->first);
             timer_.async_wait(std::bind(&Manager::handleTimer, this, std::placeholders::_1));
         }
     }
@@ -63,26 +60,21 @@ private:
             processQueue();
     }
 
-    
-    struct QueueItemCompare {
-        bool operator()(const QueueItem & lhs, const QueueItem & rhs) const
-        {
-            return lhs.second > rhs.second;
-        }
-    };
-    
-    typedef std::priority_queue<QueueItem, std::vector<QueueItem>, QueueItemCompare> Queue;
+    // Commands are inserted by callers and moved out by service thread when due, commands with the same time
+    // keep schedule order.
+    typedef std::multimap<boost::posix_time::ptime, mstd::command_queue::unique_command_type> Queue;
 
     boost::thread        thread_;
     boost::asio::io_service       service_;
     boost::asio::io_service::work work_;
     boost::asio::deadline_timer   timer_;
+    boost::mutex mutex_;
     Queue queue_;
 };
 
 }
 
-void schedule(const mstd::command_queue::command_type & command, const boost::posix_time::time_duration & delay)
+void schedule(mstd::command_queue::unique_command_type command, const boost::posix_time::time_duration & delay)
 {
     Manager::instance().schedule(command, delay);
 }
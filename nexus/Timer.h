@@ -12,6 +12,6 @@
 
 namespace nexus {
 
-void schedule(const mstd::command_queue::command_type & command, const boost::posix_time::time_duration & delay);
+void schedule(mstd::command_queue::unique_command_type command, const boost::posix_time::time_duration & delay);
 
 }
@@ -0,0 +1,316 @@
+/*
+** The author disclaims copyright to this source code.  In place of
+** a legal notice, here is a blessing:
+**
+**    May you do good and not evil.
+**    May you find forgiveness for yourself and forgive others.
+**    May you share freely, never taking more than you give.
+*/
+#include "pch.h"
+
+#if !defined(BOOST_WINDOWS)
+#include <unistd.h>
+#endif
+
+#include <boost/asio/ssl.hpp>
+
+#include <openssl/err.h>
+
+#include <mcrypt/Error.h>
+#include <mcrypt/PKey.h>
+
+#include "Tls.h"
+
+MLOG_DECLARE_LOGGER(nexus_tls);
+
+namespace nexus {
+
+namespace {
+
+const unsigned char sessionContext[] = "nexus";
+
+int streamIndex()
+{
+    static int result = SSL_get_ex_new_index(0, 0, 0, 0, 0);
+    return result;
+}
+
+boost::system::error_code lastError()
+{
+    unsigned long code = ERR_get_error();
+    ERR_clear_error();
+    return boost::system::error_code(static_cast<int>(code), boost::asio::error::get_ssl_category());
+}
+
+}
+
+TlsSessionCache::TlsSessionCache(size_t limit)
+    : limit_(limit)
+{
+}
+
+TlsSessionCache::~TlsSessionCache()
+{
+    clear();
+}
+
+SSL_SESSION * TlsSessionCache::acquire(const std::string & key)
+{
+    boost::lock_guard<boost::mutex> lock(mutex_);
+    Sessions::const_iterator i = sessions_.find(key);
+    if(i == sessions_.end())
+        return 0;
+    SSL_SESSION_up_ref(i->second);
+    return i->second;
+}
+
+void TlsSessionCache::store(const std::string & key, SSL_SESSION * session)
+{
+    SSL_SESSION * old = 0;
+    {
+        boost::lock_guard<boost::mutex> lock(mutex_);
+        Sessions::iterator i = sessions_.find(key);
+        if(i != sessions_.end())
+        {
+            old = i->second;
+            i->second = session;
+        } else if(sessions_.size() < limit_)
+            sessions_.insert(Sessions::value_type(key, session));
+        else
+            old = session;
+    }
+    if(old)
+        SSL_SESSION_free(old);
+}
+
+void TlsSessionCache::remove(const std::string & key)
+{
+    SSL_SESSION * old = 0;
+    {
+        boost::lock_guard<boost::mutex> lock(mutex_);
+        Sessions::iterator i = sessions_.find(key);
+        if(i == sessions_.end())
+            return;
+        old = i->second;
+        sessions_.erase(i);
+    }
+    SSL_SESSION_free(old);
+}
+
+void TlsSessionCache::clear()
+{
+    Sessions temp;
+    {
+        boost::lock_guard<boost::mutex> lock(mutex_);
+        temp.swap(sessions_);
+    }
+    for(Sessions::const_iterator i = temp.begin(), end = temp.end(); i != end; ++i)
+        SSL_SESSION_free(i->second);
+}
+
+size_t TlsSessionCache::size()
+{
+    boost::lock_guard<boost::mutex> lock(mutex_);
+    return sessions_.size();
+}
+
+TlsContext::TlsContext(Mode mode)
+    : mode_(mode), context_(mode == tmServer ? boost::asio::ssl::context::sslv23_server : boost::asio::ssl::context::sslv23_client)
+{
+    context_.set_options(boost::asio::ssl::context::default_workarounds | boost::asio::ssl::context::no_sslv2 |
+                         boost::asio::ssl::context::no_sslv3 | boost::asio::ssl::context::no_tlsv1 |
+                         boost::asio::ssl::context::no_tlsv1_1 | boost::asio::ssl::context::no_compression);
+
+    SSL_CTX * ctx = context_.native_handle();
+    if(mode == tmServer)
+    {
+        SSL_CTX_clear_options(ctx, SSL_OP_NO_TICKET);
+        SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_SERVER);
+        SSL_CTX_set_session_id_context(ctx, sessionContext, sizeof(sessionContext) - 1);
+    } else {
+        // sessions are kept only in sessions_, keyed by peer, internal cache could not tell peers apart
+        SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+        SSL_CTX_sess_set_new_cb(ctx, &TlsStream::newSession);
+    }
+}
+
+TlsContext::~TlsContext()
+{
+}
+
+void TlsContext::useCertificateChain(const char * pem, size_t len, boost::system::error_code & ec)
+{
+    context_.use_certificate_chain(boost::asio::buffer(pem, len), ec);
+}
+
+void TlsContext::usePrivateKey(const mcrypt::GenericPKey & key, boost::system::error_code & ec)
+{
+    if(!key)
+        ec = boost::asio::error::invalid_argument;
+    else if(SSL_CTX_use_PrivateKey(context_.native_handle(), static_cast<EVP_PKEY*>(key.handle())) != 1)
+        ec = lastError();
+    else if(SSL_CTX_check_private_key(context_.native_handle()) != 1)
+        ec = lastError();
+    else
+        ec = boost::system::error_code();
+}
+
+void TlsContext::usePrivateKeyPem(const char * pem, size_t len, boost::system::error_code & ec)
+{
+    mcrypt::Error error;
+    mcrypt::GenericPKey key = mcrypt::GenericPKey::fromPrivatePem(pem, len, error);
+    if(error)
+    {
+        MLOG_WARNING("failed to load private key: " << error.message());
+        ec = boost::system::error_code(static_cast<int>(error.code()), boost::asio::error::get_ssl_category());
+    } else
+        usePrivateKey(key, ec);
+}
+
+void TlsContext::addCertificateAuthority(const char * pem, size_t len, boost::system::error_code & ec)
+{
+    context_.add_certificate_authority(boost::asio::buffer(pem, len), ec);
+    if(!ec)
+        verifyPeer(true);
+}
+
+void TlsContext::verifyPeer(bool value)
+{
+    boost::system::error_code ec;
+    if(!value)
+        context_.set_verify_mode(boost::asio::ssl::verify_none, ec);
+    else if(mode_ == tmServer)
+        context_.set_verify_mode(boost::asio::ssl::verify_peer | boost::asio::ssl::verify_fail_if_no_peer_cert, ec);
+    else
+        context_.set_verify_mode(boost::asio::ssl::verify_peer, ec);
+}
+
+void TlsContext::sessionTimeout(long seconds)
+{
+    SSL_CTX_set_timeout(context_.native_handle(), seconds);
+}
+
+TlsStream::TlsStream(boost::asio::io_service & ios, TlsContext & context)
+    : ios_(ios), context_(context), stream_(ios, context.native()), strand_(ios), wbuffer_(maxRecord), offloaded_(false)
+{
+    SSL_set_ex_data(stream_.native_handle(), streamIndex(), this);
+}
+
+TlsStream::~TlsStream()
+{
+    SSL_set_ex_data(stream_.native_handle(), streamIndex(), 0);
+}
+
+void TlsStream::sessionKey(const std::string & key)
+{
+    BOOST_ASSERT(context_.mode() == TlsContext::tmClient);
+
+    sessionKey_ = key;
+    if(SSL_SESSION * session = context_.sessions().acquire(key))
+    {
+        // OpenSSL marks session of connection closed without close_notify as not resumable,
+        // so connection gets its own copy and cached session stays usable
+        if(SSL_SESSION * copy = SSL_SESSION_dup(session))
+        {
+            SSL_set_session(stream_.native_handle(), copy);
+            SSL_SESSION_free(copy);
+        }
+        SSL_SESSION_free(session);
+    }
+}
+
+void TlsStream::serverName(const std::string & name)
+{
+    BOOST_ASSERT(context_.mode() == TlsContext::tmClient);
+
+    SSL_set_tlsext_host_name(stream_.native_handle(), name.c_str());
+    stream_.set_verify_callback(boost::asio::ssl::rfc2818_verification(name));
+}
+
+int TlsStream::newSession(SSL * ssl, SSL_SESSION * session)
+{
+    TlsStream * stream = static_cast<TlsStream*>(SSL_get_ex_data(ssl, streamIndex()));
+    if(!stream || stream->sessionKey_.empty() || !SSL_SESSION_is_resumable(session))
+        return 0;
+    // session belongs to connection, see sessionKey
+    if(SSL_SESSION * copy = SSL_SESSION_dup(session))
+        stream->context_.sessions().store(stream->sessionKey_, copy);
+    return 0;
+}
+
+void TlsStream::async_handshake(const HandshakeHandler & handler, boost::asio::io_service * offload)
+{
+    handshake_ = handler;
+    if(offload && offload != &ios_)
+    {
+        boost::system::error_code ec;
+        rebind(*offload, ec);
+        offloaded_ = !ec;
+        if(ec)
+            MLOG_NOTICE("handshake offload failed: " << ec << ", " << ec.message());
+    }
+
+    stream_.async_handshake(context_.mode() == TlsContext::tmServer ? boost::asio::ssl::stream_base::server : boost::asio::ssl::stream_base::client,
+                            std::bind(&TlsStream::handleHandshake, this, _1));
+}
+
+void TlsStream::handleHandshake(const boost::system::error_code & ec)
+{
+    boost::system::error_code result = ec;
+    if(offloaded_)
+    {
+        offloaded_ = false;
+        boost::system::error_code rec;
+        rebind(ios_, rec);
+        if(!result)
+            result = rec;
+    }
+
+    MLOG_DEBUG("handshake(" << result << ", resumed = " << resumed() << ")");
+
+    HandshakeHandler handler;
+    handler.swap(handshake_);
+    ios_.post(std::bind(handler, result));
+}
+
+bool TlsStream::resumed()
+{
+    return SSL_session_reused(stream_.native_handle()) != 0;
+}
+
+// Moves descriptor to socket of other io_service, engine and its pending timers stay untouched.
+// Should be called only while no operation is pending on socket.
+void TlsStream::rebind(boost::asio::io_service & ios, boost::system::error_code & ec)
+{
+#if defined(BOOST_WINDOWS)
+    ec = boost::asio::error::operation_not_supported;
+#else
+    boost::asio::ip::tcp::socket & current = socket();
+    boost::asio::ip::tcp::endpoint endpoint = current.local_endpoint(ec);
+    if(ec)
+        return;
+    boost::asio::ip::tcp::socket::native_handle_type handle = current.release(ec);
+    if(ec)
+        return;
+    boost::asio::ip::tcp::socket temp(ios);
+    temp.assign(endpoint.protocol(), handle, ec);
+    if(ec)
+    {
+        ::close(handle);
+        return;
+    }
+    current = boost::move(temp);
+#endif
+}
+
+void TlsStream::shutdown(boost::system::error_code & ec)
+{
+    socket().shutdown(boost::asio::ip::tcp::socket::shutdown_both, ec);
+}
+
+void TlsStream::close(boost::system::error_code & ec)
+{
+    socket().close(ec);
+}
+
+}
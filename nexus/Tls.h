@@ -0,0 +1,239 @@
+/*
+** The author disclaims copyright to this source code.  In place of
+** a legal notice, here is a blessing:
+**
+**    May you do good and not evil.
+**    May you find forgiveness for yourself and forgive others.
+**    May you share freely, never taking more than you give.
+*/
+#pragma once
+
+#ifndef NEXUS_BUILDING
+
+#include <string.h>
+
+#include <algorithm>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <boost/noncopyable.hpp>
+
+#include <boost/asio/io_service.hpp>
+#include <boost/asio/strand.hpp>
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/asio/ssl/context.hpp>
+#include <boost/asio/ssl/stream.hpp>
+
+#include <boost/system/error_code.hpp>
+
+#include <boost/thread/mutex.hpp>
+
+#endif
+
+#include "Config.h"
+
+namespace mcrypt {
+    class GenericPKey;
+}
+
+namespace nexus {
+
+// Client side TLS sessions, keyed by name chosen by user, usually "host:port".
+// Every stored session holds one reference.
+class NEXUS_DECL TlsSessionCache : public boost::noncopyable {
+public:
+    explicit TlsSessionCache(size_t limit = 0x400);
+    ~TlsSessionCache();
+
+    // Returns session with extra reference or 0, caller should release it with SSL_SESSION_free.
+    SSL_SESSION * acquire(const std::string & key);
+    // Takes ownership of session reference.
+    void store(const std::string & key, SSL_SESSION * session);
+    void remove(const std::string & key);
+    void clear();
+    size_t size();
+private:
+    typedef std::unordered_map<std::string, SSL_SESSION*> Sessions;
+
+    boost::mutex mutex_;
+    Sessions sessions_;
+    size_t limit_;
+};
+
+// SSL_CTX with settings shared by all TLS streams of one side.
+// Server context issues session tickets and keeps server side session cache, so returning clients skip
+// certificate signature and key exchange. Client context stores sessions received from server in sessions().
+class NEXUS_DECL TlsContext : public boost::noncopyable {
+public:
+    enum Mode {
+        tmClient,
+        tmServer,
+    };
+
+    explicit TlsContext(Mode mode);
+    ~TlsContext();
+
+    // PEM certificate chain, leaf certificate first.
+    void useCertificateChain(const char * pem, size_t len, boost::system::error_code & ec);
+    void usePrivateKey(const mcrypt::GenericPKey & key, boost::system::error_code & ec);
+    void usePrivateKeyPem(const char * pem, size_t len, boost::system::error_code & ec);
+
+    // Enables verification of peer certificate against authorities added here.
+    void addCertificateAuthority(const char * pem, size_t len, boost::system::error_code & ec);
+    void verifyPeer(bool value);
+
+    // Lifetime of sessions and tickets issued by server.
+    void sessionTimeout(long seconds);
+
+    Mode mode() const
+    {
+        return mode_;
+    }
+
+    boost::asio::ssl::context & native()
+    {
+        return context_;
+    }
+
+    TlsSessionCache & sessions()
+    {
+        return sessions_;
+    }
+private:
+    Mode mode_;
+    boost::asio::ssl::context context_;
+    TlsSessionCache sessions_;
+};
+
+// TLS stream usable as stream() of Connection<Derived>.
+//
+// asio ssl stream is not thread safe, while Connection starts reads and writes from different threads,
+// so every operation is started and continued in internal strand. Records could not be read synchronously
+// outside of strand, so there is no SupportsScratchReads and readThroughScratch does not compile for it.
+// Connection writes gather list of up to 4 buffers, asio ssl stream would send only the first one per record,
+// so small buffers are joined to one record up to maxRecord bytes.
+class NEXUS_DECL TlsStream : public boost::noncopyable {
+public:
+    typedef boost::asio::ssl::stream<boost::asio::ip::tcp::socket> stream_type;
+    typedef std::function<void(const boost::system::error_code &)> HandshakeHandler;
+
+    static const size_t maxRecord = 0x4000;
+
+    TlsStream(boost::asio::io_service & ios, TlsContext & context);
+    ~TlsStream();
+
+    boost::asio::ip::tcp::socket & socket()
+    {
+        return stream_.next_layer();
+    }
+
+    stream_type & native()
+    {
+        return stream_;
+    }
+
+    boost::asio::io_service & get_io_service()
+    {
+        return ios_;
+    }
+
+    // Client only, should be called before handshake. Session stored for key is offered to server,
+    // sessions issued by server replace it.
+    void sessionKey(const std::string & key);
+    // Client only, sends SNI and, when context verifies peer, checks that certificate matches name.
+    void serverName(const std::string & name);
+
+    // When offload is not null, handshake runs on its threads, socket is returned to own io_service before
+    // handler is posted there. So expensive key exchange does not delay connections already established.
+    // Threads of offload should not exit while idle, i.e. it should have io_service::work.
+    void async_handshake(const HandshakeHandler & handler, boost::asio::io_service * offload = 0);
+    // True when handshake reused session from ticket or server cache.
+    bool resumed();
+
+    template<class MutableBufferSequence, class ReadHandler>
+    void async_read_some(const MutableBufferSequence & buffers, const ReadHandler & handler)
+    {
+        boost::asio::mutable_buffer buffer = first<boost::asio::mutable_buffer>(buffers);
+        strand_.dispatch([this, buffer, handler]() {
+            stream_.async_read_some(boost::asio::mutable_buffers_1(buffer), strand_.wrap(handler));
+        });
+    }
+
+    template<class ConstBufferSequence, class WriteHandler>
+    void async_write_some(const ConstBufferSequence & buffers, const WriteHandler & handler)
+    {
+        boost::asio::const_buffer buffer = join(buffers);
+        strand_.dispatch([this, buffer, handler]() {
+            stream_.async_write_some(boost::asio::const_buffers_1(buffer), strand_.wrap(handler));
+        });
+    }
+
+    bool is_open() const
+    {
+        return stream_.next_layer().is_open();
+    }
+
+    // Shuts down transport without close_notify, pending operations complete with error.
+    void shutdown(boost::system::error_code & ec);
+    void close(boost::system::error_code & ec);
+private:
+    template<class Buffer, class Buffers>
+    static Buffer first(const Buffers & buffers)
+    {
+        for(typename Buffers::const_iterator i = buffers.begin(), end = buffers.end(); i != end; ++i)
+        {
+            Buffer buffer(*i);
+            if(boost::asio::buffer_size(buffer))
+                return buffer;
+        }
+        return Buffer();
+    }
+
+    // Called under ConnectionLock and only one write is pending, so wbuffer_ stays untouched until it completes.
+    template<class Buffers>
+    boost::asio::const_buffer join(const Buffers & buffers)
+    {
+        typename Buffers::const_iterator i = buffers.begin(), end = buffers.end();
+        while(i != end && !boost::asio::buffer_size(boost::asio::const_buffer(*i)))
+            ++i;
+        if(!(i != end))
+            return boost::asio::const_buffer();
+        boost::asio::const_buffer result(*i);
+        if(boost::asio::buffer_size(result) >= maxRecord)
+            return result;
+        typename Buffers::const_iterator next = i;
+        while(++next != end && !boost::asio::buffer_size(boost::asio::const_buffer(*next)))
+            ;
+        if(!(next != end))
+            return result;
+
+        size_t total = 0;
+        for(; i != end && total != maxRecord; ++i)
+        {
+            boost::asio::const_buffer buffer(*i);
+            size_t len = std::min(boost::asio::buffer_size(buffer), maxRecord - total);
+            memcpy(&wbuffer_[total], boost::asio::buffer_cast<const char*>(buffer), len);
+            total += len;
+        }
+        return boost::asio::const_buffer(&wbuffer_[0], total);
+    }
+
+    void rebind(boost::asio::io_service & ios, boost::system::error_code & ec);
+    void handleHandshake(const boost::system::error_code & ec);
+
+    static int newSession(SSL * ssl, SSL_SESSION * session);
+
+    boost::asio::io_service & ios_;
+    TlsContext & context_;
+    stream_type stream_;
+    boost::asio::io_service::strand strand_;
+    std::vector<char> wbuffer_;
+    std::string sessionKey_;
+    HandshakeHandler handshake_;
+    bool offloaded_;
+
+    friend class TlsContext;
+};
+
+}
@@ -3,6 +3,7 @@
 #include "icmp_header.hpp"
 
 #include "Handler.h"
+#include "TraceRoute.h"
 
 MLOG_DECLARE_LOGGER(nexus_traceroute);
 
@@ -21,6 +22,15 @@ static unsigned short getIdentifier()
 #endif
 }
 
+static mstd::atomic<size_t> proberCounter(0);
+
+// Raw ICMP socket receives replies to every prober of process, so pid is mixed with instance number.
+// Multiplication by odd number is bijection of 16 bit values, so ids differ for 65536 probers.
+static unsigned short proberIdentifier()
+{
+    return static_cast<unsigned short>(getIdentifier() ^ (proberCounter++ * 0x9e3bU));
+}
+
 class TraceRoute: public boost::noncopyable {
 public:
     TraceRoute(const std::string & host)
@@ -268,6 +278,452 @@ private:
 
 }
 
+class TraceProber::Impl : public mstd::reference_counter<Impl> {
+public:
+    typedef boost::intrusive_ptr<Impl> ImplPtr;
+
+    Impl(boost::asio::io_service & ios, bool loopbackOnly)
+        : resolver_(ios), socket_(ios), strand_(ios), timer_(ios), loopbackOnly_(loopbackOnly), identifier_(proberIdentifier()),
+          sequenceNumber_(0), nextTarget_(0), maxHops_(30), probesPerHop_(3), timeout_(boost::posix_time::seconds(1)),
+          active_(0), running_(false), receiving_(false)
+    {
+    }
+
+    void listenHop(const HopListener & listener)
+    {
+        hopListener_ = listener;
+    }
+
+    void listenDone(const DoneListener & listener)
+    {
+        doneListener_ = listener;
+    }
+
+    void maxHops(int value)
+    {
+        maxHops_ = value;
+    }
+
+    void probesPerHop(int value)
+    {
+        probesPerHop_ = value;
+    }
+
+    void timeout(int milliseconds)
+    {
+        timeout_ = boost::posix_time::milliseconds(milliseconds);
+    }
+
+    void start(boost::system::error_code & ec)
+    {
+        socket_.open(icmp::v4(), ec);
+        if(!ec && loopbackOnly_)
+            socket_.bind(icmp::endpoint(boost::asio::ip::address_v4::loopback(), 0), ec);
+        if(ec)
+        {
+            MLOG_ERROR("failed to open icmp socket: " << ec << ", " << ec.message());
+            socket_.close();
+            return;
+        }
+
+        running_ = true;
+        startReceive(ImplPtr(this));
+        startTimer(ImplPtr(this));
+    }
+
+    void add(const std::string & host)
+    {
+        ++active_;
+        strand_.post(std::bind(&Impl::doAdd, this, host, ImplPtr(this)));
+    }
+
+    void stop()
+    {
+        strand_.dispatch(std::bind(&Impl::doStop, this, ImplPtr(this)));
+    }
+
+    size_t active() const
+    {
+        return active_;
+    }
+private:
+    struct Target {
+        std::string host;
+        boost::asio::ip::address_v4 destination;
+        int outstanding;
+        TraceHop hop;
+    };
+
+    struct Probe {
+        size_t target;
+        int ttl;
+        boost::posix_time::ptime sent;
+    };
+
+    typedef std::unordered_map<size_t, Target> Targets;
+    typedef std::unordered_map<unsigned short, Probe> Probes;
+
+    void doAdd(const std::string & host, const ImplPtr & self)
+    {
+        MLOG_DEBUG("add(" << host << ")");
+
+        if(!running_)
+        {
+            done(host, "prober is not running");
+            return;
+        }
+
+        boost::system::error_code ec;
+        auto address = boost::asio::ip::address::from_string(host, ec);
+        if(ec)
+        {
+            icmp::resolver::query query(icmp::v4(), host, "");
+            resolver_.async_resolve(query, strand_.wrap(std::bind(&Impl::handleResolve, this, std::placeholders::_1, std::placeholders::_2, host, self)));
+        } else
+            startTarget(host, address);
+    }
+
+    void handleResolve(const boost::system::error_code & ec, icmp::resolver::iterator iterator, const std::string & host, const ImplPtr &)
+    {
+        MLOG_DEBUG("handleResolve(" << ec << ", " << host << ")");
+
+        if(!running_)
+            done(host, "prober is not running");
+        else if(!ec && iterator != icmp::resolver::iterator())
+            startTarget(host, iterator->endpoint().address());
+        else
+            done(host, "resolve failed");
+    }
+
+    void startTarget(const std::string & host, const boost::asio::ip::address & address)
+    {
+        if(!address.is_v4())
+        {
+            done(host, "not an ipv4 address");
+            return;
+        }
+        if(loopbackOnly_ && !address.is_loopback())
+        {
+            done(host, "not a loopback address");
+            return;
+        }
+
+        size_t id = nextTarget_++;
+        Target & target = targets_[id];
+        target.host = host;
+        target.destination = address.to_v4();
+        sendHop(id, target, 1);
+    }
+
+    void sendHop(size_t id, Target & target, int ttl)
+    {
+        TraceHop & hop = target.hop;
+        hop.ttl = ttl;
+        hop.address = boost::asio::ip::address_v4();
+        hop.sent = hop.received = 0;
+        hop.minRtt = hop.maxRtt = hop.totalRtt = 0;
+        hop.destination = hop.unreachable = false;
+        target.outstanding = 0;
+
+        for(int i = 0; i != probesPerHop_; ++i)
+            if(sendProbe(id, target))
+                ++target.outstanding;
+
+        if(!target.outstanding)
+            finish(id, target, "send failed");
+    }
+
+    bool sendProbe(size_t id, Target & target)
+    {
+        if(probes_.size() > 0xffff)
+        {
+            MLOG_NOTICE("no free sequence number, probes outstanding: " << probes_.size());
+            return false;
+        }
+        unsigned short sequence = ++sequenceNumber_;
+        while(probes_.count(sequence))
+            sequence = ++sequenceNumber_;
+
+        icmp_header echo_request;
+        echo_request.type(icmp_header::echo_request);
+        echo_request.code(0);
+        echo_request.identifier(identifier_);
+        echo_request.sequence_number(sequence);
+        const std::string body("");
+        compute_checksum(echo_request, body.begin(), body.end());
+
+        boost::asio::streambuf request;
+        std::ostream os(&request);
+        os << echo_request << body;
+
+        // ttl is a socket option, but sends are synchronous and serialized by the strand, so it is safe to share it
+        boost::system::error_code ec;
+        socket_.set_option(boost::asio::ip::unicast::hops(target.hop.ttl), ec);
+        if(!ec)
+            socket_.send_to(request.data(), icmp::endpoint(target.destination, 0), 0, ec);
+        if(ec)
+        {
+            MLOG_NOTICE("send to " << target.destination << " failed: " << ec << ", " << ec.message());
+            return false;
+        }
+
+        Probe & probe = probes_[sequence];
+        probe.target = id;
+        probe.ttl = target.hop.ttl;
+        probe.sent = boost::posix_time::microsec_clock::universal_time();
+        ++target.hop.sent;
+        return true;
+    }
+
+    void startReceive(const ImplPtr & self)
+    {
+        receiving_ = true;
+        socket_.async_receive(boost::asio::buffer(data_), strand_.wrap(bindReceive(self)));
+    }
+
+    void handleReceive(const boost::system::error_code & ec, size_t transferred, const ImplPtr & self)
+    {
+        if(!running_)
+            return;
+
+        if(!ec)
+        {
+            processReply(transferred);
+            startReceive(self);
+        } else if(ec != boost::asio::error::operation_aborted)
+        {
+            // Persistent errors like ENETDOWN complete receive immediately, so it is restarted by next timer tick.
+            MLOG_NOTICE("receive failed: " << ec << ", " << ec.message());
+            receiving_ = false;
+        }
+    }
+
+    void processReply(size_t len)
+    {
+        const unsigned char * ip = data_.data();
+        if(len < 20)
+            return;
+        size_t ipLen = (ip[0] & 0xf) * 4;
+        if(len < ipLen + 8)
+            return;
+        const unsigned char * reply = ip + ipLen;
+        const unsigned char * echo = reply;
+        unsigned char type = reply[0];
+        if(type == icmp_header::time_exceeded || type == icmp_header::destination_unreachable)
+        {
+            // the original ip header and the first 8 bytes of our echo request follow the icmp header
+            const unsigned char * inner = reply + 8;
+            if(len < ipLen + 8 + 20)
+                return;
+            size_t innerLen = (inner[0] & 0xf) * 4;
+            if(len < ipLen + 8 + innerLen + 8)
+                return;
+            echo = inner + innerLen;
+            if(echo[0] != icmp_header::echo_request)
+                return;
+        } else if(type != icmp_header::echo_reply)
+            return;
+
+        unsigned short identifier = (echo[4] << 8) + echo[5];
+        unsigned short sequence = (echo[6] << 8) + echo[7];
+        if(identifier != identifier_)
+            return;
+
+        Probes::iterator p = probes_.find(sequence);
+        if(p == probes_.end())
+            return;
+        Probe probe = p->second;
+        probes_.erase(p);
+
+        Targets::iterator t = targets_.find(probe.target);
+        if(t == targets_.end() || t->second.hop.ttl != probe.ttl)
+            return;
+
+        Target & target = t->second;
+        TraceHop & hop = target.hop;
+        int64_t rtt = (boost::posix_time::microsec_clock::universal_time() - probe.sent).total_microseconds();
+        if(!hop.received++)
+            hop.minRtt = hop.maxRtt = rtt;
+        else {
+            hop.minRtt = std::min(hop.minRtt, rtt);
+            hop.maxRtt = std::max(hop.maxRtt, rtt);
+        }
+        hop.totalRtt += rtt;
+        hop.address = boost::asio::ip::address_v4((ip[12] << 24) | (ip[13] << 16) | (ip[14] << 8) | ip[15]);
+        if(type == icmp_header::echo_reply && hop.address == target.destination)
+            hop.destination = true;
+        else if(type == icmp_header::destination_unreachable)
+            hop.unreachable = true;
+
+        if(!--target.outstanding)
+            completeHop(t->first, target);
+    }
+
+    void startTimer(const ImplPtr & self)
+    {
+        timer_.expires_from_now(std::min(timeout_, boost::posix_time::time_duration(boost::posix_time::milliseconds(50))));
+        timer_.async_wait(strand_.wrap(bindTimer(self)));
+    }
+
+    void handleTimer(const boost::system::error_code & ec, const ImplPtr & self)
+    {
+        if(ec || !running_)
+            return;
+
+        if(!receiving_)
+            startReceive(self);
+
+        boost::posix_time::ptime deadline = boost::posix_time::microsec_clock::universal_time() - timeout_;
+        std::vector<size_t> expired;
+        for(Probes::iterator i = probes_.begin(); i != probes_.end();)
+        {
+            if(i->second.sent <= deadline)
+            {
+                Targets::iterator t = targets_.find(i->second.target);
+                if(t != targets_.end() && t->second.hop.ttl == i->second.ttl && !--t->second.outstanding)
+                    expired.push_back(t->first);
+                i = probes_.erase(i);
+            } else
+                ++i;
+        }
+
+        for(std::vector<size_t>::const_iterator i = expired.begin(), end = expired.end(); i != end; ++i)
+        {
+            Targets::iterator t = targets_.find(*i);
+            if(t != targets_.end())
+                completeHop(t->first, t->second);
+        }
+
+        startTimer(self);
+    }
+
+    void completeHop(size_t id, Target & target)
+    {
+        const TraceHop & hop = target.hop;
+        if(hopListener_)
+            hopListener_(target.host, hop);
+
+        if(hop.destination)
+            finish(id, target, std::string());
+        else if(hop.unreachable)
+            finish(id, target, "destination unreachable");
+        else if(hop.ttl >= maxHops_)
+            finish(id, target, "max hops exceeded");
+        else
+            sendHop(id, target, hop.ttl + 1);
+    }
+
+    void finish(size_t id, Target & target, const std::string & error)
+    {
+        std::string host = target.host;
+        targets_.erase(id);
+        done(host, error);
+    }
+
+    void done(const std::string & host, const std::string & error)
+    {
+        --active_;
+        if(doneListener_)
+            doneListener_(host, error);
+    }
+
+    void doStop(const ImplPtr &)
+    {
+        if(!running_)
+            return;
+        running_ = false;
+
+        boost::system::error_code ec;
+        timer_.cancel(ec);
+        resolver_.cancel();
+        socket_.close(ec);
+
+        probes_.clear();
+        Targets targets;
+        targets.swap(targets_);
+        for(Targets::const_iterator i = targets.begin(), end = targets.end(); i != end; ++i)
+            done(i->second.host, "stopped");
+    }
+
+    icmp::resolver resolver_;
+    icmp::socket socket_;
+    boost::asio::io_service::strand strand_;
+    boost::asio::deadline_timer timer_;
+    bool loopbackOnly_;
+    unsigned short identifier_;
+    unsigned short sequenceNumber_;
+    size_t nextTarget_;
+    int maxHops_;
+    int probesPerHop_;
+    boost::posix_time::time_duration timeout_;
+    HopListener hopListener_;
+    DoneListener doneListener_;
+    mstd::atomic<size_t> active_;
+    bool running_;
+    bool receiving_;
+    Targets targets_;
+    Probes probes_;
+    boost::array<unsigned char, 0x600> data_;
+
+    NEXUS_DECLARE_HANDLER(Receive, Impl, false);
+    NEXUS_DECLARE_HANDLER(Timer, Impl, false);
+};
+
+TraceProber::TraceProber(boost::asio::io_service & ios, bool loopbackOnly)
+    : impl_(new Impl(ios, loopbackOnly))
+{
+}
+
+TraceProber::~TraceProber()
+{
+    impl_->stop();
+}
+
+void TraceProber::listenHop(const HopListener & listener)
+{
+    impl_->listenHop(listener);
+}
+
+void TraceProber::listenDone(const DoneListener & listener)
+{
+    impl_->listenDone(listener);
+}
+
+void TraceProber::maxHops(int value)
+{
+    impl_->maxHops(value);
+}
+
+void TraceProber::probesPerHop(int value)
+{
+    impl_->probesPerHop(value);
+}
+
+void TraceProber::timeout(int milliseconds)
+{
+    impl_->timeout(milliseconds);
+}
+
+void TraceProber::start(boost::system::error_code & ec)
+{
+    impl_->start(ec);
+}
+
+void TraceProber::add(const std::string & host)
+{
+    impl_->add(host);
+}
+
+void TraceProber::stop()
+{
+    impl_->stop();
+}
+
+size_t TraceProber::active() const
+{
+    return impl_->active();
+}
+
 std::string makeTrace(const std::string & host)
 {
     TraceRoute t(host);
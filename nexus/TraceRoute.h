@@ -4,13 +4,69 @@
 #include <string>
 
 #include <boost/asio/io_service.hpp>
+#include <boost/asio/ip/address_v4.hpp>
 #include <boost/function.hpp>
+#include <boost/intrusive_ptr.hpp>
+#include <boost/noncopyable.hpp>
+
+#include <boost/system/error_code.hpp>
 #endif
 
+#include "Config.h"
+
 namespace nexus {
 
 std::string makeTrace(const std::string & host);
 
 void makeTraceAsync(boost::asio::io_service & ios, const std::string & host, const std::function<void(const std::string &)> & listener);
 
+struct TraceHop {
+    int ttl;
+    boost::asio::ip::address_v4 address;
+    size_t sent;
+    size_t received;
+    // round trip times are in microseconds
+    int64_t minRtt;
+    int64_t maxRtt;
+    int64_t totalRtt;
+    bool destination;
+    bool unreachable;
+
+    int64_t averageRtt() const
+    {
+        return received ? totalRtt / static_cast<int64_t>(received) : 0;
+    }
+};
+
+// Traces many hosts at once over a single raw ICMP socket.
+// Replies are matched to probes by identifier and sequence number, hops are reported as soon as they complete.
+// In loopback mode the socket is bound to 127.0.0.1 and only loopback targets are accepted, so it can be
+// exercised without touching the network.
+class NEXUS_DECL TraceProber : public boost::noncopyable {
+public:
+    typedef std::function<void(const std::string & host, const TraceHop & hop)> HopListener;
+    // error is empty when the destination was reached
+    typedef std::function<void(const std::string & host, const std::string & error)> DoneListener;
+
+    explicit TraceProber(boost::asio::io_service & ios, bool loopbackOnly = false);
+    ~TraceProber();
+
+    void listenHop(const HopListener & listener);
+    void listenDone(const DoneListener & listener);
+
+    void maxHops(int value);
+    void probesPerHop(int value);
+    void timeout(int milliseconds);
+
+    void start(boost::system::error_code & ec);
+    void add(const std::string & host);
+    void stop();
+
+    size_t active() const;
+private:
+    class Impl;
+
+    boost::intrusive_ptr<Impl> impl_;
+};
+
 }
@@ -12,18 +12,24 @@
 
 #include "Utils.h"
 
-MLOG_DECLARE_LOGGER(nexus_utils);
-
-namespace nexus {
+#if defined(__AVX2__)
+#define NEXUS_XML_AVX2 1
+#endif
 
-namespace {
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define NEXUS_XML_SSE2 1
+#include <emmintrin.h>
+#if NEXUS_XML_AVX2
+#include <immintrin.h>
+#endif
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#endif
 
-const char * const AMP = "&amp;";
-const char * const QUOT = "&quot;";
-const char * const GT = "&gt;";
-const char * const LT = "&lt;";
+MLOG_DECLARE_LOGGER(nexus_utils);
 
-}
+namespace nexus {
 
 void listen(boost::asio::ip::tcp::acceptor & acceptor, unsigned short port)
 {
@@ -189,24 +195,115 @@ void setupSocket(boost::asio::ip::tcp::socket & socket, int sendBufferSize, int
 #endif
 }
 
-std::string escapeXml(const std::string & input)
+namespace {
+
+// 1 for chars that should be replaced with entity
+const unsigned char xmlSpecial[0x100] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 1, 0, 0, 0, 1, 1, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 0, 1, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+};
+
+#if NEXUS_XML_SSE2
+inline unsigned lowestBit(unsigned mask)
 {
-    const char * p = input.c_str(), * i = p;
-    std::string result;
-    for(; *i; ++i)
+#if defined(_MSC_VER)
+    unsigned long result;
+    _BitScanForward(&result, mask);
+    return result;
+#else
+    return __builtin_ctz(mask);
+#endif
+}
+#endif
+
+}
+
+const char * findXmlSpecial(const char * begin, const char * end)
+{
+#if NEXUS_XML_AVX2
+    const __m256i wideAmp = _mm256_set1_epi8('&'), wideQuot = _mm256_set1_epi8('"'), wideApos = _mm256_set1_epi8('\'');
+    const __m256i wideLt = _mm256_set1_epi8('<'), wideGt = _mm256_set1_epi8('>');
+    for(; end - begin >= 32; begin += 32)
     {
-        char ch = *i;
-        const char * img = ch == '&' ? AMP : ch == '"' ? QUOT : ch == '>' ? GT : ch == '<' ? LT : NULL;
-        if(img)
-        {
-            if(i != p)
-                result.append(p, i - p);
-            result += img;
-            p = i + 1;
-        }
+        __m256i chunk = _mm256_loadu_si256(mstd::pointer_cast<const __m256i*>(begin));
+        __m256i found = _mm256_or_si256(
+            _mm256_or_si256(_mm256_cmpeq_epi8(chunk, wideAmp), _mm256_cmpeq_epi8(chunk, wideQuot)),
+            _mm256_or_si256(_mm256_cmpeq_epi8(chunk, wideApos), _mm256_or_si256(_mm256_cmpeq_epi8(chunk, wideLt), _mm256_cmpeq_epi8(chunk, wideGt))));
+        unsigned mask = static_cast<unsigned>(_mm256_movemask_epi8(found));
+        if(mask)
+            return begin + lowestBit(mask);
+    }
+#endif
+#if NEXUS_XML_SSE2
+    const __m128i amp = _mm_set1_epi8('&'), quot = _mm_set1_epi8('"'), apos = _mm_set1_epi8('\'');
+    const __m128i lt = _mm_set1_epi8('<'), gt = _mm_set1_epi8('>');
+    for(; end - begin >= 16; begin += 16)
+    {
+        __m128i chunk = _mm_loadu_si128(mstd::pointer_cast<const __m128i*>(begin));
+        __m128i found = _mm_or_si128(
+            _mm_or_si128(_mm_cmpeq_epi8(chunk, amp), _mm_cmpeq_epi8(chunk, quot)),
+            _mm_or_si128(_mm_cmpeq_epi8(chunk, apos), _mm_or_si128(_mm_cmpeq_epi8(chunk, lt), _mm_cmpeq_epi8(chunk, gt))));
+        unsigned mask = static_cast<unsigned>(_mm_movemask_epi8(found));
+        if(mask)
+            return begin + lowestBit(mask);
+    }
+#endif
+    for(; begin != end; ++begin)
+        if(xmlSpecial[static_cast<unsigned char>(*begin)])
+            return begin;
+    return end;
+}
+
+size_t escapedXmlLength(const char * input, size_t len)
+{
+    const char * end = input + len;
+    size_t result = len;
+    while((input = findXmlSpecial(input, end)) != end)
+        result += detail::xmlEntity(*input++).second - 1;
+    return result;
+}
+
+char * escapeXml(const char * input, size_t len, char * out)
+{
+    const char * end = input + len;
+    while(true)
+    {
+        const char * special = findXmlSpecial(input, end);
+        memcpy(out, input, special - input);
+        out += special - input;
+        if(special == end)
+            return out;
+        std::pair<const char *, size_t> entity = detail::xmlEntity(*special);
+        memcpy(out, entity.first, entity.second);
+        out += entity.second;
+        input = special + 1;
     }
-    if(i != p)
-        result.append(p, i - p);
+}
+
+std::string escapeXml(const std::string & input)
+{
+    const char * begin = input.c_str();
+    size_t len = input.length();
+    // common case, nothing to escape
+    if(findXmlSpecial(begin, begin + len) == begin + len)
+        return input;
+    std::string result;
+    result.resize(escapedXmlLength(begin, len));
+    escapeXml(begin, len, &result[0]);
     return result;
 }
 
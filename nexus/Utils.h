@@ -36,9 +36,54 @@ NEXUS_DECL void bindBroadcast(boost::asio::ip::udp::socket & socket, unsigned sh
 
 NEXUS_DECL void setupSocket(boost::asio::ip::tcp::socket & socket, int sendBufferSize, int recvBufferSize);
 
+// Returns first of <>&"' in [begin, end) or end. Scans 16 or 32 bytes at once when SSE2 or AVX2 is available.
+NEXUS_DECL const char * findXmlSpecial(const char * begin, const char * end);
+NEXUS_DECL size_t escapedXmlLength(const char * input, size_t len);
+// out should have room for escapedXmlLength(input, len) chars, returns end of written data.
+NEXUS_DECL char * escapeXml(const char * input, size_t len, char * out);
+
 NEXUS_DECL std::string escapeXml(const std::string & input);
 inline std::string escaleHtml(const std::string & input) { return escapeXml(input); }
 
+namespace detail {
+
+inline std::pair<const char *, size_t> xmlEntity(char ch)
+{
+    switch(ch) {
+    case '&':
+        return std::pair<const char *, size_t>("&amp;", 5);
+    case '"':
+        return std::pair<const char *, size_t>("&quot;", 6);
+    case '>':
+        return std::pair<const char *, size_t>("&gt;", 4);
+    case '<':
+        return std::pair<const char *, size_t>("&lt;", 4);
+    default:
+        return std::pair<const char *, size_t>("&#39;", 5);
+    }
+}
+
+}
+
+// Writes escaped input to StackStream, GrowingStackStream or anything else with write(const char *, size_t).
+// Clean runs are written whole, so input without special chars costs one scan and one write.
+template<class Stream>
+void escapeXml(const char * input, size_t len, Stream & out)
+{
+    const char * end = input + len;
+    while(true)
+    {
+        const char * special = findXmlSpecial(input, end);
+        if(special != input)
+            out.write(input, special - input);
+        if(special == end)
+            break;
+        std::pair<const char *, size_t> entity = detail::xmlEntity(*special);
+        out.write(entity.first, entity.second);
+        input = special + 1;
+    }
+}
+
 void fork();
 int changeUser(const std::string & user);
 
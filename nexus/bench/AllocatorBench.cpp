@@ -0,0 +1,277 @@
+/*
+** The author disclaims copyright to this source code.  In place of
+** a legal notice, here is a blessing:
+**
+**    May you do good and not evil.
+**    May you find forgiveness for yourself and forgive others.
+**    May you share freely, never taking more than you give.
+*/
+#include <iostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <boost/thread/lock_guard.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+
+#include <mstd/arena.hpp>
+#include <mstd/itoa.hpp>
+#include <mstd/pool_allocator.hpp>
+
+#include <nexus/Clock.h>
+
+// "request" case: every thread handles requests, each builds vector, unordered_map and string and drops them.
+// std is std::allocator, arena and pool are per thread monotonic_arena and size_class_pool that are reset
+// after each request, thread_cached is one thread_cached_pool shared by all threads.
+// "churn" case: threads keep about 1000 live blocks of 16 to 512 bytes, allocating and freeing at random.
+// locked_pool is size_class_pool under boost::mutex, the simplest thread safe pool, kept as baseline.
+// Results are checked by checksum, so broken allocator is reported as failure.
+
+namespace {
+
+class StdResource {
+public:
+    void * allocate(size_t size, size_t = mstd::detail::max_align)
+    {
+        return ::operator new(size);
+    }
+
+    void deallocate(void * ptr, size_t, size_t = mstd::detail::max_align)
+    {
+        ::operator delete(ptr);
+    }
+
+    void reset()
+    {
+    }
+};
+
+class ArenaResource : public mstd::monotonic_arena {
+public:
+    ArenaResource()
+        : mstd::monotonic_arena(16384) {}
+};
+
+class PoolResource : public mstd::size_class_pool {
+};
+
+class ThreadCachedResource {
+public:
+    explicit ThreadCachedResource(mstd::thread_cached_pool & pool)
+        : pool_(&pool) {}
+
+    void * allocate(size_t size, size_t align = mstd::detail::max_align)
+    {
+        return pool_->allocate(size, align);
+    }
+
+    void deallocate(void * ptr, size_t size, size_t align = mstd::detail::max_align)
+    {
+        pool_->deallocate(ptr, size, align);
+    }
+
+    void reset()
+    {
+    }
+private:
+    mstd::thread_cached_pool * pool_;
+};
+
+class LockedPoolResource {
+public:
+    explicit LockedPoolResource(std::pair<boost::mutex, mstd::size_class_pool> & pool)
+        : pool_(&pool) {}
+
+    void * allocate(size_t size, size_t align = mstd::detail::max_align)
+    {
+        boost::lock_guard<boost::mutex> lock(pool_->first);
+        return pool_->second.allocate(size, align);
+    }
+
+    void deallocate(void * ptr, size_t size, size_t align = mstd::detail::max_align)
+    {
+        boost::lock_guard<boost::mutex> lock(pool_->first);
+        pool_->second.deallocate(ptr, size, align);
+    }
+private:
+    std::pair<boost::mutex, mstd::size_class_pool> * pool_;
+};
+
+template<class Resource>
+boost::uint64_t handleRequest(Resource & resource, size_t seed)
+{
+    typedef std::vector<int, mstd::resource_allocator<int, Resource> > Vector;
+    typedef std::unordered_map<int, int, std::hash<int>, std::equal_to<int>,
+                               mstd::resource_allocator<std::pair<const int, int>, Resource> > Map;
+    typedef std::basic_string<char, std::char_traits<char>, mstd::resource_allocator<char, Resource> > String;
+
+    boost::uint64_t result = 0;
+    {
+        Vector values((typename Vector::allocator_type(resource)));
+        Map index(16, std::hash<int>(), std::equal_to<int>(), typename Map::allocator_type(resource));
+        String text((typename String::allocator_type(resource)));
+        for(size_t i = 0; i != 64; ++i)
+        {
+            int value = static_cast<int>(seed * 31 + i);
+            values.push_back(value);
+            if(i % 2)
+                index[value] = static_cast<int>(i);
+            text += "field=";
+            text += static_cast<char>('a' + i % 26);
+            text += ';';
+        }
+        for(typename Vector::const_iterator i = values.begin(), end = values.end(); i != end; ++i)
+        {
+            typename Map::const_iterator j = index.find(*i);
+            result += j == index.end() ? 1 : j->second;
+        }
+        result += text.size();
+    }
+    resource.reset();
+    return result;
+}
+
+template<class Resource>
+void requestWorker(Resource & resource, size_t requests, boost::uint64_t & checksum)
+{
+    boost::uint64_t sum = 0;
+    for(size_t i = 0; i != requests; ++i)
+        sum += handleRequest(resource, i);
+    checksum = sum;
+}
+
+template<class Resource>
+void churnWorker(Resource resource, size_t ops, size_t seed, boost::uint64_t & checksum)
+{
+    std::vector<std::pair<unsigned char*, size_t> > live;
+    live.reserve(1024);
+    boost::uint64_t sum = 0;
+    boost::uint32_t x = static_cast<boost::uint32_t>(seed) + 1;
+    for(size_t i = 0; i != ops; ++i)
+    {
+        x = x * 1103515245 + 12345;
+        if(live.size() < 1000 && (live.empty() || (x >> 16) % 2))
+        {
+            size_t size = 16 + (x >> 8) % 497;
+            unsigned char * block = static_cast<unsigned char*>(resource.allocate(size));
+            block[0] = static_cast<unsigned char>(i);
+            block[size - 1] = static_cast<unsigned char>(i);
+            live.push_back(std::make_pair(block, size));
+        } else {
+            size_t index = (x >> 8) % live.size();
+            std::pair<unsigned char*, size_t> block = live[index];
+            live[index] = live.back();
+            live.pop_back();
+            sum += block.first[0] == block.first[block.second - 1];
+            resource.deallocate(block.first, block.second);
+        }
+    }
+    for(size_t i = 0; i != live.size(); ++i)
+    {
+        sum += live[i].first[0] == live[i].first[live[i].second - 1];
+        resource.deallocate(live[i].first, live[i].second);
+    }
+    checksum = sum;
+}
+
+void report(const char * name, const char * scenario, size_t threads, size_t ops, nexus::Microseconds elapsed, bool ok)
+{
+    std::cout << "{\"impl\":\"" << name << "\""
+              << ",\"case\":\"" << scenario << "\""
+              << ",\"threads\":" << threads
+              << ",\"ops\":" << ops
+              << ",\"elapsed_us\":" << elapsed
+              << ",\"ops_per_sec\":" << static_cast<boost::uint64_t>(ops / (std::max<double>(elapsed, 1) / 1e6))
+              << ",\"ok\":" << (ok ? "true" : "false")
+              << "}" << std::endl;
+}
+
+template<class Worker>
+bool runRequests(const char * name, Worker worker, size_t threads, size_t requests, boost::uint64_t expected)
+{
+    size_t perThread = std::max<size_t>(requests / threads, 1);
+    std::vector<boost::uint64_t> checksums(threads);
+
+    nexus::Microseconds start = nexus::Clock::microseconds();
+    boost::thread_group group;
+    for(size_t i = 0; i != threads; ++i)
+    {
+        boost::uint64_t & out = checksums[i];
+        group.create_thread([worker, perThread, &out]() { worker(perThread, out); });
+    }
+    group.join_all();
+    nexus::Microseconds elapsed = nexus::Clock::microseconds() - start;
+
+    bool ok = true;
+    for(size_t i = 0; i != threads; ++i)
+        ok = ok && checksums[i] == expected;
+    report(name, "request", threads, perThread * threads, elapsed, ok);
+    return ok;
+}
+
+template<class Resource>
+void ownRequestWorker(size_t requests, boost::uint64_t & checksum)
+{
+    Resource resource;
+    requestWorker(resource, requests, checksum);
+}
+
+template<class Resource>
+bool runChurn(const char * name, Resource resource, size_t threads, size_t ops)
+{
+    size_t perThread = std::max<size_t>(ops / threads, 1);
+    std::vector<boost::uint64_t> checksums(threads);
+
+    nexus::Microseconds start = nexus::Clock::microseconds();
+    boost::thread_group group;
+    for(size_t i = 0; i != threads; ++i)
+    {
+        boost::uint64_t & out = checksums[i];
+        group.create_thread([resource, perThread, i, &out]() { churnWorker(resource, perThread, i, out); });
+    }
+    group.join_all();
+    nexus::Microseconds elapsed = nexus::Clock::microseconds() - start;
+
+    bool ok = true;
+    for(size_t i = 0; i != threads; ++i)
+        ok = ok && checksums[i] != 0;
+    report(name, "churn", threads, perThread * threads, elapsed, ok);
+    return ok;
+}
+
+}
+
+int main(int argc, char * argv[])
+{
+    size_t requests = argc > 1 ? mstd::str2int10<size_t>(std::string(argv[1])) : 200000;
+    size_t maxThreads = argc > 2 ? mstd::str2int10<size_t>(std::string(argv[2])) : 8;
+    size_t churnOps = requests * 50;
+
+    nexus::Clock::start();
+
+    mstd::thread_cached_pool shared;
+    std::pair<boost::mutex, mstd::size_class_pool> locked;
+
+    bool ok = true;
+    for(size_t threads = 1; threads <= maxThreads; threads *= 2)
+    {
+        size_t perThread = std::max<size_t>(requests / threads, 1);
+        boost::uint64_t expected;
+        ownRequestWorker<StdResource>(perThread, expected);
+
+        ok = runRequests("std", &ownRequestWorker<StdResource>, threads, requests, expected) && ok;
+        ok = runRequests("arena", &ownRequestWorker<ArenaResource>, threads, requests, expected) && ok;
+        ok = runRequests("pool", &ownRequestWorker<PoolResource>, threads, requests, expected) && ok;
+        ok = runRequests("thread_cached", [&shared](size_t perThread, boost::uint64_t & out) {
+            ThreadCachedResource resource(shared);
+            requestWorker(resource, perThread, out);
+        }, threads, requests, expected) && ok;
+
+        ok = runChurn("std", StdResource(), threads, churnOps) && ok;
+        ok = runChurn("locked_pool", LockedPoolResource(locked), threads, churnOps) && ok;
+        ok = runChurn("thread_cached", ThreadCachedResource(shared), threads, churnOps) && ok;
+    }
+
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,161 @@
+/*
+** The author disclaims copyright to this source code.  In place of
+** a legal notice, here is a blessing:
+**
+**    May you do good and not evil.
+**    May you find forgiveness for yourself and forgive others.
+**    May you share freely, never taking more than you give.
+*/
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <boost/thread/thread.hpp>
+
+#include <mstd/atomic.hpp>
+#include <mstd/itoa.hpp>
+#include <mstd/strings.hpp>
+
+#include <nexus/AsyncOperations.h>
+#include <nexus/Clock.h>
+
+// Per operation cost of AsyncOperations::prepare/complete and shutdown race check.
+// "legacy" is the previous implementation with separate counter and flag, kept here as baseline.
+// Race check runs many rounds where workers start and complete operations while other thread shuts the object down,
+// and verifies that finish succeeds exactly once and no operation is started after it.
+
+namespace {
+
+class LegacyAsyncOperations : public boost::noncopyable {
+public:
+    explicit LegacyAsyncOperations(bool active)
+        : asyncOperations_(0), shuttingDown_(active ? 0 : 1) {}
+
+    bool finish()
+    {
+        bool result = !asyncOperations_.cas(finishing * 2, 0);
+        if(result)
+            shutdown();
+        return result;
+    }
+
+    bool shutdown()
+    {
+        return !shuttingDown_.cas(1, 0);
+    }
+
+    bool prepare()
+    {
+        if(!shuttingDown_)
+            return ++asyncOperations_ <= finishing;
+        else
+            return false;
+    }
+
+    boost::uint32_t complete()
+    {
+        return --asyncOperations_;
+    }
+private:
+    mstd::atomic<boost::uint32_t> asyncOperations_;
+    mstd::atomic<boost::uint32_t> shuttingDown_;
+
+    static const boost::uint32_t finishing = 0xffff;
+};
+
+template<class Operations>
+void runOps(Operations & ops, size_t iterations)
+{
+    for(size_t i = 0; i != iterations; ++i)
+        if(ops.prepare())
+            ops.complete();
+}
+
+template<class Operations>
+void runCost(const char * name, size_t threads, size_t iterations)
+{
+    Operations ops(true);
+    // keeps count above zero, like pending read of connection
+    ops.prepare();
+
+    nexus::Microseconds start = nexus::Clock::microseconds();
+    boost::thread_group group;
+    for(size_t i = 0; i != threads; ++i)
+        group.create_thread([&ops, iterations]() { runOps(ops, iterations); });
+    group.join_all();
+    nexus::Microseconds elapsed = nexus::Clock::microseconds() - start;
+
+    std::cout << "{\"impl\":\"" << name << "\""
+              << ",\"threads\":" << threads
+              << ",\"iterations\":" << iterations
+              << ",\"elapsed_us\":" << elapsed
+              << ",\"ns_per_op\":" << static_cast<double>(elapsed) * 1000 / std::max<size_t>(iterations, 1)
+              << "}" << std::endl;
+}
+
+bool runRace(size_t rounds, size_t workers)
+{
+    size_t failures = 0;
+    for(size_t round = 0; round != rounds; ++round)
+    {
+        nexus::AsyncOperations ops(true);
+        mstd::atomic<size_t> finishes(0);
+        mstd::atomic<bool> finished(false);
+        mstd::atomic<size_t> late(0);
+
+        auto completeOp = [&]() {
+            if(!ops.complete() && ops.finish())
+            {
+                finished = true;
+                ++finishes;
+            }
+        };
+
+        // owner holds one operation, shuts the object down and releases it, as Connection does with its read
+        ops.prepare();
+        boost::thread_group group;
+        for(size_t i = 0; i != workers; ++i)
+            group.create_thread([&]() {
+                while(ops.prepare())
+                {
+                    if(finished)
+                        ++late;
+                    completeOp();
+                }
+            });
+        for(size_t i = round % 64; i; --i)
+            boost::this_thread::yield();
+        ops.shutdown();
+        completeOp();
+        group.join_all();
+
+        if(finishes != 1 || late || ops.count() || ops.prepare())
+        {
+            ++failures;
+            std::cerr << "race round " << round << " failed: finishes = " << static_cast<size_t>(finishes)
+                      << ", late = " << static_cast<size_t>(late) << ", count = " << ops.count() << std::endl;
+        }
+    }
+
+    std::cout << "{\"race_rounds\":" << rounds << ",\"workers\":" << workers << ",\"failures\":" << failures << "}" << std::endl;
+    return !failures;
+}
+
+}
+
+int main(int argc, char * argv[])
+{
+    size_t iterations = argc > 1 ? mstd::str2int10<size_t>(std::string(argv[1])) : 10000000;
+    size_t rounds = argc > 2 ? mstd::str2int10<size_t>(std::string(argv[2])) : 200;
+
+    nexus::Clock::start();
+
+    const size_t threads[] = { 1, 2, 4 };
+    for(size_t i = 0; i != sizeof(threads) / sizeof(threads[0]); ++i)
+    {
+        runCost<LegacyAsyncOperations>("legacy", threads[i], iterations / threads[i]);
+        runCost<nexus::AsyncOperations>("packed", threads[i], iterations / threads[i]);
+    }
+
+    return runRace(rounds, 4) ? 0 : 1;
+}
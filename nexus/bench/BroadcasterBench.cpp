@@ -0,0 +1,245 @@
+/*
+** The author disclaims copyright to this source code.  In place of
+** a legal notice, here is a blessing:
+**
+**    May you do good and not evil.
+**    May you find forgiveness for yourself and forgive others.
+**    May you share freely, never taking more than you give.
+*/
+#include <iostream>
+#include <limits>
+#include <string>
+#include <vector>
+
+#include <boost/asio/io_service.hpp>
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+
+#include <mstd/atomic.hpp>
+#include <mstd/itoa.hpp>
+
+#include <mlog/Logging.h>
+
+#include <nexus/Acceptor.h>
+#include <nexus/Broadcaster.h>
+#include <nexus/Clock.h>
+#include <nexus/Connection.h>
+#include <nexus/IoThreadPool.h>
+
+// Loopback fan-out benchmark for nexus::Broadcaster. Server connections on IoThreadPool are broadcast targets,
+// clients count received bytes. "single" batch size puts whole io_service to one task, as broadcaster did before
+// batches, so only one pool thread does all connection locks and writes of a broadcast.
+// fanout_us is broadcast call to last recipient queued, elapsed is till all clients received everything.
+
+MLOG_DECLARE_LOGGER(nexus_broadcaster_bench);
+
+namespace {
+
+class Run : public boost::noncopyable {
+public:
+    explicit Run(boost::uint64_t expected)
+        : expected_(expected), received_(0), finished_(0), fanouts_(0), fanoutTotal_(0), fanoutMax_(0) {}
+
+    void received(size_t bytes)
+    {
+        if((received_ += bytes) == expected_)
+        {
+            boost::lock_guard<boost::mutex> lock(mutex_);
+            cond_.notify_all();
+        }
+    }
+
+    void wait()
+    {
+        boost::unique_lock<boost::mutex> lock(mutex_);
+        while(received_ != expected_)
+            cond_.wait(lock);
+    }
+
+    void fanout(const nexus::BroadcastStats & stats)
+    {
+        boost::lock_guard<boost::mutex> lock(mutex_);
+        ++fanouts_;
+        fanoutTotal_ += stats.latency;
+        fanoutMax_ = std::max(fanoutMax_, stats.latency);
+    }
+
+    void connectionFinished()
+    {
+        ++finished_;
+    }
+
+    size_t finished() const
+    {
+        return finished_;
+    }
+
+    double fanoutAverage()
+    {
+        boost::lock_guard<boost::mutex> lock(mutex_);
+        return static_cast<double>(fanoutTotal_) / std::max<size_t>(fanouts_, 1);
+    }
+
+    nexus::Microseconds fanoutMax()
+    {
+        boost::lock_guard<boost::mutex> lock(mutex_);
+        return fanoutMax_;
+    }
+private:
+    boost::uint64_t expected_;
+    mstd::atomic<boost::uint64_t> received_;
+    mstd::atomic<size_t> finished_;
+    boost::mutex mutex_;
+    boost::condition_variable cond_;
+    size_t fanouts_;
+    nexus::Microseconds fanoutTotal_;
+    nexus::Microseconds fanoutMax_;
+};
+
+class BenchConnection final : public nexus::Connection<BenchConnection> {
+public:
+    typedef nexus::Connection<BenchConnection> Base;
+
+    BenchConnection(boost::asio::ip::tcp::socket & socket, Run & run)
+        : Base(true, 0x1000), socket_(boost::move(socket)), run_(run)
+    {
+        socket_.set_option(boost::asio::ip::tcp::no_delay(true));
+    }
+
+    void begin()
+    {
+        this->start();
+    }
+
+    boost::asio::ip::tcp::socket & stream()
+    {
+        return socket_;
+    }
+
+    void processPackets(nexus::PacketReader & reader)
+    {
+        size_t left = reader.left();
+        reader.skip(left);
+        run_.received(left);
+    }
+
+    void close()
+    {
+        boost::system::error_code ec;
+        socket_.shutdown(boost::asio::ip::tcp::socket::shutdown_both, ec);
+    }
+
+    void shutdown()
+    {
+        close();
+    }
+
+    void finish()
+    {
+        run_.connectionFinished();
+    }
+private:
+    boost::asio::ip::tcp::socket socket_;
+    Run & run_;
+};
+
+typedef BenchConnection Conn;
+
+void runCase(size_t connections, size_t threads, size_t batchSize, size_t broadcasts, size_t payload)
+{
+    boost::scoped_ptr<nexus::IoThreadPool> pool(new nexus::IoThreadPool);
+    boost::asio::io_service & ios = pool->ioService();
+
+    Run run(static_cast<boost::uint64_t>(connections) * broadcasts * payload);
+    boost::mutex mutex;
+    std::vector<Conn*> targets;
+
+    nexus::TcpAcceptor acceptor(ios, [&](boost::asio::ip::tcp::socket & socket) {
+        Conn * conn = new Conn(socket, run);
+        {
+            boost::lock_guard<boost::mutex> lock(mutex);
+            targets.push_back(conn);
+        }
+        conn->begin();
+    });
+    acceptor.startLoopbackV4(0);
+    boost::asio::ip::tcp::endpoint endpoint = acceptor.endpoint();
+
+    std::vector<Conn*> clients;
+    for(size_t i = 0; i != connections; ++i)
+    {
+        boost::asio::ip::tcp::socket socket(ios);
+        socket.connect(endpoint);
+        clients.push_back(new Conn(socket, run));
+    }
+
+    pool->start(threads);
+    while(true)
+    {
+        {
+            boost::lock_guard<boost::mutex> lock(mutex);
+            if(targets.size() == clients.size())
+                break;
+        }
+        boost::this_thread::sleep(boost::posix_time::milliseconds(1));
+    }
+    for(std::vector<Conn*>::const_iterator i = clients.begin(), end = clients.end(); i != end; ++i)
+        (*i)->begin();
+
+    nexus::Broadcaster<Conn*> broadcaster(std::numeric_limits<size_t>::max(), batchSize);
+    std::vector<char> data(payload, 'x');
+    nexus::Microseconds start = nexus::Clock::microseconds();
+    for(size_t i = 0; i != broadcasts; ++i)
+        broadcaster.broadcast(&data[0], data.size(), targets, [&run](const nexus::BroadcastStats & stats) { run.fanout(stats); });
+    run.wait();
+    nexus::Microseconds elapsed = nexus::Clock::microseconds() - start;
+
+    for(std::vector<Conn*>::const_iterator i = clients.begin(), end = clients.end(); i != end; ++i)
+        (*i)->close();
+    ios.post([&acceptor]() { acceptor.cancel(); });
+    while(run.finished() != clients.size() + targets.size())
+        boost::this_thread::sleep(boost::posix_time::milliseconds(1));
+    pool->stop();
+
+    for(std::vector<Conn*>::const_iterator i = clients.begin(), end = clients.end(); i != end; ++i)
+        delete *i;
+    for(std::vector<Conn*>::const_iterator i = targets.begin(), end = targets.end(); i != end; ++i)
+        delete *i;
+
+    std::cout << "{\"connections\":" << connections
+              << ",\"threads\":" << threads
+              << ",\"batch\":";
+    if(batchSize == std::numeric_limits<size_t>::max())
+        std::cout << "\"single\"";
+    else
+        std::cout << batchSize;
+    std::cout << ",\"broadcasts\":" << broadcasts
+              << ",\"payload\":" << payload
+              << ",\"elapsed_us\":" << elapsed
+              << ",\"fanout_avg_us\":" << run.fanoutAverage()
+              << ",\"fanout_max_us\":" << run.fanoutMax()
+              << ",\"deliveries_per_sec\":" << static_cast<boost::uint64_t>(connections * broadcasts / (std::max<double>(elapsed, 1) / 1e6))
+              << ",\"delivered\":" << broadcaster.delivered()
+              << "}" << std::endl;
+}
+
+}
+
+int main(int argc, char * argv[])
+{
+    size_t connections = argc > 1 ? mstd::str2int10<size_t>(std::string(argv[1])) : 2000;
+    size_t broadcasts = argc > 2 ? mstd::str2int10<size_t>(std::string(argv[2])) : 200;
+    size_t payload = 64;
+
+    nexus::Clock::start();
+
+    const size_t threads[] = { 1, 2, 4 };
+    const size_t batches[] = { std::numeric_limits<size_t>::max(), 256, 64 };
+    for(size_t t = 0; t != sizeof(threads) / sizeof(threads[0]); ++t)
+        for(size_t b = 0; b != sizeof(batches) / sizeof(batches[0]); ++b)
+            runCase(connections, threads[t], batches[b], broadcasts, payload);
+
+    return 0;
+}
@@ -0,0 +1,128 @@
+/*
+** The author disclaims copyright to this source code.  In place of
+** a legal notice, here is a blessing:
+**
+**    May you do good and not evil.
+**    May you find forgiveness for yourself and forgive others.
+**    May you share freely, never taking more than you give.
+*/
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <boost/thread/thread.hpp>
+
+#include <mstd/atomic.hpp>
+#include <mstd/itoa.hpp>
+
+#include <nexus/Capture.h>
+#include <nexus/Clock.h>
+
+// Cost of PacketCapture on the packet path: check while capture is disabled and record while it is enabled,
+// with collector thread reading rings concurrently. Every recorded payload is filled with byte derived from
+// connection, so torn slots returned by collect are reported as failures.
+
+namespace {
+
+void fill(std::vector<char> & payload, boost::uint64_t connection)
+{
+    std::fill(payload.begin(), payload.end(), static_cast<char>(connection * 7 + 1));
+}
+
+bool valid(const nexus::CapturedPacket & packet)
+{
+    char expected = static_cast<char>(packet.connection * 7 + 1);
+    for(size_t i = 0; i != packet.captured; ++i)
+        if(packet.data[i] != expected)
+            return false;
+    return packet.captured == std::min<size_t>(packet.length, nexus::PacketCapture::snapLength);
+}
+
+void runPath(size_t threads, size_t iterations, size_t payload, mstd::atomic<size_t> & sink)
+{
+    boost::thread_group group;
+    for(size_t t = 0; t != threads; ++t)
+        group.create_thread([&sink, iterations, payload, t]() {
+            std::vector<char> data(payload);
+            size_t local = 0;
+            for(size_t i = 0; i != iterations; ++i)
+            {
+                boost::uint64_t connection = t * 1000 + (i & 0xff);
+                fill(data, connection);
+                if(nexus::PacketCapture::active())
+                    nexus::PacketCapture::record(connection, nexus::cdIn, static_cast<boost::uint16_t>(i & 0xff), &data[0], data.size());
+                local += data[0];
+            }
+            sink += local;
+        });
+    group.join_all();
+}
+
+void runCase(const char * name, bool enabled, size_t threads, size_t iterations, size_t payload)
+{
+    nexus::PacketCapture::clear();
+    nexus::PacketCapture::enable(enabled);
+    nexus::PacketCapture::captureAll(enabled);
+
+    mstd::atomic<size_t> sink(0);
+    mstd::atomic<bool> done(false);
+    size_t collected = 0, torn = 0, collects = 0;
+    boost::thread collector([&]() {
+        while(!done)
+        {
+            std::vector<nexus::CapturedPacket> packets = nexus::PacketCapture::collect();
+            ++collects;
+            collected += packets.size();
+            for(std::vector<nexus::CapturedPacket>::const_iterator i = packets.begin(), end = packets.end(); i != end; ++i)
+                if(!valid(*i))
+                    ++torn;
+        }
+    });
+
+    nexus::Microseconds start = nexus::Clock::microseconds();
+    runPath(threads, iterations, payload, sink);
+    nexus::Microseconds elapsed = nexus::Clock::microseconds() - start;
+    done = true;
+    collector.join();
+
+    std::vector<nexus::CapturedPacket> packets = nexus::PacketCapture::collect();
+    std::ostringstream pcap;
+    nexus::Microseconds dumpStart = nexus::Clock::microseconds();
+    nexus::PacketCapture::writePcap(pcap, packets);
+    nexus::Microseconds dumpElapsed = nexus::Clock::microseconds() - dumpStart;
+
+    nexus::PacketCapture::enable(false);
+
+    std::cout << "{\"case\":\"" << name << "\""
+              << ",\"threads\":" << threads
+              << ",\"iterations\":" << iterations
+              << ",\"payload\":" << payload
+              << ",\"ns_per_packet\":" << static_cast<double>(elapsed) * 1000 / std::max<size_t>(iterations, 1)
+              << ",\"collects\":" << collects
+              << ",\"collected\":" << collected
+              << ",\"torn\":" << torn
+              << ",\"kept\":" << packets.size()
+              << ",\"pcap_bytes\":" << pcap.str().size()
+              << ",\"dump_us\":" << dumpElapsed
+              << "}" << std::endl;
+}
+
+}
+
+int main(int argc, char * argv[])
+{
+    size_t iterations = argc > 1 ? mstd::str2int10<size_t>(std::string(argv[1])) : 5000000;
+    size_t payload = argc > 2 ? mstd::str2int10<size_t>(std::string(argv[2])) : 16;
+
+    nexus::Clock::start();
+
+    const size_t threads[] = { 1, 4 };
+    for(size_t i = 0; i != sizeof(threads) / sizeof(threads[0]); ++i)
+    {
+        runCase("disabled", false, threads[i], iterations, payload);
+        runCase("enabled", true, threads[i], iterations, payload);
+    }
+
+    return 0;
+}
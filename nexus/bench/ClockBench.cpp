@@ -0,0 +1,79 @@
+/*
+** The author disclaims copyright to this source code.  In place of
+** a legal notice, here is a blessing:
+**
+**    May you do good and not evil.
+**    May you find forgiveness for yourself and forgive others.
+**    May you share freely, never taking more than you give.
+*/
+#include <chrono>
+#include <iostream>
+#include <string>
+
+#include <boost/date_time/posix_time/posix_time.hpp>
+
+#include <mstd/itoa.hpp>
+
+#include <nexus/Clock.h>
+
+// Per call cost of every nexus::Clock source, std::chrono::steady_clock and boost microsec_clock are baselines.
+// Values of one source must never go backwards, otherwise it is reported as failure.
+
+namespace {
+
+void report(const char * name, size_t calls, boost::int64_t elapsed, bool ok)
+{
+    std::cout << "{\"impl\":\"" << name << "\""
+              << ",\"calls\":" << calls
+              << ",\"elapsed_us\":" << elapsed
+              << ",\"ns_per_call\":" << static_cast<double>(elapsed) * 1000 / std::max<size_t>(calls, 1)
+              << ",\"ok\":" << (ok ? "true" : "false")
+              << "}" << std::endl;
+}
+
+// Elapsed time is measured by steady_clock, so it does not depend on source being measured.
+template<class Source>
+bool run(const char * name, Source source, size_t calls)
+{
+    bool ok = true;
+    boost::int64_t last = source();
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for(size_t i = 0; i != calls; ++i)
+    {
+        boost::int64_t value = source();
+        ok = ok && value >= last;
+        last = value;
+    }
+    std::chrono::steady_clock::time_point stop = std::chrono::steady_clock::now();
+    report(name, calls, std::chrono::duration_cast<std::chrono::microseconds>(stop - start).count(), ok);
+    return ok;
+}
+
+boost::int64_t steadyClock()
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+boost::int64_t microsecClock()
+{
+    return (boost::posix_time::microsec_clock::universal_time() - nexus::Clock::timeStart()).total_microseconds();
+}
+
+}
+
+int main(int argc, char * argv[])
+{
+    size_t calls = argc > 1 ? mstd::str2int10<size_t>(std::string(argv[1])) : 20000000;
+
+    nexus::Clock::start();
+
+    bool ok = true;
+    ok = run("milliseconds", &nexus::Clock::milliseconds, calls) && ok;
+    ok = run("coarseMilliseconds", &nexus::Clock::coarseMilliseconds, calls) && ok;
+    ok = run("preciseMilliseconds", &nexus::Clock::preciseMilliseconds, calls) && ok;
+    ok = run("microseconds", &nexus::Clock::microseconds, calls) && ok;
+    ok = run("steady_clock", &steadyClock, calls) && ok;
+    ok = run("microsec_clock", &microsecClock, calls) && ok;
+
+    return ok ? 0 : 1;
+}
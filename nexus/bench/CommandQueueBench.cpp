@@ -0,0 +1,173 @@
+/*
+** The author disclaims copyright to this source code.  In place of
+** a legal notice, here is a blessing:
+**
+**    May you do good and not evil.
+**    May you find forgiveness for yourself and forgive others.
+**    May you share freely, never taking more than you give.
+*/
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/thread.hpp>
+
+#include <mstd/atomic.hpp>
+#include <mstd/command_queue.hpp>
+#include <mstd/itoa.hpp>
+#include <mstd/reverse_lock.hpp>
+
+#include <nexus/Clock.h>
+
+// Enqueue throughput of mstd::command_queue, as used by nexus::schedule and default_enqueue.
+// "legacy" is the previous implementation with mutex and notify_one per enqueue, kept here as baseline.
+// Commands are enqueued with keys, per key order is verified for lock free queue.
+
+namespace {
+
+class LegacyCommandQueue : public boost::noncopyable {
+public:
+    typedef std::function<void()> command_type;
+
+    LegacyCommandQueue()
+    {
+        thread_ = boost::thread(&LegacyCommandQueue::execute, this);
+    }
+
+    ~LegacyCommandQueue()
+    {
+        thread_.interrupt();
+        thread_.join();
+    }
+
+    void enqueue(size_t, const command_type & command)
+    {
+        boost::unique_lock<boost::mutex> lock(mutex_);
+        queue_.push_back(command);
+        cond_.notify_one();
+    }
+private:
+    void execute()
+    {
+        std::vector<command_type> queue;
+        boost::unique_lock<boost::mutex> lock(mutex_);
+        while(!boost::this_thread::interruption_requested())
+        {
+            try {
+                if(queue_.empty())
+                    cond_.wait(lock);
+                else {
+                    queue_.swap(queue);
+                    mstd::reverse_lock<boost::unique_lock<boost::mutex> > rlock(lock);
+                    for(std::vector<command_type>::const_iterator i = queue.begin(), end = queue.end(); i != end; ++i)
+                        (*i)();
+                    queue.clear();
+                }
+            } catch(boost::thread_interrupted&) {
+                return;
+            }
+        }
+    }
+
+    boost::mutex mutex_;
+    boost::condition_variable cond_;
+    boost::thread thread_;
+    std::vector<command_type> queue_;
+};
+
+class Checker {
+public:
+    explicit Checker(size_t slots)
+        : last_(slots), executed_(0), disorders_(0) {}
+
+    void operator()(size_t slot, size_t index)
+    {
+        if(last_[slot] >= index)
+            ++disorders_;
+        last_[slot] = index;
+        ++executed_;
+    }
+
+    size_t executed() const
+    {
+        return executed_;
+    }
+
+    size_t disorders() const
+    {
+        return disorders_;
+    }
+private:
+    std::vector<size_t> last_;
+    mstd::atomic<size_t> executed_;
+    mstd::atomic<size_t> disorders_;
+};
+
+const size_t keys = 64;
+
+template<class Queue>
+void runCase(const char * name, Queue & queue, size_t consumers, size_t producers, size_t commands)
+{
+    Checker checker(producers * keys);
+    size_t total = commands * producers;
+
+    nexus::Microseconds start = nexus::Clock::microseconds();
+    boost::thread_group group;
+    for(size_t p = 0; p != producers; ++p)
+        group.create_thread([&queue, &checker, p, commands]() {
+            for(size_t i = 1; i <= commands; ++i)
+            {
+                size_t key = i % keys;
+                size_t slot = p * keys + key;
+                queue.enqueue(key, [&checker, slot, i]() { checker(slot, i); });
+            }
+        });
+    group.join_all();
+    nexus::Microseconds enqueued = nexus::Clock::microseconds() - start;
+    while(checker.executed() != total)
+        boost::this_thread::yield();
+    nexus::Microseconds elapsed = nexus::Clock::microseconds() - start;
+
+    std::cout << "{\"impl\":\"" << name << "\""
+              << ",\"consumers\":" << consumers
+              << ",\"producers\":" << producers
+              << ",\"commands\":" << total
+              << ",\"enqueue_ns\":" << static_cast<double>(enqueued) * 1000 * producers / std::max<size_t>(total, 1)
+              << ",\"commands_per_sec\":" << static_cast<boost::uint64_t>(total / (std::max<double>(elapsed, 1) / 1e6))
+              << ",\"disorders\":" << checker.disorders();
+}
+
+}
+
+int main(int argc, char * argv[])
+{
+    size_t commands = argc > 1 ? mstd::str2int10<size_t>(std::string(argv[1])) : 1000000;
+    size_t spin = argc > 2 ? mstd::str2int10<size_t>(std::string(argv[2])) : 32;
+
+    nexus::Clock::start();
+
+    const size_t producers[] = { 1, 4 };
+    for(size_t i = 0; i != sizeof(producers) / sizeof(producers[0]); ++i)
+    {
+        {
+            LegacyCommandQueue queue;
+            runCase("legacy", queue, 1, producers[i], commands / producers[i]);
+            std::cout << "}" << std::endl;
+        }
+
+        const size_t consumers[] = { 1, 4 };
+        for(size_t j = 0; j != sizeof(consumers) / sizeof(consumers[0]); ++j)
+        {
+            mstd::command_queue queue(consumers[j], spin);
+            runCase("lockfree", queue, consumers[j], producers[i], commands / producers[i]);
+            mstd::command_queue::stats_type stats = queue.stats();
+            std::cout << ",\"batches\":" << stats.batches
+                      << ",\"dwell_avg_us\":" << stats.dwell_total_us / std::max<boost::uint64_t>(stats.executed, 1)
+                      << ",\"dwell_max_us\":" << stats.dwell_max_us
+                      << "}" << std::endl;
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,369 @@
+/*
+** The author disclaims copyright to this source code.  In place of
+** a legal notice, here is a blessing:
+**
+**    May you do good and not evil.
+**    May you find forgiveness for yourself and forgive others.
+**    May you share freely, never taking more than you give.
+*/
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <boost/asio/io_service.hpp>
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+
+#include <mstd/atomic.hpp>
+#include <mstd/strings.hpp>
+
+#include <mlog/Logging.h>
+
+#include <nexus/Acceptor.h>
+#include <nexus/Clock.h>
+#include <nexus/Connection.h>
+#include <nexus/IoThreadPool.h>
+#include <nexus/Strand.h>
+
+// Loopback echo benchmark for nexus::Connection.
+// Every client keeps window packets in flight, server echoes them back, client measures round trip of each packet.
+// Each configuration is printed as one JSON object per line.
+//
+// Packet layout: uint32 size (including header), uint64 send time in microseconds, payload.
+
+MLOG_DECLARE_LOGGER(nexus_bench);
+
+namespace {
+
+const size_t headerSize = sizeof(boost::uint32_t) + sizeof(boost::uint64_t);
+
+struct Settings {
+    size_t clients;
+    size_t messages;
+    size_t window;
+    std::vector<size_t> payloads;
+    std::vector<size_t> threads;
+
+    Settings()
+        : clients(8), messages(20000), window(16)
+    {
+        payloads.push_back(16);
+        payloads.push_back(256);
+        payloads.push_back(4096);
+        payloads.push_back(65536);
+        threads.push_back(1);
+        threads.push_back(2);
+        threads.push_back(4);
+    }
+};
+
+class PlainGuard : public nexus::NoGuard {
+public:
+    explicit PlainGuard(boost::asio::io_service &) {}
+};
+
+class StrandGuard : public nexus::Strand<> {
+public:
+    explicit StrandGuard(boost::asio::io_service & ios)
+        : nexus::Strand<>(ios) {}
+};
+
+class Run : public boost::noncopyable {
+public:
+    explicit Run(size_t connections)
+        : connections_(connections), finished_(0), doneClients_(0) {}
+
+    void clientDone(size_t clients)
+    {
+        if(++doneClients_ == clients)
+        {
+            boost::lock_guard<boost::mutex> lock(mutex_);
+            cond_.notify_all();
+        }
+    }
+
+    void waitClients(size_t clients)
+    {
+        boost::unique_lock<boost::mutex> lock(mutex_);
+        while(doneClients_ != clients)
+            cond_.wait(lock);
+    }
+
+    void connectionFinished()
+    {
+        ++finished_;
+    }
+
+    bool allFinished() const
+    {
+        return finished_ == connections_;
+    }
+
+    void addSamples(const std::vector<boost::uint32_t> & samples)
+    {
+        boost::lock_guard<boost::mutex> lock(mutex_);
+        samples_.insert(samples_.end(), samples.begin(), samples.end());
+    }
+
+    std::vector<boost::uint32_t> & samples()
+    {
+        return samples_;
+    }
+private:
+    size_t connections_;
+    mstd::atomic<size_t> finished_;
+    mstd::atomic<size_t> doneClients_;
+    boost::mutex mutex_;
+    boost::condition_variable cond_;
+    std::vector<boost::uint32_t> samples_;
+};
+
+template<class Guard, class Lazy>
+class BenchConnection : public nexus::Connection<BenchConnection<Guard, Lazy>, Guard, Lazy> {
+public:
+    typedef nexus::Connection<BenchConnection<Guard, Lazy>, Guard, Lazy> Base;
+
+    BenchConnection(boost::asio::ip::tcp::socket & socket, Run & run, size_t payload, size_t messages, size_t window, size_t clients)
+        : Base(true, 0x1000, 2, boost::ref(socket.get_io_service())), socket_(boost::move(socket)), run_(run),
+          packet_(headerSize + payload), messages_(messages), window_(window), clients_(clients), sent_(0), received_(0)
+    {
+        socket_.set_option(boost::asio::ip::tcp::no_delay(true));
+        if(messages_)
+            samples_.reserve(messages_);
+    }
+
+    void begin()
+    {
+        // reading is not started yet, so replies could not race with the initial window
+        for(size_t i = 0; i != window_ && sent_ != messages_; ++i)
+            sendPacket();
+        this->start();
+    }
+
+    void close()
+    {
+        boost::system::error_code ec;
+        socket_.shutdown(boost::asio::ip::tcp::socket::shutdown_both, ec);
+    }
+
+    boost::asio::ip::tcp::socket & stream()
+    {
+        return socket_;
+    }
+
+    void processPackets(nexus::PacketReader & reader)
+    {
+        while(reader.left() >= headerSize)
+        {
+            boost::uint32_t size = reader.peek<boost::uint32_t>();
+            if(reader.left() < size)
+                break;
+            if(!messages_)
+                this->send(reader.raw(), size);
+            else
+                processReply(reader.raw());
+            reader.skip(size);
+        }
+    }
+
+    void shutdown()
+    {
+        boost::system::error_code ec;
+        socket_.shutdown(boost::asio::ip::tcp::socket::shutdown_both, ec);
+    }
+
+    void finish()
+    {
+        run_.connectionFinished();
+    }
+private:
+    void sendPacket()
+    {
+        boost::uint32_t size = static_cast<boost::uint32_t>(packet_.size());
+        boost::uint64_t now = nexus::Clock::microseconds();
+        memcpy(&packet_[0], &size, sizeof(size));
+        memcpy(&packet_[sizeof(size)], &now, sizeof(now));
+        ++sent_;
+        this->send(&packet_[0], packet_.size());
+    }
+
+    void processReply(const char * packet)
+    {
+        boost::uint64_t start;
+        memcpy(&start, packet + sizeof(boost::uint32_t), sizeof(start));
+        samples_.push_back(static_cast<boost::uint32_t>(nexus::Clock::microseconds() - start));
+        if(sent_ != messages_)
+            sendPacket();
+        if(++received_ == messages_)
+        {
+            run_.addSamples(samples_);
+            run_.clientDone(clients_);
+        }
+    }
+
+    boost::asio::ip::tcp::socket socket_;
+    Run & run_;
+    std::vector<char> packet_;
+    size_t messages_;
+    size_t window_;
+    size_t clients_;
+    size_t sent_;
+    size_t received_;
+    std::vector<boost::uint32_t> samples_;
+};
+
+boost::uint32_t percentile(const std::vector<boost::uint32_t> & sorted, double p)
+{
+    if(sorted.empty())
+        return 0;
+    size_t index = static_cast<size_t>(p * (sorted.size() - 1));
+    return sorted[index];
+}
+
+template<class Guard, class Lazy>
+void runCase(const Settings & settings, size_t payload, size_t threads, const char * guardName, size_t lazySize)
+{
+    typedef BenchConnection<Guard, Lazy> Conn;
+
+    boost::scoped_ptr<nexus::IoThreadPool> pool(new nexus::IoThreadPool);
+    boost::asio::io_service & ios = pool->ioService();
+
+    Run run(settings.clients * 2);
+    boost::mutex mutex;
+    std::vector<Conn*> connections;
+
+    nexus::TcpAcceptor acceptor(ios, [&](boost::asio::ip::tcp::socket & socket) {
+        Conn * conn = new Conn(socket, run, payload, 0, 0, settings.clients);
+        {
+            boost::lock_guard<boost::mutex> lock(mutex);
+            connections.push_back(conn);
+        }
+        conn->begin();
+    });
+    acceptor.startLoopbackV4(0);
+    boost::asio::ip::tcp::endpoint endpoint = acceptor.endpoint();
+
+    std::vector<Conn*> clients;
+    for(size_t i = 0; i != settings.clients; ++i)
+    {
+        boost::asio::ip::tcp::socket socket(ios);
+        socket.connect(endpoint);
+        clients.push_back(new Conn(socket, run, payload, settings.messages, settings.window, settings.clients));
+    }
+
+    pool->start(threads);
+    while(true)
+    {
+        {
+            boost::lock_guard<boost::mutex> lock(mutex);
+            if(connections.size() == clients.size())
+                break;
+        }
+        boost::this_thread::sleep(boost::posix_time::milliseconds(1));
+    }
+
+    nexus::Microseconds start = nexus::Clock::microseconds();
+    for(typename std::vector<Conn*>::const_iterator i = clients.begin(), end = clients.end(); i != end; ++i)
+        (*i)->begin();
+    run.waitClients(settings.clients);
+    nexus::Microseconds elapsed = nexus::Clock::microseconds() - start;
+
+    for(typename std::vector<Conn*>::const_iterator i = clients.begin(), end = clients.end(); i != end; ++i)
+        (*i)->close();
+    ios.post([&acceptor]() { acceptor.cancel(); });
+    while(!run.allFinished())
+        boost::this_thread::sleep(boost::posix_time::milliseconds(1));
+    pool->stop();
+
+    for(typename std::vector<Conn*>::const_iterator i = clients.begin(), end = clients.end(); i != end; ++i)
+        delete *i;
+    for(typename std::vector<Conn*>::const_iterator i = connections.begin(), end = connections.end(); i != end; ++i)
+        delete *i;
+
+    std::vector<boost::uint32_t> & samples = run.samples();
+    std::sort(samples.begin(), samples.end());
+    double seconds = std::max<double>(elapsed, 1) / 1e6;
+    double messages = static_cast<double>(settings.clients * settings.messages);
+
+    std::cout << "{\"transport\":\"tcp\""
+              << ",\"payload\":" << payload
+              << ",\"clients\":" << settings.clients
+              << ",\"threads\":" << threads
+              << ",\"guard\":\"" << guardName << "\""
+              << ",\"lazy\":" << lazySize
+              << ",\"window\":" << settings.window
+              << ",\"messages\":" << settings.clients * settings.messages
+              << ",\"elapsed_us\":" << elapsed
+              << ",\"msgs_per_sec\":" << static_cast<boost::uint64_t>(messages / seconds)
+              << ",\"bytes_per_sec\":" << static_cast<boost::uint64_t>(messages * (payload + headerSize) / seconds)
+              << ",\"p50_us\":" << percentile(samples, 0.5)
+              << ",\"p90_us\":" << percentile(samples, 0.9)
+              << ",\"p99_us\":" << percentile(samples, 0.99)
+              << ",\"p999_us\":" << percentile(samples, 0.999)
+              << ",\"max_us\":" << (samples.empty() ? 0 : samples.back())
+              << "}" << std::endl;
+}
+
+std::vector<size_t> parseList(const std::string & input)
+{
+    std::vector<size_t> result;
+    std::string::const_iterator begin = input.begin(), end = input.end();
+    while(begin != end)
+    {
+        std::string::const_iterator next = std::find(begin, end, ',');
+        result.push_back(mstd::str2int10<size_t>(begin, next));
+        begin = next == end ? end : next + 1;
+    }
+    return result;
+}
+
+void usage()
+{
+    std::cerr << "usage: nexus_bench [--clients N] [--messages N] [--window N] [--payloads a,b,c] [--threads a,b,c]" << std::endl;
+}
+
+}
+
+int main(int argc, char * argv[])
+{
+    Settings settings;
+    for(int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        if(i + 1 == argc)
+        {
+            usage();
+            return 1;
+        }
+        std::string value = argv[++i];
+        if(arg == "--clients")
+            settings.clients = mstd::str2int10<size_t>(value);
+        else if(arg == "--messages")
+            settings.messages = mstd::str2int10<size_t>(value);
+        else if(arg == "--window")
+            settings.window = mstd::str2int10<size_t>(value);
+        else if(arg == "--payloads")
+            settings.payloads = parseList(value);
+        else if(arg == "--threads")
+            settings.threads = parseList(value);
+        else {
+            usage();
+            return 1;
+        }
+    }
+
+    nexus::Clock::start();
+
+    for(std::vector<size_t>::const_iterator payload = settings.payloads.begin(); payload != settings.payloads.end(); ++payload)
+        for(std::vector<size_t>::const_iterator threads = settings.threads.begin(); threads != settings.threads.end(); ++threads)
+        {
+            runCase<PlainGuard, nexus::NoLazyBuffer>(settings, *payload, *threads, "none", 0);
+            runCase<PlainGuard, nexus::LazyBuffer<0x1000> >(settings, *payload, *threads, "none", 0x1000);
+            runCase<StrandGuard, nexus::NoLazyBuffer>(settings, *payload, *threads, "strand", 0);
+            runCase<StrandGuard, nexus::LazyBuffer<0x1000> >(settings, *payload, *threads, "strand", 0x1000);
+        }
+
+    return 0;
+}
@@ -0,0 +1,170 @@
+/*
+** The author disclaims copyright to this source code.  In place of
+** a legal notice, here is a blessing:
+**
+**    May you do good and not evil.
+**    May you find forgiveness for yourself and forgive others.
+**    May you share freely, never taking more than you give.
+*/
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <mstd/hash_map.hpp>
+#include <mstd/itoa.hpp>
+
+#include <nexus/Clock.h>
+
+// Insert, lookup of present keys and lookup of absent keys for mstd::hash_map<Key, Value>::type
+// and mstd::flat_hash_map. String keys are looked up by const char *, that flat map accepts without
+// building std::string. Both maps should find the same values, mismatch is reported as failure.
+
+namespace {
+
+template<class Key>
+struct Keys;
+
+template<>
+struct Keys<boost::uint64_t> {
+    static boost::uint64_t make(size_t i)
+    {
+        return i * 0x9e3779b97f4a7c15ULL;
+    }
+};
+
+template<>
+struct Keys<std::string> {
+    static std::string make(size_t i)
+    {
+        char buf[0x20];
+        mstd::itoa(i * 2654435761U, buf);
+        return std::string("session:") + buf;
+    }
+};
+
+template<class Key>
+struct Lookup {
+    typedef Key type;
+
+    static const Key & get(const Key & key)
+    {
+        return key;
+    }
+};
+
+template<>
+struct Lookup<std::string> {
+    typedef const char * type;
+
+    static const char * get(const std::string & key)
+    {
+        return key.c_str();
+    }
+};
+
+// multi_index needs compatible hash and predicate for foreign keys, so it gets key built, as users did.
+template<class Map, class LookupKey>
+typename Map::const_iterator find(const Map & map, const LookupKey & key)
+{
+    return map.find(typename Map::value_type::first_type(key));
+}
+
+template<class Key, class LookupKey>
+typename mstd::flat_hash_map<Key, size_t>::const_iterator find(const mstd::flat_hash_map<Key, size_t> & map, const LookupKey & key)
+{
+    return map.find(key);
+}
+
+struct Result {
+    nexus::Microseconds insert;
+    nexus::Microseconds hit;
+    nexus::Microseconds miss;
+    size_t checksum;
+};
+
+template<class Map, class Key>
+Result runMap(const std::vector<Key> & present, const std::vector<Key> & absent, size_t rounds)
+{
+    typedef typename Lookup<Key>::type LookupKey;
+    std::vector<LookupKey> hits, misses;
+    for(size_t i = 0; i != present.size(); ++i)
+        hits.push_back(Lookup<Key>::get(present[(i * 7919) % present.size()]));
+    for(size_t i = 0; i != absent.size(); ++i)
+        misses.push_back(Lookup<Key>::get(absent[i]));
+
+    Result result = { 0, 0, 0, 0 };
+    Map map;
+    nexus::Microseconds start = nexus::Clock::microseconds();
+    for(size_t i = 0; i != present.size(); ++i)
+        map.insert(typename Map::value_type(present[i], i));
+    result.insert = nexus::Clock::microseconds() - start;
+
+    start = nexus::Clock::microseconds();
+    for(size_t r = 0; r != rounds; ++r)
+        for(typename std::vector<LookupKey>::const_iterator i = hits.begin(), end = hits.end(); i != end; ++i)
+        {
+            typename Map::const_iterator f = find(map, *i);
+            if(f != map.end())
+                result.checksum += f->second;
+        }
+    result.hit = nexus::Clock::microseconds() - start;
+
+    start = nexus::Clock::microseconds();
+    for(size_t r = 0; r != rounds; ++r)
+        for(typename std::vector<LookupKey>::const_iterator i = misses.begin(), end = misses.end(); i != end; ++i)
+            if(find(map, *i) != map.end())
+                ++result.checksum;
+    result.miss = nexus::Clock::microseconds() - start;
+
+    return result;
+}
+
+void print(const char * impl, const char * key, size_t size, size_t rounds, const Result & result)
+{
+    size_t lookups = std::max<size_t>(size * rounds, 1);
+    std::cout << "{\"impl\":\"" << impl << "\""
+              << ",\"key\":\"" << key << "\""
+              << ",\"size\":" << size
+              << ",\"insert_ns\":" << static_cast<double>(result.insert) * 1000 / std::max<size_t>(size, 1)
+              << ",\"hit_ns\":" << static_cast<double>(result.hit) * 1000 / lookups
+              << ",\"miss_ns\":" << static_cast<double>(result.miss) * 1000 / lookups
+              << ",\"checksum\":" << result.checksum
+              << "}" << std::endl;
+}
+
+template<class Key>
+bool runCase(const char * name, size_t size, size_t rounds)
+{
+    std::vector<Key> present, absent;
+    for(size_t i = 0; i != size; ++i)
+    {
+        present.push_back(Keys<Key>::make(i * 2));
+        absent.push_back(Keys<Key>::make(i * 2 + 1));
+    }
+
+    Result multiIndex = runMap<typename mstd::hash_map<Key, size_t>::type>(present, absent, rounds);
+    print("multi_index", name, size, rounds, multiIndex);
+    Result flat = runMap<typename mstd::hash_map<Key, size_t>::flat>(present, absent, rounds);
+    print("flat", name, size, rounds, flat);
+    return multiIndex.checksum == flat.checksum;
+}
+
+}
+
+int main(int argc, char * argv[])
+{
+    size_t lookups = argc > 1 ? mstd::str2int10<size_t>(std::string(argv[1])) : 20000000;
+
+    nexus::Clock::start();
+
+    bool ok = true;
+    const size_t sizes[] = { 1000, 100000, 1000000 };
+    for(size_t i = 0; i != sizeof(sizes) / sizeof(sizes[0]); ++i)
+    {
+        size_t rounds = std::max<size_t>(lookups / sizes[i], 1);
+        ok = runCase<boost::uint64_t>("uint64", sizes[i], rounds) && ok;
+        ok = runCase<std::string>("string", sizes[i], rounds / 4 + 1) && ok;
+    }
+
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,128 @@
+/*
+** The author disclaims copyright to this source code.  In place of
+** a legal notice, here is a blessing:
+**
+**    May you do good and not evil.
+**    May you find forgiveness for yourself and forgive others.
+**    May you share freely, never taking more than you give.
+*/
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <boost/cstdint.hpp>
+
+#include <mstd/itoa.hpp>
+#include <mstd/plain_interval_map.hpp>
+
+#include <nexus/Clock.h>
+
+// Map of IPv4 ranges with gaps between them, as GeoIP or ASN database, is searched by random addresses.
+// lower_bound is map without index, eytzinger is map after build_index, batched is get of keys array.
+// Results are checked by checksum of found values, so broken search is reported as failure.
+
+namespace {
+
+typedef mstd::plain_interval_map<boost::uint32_t, boost::uint32_t> Map;
+
+struct Random {
+    boost::uint64_t state;
+
+    explicit Random(boost::uint64_t seed)
+        : state(seed * 2 + 1) {}
+
+    boost::uint32_t operator()()
+    {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        return static_cast<boost::uint32_t>(state >> 16);
+    }
+};
+
+std::vector<Map::interval_type> makeIntervals(size_t count)
+{
+    std::vector<Map::interval_type> result;
+    result.reserve(count);
+    Random random(1);
+    boost::uint64_t step = 0x100000000ULL / count;
+    for(size_t i = 0; i != count; ++i)
+    {
+        boost::uint32_t lower = static_cast<boost::uint32_t>(i * step);
+        boost::uint32_t length = static_cast<boost::uint32_t>(1 + random() % step);
+        result.push_back(Map::interval_type(lower, lower + length - 1, static_cast<boost::uint32_t>(i)));
+    }
+    // Shuffled, so map sorts them as for unordered database dump.
+    for(size_t i = result.size(); i > 1; --i)
+        std::swap(result[i - 1], result[random() % i]);
+    return result;
+}
+
+void report(const char * name, size_t intervals, size_t lookups, nexus::Microseconds elapsed, bool ok)
+{
+    std::cout << "{\"impl\":\"" << name << "\""
+              << ",\"intervals\":" << intervals
+              << ",\"lookups\":" << lookups
+              << ",\"elapsed_us\":" << elapsed
+              << ",\"ns_per_lookup\":" << static_cast<double>(elapsed) * 1000 / std::max<size_t>(lookups, 1)
+              << ",\"ok\":" << (ok ? "true" : "false")
+              << "}" << std::endl;
+}
+
+boost::uint64_t runSingle(const char * name, const Map & map, const std::vector<boost::uint32_t> & keys, boost::uint64_t expected)
+{
+    boost::uint64_t sum = 0;
+    nexus::Microseconds start = nexus::Clock::microseconds();
+    for(std::vector<boost::uint32_t>::const_iterator i = keys.begin(), end = keys.end(); i != end; ++i)
+        sum += map.get(*i, 0xffffffff);
+    nexus::Microseconds elapsed = nexus::Clock::microseconds() - start;
+    report(name, map.size(), keys.size(), elapsed, expected == 0 || sum == expected);
+    return sum;
+}
+
+boost::uint64_t runBatched(const Map & map, const std::vector<boost::uint32_t> & keys, boost::uint64_t expected)
+{
+    const size_t chunk = 256;
+    const boost::uint32_t * values[chunk];
+    boost::uint64_t sum = 0;
+    nexus::Microseconds start = nexus::Clock::microseconds();
+    for(size_t i = 0; i < keys.size(); i += chunk)
+    {
+        size_t n = std::min(chunk, keys.size() - i);
+        map.get(&keys[i], n, values);
+        for(size_t j = 0; j != n; ++j)
+            sum += values[j] ? *values[j] : 0xffffffff;
+    }
+    nexus::Microseconds elapsed = nexus::Clock::microseconds() - start;
+    report("batched", map.size(), keys.size(), elapsed, sum == expected);
+    return sum;
+}
+
+}
+
+int main(int argc, char * argv[])
+{
+    size_t lookups = argc > 1 ? mstd::str2int10<size_t>(std::string(argv[1])) : 10000000;
+
+    nexus::Clock::start();
+
+    bool ok = true;
+    const size_t sizes[] = { 1000, 100000, 1500000 };
+    for(size_t s = 0; s != sizeof(sizes) / sizeof(sizes[0]); ++s)
+    {
+        std::vector<Map::interval_type> intervals = makeIntervals(sizes[s]);
+        Map map(intervals.begin(), intervals.end());
+
+        Random random(sizes[s]);
+        std::vector<boost::uint32_t> keys(lookups);
+        for(size_t i = 0; i != keys.size(); ++i)
+            keys[i] = random();
+
+        boost::uint64_t expected = runSingle("lower_bound", map, keys, 0);
+        map.build_index();
+        ok = runSingle("eytzinger", map, keys, expected) == expected && ok;
+        ok = runBatched(map, keys, expected) == expected && ok;
+    }
+
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,234 @@
+/*
+** The author disclaims copyright to this source code.  In place of
+** a legal notice, here is a blessing:
+**
+**    May you do good and not evil.
+**    May you find forgiveness for yourself and forgive others.
+**    May you share freely, never taking more than you give.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <mstd/itoa.hpp>
+
+#include <nexus/Clock.h>
+
+// Integer and double formatting and parsing. "legacy" is code mstd had before: reversed 4 digit blocks for itoa
+// and digit by digit str2int10, "libc" is snprintf/strtoull/strtod, "mstd" is current itoa.hpp.
+// Every parsed value is compared with source value, every written double is read back by strtod,
+// mismatch is reported as failure.
+
+namespace {
+
+class Legacy {
+public:
+    Legacy()
+        : blocks_(4 * 10000)
+    {
+        for(size_t i = 0; i != 10000; ++i)
+        {
+            blocks_[i * 4] = static_cast<char>('0' + i % 10);
+            blocks_[i * 4 + 1] = static_cast<char>('0' + (i / 10) % 10);
+            blocks_[i * 4 + 2] = static_cast<char>('0' + (i / 100) % 10);
+            blocks_[i * 4 + 3] = static_cast<char>('0' + (i / 1000) % 10);
+        }
+    }
+
+    char * itoa(boost::uint64_t i, char * buf) const
+    {
+        char * p = buf;
+        if(!i)
+            *p++ = '0';
+        else
+        {
+            while(i)
+            {
+                const char * src = &blocks_[(i % 10000) * 4];
+                std::copy(src, src + 4, p);
+                p += 4;
+                i /= 10000;
+            }
+            while(*(p - 1) == '0')
+                --p;
+            std::reverse(buf, p);
+        }
+        *p = 0;
+        return buf;
+    }
+
+    static boost::uint64_t str2int10(const char * inp, const char * end)
+    {
+        boost::uint64_t result = 0;
+        for(; inp != end; ++inp)
+            result = result * 10 + (*inp - '0');
+        return result;
+    }
+private:
+    std::vector<char> blocks_;
+};
+
+// Legacy code is called through pointers, so it is not inlined into measuring loop, as library functions are not.
+boost::uint64_t (* volatile legacyParse)(const char *, const char *) = &Legacy::str2int10;
+
+template<class F>
+double measure(size_t count, F f)
+{
+    nexus::Microseconds start = nexus::Clock::microseconds();
+    f();
+    nexus::Microseconds elapsed = nexus::Clock::microseconds() - start;
+    return static_cast<double>(elapsed) * 1000 / std::max<size_t>(count, 1);
+}
+
+boost::uint32_t nextRandom(boost::uint64_t & seed)
+{
+    seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+    return static_cast<boost::uint32_t>(seed >> 32);
+}
+
+bool runIntegers(const char * name, const std::vector<boost::uint64_t> & values)
+{
+    Legacy legacy;
+    char buf[0x20];
+    size_t checksum = 0;
+    bool ok = true;
+
+    double itoaLegacy = measure(values.size(), [&]() {
+        for(size_t i = 0; i != values.size(); ++i)
+            checksum += legacy.itoa(values[i], buf)[0];
+    });
+    double itoaLibc = measure(values.size(), [&]() {
+        for(size_t i = 0; i != values.size(); ++i)
+            checksum += snprintf(buf, sizeof(buf), "%llu", static_cast<unsigned long long>(values[i]));
+    });
+    double itoaMstd = measure(values.size(), [&]() {
+        for(size_t i = 0; i != values.size(); ++i)
+            checksum += mstd::itoa(values[i], buf)[0];
+    });
+
+    std::vector<std::string> strings;
+    for(size_t i = 0; i != values.size(); ++i)
+    {
+        strings.push_back(mstd::itoa(values[i], buf));
+        snprintf(buf, sizeof(buf), "%llu", static_cast<unsigned long long>(values[i]));
+        ok = ok && strings.back() == buf;
+    }
+
+    double parseLegacy = measure(values.size(), [&]() {
+        for(size_t i = 0; i != strings.size(); ++i)
+            ok = legacyParse(strings[i].c_str(), strings[i].c_str() + strings[i].length()) == values[i] && ok;
+    });
+    double parseLibc = measure(values.size(), [&]() {
+        for(size_t i = 0; i != strings.size(); ++i)
+            ok = strtoull(strings[i].c_str(), 0, 10) == values[i] && ok;
+    });
+    double parseMstd = measure(values.size(), [&]() {
+        for(size_t i = 0; i != strings.size(); ++i)
+            ok = mstd::str2int10_checked<boost::uint64_t>(strings[i].c_str(), strings[i].length()) == values[i] && ok;
+    });
+
+    std::cout << "{\"case\":\"" << name << "\""
+              << ",\"count\":" << values.size()
+              << ",\"itoa_legacy_ns\":" << itoaLegacy
+              << ",\"itoa_libc_ns\":" << itoaLibc
+              << ",\"itoa_mstd_ns\":" << itoaMstd
+              << ",\"parse_legacy_ns\":" << parseLegacy
+              << ",\"parse_libc_ns\":" << parseLibc
+              << ",\"parse_mstd_ns\":" << parseMstd
+              << ",\"checksum\":" << checksum
+              << ",\"ok\":" << (ok ? "true" : "false")
+              << "}" << std::endl;
+    return ok;
+}
+
+bool runDoubles(const char * name, const std::vector<double> & values)
+{
+    char buf[0x40];
+    size_t checksum = 0;
+
+    double formatShort = measure(values.size(), [&]() {
+        for(size_t i = 0; i != values.size(); ++i)
+            checksum += snprintf(buf, sizeof(buf), "%g", values[i]);
+    });
+    double formatExact = measure(values.size(), [&]() {
+        for(size_t i = 0; i != values.size(); ++i)
+            checksum += snprintf(buf, sizeof(buf), "%.17g", values[i]);
+    });
+    double formatMstd = measure(values.size(), [&]() {
+        for(size_t i = 0; i != values.size(); ++i)
+            checksum += mstd::dtoa(values[i], buf)[0];
+    });
+
+    std::vector<std::string> strings;
+    size_t failures = 0, longer = 0;
+    for(size_t i = 0; i != values.size(); ++i)
+    {
+        strings.push_back(mstd::dtoa(values[i], buf));
+        if(strtod(buf, 0) != values[i])
+            ++failures;
+        snprintf(buf, sizeof(buf), "%.17g", values[i]);
+        if(strings.back().length() > strlen(buf))
+            ++longer;
+    }
+
+    double parseLibc = measure(values.size(), [&]() {
+        for(size_t i = 0; i != strings.size(); ++i)
+            if(strtod(strings[i].c_str(), 0) != values[i])
+                ++failures;
+    });
+    double parseMstd = measure(values.size(), [&]() {
+        double value;
+        for(size_t i = 0; i != strings.size(); ++i)
+            if(!mstd::str2double(strings[i].c_str(), strings[i].length(), value) || value != values[i])
+                ++failures;
+    });
+
+    std::cout << "{\"case\":\"" << name << "\""
+              << ",\"count\":" << values.size()
+              << ",\"format_libc_g_ns\":" << formatShort
+              << ",\"format_libc_17g_ns\":" << formatExact
+              << ",\"format_mstd_ns\":" << formatMstd
+              << ",\"parse_libc_ns\":" << parseLibc
+              << ",\"parse_mstd_ns\":" << parseMstd
+              << ",\"longer_than_17g\":" << longer
+              << ",\"roundtrip_failures\":" << failures
+              << ",\"checksum\":" << checksum
+              << "}" << std::endl;
+    return !failures;
+}
+
+}
+
+int main(int argc, char * argv[])
+{
+    size_t count = argc > 1 ? mstd::str2int10<size_t>(std::string(argv[1])) : 2000000;
+
+    nexus::Clock::start();
+
+    boost::uint64_t seed = 42;
+    std::vector<boost::uint64_t> small, large;
+    std::vector<double> prices, scaled, bits;
+    for(size_t i = 0; i != count; ++i)
+    {
+        small.push_back(nextRandom(seed) % 100000);
+        large.push_back((static_cast<boost::uint64_t>(nextRandom(seed)) << 32) | nextRandom(seed));
+        prices.push_back(static_cast<double>(nextRandom(seed) % 1000000) / 100);
+        scaled.push_back(static_cast<double>(nextRandom(seed)) / (nextRandom(seed) | 1));
+        boost::uint64_t raw = (static_cast<boost::uint64_t>(nextRandom(seed)) << 32) | nextRandom(seed);
+        double value;
+        memcpy(&value, &raw, sizeof(value));
+        bits.push_back(value == value && value - value == 0 ? value : 0.0);
+    }
+
+    bool ok = true;
+    ok = runIntegers("uint_small", small) && ok;
+    ok = runIntegers("uint_large", large) && ok;
+    ok = runDoubles("double_prices", prices) && ok;
+    ok = runDoubles("double_ratios", scaled) && ok;
+    ok = runDoubles("double_bits", bits) && ok;
+
+    return ok ? 0 : 1;
+}
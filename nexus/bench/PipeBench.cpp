@@ -0,0 +1,249 @@
+/*
+** The author disclaims copyright to this source code.  In place of
+** a legal notice, here is a blessing:
+**
+**    May you do good and not evil.
+**    May you find forgiveness for yourself and forgive others.
+**    May you share freely, never taking more than you give.
+*/
+#include <iostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+
+#include <mstd/atomic.hpp>
+#include <mstd/itoa.hpp>
+#include <mstd/strings.hpp>
+
+#include <mlog/Logging.h>
+
+#include <nexus/Clock.h>
+#include <nexus/PipeService.h>
+
+// Echo benchmark for nexus::PipeService, counterpart of nexus_bench that runs the same workload over tcp connections.
+// Every client keeps window packets in flight, server echoes them back, client measures round trip of each packet.
+// Output uses the same JSON fields as nexus_bench, so results of both could be compared directly.
+//
+// Packet payload starts with uint64 send time in microseconds.
+
+MLOG_DECLARE_LOGGER(nexus_pipe_bench);
+
+namespace {
+
+const nexus::PacketCode benchCode = 0x10;
+const size_t headerSize = sizeof(boost::uint64_t);
+
+struct Settings {
+    size_t clients;
+    size_t messages;
+    size_t window;
+    std::vector<size_t> payloads;
+
+    Settings()
+        : clients(8), messages(20000), window(16)
+    {
+        payloads.push_back(16);
+        payloads.push_back(256);
+        payloads.push_back(4096);
+        payloads.push_back(65536);
+    }
+};
+
+struct ClientState {
+    size_t sent;
+    size_t received;
+};
+
+// All callbacks of one PipeService are invoked from its single thread, so state is touched only from there.
+class Run : public boost::noncopyable {
+public:
+    Run(const Settings & settings, size_t payload)
+        : settings_(settings), packet_(headerSize + payload), connected_(0), done_(0)
+    {
+        samples_.reserve(settings.clients * settings.messages);
+    }
+
+    void serverEvent(int id, int code, const char * data, size_t len)
+    {
+        if(code == benchCode)
+            server_.send(id, benchCode, data, len);
+    }
+
+    void clientEvent(int id, int code, const char * data, size_t len)
+    {
+        if(code == -nexus::pcConnected)
+        {
+            ClientState & state = clients_[id];
+            state.sent = state.received = 0;
+            notify(++connected_ == settings_.clients);
+        } else if(code == benchCode) {
+            boost::uint64_t start;
+            memcpy(&start, data, sizeof(start));
+            samples_.push_back(static_cast<boost::uint32_t>(nexus::Clock::microseconds() - start));
+            ClientState & state = clients_[id];
+            if(state.sent != settings_.messages)
+                sendPacket(id, state);
+            if(++state.received == settings_.messages)
+                notify(++done_ == settings_.clients);
+        } else if(code == -nexus::pcFailed)
+            MLOG_ERROR("connect failed: " << -id);
+    }
+
+    nexus::Microseconds execute(const std::wstring & name)
+    {
+        server_.listen([this](int id, int code, const char * data, size_t len) { serverEvent(id, code, data, len); }, name);
+        for(size_t i = 0; i != settings_.clients; ++i)
+            client_.connect([this](int id, int code, const char * data, size_t len) { clientEvent(id, code, data, len); }, name, 40);
+        wait(connected_, settings_.clients);
+
+        nexus::Microseconds start = nexus::Clock::microseconds();
+        client_.post([this]() { begin(); });
+        wait(done_, settings_.clients);
+        return nexus::Clock::microseconds() - start;
+    }
+
+    std::vector<boost::uint32_t> & samples()
+    {
+        return samples_;
+    }
+private:
+    void begin()
+    {
+        for(auto i = clients_.begin(), end = clients_.end(); i != end; ++i)
+            for(size_t j = 0; j != settings_.window && i->second.sent != settings_.messages; ++j)
+                sendPacket(i->first, i->second);
+    }
+
+    void sendPacket(int id, ClientState & state)
+    {
+        boost::uint64_t now = nexus::Clock::microseconds();
+        memcpy(&packet_[0], &now, sizeof(now));
+        ++state.sent;
+        client_.send(id, benchCode, &packet_[0], packet_.size());
+    }
+
+    void notify(bool value)
+    {
+        if(value)
+        {
+            boost::lock_guard<boost::mutex> lock(mutex_);
+            cond_.notify_all();
+        }
+    }
+
+    void wait(const mstd::atomic<size_t> & counter, size_t value)
+    {
+        boost::unique_lock<boost::mutex> lock(mutex_);
+        while(counter != value)
+            cond_.wait(lock);
+    }
+
+    const Settings & settings_;
+    std::vector<char> packet_;
+    nexus::PipeService server_;
+    nexus::PipeService client_;
+    std::unordered_map<int, ClientState> clients_;
+    mstd::atomic<size_t> connected_;
+    mstd::atomic<size_t> done_;
+    boost::mutex mutex_;
+    boost::condition_variable cond_;
+    std::vector<boost::uint32_t> samples_;
+};
+
+boost::uint32_t percentile(const std::vector<boost::uint32_t> & sorted, double p)
+{
+    if(sorted.empty())
+        return 0;
+    size_t index = static_cast<size_t>(p * (sorted.size() - 1));
+    return sorted[index];
+}
+
+void runCase(const Settings & settings, size_t payload, size_t index)
+{
+    std::vector<boost::uint32_t> samples;
+    nexus::Microseconds elapsed;
+    {
+        Run run(settings, payload);
+        elapsed = run.execute(L"nexus_pipe_bench." + std::to_wstring(static_cast<unsigned long long>(index)));
+        samples.swap(run.samples());
+    }
+
+    std::sort(samples.begin(), samples.end());
+    double seconds = std::max<double>(elapsed, 1) / 1e6;
+    double messages = static_cast<double>(settings.clients * settings.messages);
+
+    std::cout << "{\"transport\":\"pipe\""
+              << ",\"payload\":" << payload
+              << ",\"clients\":" << settings.clients
+              << ",\"threads\":1"
+              << ",\"window\":" << settings.window
+              << ",\"messages\":" << settings.clients * settings.messages
+              << ",\"elapsed_us\":" << elapsed
+              << ",\"msgs_per_sec\":" << static_cast<boost::uint64_t>(messages / seconds)
+              << ",\"bytes_per_sec\":" << static_cast<boost::uint64_t>(messages * (payload + headerSize) / seconds)
+              << ",\"p50_us\":" << percentile(samples, 0.5)
+              << ",\"p90_us\":" << percentile(samples, 0.9)
+              << ",\"p99_us\":" << percentile(samples, 0.99)
+              << ",\"p999_us\":" << percentile(samples, 0.999)
+              << ",\"max_us\":" << (samples.empty() ? 0 : samples.back())
+              << "}" << std::endl;
+}
+
+std::vector<size_t> parseList(const std::string & input)
+{
+    std::vector<size_t> result;
+    std::string::const_iterator begin = input.begin(), end = input.end();
+    while(begin != end)
+    {
+        std::string::const_iterator next = std::find(begin, end, ',');
+        result.push_back(mstd::str2int10<size_t>(begin, next));
+        begin = next == end ? end : next + 1;
+    }
+    return result;
+}
+
+void usage()
+{
+    std::cerr << "usage: nexus_pipe_bench [--clients N] [--messages N] [--window N] [--payloads a,b,c]" << std::endl;
+}
+
+}
+
+int main(int argc, char * argv[])
+{
+    Settings settings;
+    for(int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        if(i + 1 == argc)
+        {
+            usage();
+            return 1;
+        }
+        std::string value = argv[++i];
+        if(arg == "--clients")
+            settings.clients = mstd::str2int10<size_t>(value);
+        else if(arg == "--messages")
+            settings.messages = mstd::str2int10<size_t>(value);
+        else if(arg == "--window")
+            settings.window = mstd::str2int10<size_t>(value);
+        else if(arg == "--payloads")
+            settings.payloads = parseList(value);
+        else {
+            usage();
+            return 1;
+        }
+    }
+
+    nexus::Clock::start();
+
+    size_t index = 0;
+    for(std::vector<size_t>::const_iterator payload = settings.payloads.begin(); payload != settings.payloads.end(); ++payload)
+        runCase(settings, *payload, index++);
+
+    return 0;
+}
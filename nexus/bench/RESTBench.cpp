@@ -0,0 +1,122 @@
+/*
+** The author disclaims copyright to this source code.  In place of
+** a legal notice, here is a blessing:
+**
+**    May you do good and not evil.
+**    May you find forgiveness for yourself and forgive others.
+**    May you share freely, never taking more than you give.
+*/
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <mcrypt/MD5.h>
+#include <mcrypt/Utils.h>
+
+#include <mstd/strings.hpp>
+
+#include <nexus/Clock.h>
+#include <nexus/REST.h>
+
+// Micro benchmark for signed url building.
+// "concat" is the plain string concatenation RESTRequest used before, "fresh" creates RESTRequest for every url
+// and "reused" resets single RESTRequest, so its storage is allocated only once.
+
+namespace {
+
+struct Param {
+    std::string name;
+    std::string value;
+};
+
+const std::string base = "https://api.example.com/method?";
+const std::string secret = "0123456789abcdef0123456789abcdef";
+
+std::vector<Param> makeParams(size_t count, size_t valueSize)
+{
+    std::vector<Param> result(count);
+    for(size_t i = 0; i != count; ++i)
+    {
+        result[i].name = "param" + std::to_string(static_cast<unsigned long long>(i));
+        for(size_t j = 0; j != valueSize; ++j)
+            result[i].value += j % 7 ? static_cast<char>('a' + j % 26) : ' ';
+    }
+    return result;
+}
+
+size_t buildConcat(const std::vector<Param> & params)
+{
+    std::string url = base, str;
+    for(std::vector<Param>::const_iterator i = params.begin(), end = params.end(); i != end; ++i)
+    {
+        str += i->name;
+        str += '=';
+        str += i->value;
+        url += i->name;
+        url += '=';
+        url += i->value;
+        url += '&';
+    }
+    str += secret;
+    url += "sig=";
+    url += mcrypt::visualize(mcrypt::md5String(str));
+    return url.length();
+}
+
+size_t buildFresh(const std::vector<Param> & params)
+{
+    nexus::RESTRequest request(base);
+    for(std::vector<Param>::const_iterator i = params.begin(), end = params.end(); i != end; ++i)
+        request.addParam(i->name, i->value);
+    return request.url(secret).length();
+}
+
+size_t buildReused(nexus::RESTRequest & request, const std::vector<Param> & params)
+{
+    request.reset(base);
+    for(std::vector<Param>::const_iterator i = params.begin(), end = params.end(); i != end; ++i)
+        request.addParam(i->name, i->value);
+    return request.url(secret).length();
+}
+
+template<class F>
+void runCase(const char * name, size_t iterations, size_t params, size_t valueSize, const F & f)
+{
+    size_t total = 0;
+    nexus::Microseconds start = nexus::Clock::microseconds();
+    for(size_t i = 0; i != iterations; ++i)
+        total += f();
+    nexus::Microseconds elapsed = nexus::Clock::microseconds() - start;
+
+    std::cout << "{\"builder\":\"" << name << "\""
+              << ",\"params\":" << params
+              << ",\"value_size\":" << valueSize
+              << ",\"iterations\":" << iterations
+              << ",\"elapsed_us\":" << elapsed
+              << ",\"ns_per_url\":" << elapsed * 1000 / static_cast<nexus::Microseconds>(std::max<size_t>(iterations, 1))
+              << ",\"bytes\":" << total / std::max<size_t>(iterations, 1)
+              << "}" << std::endl;
+}
+
+}
+
+int main(int argc, char * argv[])
+{
+    size_t iterations = argc > 1 ? mstd::str2int10<size_t>(std::string(argv[1])) : 200000;
+
+    nexus::Clock::start();
+
+    nexus::RESTRequest request;
+    const size_t paramCounts[] = { 4, 16 };
+    const size_t valueSizes[] = { 8, 64 };
+    for(size_t i = 0; i != sizeof(paramCounts) / sizeof(paramCounts[0]); ++i)
+        for(size_t j = 0; j != sizeof(valueSizes) / sizeof(valueSizes[0]); ++j)
+        {
+            std::vector<Param> params = makeParams(paramCounts[i], valueSizes[j]);
+            runCase("concat", iterations, paramCounts[i], valueSizes[j], [&params]() { return buildConcat(params); });
+            runCase("fresh", iterations, paramCounts[i], valueSizes[j], [&params]() { return buildFresh(params); });
+            runCase("reused", iterations, paramCounts[i], valueSizes[j], [&request, &params]() { return buildReused(request, params); });
+        }
+
+    return 0;
+}
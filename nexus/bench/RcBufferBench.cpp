@@ -0,0 +1,174 @@
+/*
+** The author disclaims copyright to this source code.  In place of
+** a legal notice, here is a blessing:
+**
+**    May you do good and not evil.
+**    May you find forgiveness for yourself and forgive others.
+**    May you share freely, never taking more than you give.
+*/
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <mstd/itoa.hpp>
+#include <mstd/rc_buffer.hpp>
+
+#include <nexus/Clock.h>
+
+// "append" case: response body is received in chunks, as mnet HTTP does, to buffer that starts with
+// rc_buffer(size) and resize(0). "legacy" is previous rc_buffer that reallocates to exact size on every append,
+// kept here as baseline. "split" case: body is split to fields that are copied to own buffers or sliced.
+
+namespace {
+
+class LegacyRcBuffer {
+public:
+    explicit LegacyRcBuffer(size_t size)
+        : data_(static_cast<char*>(malloc(size + sizeof(size_t)))), size_(0)
+    {
+    }
+
+    ~LegacyRcBuffer()
+    {
+        free(data_);
+    }
+
+    void append(const char * buf, size_t len)
+    {
+        data_ = static_cast<char*>(realloc(data_, sizeof(size_t) + size_ + len));
+        memcpy(data_ + sizeof(size_t) + size_, buf, len);
+        size_ += len;
+    }
+
+    const char * data() const
+    {
+        return data_ + sizeof(size_t);
+    }
+
+    size_t size() const
+    {
+        return size_;
+    }
+private:
+    char * data_;
+    size_t size_;
+};
+
+class Buffer {
+public:
+    explicit Buffer(size_t size)
+        : impl_(size)
+    {
+        impl_.resize(0);
+    }
+
+    void append(const char * buf, size_t len)
+    {
+        impl_.append(buf, len);
+    }
+
+    const char * data() const
+    {
+        return impl_.data();
+    }
+
+    size_t size() const
+    {
+        return impl_.size();
+    }
+private:
+    mstd::rc_buffer impl_;
+};
+
+void report(const char * name, const char * scenario, size_t chunk, size_t ops, size_t bytes, nexus::Microseconds elapsed, bool ok)
+{
+    std::cout << "{\"impl\":\"" << name << "\""
+              << ",\"case\":\"" << scenario << "\""
+              << ",\"chunk\":" << chunk
+              << ",\"ops\":" << ops
+              << ",\"elapsed_us\":" << elapsed
+              << ",\"mb_per_sec\":" << static_cast<double>(bytes) / std::max<double>(elapsed, 1)
+              << ",\"ok\":" << (ok ? "true" : "false")
+              << "}" << std::endl;
+}
+
+template<class Impl>
+bool runAppend(const char * name, const std::string & body, size_t chunk, size_t rounds)
+{
+    bool ok = true;
+    nexus::Microseconds start = nexus::Clock::microseconds();
+    for(size_t r = 0; r != rounds; ++r)
+    {
+        Impl buffer(chunk);
+        for(size_t pos = 0; pos < body.size(); pos += chunk)
+            buffer.append(body.data() + pos, std::min(chunk, body.size() - pos));
+        ok = ok && buffer.size() == body.size() && buffer.data()[body.size() / 2] == body[body.size() / 2];
+    }
+    nexus::Microseconds elapsed = nexus::Clock::microseconds() - start;
+    report(name, "append", chunk, rounds * (body.size() / chunk), rounds * body.size(), elapsed, ok);
+    return ok;
+}
+
+bool runSplit(const std::string & body, size_t field, size_t rounds)
+{
+    mstd::rc_buffer source(body.data(), body.size());
+    size_t fields = body.size() / field;
+    bool ok = true;
+
+    nexus::Microseconds start = nexus::Clock::microseconds();
+    for(size_t r = 0; r != rounds; ++r)
+    {
+        std::vector<mstd::rc_buffer> copies;
+        copies.reserve(fields);
+        for(size_t i = 0; i != fields; ++i)
+            copies.push_back(mstd::rc_buffer(source.data() + i * field, field));
+        ok = ok && copies.back().data()[0] == body[(fields - 1) * field];
+    }
+    nexus::Microseconds elapsed = nexus::Clock::microseconds() - start;
+    report("copy", "split", field, rounds * fields, rounds * body.size(), elapsed, ok);
+
+    start = nexus::Clock::microseconds();
+    for(size_t r = 0; r != rounds; ++r)
+    {
+        std::vector<mstd::rc_buffer_view> slices;
+        slices.reserve(fields);
+        for(size_t i = 0; i != fields; ++i)
+            slices.push_back(source.slice(i * field, field));
+        ok = ok && slices.back().data()[0] == body[(fields - 1) * field];
+    }
+    elapsed = nexus::Clock::microseconds() - start;
+    report("slice", "split", field, rounds * fields, rounds * body.size(), elapsed, ok);
+    return ok;
+}
+
+}
+
+int main(int argc, char * argv[])
+{
+    size_t bodySize = argc > 1 ? mstd::str2int10<size_t>(std::string(argv[1])) : 4 << 20;
+    size_t rounds = argc > 2 ? mstd::str2int10<size_t>(std::string(argv[2])) : 20;
+
+    nexus::Clock::start();
+
+    std::string body(bodySize, 0);
+    for(size_t i = 0; i != body.size(); ++i)
+        body[i] = static_cast<char>('a' + i % 26);
+
+    bool ok = true;
+    const size_t chunks[] = { 64, 1024, 16384 };
+    for(size_t i = 0; i != sizeof(chunks) / sizeof(chunks[0]); ++i)
+    {
+        ok = runAppend<LegacyRcBuffer>("legacy", body, chunks[i], rounds) && ok;
+        ok = runAppend<Buffer>("rc_buffer", body, chunks[i], rounds) && ok;
+    }
+
+    const size_t fields[] = { 16, 256, 4096 };
+    for(size_t i = 0; i != sizeof(fields) / sizeof(fields[0]); ++i)
+        ok = runSplit(body, fields[i], rounds) && ok;
+
+    return ok ? 0 : 1;
+}
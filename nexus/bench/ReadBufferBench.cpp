@@ -0,0 +1,266 @@
+/*
+** The author disclaims copyright to this source code.  In place of
+** a legal notice, here is a blessing:
+**
+**    May you do good and not evil.
+**    May you find forgiveness for yourself and forgive others.
+**    May you share freely, never taking more than you give.
+*/
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <boost/asio/io_service.hpp>
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/asio/write.hpp>
+#include <boost/ptr_container/ptr_vector.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/thread/thread.hpp>
+
+#include <mstd/atomic.hpp>
+#include <mstd/itoa.hpp>
+
+#include <mlog/Logging.h>
+
+#include <nexus/Clock.h>
+#include <nexus/Connection.h>
+#include <nexus/IoThreadPool.h>
+
+// Reading buffer memory of many mostly idle connections.
+// Every client sends one large packet, then small packets with pauses between rounds, like heartbeats of idle
+// connections, then burst of small packets to measure throughput. Total reading buffer capacity of server
+// connections is printed after first two phases, for buffers that only grow, buffers that shrink after small reads
+// and reads through per thread scratch buffer.
+//
+// Packet layout: uint32 size (including header), payload.
+
+MLOG_DECLARE_LOGGER(nexus_read_buffer_bench);
+
+namespace {
+
+struct Settings {
+    size_t connections;
+    size_t large;
+    size_t small;
+    size_t heartbeats;
+    size_t messages;
+
+    Settings()
+        : connections(1000), large(0x40000), small(64), heartbeats(20), messages(100) {}
+};
+
+enum Mode {
+    mGrow,
+    mShrink,
+    mScratch,
+};
+
+const char * modeNames[] = { "grow", "shrink", "scratch" };
+
+class Run : public boost::noncopyable {
+public:
+    Run()
+        : packets_(0), finished_(0) {}
+
+    void packet()
+    {
+        ++packets_;
+    }
+
+    size_t packets() const
+    {
+        return packets_;
+    }
+
+    void finished()
+    {
+        ++finished_;
+    }
+
+    size_t finishedCount() const
+    {
+        return finished_;
+    }
+private:
+    mstd::atomic<size_t> packets_;
+    mstd::atomic<size_t> finished_;
+};
+
+class Server : public nexus::Connection<Server> {
+public:
+    Server(boost::asio::ip::tcp::socket & socket, Run & run, Mode mode)
+        : nexus::Connection<Server>(true, 0x1000, 2), socket_(boost::move(socket)), run_(run)
+    {
+        if(mode == mGrow)
+            shrinkAfter(0);
+        else if(mode == mScratch)
+            readThroughScratch(true);
+    }
+
+    void begin()
+    {
+        start();
+    }
+
+    boost::asio::ip::tcp::socket & stream()
+    {
+        return socket_;
+    }
+
+    void processPackets(nexus::PacketReader & reader)
+    {
+        while(reader.left() >= sizeof(boost::uint32_t))
+        {
+            boost::uint32_t size = reader.peek<boost::uint32_t>();
+            if(reader.left() < size)
+                break;
+            reader.skip(size);
+            run_.packet();
+        }
+    }
+
+    void shutdown()
+    {
+        boost::system::error_code ec;
+        socket_.shutdown(boost::asio::ip::tcp::socket::shutdown_both, ec);
+    }
+
+    void finish()
+    {
+        run_.finished();
+    }
+private:
+    boost::asio::ip::tcp::socket socket_;
+    Run & run_;
+};
+
+void waitFor(const Run & run, size_t packets)
+{
+    while(run.packets() < packets)
+        boost::this_thread::sleep(boost::posix_time::milliseconds(1));
+}
+
+size_t totalBuffers(const boost::ptr_vector<Server> & servers)
+{
+    size_t result = 0;
+    for(boost::ptr_vector<Server>::const_iterator i = servers.begin(), end = servers.end(); i != end; ++i)
+        result += i->readBufferSize();
+    return result;
+}
+
+std::vector<char> makePacket(size_t size)
+{
+    std::vector<char> result(size, 'x');
+    boost::uint32_t header = static_cast<boost::uint32_t>(size);
+    memcpy(&result[0], &header, sizeof(header));
+    return result;
+}
+
+void runCase(const Settings & settings, Mode mode)
+{
+    boost::scoped_ptr<nexus::IoThreadPool> pool(new nexus::IoThreadPool);
+    boost::asio::io_service & ios = pool->ioService();
+    Run run;
+
+    boost::ptr_vector<Server> servers;
+    boost::ptr_vector<boost::asio::ip::tcp::socket> clients;
+    {
+        boost::asio::ip::tcp::acceptor acceptor(ios, boost::asio::ip::tcp::endpoint(boost::asio::ip::address_v4::loopback(), 0));
+        for(size_t i = 0; i != settings.connections; ++i)
+        {
+            clients.push_back(new boost::asio::ip::tcp::socket(ios));
+            clients.back().connect(acceptor.local_endpoint());
+            boost::asio::ip::tcp::socket socket(ios);
+            acceptor.accept(socket);
+            servers.push_back(new Server(socket, run, mode));
+            servers.back().begin();
+        }
+    }
+    pool->start(1);
+
+    std::vector<char> large = makePacket(settings.large);
+    for(size_t i = 0; i != clients.size(); ++i)
+        boost::asio::write(clients[i], boost::asio::buffer(large));
+    waitFor(run, clients.size());
+    size_t afterLarge = totalBuffers(servers);
+
+    std::vector<char> small = makePacket(settings.small);
+    size_t expected = clients.size();
+    for(size_t j = 0; j != settings.heartbeats; ++j)
+    {
+        for(size_t i = 0; i != clients.size(); ++i)
+            boost::asio::write(clients[i], boost::asio::buffer(small));
+        waitFor(run, expected += clients.size());
+    }
+    size_t afterSmall = totalBuffers(servers);
+
+    nexus::Microseconds start = nexus::Clock::microseconds();
+    for(size_t j = 0; j != settings.messages; ++j)
+        for(size_t i = 0; i != clients.size(); ++i)
+            boost::asio::write(clients[i], boost::asio::buffer(small));
+    waitFor(run, expected + clients.size() * settings.messages);
+    nexus::Microseconds elapsed = nexus::Clock::microseconds() - start;
+
+    for(size_t i = 0; i != clients.size(); ++i)
+        clients[i].close();
+    while(run.finishedCount() != servers.size())
+        boost::this_thread::sleep(boost::posix_time::milliseconds(1));
+    pool->stop();
+
+    double seconds = std::max<double>(elapsed, 1) / 1e6;
+    std::cout << "{\"mode\":\"" << modeNames[mode] << "\""
+              << ",\"connections\":" << settings.connections
+              << ",\"large\":" << settings.large
+              << ",\"small\":" << settings.small
+              << ",\"heartbeats\":" << settings.heartbeats
+              << ",\"messages\":" << settings.messages
+              << ",\"buffers_after_large\":" << afterLarge
+              << ",\"buffers_after_small\":" << afterSmall
+              << ",\"bytes_per_connection\":" << afterSmall / std::max<size_t>(settings.connections, 1)
+              << ",\"small_msgs_per_sec\":" << static_cast<boost::uint64_t>(clients.size() * settings.messages / seconds)
+              << "}" << std::endl;
+}
+
+void usage()
+{
+    std::cerr << "usage: nexus_read_buffer_bench [--connections N] [--large N] [--small N] [--heartbeats N] [--messages N]" << std::endl;
+}
+
+}
+
+int main(int argc, char * argv[])
+{
+    Settings settings;
+    for(int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        if(i + 1 == argc)
+        {
+            usage();
+            return 1;
+        }
+        std::string value = argv[++i];
+        if(arg == "--connections")
+            settings.connections = mstd::str2int10<size_t>(value);
+        else if(arg == "--large")
+            settings.large = mstd::str2int10<size_t>(value);
+        else if(arg == "--small")
+            settings.small = mstd::str2int10<size_t>(value);
+        else if(arg == "--heartbeats")
+            settings.heartbeats = mstd::str2int10<size_t>(value);
+        else if(arg == "--messages")
+            settings.messages = mstd::str2int10<size_t>(value);
+        else {
+            usage();
+            return 1;
+        }
+    }
+
+    nexus::Clock::start();
+
+    runCase(settings, mGrow);
+    runCase(settings, mShrink);
+    runCase(settings, mScratch);
+
+    return 0;
+}
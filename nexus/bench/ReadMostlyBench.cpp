@@ -0,0 +1,236 @@
+/*
+** The author disclaims copyright to this source code.  In place of
+** a legal notice, here is a blessing:
+**
+**    May you do good and not evil.
+**    May you find forgiveness for yourself and forgive others.
+**    May you share freely, never taking more than you give.
+*/
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <boost/thread/thread.hpp>
+
+#include <mstd/atomic.hpp>
+#include <mstd/distributed_shared_mutex.hpp>
+#include <mstd/itoa.hpp>
+#include <mstd/seqlock.hpp>
+#include <mstd/shared_mutex.hpp>
+#include <mstd/snapshot_ptr.hpp>
+
+#include <nexus/Clock.h>
+
+// Readers copy small routing entry while writer replaces it every 100us, from 1 to 64 reader threads.
+// "shared_mutex" is mstd::shared_mutex, "legacy_atomic_pod" is previous atomic_pod with dirty flag,
+// others are distributed_shared_mutex, seqlock and snapshot_ptr. Entry carries checksum of its fields,
+// so torn read is reported as failure.
+
+namespace {
+
+struct Route {
+    boost::uint64_t version;
+    boost::uint64_t fields[6];
+    boost::uint64_t checksum;
+
+    explicit Route(boost::uint64_t v = 0)
+        : version(v)
+    {
+        checksum = version;
+        for(size_t i = 0; i != sizeof(fields) / sizeof(fields[0]); ++i)
+        {
+            fields[i] = version * (i + 3);
+            checksum ^= fields[i];
+        }
+    }
+
+    bool valid() const
+    {
+        boost::uint64_t expected = version;
+        for(size_t i = 0; i != sizeof(fields) / sizeof(fields[0]); ++i)
+            expected ^= fields[i];
+        return expected == checksum;
+    }
+};
+
+template<class Mutex, class ReadLock, class WriteLock>
+class Locked {
+public:
+    bool read(boost::uint64_t & version)
+    {
+        ReadLock lock(mutex_);
+        version = route_.version;
+        return route_.valid();
+    }
+
+    void write(const Route & route)
+    {
+        WriteLock lock(mutex_);
+        route_ = route;
+    }
+private:
+    Mutex mutex_;
+    Route route_;
+};
+
+typedef Locked<mstd::shared_mutex, boost::shared_lock<mstd::shared_mutex>, boost::unique_lock<mstd::shared_mutex> > SharedMutex;
+typedef Locked<mstd::distributed_shared_mutex, mstd::distributed_shared_mutex::shared_lock,
+               mstd::distributed_shared_mutex::unique_lock> Distributed;
+
+class LegacyAtomicPod {
+public:
+    LegacyAtomicPod()
+        : dirty_(0) {}
+
+    bool read(boost::uint64_t & version)
+    {
+        for(;;)
+        {
+            boost::uint32_t old = dirty_;
+            Route result(route_);
+            if(old != 1 && old == dirty_)
+            {
+                version = result.version;
+                return result.valid();
+            }
+            boost::this_thread::yield();
+        }
+    }
+
+    void write(const Route & route)
+    {
+        boost::uint32_t old = dirty_;
+        dirty_ = 1;
+        route_ = route;
+        dirty_ = old + 2;
+    }
+private:
+    mstd::atomic<boost::uint32_t> dirty_;
+    Route route_;
+};
+
+class Seqlock {
+public:
+    bool read(boost::uint64_t & version)
+    {
+        Route result = route_.load();
+        version = result.version;
+        return result.valid();
+    }
+
+    void write(const Route & route)
+    {
+        route_.store(route);
+    }
+private:
+    mstd::seqlock<Route> route_;
+};
+
+class Snapshot {
+public:
+    Snapshot()
+        : route_(new Route) {}
+
+    bool read(boost::uint64_t & version)
+    {
+        mstd::snapshot_ptr<Route>::reader reader(route_);
+        version = reader->version;
+        return reader->valid();
+    }
+
+    void write(const Route & route)
+    {
+        route_.reset(new Route(route));
+    }
+private:
+    mstd::snapshot_ptr<Route> route_;
+};
+
+struct Shared {
+    mstd::atomic<size_t> active;
+    mstd::atomic<size_t> torn;
+    mstd::atomic<size_t> backwards;
+    mstd::atomic<size_t> writes;
+
+    explicit Shared(size_t readers)
+        : active(readers), torn(0), backwards(0), writes(0) {}
+};
+
+template<class Impl>
+void reader(Impl & impl, Shared & shared, size_t reads)
+{
+    size_t torn = 0, backwards = 0;
+    boost::uint64_t last = 0;
+    for(size_t i = 0; i != reads; ++i)
+    {
+        boost::uint64_t version;
+        if(!impl.read(version))
+            ++torn;
+        if(version < last)
+            ++backwards;
+        last = version;
+    }
+    shared.torn += torn;
+    shared.backwards += backwards;
+    --shared.active;
+}
+
+template<class Impl>
+void writer(Impl & impl, Shared & shared)
+{
+    for(boost::uint64_t version = 1; shared.active; ++version)
+    {
+        impl.write(Route(version));
+        ++shared.writes;
+        boost::this_thread::sleep(boost::posix_time::microseconds(100));
+    }
+}
+
+template<class Impl>
+bool runCase(const char * name, size_t readers, size_t reads)
+{
+    Impl impl;
+    Shared shared(readers);
+    size_t perReader = std::max<size_t>(reads / readers, 1);
+
+    nexus::Microseconds start = nexus::Clock::microseconds();
+    boost::thread_group group;
+    group.create_thread([&impl, &shared]() { writer(impl, shared); });
+    for(size_t i = 0; i != readers; ++i)
+        group.create_thread([&impl, &shared, perReader]() { reader(impl, shared, perReader); });
+    group.join_all();
+    nexus::Microseconds elapsed = nexus::Clock::microseconds() - start;
+
+    std::cout << "{\"impl\":\"" << name << "\""
+              << ",\"readers\":" << readers
+              << ",\"reads\":" << perReader * readers
+              << ",\"writes\":" << static_cast<size_t>(shared.writes)
+              << ",\"elapsed_us\":" << elapsed
+              << ",\"reads_per_sec\":" << static_cast<boost::uint64_t>(perReader * readers / (std::max<double>(elapsed, 1) / 1e6))
+              << ",\"torn\":" << static_cast<size_t>(shared.torn)
+              << ",\"backwards\":" << static_cast<size_t>(shared.backwards)
+              << "}" << std::endl;
+    return !shared.torn && !shared.backwards;
+}
+
+}
+
+int main(int argc, char * argv[])
+{
+    size_t reads = argc > 1 ? mstd::str2int10<size_t>(std::string(argv[1])) : 20000000;
+    size_t maxReaders = argc > 2 ? mstd::str2int10<size_t>(std::string(argv[2])) : 64;
+
+    nexus::Clock::start();
+
+    bool ok = true;
+    for(size_t readers = 1; readers <= maxReaders; readers *= 2)
+    {
+        ok = runCase<SharedMutex>("shared_mutex", readers, reads) && ok;
+        ok = runCase<Distributed>("distributed_shared_mutex", readers, reads) && ok;
+        ok = runCase<LegacyAtomicPod>("legacy_atomic_pod", readers, reads) && ok;
+        ok = runCase<Seqlock>("seqlock", readers, reads) && ok;
+        ok = runCase<Snapshot>("snapshot_ptr", readers, reads) && ok;
+    }
+
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,237 @@
+/*
+** The author disclaims copyright to this source code.  In place of
+** a legal notice, here is a blessing:
+**
+**    May you do good and not evil.
+**    May you find forgiveness for yourself and forgive others.
+**    May you share freely, never taking more than you give.
+*/
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <boost/asio/io_service.hpp>
+#include <boost/asio/local/connect_pair.hpp>
+#include <boost/asio/local/stream_protocol.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+
+#include <mstd/atomic.hpp>
+#include <mstd/itoa.hpp>
+
+#include <mlog/Logging.h>
+
+#include <nexus/Clock.h>
+#include <nexus/Connection.h>
+#include <nexus/IoThreadPool.h>
+#include <nexus/ShmStream.h>
+
+// Throughput of nexus::ShmStream against unix socket, each configuration is printed as one JSON object per line.
+// Client Connection sends messages of payload bytes, server Connection counts bytes it received, so Connection
+// is built over both streams.
+
+MLOG_DECLARE_LOGGER(nexus_shm_bench);
+
+#if defined(__linux__)
+
+namespace {
+
+const size_t ringSize = 1 << 20;
+
+class Waiter : public boost::noncopyable {
+public:
+    explicit Waiter(boost::uint64_t expected)
+        : expected_(expected), done_(0) {}
+
+    void done(boost::uint64_t value = 1)
+    {
+        if((done_ += value) == expected_)
+        {
+            boost::lock_guard<boost::mutex> lock(mutex_);
+            cond_.notify_all();
+        }
+    }
+
+    void wait()
+    {
+        boost::unique_lock<boost::mutex> lock(mutex_);
+        while(done_ != expected_)
+            cond_.wait(lock);
+    }
+private:
+    boost::uint64_t expected_;
+    mstd::atomic<boost::uint64_t> done_;
+    boost::mutex mutex_;
+    boost::condition_variable cond_;
+};
+
+void closeStream(boost::asio::local::stream_protocol::socket & socket)
+{
+    boost::system::error_code ec;
+    socket.shutdown(boost::asio::local::stream_protocol::socket::shutdown_both, ec);
+}
+
+void closeStream(nexus::ShmStream & stream)
+{
+    stream.close();
+}
+
+template<class Stream>
+class Endpoint : public nexus::Connection<Endpoint<Stream> > {
+public:
+    typedef nexus::Connection<Endpoint<Stream> > Base;
+
+    Endpoint(Stream & stream, Waiter & received, Waiter & finished)
+        : Base(true, 0x10000), stream_(stream), received_(received), finished_(finished)
+    {
+    }
+
+    void begin()
+    {
+        this->start();
+    }
+
+    Stream & stream()
+    {
+        return stream_;
+    }
+
+    void processPackets(nexus::PacketReader & reader)
+    {
+        size_t left = reader.left();
+        reader.skip(left);
+        received_.done(left);
+    }
+
+    void shutdown()
+    {
+        closeStream(stream_);
+    }
+
+    void finish()
+    {
+        finished_.done();
+    }
+private:
+    Stream & stream_;
+    Waiter & received_;
+    Waiter & finished_;
+};
+
+struct UnixPair {
+    boost::asio::local::stream_protocol::socket client;
+    boost::asio::local::stream_protocol::socket server;
+
+    explicit UnixPair(boost::asio::io_service & ios)
+        : client(ios), server(ios) {}
+
+    void connect(boost::system::error_code & ec)
+    {
+        boost::asio::local::connect_pair(client, server, ec);
+    }
+
+    static const char * name() { return "unix"; }
+};
+
+struct ShmPair {
+    nexus::ShmStream client;
+    nexus::ShmStream server;
+
+    explicit ShmPair(boost::asio::io_service & ios)
+        : client(ios), server(ios), ios_(ios) {}
+
+    // Handshake message is queued in socket, so both sides are set up from one thread.
+    void connect(boost::system::error_code & ec)
+    {
+        boost::asio::local::stream_protocol::socket first(ios_), second(ios_);
+        boost::asio::local::connect_pair(first, second, ec);
+        if(!ec)
+            client.connect(first, ringSize, ec);
+        if(!ec)
+            server.accept(second, ec);
+    }
+
+    static const char * name() { return "shm"; }
+private:
+    boost::asio::io_service & ios_;
+};
+
+template<class Pair>
+void runCase(size_t messages, size_t payload, size_t threads)
+{
+    boost::scoped_ptr<nexus::IoThreadPool> pool(new nexus::IoThreadPool);
+    boost::asio::io_service & ios = pool->ioService();
+
+    Pair pair(ios);
+    boost::system::error_code ec;
+    pair.connect(ec);
+    if(ec)
+    {
+        std::cerr << Pair::name() << " connect failed: " << ec.message() << std::endl;
+        exit(1);
+    }
+
+    typedef typename boost::remove_reference<decltype(pair.client)>::type Stream;
+    Waiter received(static_cast<boost::uint64_t>(messages) * payload);
+    Waiter ignored(0);
+    Waiter finished(2);
+    Endpoint<Stream> sender(pair.client, ignored, finished);
+    Endpoint<Stream> receiver(pair.server, received, finished);
+    pool->start(threads);
+
+    std::vector<char> packet(payload, 'x');
+    const size_t limit = std::max<size_t>(payload * 16, 0x10000);
+    nexus::Microseconds start = nexus::Clock::microseconds();
+    receiver.begin();
+    sender.begin();
+    for(size_t i = 0; i != messages; ++i)
+        while(!sender.trySend(nexus::Buffer(&packet[0], packet.size()), limit))
+            boost::this_thread::yield();
+    received.wait();
+    nexus::Microseconds elapsed = nexus::Clock::microseconds() - start;
+    sender.shutdown();
+    receiver.shutdown();
+    finished.wait();
+    pool->stop();
+
+    double seconds = std::max<double>(elapsed, 1) / 1e6;
+    std::cout << "{\"transport\":\"" << Pair::name() << "\""
+              << ",\"payload\":" << payload
+              << ",\"threads\":" << threads
+              << ",\"messages\":" << messages
+              << ",\"elapsed_us\":" << elapsed
+              << ",\"msgs_per_sec\":" << static_cast<boost::uint64_t>(messages / seconds)
+              << ",\"bytes_per_sec\":" << static_cast<boost::uint64_t>(static_cast<double>(messages) * payload / seconds)
+              << "}" << std::endl;
+}
+
+}
+
+int main(int argc, char * argv[])
+{
+    size_t messages = argc > 1 ? mstd::str2int10<size_t>(std::string(argv[1])) : 200000;
+    size_t threads = argc > 2 ? mstd::str2int10<size_t>(std::string(argv[2])) : 2;
+
+    nexus::Clock::start();
+
+    const size_t payloads[] = { 16, 256, 4096, 65536 };
+    for(size_t i = 0; i != sizeof(payloads) / sizeof(payloads[0]); ++i)
+    {
+        runCase<UnixPair>(messages, payloads[i], threads);
+        runCase<ShmPair>(messages, payloads[i], threads);
+    }
+
+    return 0;
+}
+
+#else
+
+int main()
+{
+    std::cerr << "nexus::ShmStream is available only on linux" << std::endl;
+    return 1;
+}
+
+#endif
@@ -0,0 +1,162 @@
+/*
+** The author disclaims copyright to this source code.  In place of
+** a legal notice, here is a blessing:
+**
+**    May you do good and not evil.
+**    May you find forgiveness for yourself and forgive others.
+**    May you share freely, never taking more than you give.
+*/
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+
+#include <mstd/atomic.hpp>
+#include <mstd/itoa.hpp>
+#include <mstd/lock_site.hpp>
+#include <mstd/spinlock.hpp>
+
+#include <nexus/Clock.h>
+
+// Threads increment shared counters under lock, as Strand and ConnectionLock do with their queues.
+// "legacy_spinlock" is previous mstd::spinlock with test-and-set on every attempt, kept here as baseline.
+// Counters are not atomic, so lost increment means broken mutual exclusion and is reported as failure.
+// "fairness" is ratio of the least to the most acquisitions among threads, 1 is perfectly fair.
+// Profiled run prints lock_site statistics of spinlock under the same load. Ticket lock hands lock over to waiter
+// that could be preempted, so it runs only up to number of cores.
+
+namespace {
+
+class LegacySpinlock {
+public:
+    LegacySpinlock()
+        : v_(0) {}
+
+    bool try_lock()
+    {
+#if BOOST_WINDOWS
+        long r = _InterlockedExchange(&v_, 1);
+        _ReadWriteBarrier();
+        return r == 0;
+#else
+        return __sync_lock_test_and_set(&v_, 1) == 0;
+#endif
+    }
+
+    void lock()
+    {
+        for(size_t k = 0; !try_lock(); ++k)
+            mstd::yield(k);
+    }
+
+    void unlock()
+    {
+#if BOOST_WINDOWS
+        _ReadWriteBarrier();
+        *const_cast<long volatile*>(&v_) = 0;
+#else
+        __sync_lock_release(&v_);
+#endif
+    }
+private:
+#if BOOST_WINDOWS
+    long v_;
+#else
+    int v_;
+#endif
+};
+
+struct Counters {
+    size_t value;
+    size_t other[7];
+};
+
+template<class Mutex>
+void worker(Mutex & mutex, Counters & counters, size_t ops, size_t & acquired)
+{
+    for(size_t i = 0; i != ops; ++i)
+    {
+        mutex.lock();
+        ++counters.value;
+        for(size_t j = 0; j != sizeof(counters.other) / sizeof(counters.other[0]); ++j)
+            counters.other[j] += j;
+        mutex.unlock();
+        ++acquired;
+    }
+}
+
+template<class Mutex>
+bool runCase(const char * name, Mutex & mutex, size_t threads, size_t ops)
+{
+    Counters counters = {};
+    std::vector<size_t> acquired(threads * 16);
+    size_t perThread = std::max<size_t>(ops / threads, 1);
+
+    nexus::Microseconds start = nexus::Clock::microseconds();
+    boost::thread_group group;
+    for(size_t i = 0; i != threads; ++i)
+    {
+        size_t & out = acquired[i * 16];
+        group.create_thread([&mutex, &counters, perThread, &out]() { worker(mutex, counters, perThread, out); });
+    }
+    group.join_all();
+    nexus::Microseconds elapsed = nexus::Clock::microseconds() - start;
+
+    size_t least = perThread, most = 0;
+    for(size_t i = 0; i != threads; ++i)
+    {
+        least = std::min(least, acquired[i * 16]);
+        most = std::max(most, acquired[i * 16]);
+    }
+    bool ok = counters.value == perThread * threads;
+
+    std::cout << "{\"impl\":\"" << name << "\""
+              << ",\"threads\":" << threads
+              << ",\"ops\":" << perThread * threads
+              << ",\"elapsed_us\":" << elapsed
+              << ",\"ops_per_sec\":" << static_cast<boost::uint64_t>(perThread * threads / (std::max<double>(elapsed, 1) / 1e6))
+              << ",\"fairness\":" << static_cast<double>(least) / std::max<size_t>(most, 1)
+              << ",\"ok\":" << (ok ? "true" : "false")
+              << "}" << std::endl;
+    return ok;
+}
+
+template<class Mutex>
+bool runCase(const char * name, size_t threads, size_t ops)
+{
+    Mutex mutex;
+    return runCase(name, mutex, threads, ops);
+}
+
+}
+
+int main(int argc, char * argv[])
+{
+    size_t ops = argc > 1 ? mstd::str2int10<size_t>(std::string(argv[1])) : 10000000;
+    size_t maxThreads = argc > 2 ? mstd::str2int10<size_t>(std::string(argv[2])) : 16;
+
+    nexus::Clock::start();
+
+    bool ok = true;
+    for(size_t threads = 1; threads <= maxThreads; threads *= 2)
+    {
+        ok = runCase<boost::mutex>("boost_mutex", threads, ops) && ok;
+        ok = runCase<LegacySpinlock>("legacy_spinlock", threads, ops) && ok;
+        ok = runCase<mstd::spinlock>("spinlock", threads, ops) && ok;
+        if(threads <= boost::thread::hardware_concurrency())
+            ok = runCase<mstd::ticket_spinlock>("ticket_spinlock", threads, ops) && ok;
+    }
+
+    mstd::lock_site site("bench::spinlock");
+    mstd::profiled_mutex<mstd::spinlock> profiled;
+    profiled.site(site);
+    ok = runCase("profiled_spinlock", profiled, maxThreads, ops) && ok;
+    std::ostringstream report;
+    mstd::lock_site::report(report);
+    std::cout << report.str();
+
+    return ok ? 0 : 1;
+}
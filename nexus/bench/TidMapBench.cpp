@@ -0,0 +1,163 @@
+/*
+** The author disclaims copyright to this source code.  In place of
+** a legal notice, here is a blessing:
+**
+**    May you do good and not evil.
+**    May you find forgiveness for yourself and forgive others.
+**    May you share freely, never taking more than you give.
+*/
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+
+#include <mstd/atomic.hpp>
+#include <mstd/itoa.hpp>
+#include <mstd/tid_map.hpp>
+
+#include <nexus/Clock.h>
+
+// Session table lookups from several threads while other thread inserts and erases sessions.
+// "locked" is tid_map behind mutex, as sessions were kept before, "concurrent" is concurrent_tid_map.
+// Every value encodes its own key, so lookup that returned value of other key is reported as failure.
+
+namespace {
+
+typedef mstd::tid_map_key<boost::uint32_t> Key;
+
+class Locked {
+public:
+    bool find(Key key, boost::uint32_t & out)
+    {
+        boost::lock_guard<boost::mutex> lock(mutex_);
+        mstd::tid_map<Key, boost::uint32_t>::iterator i = map_.find(key);
+        if(i.impl() == i.end())
+            return false;
+        out = *i;
+        return true;
+    }
+
+    bool insert(boost::uint32_t value, Key & out)
+    {
+        boost::lock_guard<boost::mutex> lock(mutex_);
+        out = map_.insert(value);
+        return true;
+    }
+
+    bool erase(Key key)
+    {
+        boost::lock_guard<boost::mutex> lock(mutex_);
+        return map_.erase(key) != 0;
+    }
+private:
+    boost::mutex mutex_;
+    mstd::tid_map<Key, boost::uint32_t> map_;
+};
+
+struct Shared {
+    std::vector<mstd::atomic<boost::uint32_t> > keys;
+    mstd::atomic<bool> done;
+    mstd::atomic<size_t> lookups;
+    mstd::atomic<size_t> hits;
+    mstd::atomic<size_t> wrong;
+
+    explicit Shared(size_t sessions)
+        : keys(sessions), done(false), lookups(0), hits(0), wrong(0) {}
+};
+
+// Value stored for key, it is set after insert, so it encodes slot in keys instead of key itself.
+template<class Map>
+void churn(Map & map, Shared & shared, size_t rounds)
+{
+    size_t sessions = shared.keys.size();
+    std::vector<Key> current;
+    for(size_t i = 0; i != sessions; ++i)
+    {
+        Key key(0);
+        map.insert(static_cast<boost::uint32_t>(i), key);
+        shared.keys[i] = key.full();
+        current.push_back(key);
+    }
+    for(size_t r = 0; r != rounds; ++r)
+    {
+        size_t i = r % sessions;
+        map.erase(current[i]);
+        Key key(0);
+        map.insert(static_cast<boost::uint32_t>(i), key);
+        shared.keys[i] = key.full();
+        current[i] = key;
+    }
+    shared.done = true;
+}
+
+template<class Map>
+void lookup(Map & map, Shared & shared)
+{
+    size_t sessions = shared.keys.size();
+    size_t lookups = 0, hits = 0, wrong = 0;
+    for(size_t i = 0; !shared.done || !lookups; ++i)
+    {
+        size_t slot = (i * 7) % sessions;
+        boost::uint32_t value;
+        if(map.find(Key(shared.keys[slot]), value))
+        {
+            ++hits;
+            if(value != slot)
+                ++wrong;
+        }
+        ++lookups;
+    }
+    shared.lookups += lookups;
+    shared.hits += hits;
+    shared.wrong += wrong;
+}
+
+template<class Map>
+bool runCase(const char * name, size_t readers, size_t sessions, size_t rounds)
+{
+    Map map;
+    Shared shared(sessions);
+    for(size_t i = 0; i != sessions; ++i)
+        shared.keys[i] = 0;
+
+    nexus::Microseconds start = nexus::Clock::microseconds();
+    boost::thread_group group;
+    group.create_thread([&map, &shared, rounds]() { churn(map, shared, rounds); });
+    for(size_t i = 0; i != readers; ++i)
+        group.create_thread([&map, &shared]() { lookup(map, shared); });
+    group.join_all();
+    nexus::Microseconds elapsed = nexus::Clock::microseconds() - start;
+
+    std::cout << "{\"impl\":\"" << name << "\""
+              << ",\"readers\":" << readers
+              << ",\"sessions\":" << sessions
+              << ",\"rounds\":" << rounds
+              << ",\"elapsed_us\":" << elapsed
+              << ",\"lookups_per_sec\":" << static_cast<boost::uint64_t>(shared.lookups / (std::max<double>(elapsed, 1) / 1e6))
+              << ",\"hits\":" << static_cast<size_t>(shared.hits)
+              << ",\"wrong\":" << static_cast<size_t>(shared.wrong)
+              << "}" << std::endl;
+    return !shared.wrong;
+}
+
+}
+
+int main(int argc, char * argv[])
+{
+    size_t rounds = argc > 1 ? mstd::str2int10<size_t>(std::string(argv[1])) : 2000000;
+    size_t sessions = argc > 2 ? mstd::str2int10<size_t>(std::string(argv[2])) : 10000;
+
+    nexus::Clock::start();
+
+    bool ok = true;
+    const size_t readers[] = { 1, 4 };
+    for(size_t i = 0; i != sizeof(readers) / sizeof(readers[0]); ++i)
+    {
+        ok = runCase<Locked>("locked", readers[i], sessions, rounds) && ok;
+        ok = runCase<mstd::concurrent_tid_map<Key, boost::uint32_t> >("concurrent", readers[i], sessions, rounds) && ok;
+    }
+
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,594 @@
+/*
+** The author disclaims copyright to this source code.  In place of
+** a legal notice, here is a blessing:
+**
+**    May you do good and not evil.
+**    May you find forgiveness for yourself and forgive others.
+**    May you share freely, never taking more than you give.
+*/
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <boost/asio/io_service.hpp>
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/asio/ssl.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+
+#include <openssl/evp.h>
+#include <openssl/pem.h>
+#include <openssl/rsa.h>
+#include <openssl/x509.h>
+
+#include <mstd/atomic.hpp>
+#include <mstd/rc_buffer.hpp>
+#include <mstd/strings.hpp>
+
+#include <mlog/Logging.h>
+
+#include <mcrypt/PKey.h>
+
+#include <nexus/Acceptor.h>
+#include <nexus/Clock.h>
+#include <nexus/Connection.h>
+#include <nexus/IoThreadPool.h>
+#include <nexus/Tls.h>
+
+// TLS benchmark for nexus::TlsStream, each configuration is printed as one JSON object per line.
+//
+// Handshakes: clients connect, handshake, read one byte written by server after handshake (so TLS 1.3 tickets
+// reach client) and disconnect. Full and resumed handshakes are run with server handshake inline and offloaded
+// to separate pool.
+// Writes: client Connection sends messages of payload bytes, server counts bytes received on the wire, the same
+// workload is run over plain tcp.
+//
+// Server credentials are self signed RSA 2048 certificate generated on start.
+
+MLOG_DECLARE_LOGGER(nexus_tls_bench);
+
+using std::placeholders::_1;
+using std::placeholders::_2;
+
+namespace {
+
+struct Settings {
+    size_t handshakes;
+    size_t concurrency;
+    size_t messages;
+    std::vector<size_t> payloads;
+
+    Settings()
+        : handshakes(2000), concurrency(8), messages(20000)
+    {
+        payloads.push_back(16);
+        payloads.push_back(256);
+        payloads.push_back(4096);
+        payloads.push_back(65536);
+    }
+};
+
+struct Credentials {
+    std::string certificate;
+    mstd::rc_buffer key;
+};
+
+std::string bio2string(BIO * bio)
+{
+    BUF_MEM * mem;
+    BIO_get_mem_ptr(bio, &mem);
+    std::string result(mem->data, mem->length);
+    BIO_free_all(bio);
+    return result;
+}
+
+bool generateCredentials(Credentials & out)
+{
+    EVP_PKEY_CTX * ctx = EVP_PKEY_CTX_new_id(EVP_PKEY_RSA, 0);
+    EVP_PKEY * pkey = 0;
+    bool ok = ctx && EVP_PKEY_keygen_init(ctx) == 1 && EVP_PKEY_CTX_set_rsa_keygen_bits(ctx, 2048) == 1 && EVP_PKEY_keygen(ctx, &pkey) == 1;
+    EVP_PKEY_CTX_free(ctx);
+    if(!ok)
+        return false;
+    mcrypt::GenericPKey key(pkey);
+
+    X509 * x509 = X509_new();
+    ASN1_INTEGER_set(X509_get_serialNumber(x509), 1);
+    X509_gmtime_adj(X509_get_notBefore(x509), 0);
+    X509_gmtime_adj(X509_get_notAfter(x509), 86400);
+    X509_set_pubkey(x509, pkey);
+    X509_NAME * name = X509_get_subject_name(x509);
+    X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC, reinterpret_cast<const unsigned char*>("localhost"), -1, -1, 0);
+    X509_set_issuer_name(x509, name);
+    ok = X509_sign(x509, pkey, EVP_sha256()) != 0;
+    if(ok)
+    {
+        BIO * bio = BIO_new(BIO_s_mem());
+        PEM_write_bio_X509(bio, x509);
+        out.certificate = bio2string(bio);
+        out.key = key.privatePem();
+    }
+    X509_free(x509);
+    return ok;
+}
+
+void setupServer(nexus::TlsContext & context, const Credentials & credentials)
+{
+    boost::system::error_code ec;
+    context.useCertificateChain(credentials.certificate.c_str(), credentials.certificate.size(), ec);
+    if(!ec)
+        context.usePrivateKeyPem(credentials.key.data(), credentials.key.size(), ec);
+    if(ec)
+    {
+        std::cerr << "failed to setup server context: " << ec.message() << std::endl;
+        exit(1);
+    }
+}
+
+class Waiter : public boost::noncopyable {
+public:
+    explicit Waiter(size_t expected)
+        : expected_(expected), done_(0) {}
+
+    void done()
+    {
+        if(++done_ == expected_)
+        {
+            boost::lock_guard<boost::mutex> lock(mutex_);
+            cond_.notify_all();
+        }
+    }
+
+    void wait()
+    {
+        boost::unique_lock<boost::mutex> lock(mutex_);
+        while(done_ != expected_)
+            cond_.wait(lock);
+    }
+private:
+    size_t expected_;
+    mstd::atomic<size_t> done_;
+    boost::mutex mutex_;
+    boost::condition_variable cond_;
+};
+
+// Server side of handshake run: handshake, write one byte, wait for client to disconnect.
+class HandshakeSession {
+public:
+    HandshakeSession(boost::asio::ip::tcp::socket & socket, nexus::TlsContext & context, boost::asio::io_service * offload, Waiter & closed)
+        : stream_(socket.get_io_service(), context), closed_(closed), byte_(0)
+    {
+        stream_.socket() = boost::move(socket);
+        stream_.socket().set_option(boost::asio::ip::tcp::no_delay(true));
+        stream_.async_handshake(std::bind(&HandshakeSession::handleHandshake, this, _1), offload);
+    }
+private:
+    void handleHandshake(const boost::system::error_code & ec)
+    {
+        if(ec)
+            finish();
+        else
+            stream_.async_write_some(boost::asio::buffer(&byte_, 1), std::bind(&HandshakeSession::handleWrite, this, _1));
+    }
+
+    void handleWrite(const boost::system::error_code & ec)
+    {
+        if(ec)
+            finish();
+        else
+            stream_.async_read_some(boost::asio::buffer(&byte_, 1), std::bind(&HandshakeSession::handleRead, this, _1));
+    }
+
+    void handleRead(const boost::system::error_code & ec)
+    {
+        finish();
+    }
+
+    void finish()
+    {
+        closed_.done();
+        delete this;
+    }
+
+    nexus::TlsStream stream_;
+    Waiter & closed_;
+    char byte_;
+};
+
+// Client side of handshake run, performs handshakes one after another until shared counter is exhausted.
+class HandshakeClient {
+public:
+    HandshakeClient(boost::asio::io_service & ios, nexus::TlsContext & context, const boost::asio::ip::tcp::endpoint & endpoint,
+                    bool resume, mstd::atomic<size_t> & left, mstd::atomic<size_t> & resumed, Waiter & done)
+        : ios_(ios), context_(context), endpoint_(endpoint), resume_(resume), left_(left), resumed_(resumed), done_(done), byte_(0)
+    {
+        next();
+    }
+private:
+    void next()
+    {
+        // every client decrements counter once after it was exhausted, so it wraps below zero
+        if(--left_ >= static_cast<size_t>(-1) / 2)
+        {
+            done_.done();
+            delete this;
+            return;
+        }
+        stream_.reset(new nexus::TlsStream(ios_, context_));
+        if(resume_)
+            stream_->sessionKey("bench");
+        stream_->socket().async_connect(endpoint_, std::bind(&HandshakeClient::handleConnect, this, _1));
+    }
+
+    void handleConnect(const boost::system::error_code & ec)
+    {
+        if(ec)
+            failed(ec);
+        else {
+            stream_->socket().set_option(boost::asio::ip::tcp::no_delay(true));
+            stream_->async_handshake(std::bind(&HandshakeClient::handleHandshake, this, _1));
+        }
+    }
+
+    void handleHandshake(const boost::system::error_code & ec)
+    {
+        if(ec)
+            failed(ec);
+        else {
+            if(stream_->resumed())
+                ++resumed_;
+            stream_->async_read_some(boost::asio::buffer(&byte_, 1), std::bind(&HandshakeClient::handleRead, this, _1));
+        }
+    }
+
+    void handleRead(const boost::system::error_code & ec)
+    {
+        if(ec)
+            failed(ec);
+        else {
+            boost::system::error_code ignored;
+            stream_->close(ignored);
+            next();
+        }
+    }
+
+    void failed(const boost::system::error_code & ec)
+    {
+        std::cerr << "handshake client failed: " << ec.message() << std::endl;
+        exit(1);
+    }
+
+    boost::asio::io_service & ios_;
+    nexus::TlsContext & context_;
+    boost::asio::ip::tcp::endpoint endpoint_;
+    bool resume_;
+    mstd::atomic<size_t> & left_;
+    mstd::atomic<size_t> & resumed_;
+    Waiter & done_;
+    boost::scoped_ptr<nexus::TlsStream> stream_;
+    char byte_;
+};
+
+void runHandshakes(const Settings & settings, const Credentials & credentials, bool resume, bool offload)
+{
+    boost::scoped_ptr<nexus::IoThreadPool> pool(new nexus::IoThreadPool);
+    boost::scoped_ptr<nexus::IoThreadPool> handshakePool(new nexus::IoThreadPool);
+    boost::scoped_ptr<nexus::IoThreadPool> clientPool(new nexus::IoThreadPool);
+    boost::asio::io_service & ios = pool->ioService();
+
+    nexus::TlsContext server(nexus::TlsContext::tmServer);
+    setupServer(server, credentials);
+    nexus::TlsContext client(nexus::TlsContext::tmClient);
+
+    Waiter closed(settings.handshakes);
+    boost::asio::io_service * offloadService = offload ? &handshakePool->ioService() : 0;
+    nexus::TcpAcceptor acceptor(ios, [&](boost::asio::ip::tcp::socket & socket) {
+        new HandshakeSession(socket, server, offloadService, closed);
+    });
+    acceptor.startLoopbackV4(0);
+
+    // pools stop when they run out of work, handshake and client pools are idle between runs
+    boost::scoped_ptr<boost::asio::io_service::work> handshakeWork(new boost::asio::io_service::work(handshakePool->ioService()));
+    boost::scoped_ptr<boost::asio::io_service::work> clientWork(new boost::asio::io_service::work(clientPool->ioService()));
+    pool->start(1);
+    handshakePool->start(1);
+    clientPool->start(1);
+
+    if(resume)
+    {
+        // first handshake is full, it stores session used by the rest
+        mstd::atomic<size_t> left(1), resumed(0);
+        Waiter done(1);
+        clientPool->ioService().post([&]() {
+            new HandshakeClient(clientPool->ioService(), client, acceptor.endpoint(), true, left, resumed, done);
+        });
+        done.wait();
+    }
+
+    size_t total = settings.handshakes - (resume ? 1 : 0);
+    mstd::atomic<size_t> left(total), resumed(0);
+    size_t clients = std::min(settings.concurrency, total);
+    Waiter done(clients);
+
+    nexus::Microseconds start = nexus::Clock::microseconds();
+    for(size_t i = 0; i != clients; ++i)
+        clientPool->ioService().post([&]() {
+            new HandshakeClient(clientPool->ioService(), client, acceptor.endpoint(), resume, left, resumed, done);
+        });
+    done.wait();
+    nexus::Microseconds elapsed = nexus::Clock::microseconds() - start;
+    closed.wait();
+
+    ios.post([&acceptor]() { acceptor.cancel(); });
+    clientWork.reset();
+    handshakeWork.reset();
+    clientPool->stop();
+    handshakePool->stop();
+    pool->stop();
+
+    double seconds = std::max<double>(elapsed, 1) / 1e6;
+    std::cout << "{\"case\":\"handshake\""
+              << ",\"resume\":" << (resume ? "true" : "false")
+              << ",\"offload\":" << (offload ? "true" : "false")
+              << ",\"concurrency\":" << clients
+              << ",\"handshakes\":" << total
+              << ",\"resumed\":" << static_cast<size_t>(resumed)
+              << ",\"elapsed_us\":" << elapsed
+              << ",\"handshakes_per_sec\":" << static_cast<boost::uint64_t>(total / seconds)
+              << "}" << std::endl;
+}
+
+void shutdownStream(boost::asio::ip::tcp::socket & socket)
+{
+    boost::system::error_code ec;
+    socket.shutdown(boost::asio::ip::tcp::socket::shutdown_both, ec);
+}
+
+void shutdownStream(nexus::TlsStream & stream)
+{
+    boost::system::error_code ec;
+    stream.shutdown(ec);
+}
+
+template<class Stream>
+class Sender : public nexus::Connection<Sender<Stream> > {
+public:
+    typedef nexus::Connection<Sender<Stream> > Base;
+
+    explicit Sender(Stream & stream, Waiter & finished)
+        : Base(true, 0x1000), stream_(stream), finished_(finished)
+    {
+    }
+
+    void begin()
+    {
+        this->start();
+    }
+
+    Stream & stream()
+    {
+        return stream_;
+    }
+
+    void processPackets(nexus::PacketReader & reader)
+    {
+        reader.skip(reader.left());
+    }
+
+    void shutdown()
+    {
+        shutdownStream(stream_);
+    }
+
+    void finish()
+    {
+        finished_.done();
+    }
+private:
+    Stream & stream_;
+    Waiter & finished_;
+};
+
+// Counts bytes arriving on socket, TLS records are not decrypted.
+class WireCounter {
+public:
+    WireCounter(boost::asio::ip::tcp::socket & socket, Waiter & done)
+        : socket_(socket), done_(done), bytes_(0), buffer_(0x10000)
+    {
+        read();
+    }
+
+    boost::uint64_t bytes() const
+    {
+        return bytes_;
+    }
+private:
+    void read()
+    {
+        socket_.async_read_some(boost::asio::buffer(buffer_), std::bind(&WireCounter::handleRead, this, _1, _2));
+    }
+
+    void handleRead(const boost::system::error_code & ec, size_t len)
+    {
+        bytes_ += len;
+        if(ec)
+            done_.done();
+        else
+            read();
+    }
+
+    boost::asio::ip::tcp::socket & socket_;
+    Waiter & done_;
+    boost::uint64_t bytes_;
+    std::vector<char> buffer_;
+};
+
+// Client stream and server side socket, whose bytes are counted, for both transports.
+struct PlainPair {
+    boost::asio::ip::tcp::socket client;
+    boost::asio::ip::tcp::socket server;
+
+    PlainPair(boost::asio::io_service & ios, nexus::TlsContext &, nexus::TlsContext &)
+        : client(ios), server(ios) {}
+
+    void handshake(boost::system::error_code & ec) { ec = boost::system::error_code(); }
+    boost::asio::ip::tcp::socket & clientSocket() { return client; }
+    boost::asio::ip::tcp::socket & wire() { return server; }
+    boost::asio::ip::tcp::socket & stream() { return client; }
+    static const char * name() { return "tcp"; }
+};
+
+struct TlsPair {
+    nexus::TlsStream client;
+    nexus::TlsStream server;
+
+    TlsPair(boost::asio::io_service & ios, nexus::TlsContext & serverContext, nexus::TlsContext & clientContext)
+        : client(ios, clientContext), server(ios, serverContext) {}
+
+    void handshake(boost::system::error_code & ec)
+    {
+        boost::system::error_code serverEc;
+        boost::thread thread([this, &serverEc]() { server.native().handshake(boost::asio::ssl::stream_base::server, serverEc); });
+        client.native().handshake(boost::asio::ssl::stream_base::client, ec);
+        thread.join();
+        if(!ec)
+            ec = serverEc;
+    }
+
+    boost::asio::ip::tcp::socket & clientSocket() { return client.socket(); }
+    boost::asio::ip::tcp::socket & wire() { return server.socket(); }
+    nexus::TlsStream & stream() { return client; }
+    static const char * name() { return "tls"; }
+};
+
+template<class Pair>
+void runWrites(const Settings & settings, const Credentials & credentials, size_t payload)
+{
+    boost::scoped_ptr<nexus::IoThreadPool> pool(new nexus::IoThreadPool);
+    boost::asio::io_service & ios = pool->ioService();
+
+    nexus::TlsContext serverContext(nexus::TlsContext::tmServer);
+    setupServer(serverContext, credentials);
+    nexus::TlsContext clientContext(nexus::TlsContext::tmClient);
+
+    Pair pair(ios, serverContext, clientContext);
+    {
+        boost::asio::ip::tcp::acceptor acceptor(ios, boost::asio::ip::tcp::endpoint(boost::asio::ip::address_v4::loopback(), 0));
+        pair.clientSocket().connect(acceptor.local_endpoint());
+        acceptor.accept(pair.wire());
+    }
+    pair.clientSocket().set_option(boost::asio::ip::tcp::no_delay(true));
+    boost::system::error_code ec;
+    pair.handshake(ec);
+    if(ec)
+    {
+        std::cerr << "handshake failed: " << ec.message() << std::endl;
+        exit(1);
+    }
+
+    Waiter received(1);
+    Waiter finished(1);
+    WireCounter counter(pair.wire(), received);
+    Sender<typename boost::remove_reference<decltype(pair.stream())>::type> sender(pair.stream(), finished);
+    pool->start(1);
+
+    std::vector<char> packet(payload, 'x');
+    const size_t limit = std::max<size_t>(payload * 16, 0x10000);
+    nexus::Microseconds start = nexus::Clock::microseconds();
+    sender.begin();
+    for(size_t i = 0; i != settings.messages; ++i)
+        while(!sender.trySend(nexus::Buffer(&packet[0], packet.size()), limit))
+            boost::this_thread::yield();
+    while(sender.sendQueueSize())
+        boost::this_thread::yield();
+    sender.shutdown();
+    received.wait();
+    nexus::Microseconds elapsed = nexus::Clock::microseconds() - start;
+    finished.wait();
+    pool->stop();
+
+    double seconds = std::max<double>(elapsed, 1) / 1e6;
+    double plain = static_cast<double>(payload) * settings.messages;
+    double wire = static_cast<double>(counter.bytes());
+    std::cout << "{\"case\":\"write\""
+              << ",\"transport\":\"" << Pair::name() << "\""
+              << ",\"payload\":" << payload
+              << ",\"messages\":" << settings.messages
+              << ",\"elapsed_us\":" << elapsed
+              << ",\"bytes_per_sec\":" << static_cast<boost::uint64_t>(plain / seconds)
+              << ",\"wire_bytes\":" << counter.bytes()
+              << ",\"wire_bytes_per_write\":" << wire / settings.messages
+              << ",\"overhead_per_write\":" << (wire - plain) / settings.messages
+              << "}" << std::endl;
+}
+
+void usage()
+{
+    std::cerr << "usage: nexus_tls_bench [--handshakes N] [--concurrency N] [--messages N] [--payloads a,b,c]" << std::endl;
+}
+
+std::vector<size_t> parseList(const std::string & input)
+{
+    std::vector<size_t> result;
+    std::string::const_iterator begin = input.begin(), end = input.end();
+    while(begin != end)
+    {
+        std::string::const_iterator next = std::find(begin, end, ',');
+        result.push_back(mstd::str2int10<size_t>(begin, next));
+        begin = next == end ? end : next + 1;
+    }
+    return result;
+}
+
+}
+
+int main(int argc, char * argv[])
+{
+    Settings settings;
+    for(int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        if(i + 1 == argc)
+        {
+            usage();
+            return 1;
+        }
+        std::string value = argv[++i];
+        if(arg == "--handshakes")
+            settings.handshakes = mstd::str2int10<size_t>(value);
+        else if(arg == "--concurrency")
+            settings.concurrency = mstd::str2int10<size_t>(value);
+        else if(arg == "--messages")
+            settings.messages = mstd::str2int10<size_t>(value);
+        else if(arg == "--payloads")
+            settings.payloads = parseList(value);
+        else {
+            usage();
+            return 1;
+        }
+    }
+
+    nexus::Clock::start();
+
+    Credentials credentials;
+    if(!generateCredentials(credentials))
+    {
+        std::cerr << "failed to generate credentials" << std::endl;
+        return 1;
+    }
+
+    runHandshakes(settings, credentials, false, false);
+    runHandshakes(settings, credentials, false, true);
+    runHandshakes(settings, credentials, true, false);
+    runHandshakes(settings, credentials, true, true);
+
+    for(std::vector<size_t>::const_iterator payload = settings.payloads.begin(); payload != settings.payloads.end(); ++payload)
+    {
+        runWrites<PlainPair>(settings, credentials, *payload);
+        runWrites<TlsPair>(settings, credentials, *payload);
+    }
+
+    return 0;
+}
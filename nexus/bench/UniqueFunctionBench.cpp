@@ -0,0 +1,241 @@
+/*
+** The author disclaims copyright to this source code.  In place of
+** a legal notice, here is a blessing:
+**
+**    May you do good and not evil.
+**    May you find forgiveness for yourself and forgive others.
+**    May you share freely, never taking more than you give.
+*/
+#include <cstdlib>
+#include <functional>
+#include <iostream>
+#include <new>
+#include <string>
+#include <vector>
+
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/thread.hpp>
+
+#include <mstd/atomic.hpp>
+#include <mstd/command_queue.hpp>
+#include <mstd/itoa.hpp>
+#include <mstd/reverse_lock.hpp>
+#include <mstd/unique_function.hpp>
+
+#include <nexus/Clock.h>
+
+// "wrap" case: command capturing 1 to 6 pointers is stored to slot of vector, called and destroyed,
+// as queue does with it. "queue" case: producer posts commands with 3 captured pointers to consumer thread
+// through mutex and vector swap queue, as thread_pool and PipeService do, and through mstd::command_queue.
+// std_function is previous command type, unique_function is new one, allocs is operator new calls per command.
+
+mstd::atomic<size_t> allocations(0);
+
+void * operator new(size_t size)
+{
+    ++allocations;
+    void * result = malloc(size ? size : 1);
+    if(!result)
+        throw std::bad_alloc();
+    return result;
+}
+
+// Pairs with malloc of operator new above, gcc checks free against new expressions it is inlined to.
+#if defined(__GNUC__) && !defined(__clang__) && __GNUC__ >= 11
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+
+void operator delete(void * ptr) throw()
+{
+    free(ptr);
+}
+
+void operator delete(void * ptr, size_t) throw()
+{
+    free(ptr);
+}
+
+#if defined(__GNUC__) && !defined(__clang__) && __GNUC__ >= 11
+#pragma GCC diagnostic pop
+#endif
+
+namespace {
+
+template<size_t N>
+struct Payload {
+    size_t * counter;
+    void * extra[N - 1];
+
+    explicit Payload(size_t * c)
+        : counter(c)
+    {
+        for(size_t i = 0; i != N - 1; ++i)
+            extra[i] = c;
+    }
+
+    void operator()() const
+    {
+        ++*counter;
+    }
+};
+
+template<>
+struct Payload<1> {
+    size_t * counter;
+
+    explicit Payload(size_t * c)
+        : counter(c) {}
+
+    void operator()() const
+    {
+        ++*counter;
+    }
+};
+
+void report(const char * impl, const char * scenario, size_t captured, size_t commands,
+            nexus::Microseconds elapsed, size_t allocs, bool ok)
+{
+    std::cout << "{\"impl\":\"" << impl << "\""
+              << ",\"case\":\"" << scenario << "\""
+              << ",\"captured_pointers\":" << captured
+              << ",\"commands\":" << commands
+              << ",\"ns_per_command\":" << static_cast<double>(elapsed) * 1000 / std::max<size_t>(commands, 1)
+              << ",\"allocs_per_command\":" << static_cast<double>(allocs) / std::max<size_t>(commands, 1)
+              << ",\"ok\":" << (ok ? "true" : "false")
+              << "}" << std::endl;
+}
+
+template<class Command, class Callable>
+bool runWrap(const char * impl, size_t captured, Callable callable, size_t commands, size_t & counter)
+{
+    std::vector<Command> slots(64);
+    counter = 0;
+    size_t allocs = allocations;
+    nexus::Microseconds start = nexus::Clock::microseconds();
+    for(size_t i = 0; i != commands; ++i)
+    {
+        Command & slot = slots[i % slots.size()];
+        slot = Command(callable);
+        slot();
+        slot = nullptr;
+    }
+    nexus::Microseconds elapsed = nexus::Clock::microseconds() - start;
+    allocs = allocations - allocs;
+    bool ok = counter == commands;
+    report(impl, "wrap", captured, commands, elapsed, allocs, ok);
+    return ok;
+}
+
+template<size_t N>
+bool runWrap(size_t commands)
+{
+    size_t counter;
+    Payload<N> payload(&counter);
+    bool ok = runWrap<std::function<void()> >("std_function", N, payload, commands, counter);
+    return runWrap<mstd::unique_function<void()> >("unique_function", N, payload, commands, counter) && ok;
+}
+
+template<class Command>
+class SwapQueue : public boost::noncopyable {
+public:
+    SwapQueue()
+    {
+        thread_ = boost::thread(&SwapQueue::execute, this);
+    }
+
+    ~SwapQueue()
+    {
+        thread_.interrupt();
+        thread_.join();
+    }
+
+    void enqueue(Command command)
+    {
+        boost::unique_lock<boost::mutex> lock(mutex_);
+        bool wasEmpty = queue_.empty();
+        queue_.push_back(std::move(command));
+        if(wasEmpty)
+            cond_.notify_one();
+    }
+private:
+    void execute()
+    {
+        std::vector<Command> queue;
+        boost::unique_lock<boost::mutex> lock(mutex_);
+        while(!boost::this_thread::interruption_requested())
+        {
+            try {
+                if(queue_.empty())
+                    cond_.wait(lock);
+                else {
+                    queue_.swap(queue);
+                    mstd::reverse_lock<boost::unique_lock<boost::mutex> > rlock(lock);
+                    for(typename std::vector<Command>::iterator i = queue.begin(), end = queue.end(); i != end; ++i)
+                        (*i)();
+                    queue.clear();
+                }
+            } catch(boost::thread_interrupted&) {
+                return;
+            }
+        }
+    }
+
+    boost::mutex mutex_;
+    boost::condition_variable cond_;
+    boost::thread thread_;
+    std::vector<Command> queue_;
+};
+
+template<class Queue>
+bool runQueue(const char * impl, Queue & queue, size_t commands)
+{
+    mstd::atomic<size_t> executed(0);
+    size_t value = 0;
+    size_t * first = &value, * second = &value;
+
+    size_t allocs = allocations;
+    nexus::Microseconds start = nexus::Clock::microseconds();
+    for(size_t i = 0; i != commands; ++i)
+        queue.enqueue([&executed, first, second]() { executed += first == second; });
+    nexus::Microseconds enqueued = nexus::Clock::microseconds() - start;
+    while(executed != commands)
+        boost::this_thread::yield();
+    nexus::Microseconds elapsed = nexus::Clock::microseconds() - start;
+    allocs = allocations - allocs;
+
+    report(impl, "queue", 3, commands, elapsed, allocs, true);
+    std::cout << "{\"impl\":\"" << impl << "\",\"case\":\"queue_enqueue\",\"ns_per_command\":"
+              << static_cast<double>(enqueued) * 1000 / std::max<size_t>(commands, 1) << "}" << std::endl;
+    return true;
+}
+
+}
+
+int main(int argc, char * argv[])
+{
+    size_t commands = argc > 1 ? mstd::str2int10<size_t>(std::string(argv[1])) : 5000000;
+
+    nexus::Clock::start();
+
+    bool ok = true;
+    ok = runWrap<1>(commands) && ok;
+    ok = runWrap<3>(commands) && ok;
+    ok = runWrap<4>(commands) && ok;
+    ok = runWrap<6>(commands) && ok;
+
+    {
+        SwapQueue<std::function<void()> > queue;
+        ok = runQueue("std_function", queue, commands) && ok;
+    }
+    {
+        SwapQueue<mstd::unique_function<void()> > queue;
+        ok = runQueue("unique_function", queue, commands) && ok;
+    }
+    {
+        mstd::command_queue queue;
+        ok = runQueue("command_queue", queue, commands) && ok;
+    }
+
+    return ok ? 0 : 1;
+}
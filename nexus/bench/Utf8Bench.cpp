@@ -0,0 +1,137 @@
+/*
+** The author disclaims copyright to this source code.  In place of
+** a legal notice, here is a blessing:
+**
+**    May you do good and not evil.
+**    May you find forgiveness for yourself and forgive others.
+**    May you share freely, never taking more than you give.
+*/
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <mstd/itoa.hpp>
+#include <mstd/strings.hpp>
+#include <mstd/utf8.hpp>
+
+#include <nexus/Clock.h>
+
+// Throughput of UTF-8 decode and encode on chat like corpora. "scalar" is the template code from mstd/utf8.hpp,
+// "kernel" is deutf8_to/utf8_to, "string" is std::string/std::wstring interface used by message handlers.
+// All implementations should produce the same output, mismatch is reported as failure.
+
+namespace {
+
+// Mostly ASCII chat with rare accented words, mostly CJK text with ASCII punctuation, and Cyrillic.
+std::wstring makeCorpus(const char * kind, size_t length)
+{
+    std::wstring result;
+    std::string name(kind);
+    boost::uint32_t seed = 12345;
+    while(result.length() < length)
+    {
+        seed = seed * 1103515245 + 12345;
+        size_t r = (seed >> 16) % 100;
+        if(name == "ascii")
+            result.push_back(r < 2 ? static_cast<wchar_t>(0xe9) : r < 17 ? L' ' : static_cast<wchar_t>('a' + r % 26));
+        else if(name == "cjk")
+            result.push_back(r < 10 ? (r < 5 ? L' ' : L'!') : static_cast<wchar_t>(0x4e00 + (seed >> 8) % 0x5000));
+        else
+            result.push_back(r < 15 ? L' ' : static_cast<wchar_t>(0x430 + r % 32));
+    }
+    return result;
+}
+
+// Scalar code is called through pointers, so it is not inlined into measuring loop, as library kernels are not.
+wchar_t * (* volatile scalarDecode)(const char *, const char *, wchar_t *) = &mstd::deutf8<const char *, wchar_t *>;
+char * (* volatile scalarEncode)(const wchar_t *, const wchar_t *, char *) = &mstd::utf8<const wchar_t *, char *>;
+size_t (* volatile scalarLength)(const wchar_t *, const wchar_t *) = &mstd::utf8_length<const wchar_t *>;
+
+template<class F>
+double measure(size_t bytes, size_t rounds, F f)
+{
+    nexus::Microseconds start = nexus::Clock::microseconds();
+    for(size_t i = 0; i != rounds; ++i)
+        f();
+    nexus::Microseconds elapsed = nexus::Clock::microseconds() - start;
+    return static_cast<double>(bytes) * rounds / std::max<double>(elapsed, 1);
+}
+
+bool runCase(const char * kind, size_t length, size_t rounds)
+{
+    std::wstring wide = makeCorpus(kind, length);
+    std::string narrow;
+    mstd::utf8(wide.begin(), wide.end(), std::back_inserter(narrow));
+    const char * nbegin = narrow.c_str(), * nend = nbegin + narrow.length();
+    const wchar_t * wbegin = wide.c_str(), * wend = wbegin + wide.length();
+
+    std::vector<wchar_t> wout(narrow.length());
+    std::vector<char> nout(wide.length() * mstd::max_utf8_length);
+    bool ok = true;
+
+    double decodeScalar = measure(narrow.length(), rounds, [&]() {
+        wchar_t * end = scalarDecode(nbegin, nend, &wout[0]);
+        ok = ok && static_cast<size_t>(end - &wout[0]) == wide.length();
+    });
+    double decodeKernel = measure(narrow.length(), rounds, [&]() {
+        wchar_t * end = mstd::deutf8_to(nbegin, nend, &wout[0]);
+        ok = ok && end && static_cast<size_t>(end - &wout[0]) == wide.length();
+    });
+    ok = ok && std::equal(wide.begin(), wide.end(), wout.begin());
+    double decodeString = measure(narrow.length(), rounds, [&]() {
+        ok = ok && mstd::deutf8(narrow).length() == wide.length();
+    });
+
+    double encodeScalar = measure(narrow.length(), rounds, [&]() {
+        char * end = scalarEncode(wbegin, wend, &nout[0]);
+        ok = ok && static_cast<size_t>(end - &nout[0]) == narrow.length();
+    });
+    double encodeKernel = measure(narrow.length(), rounds, [&]() {
+        char * end = mstd::utf8_to(wbegin, wend, &nout[0]);
+        ok = ok && end && static_cast<size_t>(end - &nout[0]) == narrow.length();
+    });
+    ok = ok && std::equal(narrow.begin(), narrow.end(), nout.begin());
+    double encodeString = measure(narrow.length(), rounds, [&]() {
+        ok = ok && mstd::utf8(wide).length() == narrow.length();
+    });
+
+    double lengthScalar = measure(narrow.length(), rounds, [&]() {
+        ok = ok && scalarLength(wbegin, wend) == narrow.length();
+    });
+    double lengthKernel = measure(narrow.length(), rounds, [&]() {
+        ok = ok && mstd::utf8_length(wide) == narrow.length();
+    });
+
+    std::cout << "{\"corpus\":\"" << kind << "\""
+              << ",\"chars\":" << wide.length()
+              << ",\"bytes\":" << narrow.length()
+              << ",\"decode_scalar_mbps\":" << decodeScalar
+              << ",\"decode_kernel_mbps\":" << decodeKernel
+              << ",\"decode_string_mbps\":" << decodeString
+              << ",\"encode_scalar_mbps\":" << encodeScalar
+              << ",\"encode_kernel_mbps\":" << encodeKernel
+              << ",\"encode_string_mbps\":" << encodeString
+              << ",\"utf8_length_scalar_mbps\":" << lengthScalar
+              << ",\"utf8_length_kernel_mbps\":" << lengthKernel
+              << ",\"ok\":" << (ok ? "true" : "false")
+              << "}" << std::endl;
+    return ok;
+}
+
+}
+
+int main(int argc, char * argv[])
+{
+    size_t bytes = argc > 1 ? mstd::str2int10<size_t>(std::string(argv[1])) : 50000000;
+
+    nexus::Clock::start();
+
+    bool ok = true;
+    const char * corpora[] = { "ascii", "cjk", "cyrillic" };
+    const size_t lengths[] = { 64, 4096 };
+    for(size_t i = 0; i != sizeof(corpora) / sizeof(corpora[0]); ++i)
+        for(size_t j = 0; j != sizeof(lengths) / sizeof(lengths[0]); ++j)
+            ok = runCase(corpora[i], lengths[j], std::max<size_t>(bytes / lengths[j], 1)) && ok;
+
+    return ok ? 0 : 1;
+}
@@ -25,8 +25,11 @@
 #include <algorithm>
 #include <deque>
 #include <exception>
+#include <map>
 #include <queue>
+#include <random>
 #include <string>
+#include <unordered_map>
 #include <unordered_set>
 #include <vector>
 
@@ -96,6 +99,7 @@
 #include <mstd/enum_utils.hpp>
 #include <mstd/exception.hpp>
 #include <mstd/itoa.hpp>
+#include <mstd/lock_site.hpp>
 #include <mstd/hton.hpp>
 #include <mstd/null.hpp>
 #include <mstd/pointer_cast.hpp>
@@ -104,6 +108,7 @@
 #include <mstd/singleton.hpp>
 #include <mstd/threads.hpp>
 #include <mstd/tid_map.hpp>
+#include <mstd/unique_function.hpp>
 #include <mstd/utf8.hpp>
 
 #include <mlog/Dumper.h>